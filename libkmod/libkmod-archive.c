@@ -0,0 +1,278 @@
+/*
+ * libkmod - interface to kernel module operations
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <shared/util.h>
+
+#include "libkmod.h"
+#include "libkmod-internal.h"
+#include "libkmod-index.h"
+
+/*
+ * A module archive is mapped once and everything in it is used in place:
+ * modules are handed to init_module() right from the mapping and the
+ * indexes are searched the same way as the ones mapped from dirname.
+ */
+struct kmod_archive {
+	struct kmod_ctx *ctx; /* not referenced, the ctx owns the archive */
+	char *dirname;
+	size_t dirnamelen;
+	void *mm;
+	size_t size;
+	uint32_t n_modules;
+	uint32_t n_indexes;
+	const struct kmod_archive_entry *modules;
+	const struct kmod_archive_entry *indexes;
+	int refcount;
+};
+
+static const char *entry_name(const struct kmod_archive *archive,
+				const struct kmod_archive_entry *entry)
+{
+	return (const char *) archive->mm + be32toh(entry->name);
+}
+
+static bool archive_table_is_valid(const struct kmod_archive *archive,
+					const struct kmod_archive_entry *table,
+					uint32_t count)
+{
+	const char *prev = NULL;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		uint32_t name = be32toh(table[i].name);
+		uint64_t offset = be64toh(table[i].offset);
+		uint32_t size = be32toh(table[i].size);
+		const char *s;
+
+		if (name >= archive->size ||
+		    memchr((const char *) archive->mm + name, '\0',
+						archive->size - name) == NULL)
+			return false;
+
+		if (offset > archive->size || size > archive->size - offset)
+			return false;
+
+		/* lookups are a bsearch() over the mapped table */
+		s = entry_name(archive, &table[i]);
+		if (prev != NULL && strcmp(prev, s) >= 0)
+			return false;
+		prev = s;
+	}
+
+	return true;
+}
+
+static bool archive_is_valid(struct kmod_archive *archive,
+							const char *filename)
+{
+	const struct kmod_archive_header *hdr = archive->mm;
+	size_t tables;
+
+	if (archive->size < sizeof(*hdr)) {
+		ERR(archive->ctx, "%s: too small for a module archive\n",
+								filename);
+		return false;
+	}
+
+	if (be32toh(hdr->magic) != KMOD_ARCHIVE_MAGIC) {
+		ERR(archive->ctx, "%s: magic check fail: %x instead of %x\n",
+			filename, be32toh(hdr->magic), KMOD_ARCHIVE_MAGIC);
+		return false;
+	}
+
+	if (be32toh(hdr->version) != KMOD_ARCHIVE_VERSION) {
+		ERR(archive->ctx, "%s: version check fail: %u instead of %u\n",
+			filename, be32toh(hdr->version), KMOD_ARCHIVE_VERSION);
+		return false;
+	}
+
+	archive->n_modules = be32toh(hdr->n_modules);
+	archive->n_indexes = be32toh(hdr->n_indexes);
+	tables = ((size_t) archive->n_modules + archive->n_indexes) *
+					sizeof(struct kmod_archive_entry);
+	if (tables > archive->size - sizeof(*hdr))
+		goto corrupt;
+
+	archive->modules = (const void *) (hdr + 1);
+	archive->indexes = archive->modules + archive->n_modules;
+
+	if (!archive_table_is_valid(archive, archive->modules,
+							archive->n_modules) ||
+	    !archive_table_is_valid(archive, archive->indexes,
+							archive->n_indexes))
+		goto corrupt;
+
+	return true;
+
+corrupt:
+	ERR(archive->ctx, "%s: module archive is corrupted\n", filename);
+	return false;
+}
+
+int kmod_archive_open(struct kmod_ctx *ctx, const char *filename,
+						struct kmod_archive **archive)
+{
+	struct kmod_archive *a;
+	const char *dirname;
+	struct stat st;
+	int fd, err;
+
+	fd = open(filename, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) {
+		err = -errno;
+		DBG(ctx, "open(%s): %m\n", filename);
+		return err;
+	}
+
+	a = calloc(1, sizeof(struct kmod_archive));
+	if (a == NULL) {
+		err = -ENOMEM;
+		goto fail_close;
+	}
+
+	dirname = kmod_get_dirname(ctx);
+	a->ctx = ctx;
+	a->refcount = 1;
+	a->dirname = strdup(dirname);
+	a->dirnamelen = strlen(dirname);
+	if (a->dirname == NULL) {
+		err = -ENOMEM;
+		goto fail_free;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		goto fail_free;
+	}
+
+	a->size = st.st_size;
+	a->mm = mmap(NULL, a->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (a->mm == MAP_FAILED) {
+		err = -errno;
+		ERR(ctx, "mmap(%s, %zu): %m\n", filename, a->size);
+		goto fail_free;
+	}
+
+	if (!archive_is_valid(a, filename)) {
+		err = -EINVAL;
+		goto fail_unmap;
+	}
+
+	close(fd);
+
+	DBG(ctx, "%s: %u modules, %u indexes\n", filename, a->n_modules,
+								a->n_indexes);
+
+	*archive = a;
+	return 0;
+
+fail_unmap:
+	munmap(a->mm, a->size);
+fail_free:
+	free(a->dirname);
+	free(a);
+fail_close:
+	close(fd);
+	return err;
+}
+
+struct kmod_archive *kmod_archive_ref(struct kmod_archive *archive)
+{
+	archive->refcount++;
+	return archive;
+}
+
+void kmod_archive_unref(struct kmod_archive *archive)
+{
+	if (archive == NULL || --archive->refcount > 0)
+		return;
+
+	munmap(archive->mm, archive->size);
+	free(archive->dirname);
+	free(archive);
+}
+
+struct archive_key {
+	const struct kmod_archive *archive;
+	const char *name;
+};
+
+static int archive_entry_cmp(const void *key, const void *elem)
+{
+	const struct archive_key *k = key;
+
+	return strcmp(k->name, entry_name(k->archive, elem));
+}
+
+static const void *archive_find(const struct kmod_archive *archive,
+				const struct kmod_archive_entry *table,
+				uint32_t count, const char *name, size_t *size)
+{
+	struct archive_key key = { archive, name };
+	const struct kmod_archive_entry *entry;
+
+	entry = bsearch(&key, table, count, sizeof(*table), archive_entry_cmp);
+	if (entry == NULL)
+		return NULL;
+
+	*size = be32toh(entry->size);
+	return (const char *) archive->mm + be64toh(entry->offset);
+}
+
+/*
+ * Modules are stored with the path modules.dep has for them, usually
+ * relative to dirname. Paths given here are the ones libkmod built from it.
+ */
+const void *kmod_archive_find_module(const struct kmod_archive *archive,
+					const char *path, size_t *size)
+{
+	if (strncmp(path, archive->dirname, archive->dirnamelen) == 0 &&
+					path[archive->dirnamelen] == '/')
+		path += archive->dirnamelen + 1;
+
+	return archive_find(archive, archive->modules, archive->n_modules,
+								path, size);
+}
+
+struct index_mm *kmod_archive_open_index(struct kmod_archive *archive,
+							const char *name)
+{
+	const void *mem;
+	size_t size;
+
+	mem = archive_find(archive, archive->indexes, archive->n_indexes,
+								name, &size);
+	if (mem == NULL) {
+		DBG(archive->ctx, "index %s is missing from module archive\n",
+									name);
+		return NULL;
+	}
+
+	return index_mm_open_mem(archive->ctx, mem, size, name);
+}
@@ -21,6 +21,7 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fnmatch.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -665,7 +666,7 @@ done_next:
 	return 0;
 }
 
-void kmod_config_free(struct kmod_config *config)
+static void kmod_config_free_entries(struct kmod_config *config)
 {
 	while (config->aliases)
 		kmod_config_free_alias(config, config->aliases);
@@ -688,11 +689,66 @@ void kmod_config_free(struct kmod_config *config)
 
 	while (config->softdeps)
 		kmod_config_free_softdep(config, config->softdeps);
+}
+
+static struct kmod_config_file *kmod_config_file_new(struct kmod_ctx *ctx,
+							const char *path,
+							unsigned long long stamp)
+{
+	struct kmod_config_file *cf;
+	size_t pathlen = strlen(path) + 1;
+
+	cf = calloc(1, sizeof(*cf) + pathlen);
+	if (cf == NULL)
+		return NULL;
+
+	cf->entries.ctx = ctx;
+	cf->stamp = stamp;
+	cf->refcount = 1;
+	memcpy(cf->path, path, pathlen);
+
+	return cf;
+}
+
+static void kmod_config_file_unref(struct kmod_config_file *cf)
+{
+	if (--cf->refcount > 0)
+		return;
+
+	kmod_config_free_entries(&cf->entries);
+	free(cf);
+}
+
+static struct kmod_list *config_list_release(struct kmod_list *list)
+{
+	while (list != NULL)
+		list = kmod_list_remove(list);
+
+	return NULL;
+}
+
+void kmod_config_free(struct kmod_config *config)
+{
+	/* entries are owned by the files, only drop the merged lists */
+	config->aliases = config_list_release(config->aliases);
+	config->blacklists = config_list_release(config->blacklists);
+	config->options = config_list_release(config->options);
+	config->install_commands = config_list_release(config->install_commands);
+	config->remove_commands = config_list_release(config->remove_commands);
+	config->softdeps = config_list_release(config->softdeps);
+
+	for (; config->files != NULL;
+				config->files = kmod_list_remove(config->files))
+		kmod_config_file_unref(config->files->data);
+
+	if (config->kcmdline != NULL)
+		kmod_config_file_unref(config->kcmdline);
 
 	for (; config->paths != NULL;
 				config->paths = kmod_list_remove(config->paths))
 		free(config->paths->data);
 
+	free(config->config_paths);
 	free(config);
 }
 
@@ -823,8 +879,134 @@ static int conf_files_list(struct kmod_ctx *ctx, struct kmod_list **list,
 	return 0;
 }
 
-int kmod_config_new(struct kmod_ctx *ctx, struct kmod_config **p_config,
-					const char * const *config_paths)
+char **kmod_config_paths_dup(const char * const *config_paths)
+{
+	char **paths, *p;
+	size_t i, n, len = 0;
+
+	for (n = 0; config_paths[n] != NULL; n++)
+		len += strlen(config_paths[n]) + 1;
+
+	paths = malloc((n + 1) * sizeof(char *) + len);
+	if (paths == NULL)
+		return NULL;
+
+	p = (char *)(paths + n + 1);
+	for (i = 0; i < n; i++) {
+		size_t pathlen = strlen(config_paths[i]) + 1;
+
+		memcpy(p, config_paths[i], pathlen);
+		paths[i] = p;
+		p += pathlen;
+	}
+	paths[n] = NULL;
+
+	return paths;
+}
+
+static struct kmod_config_file *kmod_config_find_file(
+					const struct kmod_config *config,
+					const char *path)
+{
+	const struct kmod_list *l;
+
+	kmod_list_foreach(l, config->files) {
+		struct kmod_config_file *cf = l->data;
+
+		if (streq(cf->path, path))
+			return cf;
+	}
+
+	return NULL;
+}
+
+static int config_list_merge(struct kmod_list **list,
+						const struct kmod_list *from)
+{
+	const struct kmod_list *l;
+
+	kmod_list_foreach(l, from) {
+		struct kmod_list *tmp = kmod_list_append(*list, l->data);
+
+		if (tmp == NULL)
+			return -ENOMEM;
+		*list = tmp;
+	}
+
+	return 0;
+}
+
+static int kmod_config_merge(struct kmod_config *config,
+					const struct kmod_config *entries)
+{
+	if (config_list_merge(&config->aliases, entries->aliases) < 0
+		|| config_list_merge(&config->blacklists, entries->blacklists) < 0
+		|| config_list_merge(&config->options, entries->options) < 0
+		|| config_list_merge(&config->install_commands,
+					entries->install_commands) < 0
+		|| config_list_merge(&config->remove_commands,
+					entries->remove_commands) < 0
+		|| config_list_merge(&config->softdeps, entries->softdeps) < 0)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/*
+ * Append the entries of file @fn to @config. If @old already parsed it and
+ * the file didn't change since, its entries are shared instead of parsed
+ * again.
+ */
+static int kmod_config_add_file(struct kmod_config *config,
+					const struct kmod_config *old,
+					const char *fn)
+{
+	struct kmod_ctx *ctx = config->ctx;
+	struct kmod_config_file *cf = NULL;
+	struct kmod_list *tmp;
+	struct stat st;
+	int fd;
+
+	fd = open(fn, O_RDONLY|O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		DBG(ctx, "could not open '%s': %m\n", fn);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+
+	if (old != NULL)
+		cf = kmod_config_find_file(old, fn);
+
+	if (cf != NULL && cf->stamp == stat_mstamp(&st)) {
+		DBG(ctx, "file '%s' didn't change\n", fn);
+		cf->refcount++;
+		close(fd);
+	} else {
+		cf = kmod_config_file_new(ctx, fn, stat_mstamp(&st));
+		if (cf == NULL) {
+			close(fd);
+			return -ENOMEM;
+		}
+
+		DBG(ctx, "parsing file '%s' fd=%d\n", fn, fd);
+		kmod_config_parse(&cf->entries, fd, fn);
+	}
+
+	tmp = kmod_list_append(config->files, cf);
+	if (tmp == NULL) {
+		kmod_config_file_unref(cf);
+		return -ENOMEM;
+	}
+	config->files = tmp;
+
+	return kmod_config_merge(config, &cf->entries);
+}
+
+static int kmod_config_build(struct kmod_ctx *ctx,
+					const struct kmod_config *old,
+					const char * const *config_paths,
+					struct kmod_config **p_config)
 {
 	struct kmod_config *config;
 	struct kmod_list *list = NULL;
@@ -857,18 +1039,22 @@ int kmod_config_new(struct kmod_ctx *ctx, struct kmod_config **p_config,
 		path_list = tmp;
 	}
 
-	*p_config = config = calloc(1, sizeof(struct kmod_config));
+	config = calloc(1, sizeof(struct kmod_config));
 	if (config == NULL)
 		goto oom;
 
 	config->paths = path_list;
 	config->ctx = ctx;
 
+	config->config_paths = kmod_config_paths_dup(config_paths);
+	if (config->config_paths == NULL)
+		goto oom_config;
+
 	for (; list != NULL; list = kmod_list_remove(list)) {
 		char buf[PATH_MAX];
 		const char *fn = buf;
 		struct conf_file *cf = list->data;
-		int fd;
+		int err;
 
 		if (cf->is_single) {
 			fn = cf->path;
@@ -880,19 +1066,35 @@ int kmod_config_new(struct kmod_ctx *ctx, struct kmod_config **p_config,
 			continue;
 		}
 
-		fd = open(fn, O_RDONLY|O_CLOEXEC);
-		DBG(ctx, "parsing file '%s' fd=%d\n", fn, fd);
+		err = kmod_config_add_file(config, old, fn);
+		free(cf);
+		if (err < 0)
+			goto oom_config;
+	}
 
-		if (fd >= 0)
-			kmod_config_parse(config, fd, fn);
+	/* kernel command line can't change, parse it only once */
+	if (old != NULL) {
+		config->kcmdline = old->kcmdline;
+		config->kcmdline->refcount++;
+	} else {
+		config->kcmdline = kmod_config_file_new(ctx, "/proc/cmdline", 0);
+		if (config->kcmdline == NULL)
+			goto oom_config;
 
-		free(cf);
+		kmod_config_parse_kcmdline(&config->kcmdline->entries);
 	}
 
-	kmod_config_parse_kcmdline(config);
+	if (kmod_config_merge(config, &config->kcmdline->entries) < 0)
+		goto oom_config;
+
+	*p_config = config;
 
 	return 0;
 
+oom_config:
+	/* path_list is released together with config */
+	path_list = NULL;
+	kmod_config_free(config);
 oom:
 	for (; list != NULL; list = kmod_list_remove(list))
 		free(list->data);
@@ -903,6 +1105,107 @@ oom:
 	return -ENOMEM;
 }
 
+int kmod_config_new(struct kmod_ctx *ctx, struct kmod_config **p_config,
+					const char * const *config_paths)
+{
+	return kmod_config_build(ctx, NULL, config_paths, p_config);
+}
+
+/*
+ * Create a new config from the same paths as @old, parsing again only the
+ * files that changed. Entries of unchanged files are shared by both configs,
+ * so @old must be freed only after the new one is in place.
+ *
+ * Returns 1 if any file was added, removed or changed, 0 if the new config is
+ * equivalent to @old, or < 0 on failure in which case @old is left untouched.
+ */
+int kmod_config_reload(const struct kmod_config *old,
+					struct kmod_config **p_config)
+{
+	const struct kmod_list *l;
+	struct kmod_config *config;
+	int err, changed = 0;
+
+	err = kmod_config_build(old->ctx, old,
+				(const char * const *)old->config_paths,
+				&config);
+	if (err < 0)
+		return err;
+
+	/* a file referenced only once is either new or gone */
+	kmod_list_foreach(l, config->files) {
+		const struct kmod_config_file *cf = l->data;
+
+		if (cf->refcount == 1)
+			changed = 1;
+	}
+
+	kmod_list_foreach(l, old->files) {
+		const struct kmod_config_file *cf = l->data;
+
+		if (cf->refcount == 1)
+			changed = 1;
+	}
+
+	*p_config = config;
+
+	return changed;
+}
+
+static bool command_matches(const struct kmod_list *l, const char *name)
+{
+	const char *modname = kmod_command_get_modname(l);
+
+	return streq(modname, name) || fnmatch(modname, name, 0) == 0;
+}
+
+static bool config_files_change_module(const struct kmod_list *files,
+					const char *name, const char *alias)
+{
+	const struct kmod_list *f, *l;
+
+	kmod_list_foreach(f, files) {
+		const struct kmod_config_file *cf = f->data;
+
+		if (cf->refcount > 1)
+			continue;
+
+		kmod_list_foreach(l, cf->entries.options) {
+			const char *modname = kmod_option_get_modname(l);
+
+			if (streq(modname, name) ||
+					(alias != NULL && streq(modname, alias)))
+				return true;
+		}
+
+		kmod_list_foreach(l, cf->entries.install_commands) {
+			if (command_matches(l, name))
+				return true;
+		}
+
+		kmod_list_foreach(l, cf->entries.remove_commands) {
+			if (command_matches(l, name))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Check whether the options or commands of module @name may differ between
+ * @old and @config, as returned by kmod_config_reload(). Blacklist, aliases
+ * and softdeps are always looked up in the current config, so only what
+ * struct kmod_module caches matters here.
+ */
+bool kmod_config_changed_module(const struct kmod_config *old,
+					const struct kmod_config *config,
+					const char *name, const char *alias)
+{
+	return config_files_change_module(old->files, name, alias)
+		|| config_files_change_module(config->files, name, alias);
+}
+
 /**********************************************************************
  * struct kmod_config_iter functions
  **********************************************************************/
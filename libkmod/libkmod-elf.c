@@ -497,77 +497,6 @@ int kmod_elf_get_strings(const struct kmod_elf *elf, const char *section, char *
 	return count;
 }
 
-/* array will be allocated with strings in a single malloc, just free *array */
-int kmod_elf_get_modversions(const struct kmod_elf *elf, struct kmod_modversion **array)
-{
-	size_t off, offcrc, slen;
-	uint64_t size;
-	struct kmod_modversion *a;
-	const void *buf;
-	char *itr;
-	int i, count, err;
-#define MODVERSION_SEC_SIZE (sizeof(struct kmod_modversion64))
-
-	assert_cc(sizeof(struct kmod_modversion64) ==
-					sizeof(struct kmod_modversion32));
-
-	if (elf->class & KMOD_ELF_32)
-		offcrc = sizeof(uint32_t);
-	else
-		offcrc = sizeof(uint64_t);
-
-	*array = NULL;
-
-	err = kmod_elf_get_section(elf, "__versions", &buf, &size);
-	if (err < 0)
-		return err;
-
-	if (buf == NULL || size == 0)
-		return 0;
-
-	if (size % MODVERSION_SEC_SIZE != 0)
-		return -EINVAL;
-
-	count = size / MODVERSION_SEC_SIZE;
-
-	off = (const uint8_t *)buf - elf->memory;
-	slen = 0;
-
-	for (i = 0; i < count; i++, off += MODVERSION_SEC_SIZE) {
-		const char *symbol = elf_get_mem(elf, off + offcrc);
-
-		if (symbol[0] == '.')
-			symbol++;
-
-		slen += strlen(symbol) + 1;
-	}
-
-	*array = a = malloc(sizeof(struct kmod_modversion) * count + slen);
-	if (*array == NULL)
-		return -errno;
-
-	itr = (char *)(a + count);
-	off = (const uint8_t *)buf - elf->memory;
-
-	for (i = 0; i < count; i++, off += MODVERSION_SEC_SIZE) {
-		uint64_t crc = elf_get_uint(elf, off, offcrc);
-		const char *symbol = elf_get_mem(elf, off + offcrc);
-		size_t symbollen;
-
-		if (symbol[0] == '.')
-			symbol++;
-
-		a[i].crc = crc;
-		a[i].bind = KMOD_SYMBOL_UNDEF;
-		a[i].symbol = itr;
-		symbollen = strlen(symbol) + 1;
-		memcpy(itr, symbol, symbollen);
-		itr += symbollen;
-	}
-
-	return count;
-}
-
 int kmod_elf_strip_section(struct kmod_elf *elf, const char *section)
 {
 	uint64_t off, size;
@@ -657,82 +586,6 @@ int kmod_elf_strip_vermagic(struct kmod_elf *elf)
 }
 
 
-static int kmod_elf_get_symbols_symtab(const struct kmod_elf *elf, struct kmod_modversion **array)
-{
-	uint64_t i, last, size;
-	const void *buf;
-	const char *strings;
-	char *itr;
-	struct kmod_modversion *a;
-	int count, err;
-
-	*array = NULL;
-
-	err = kmod_elf_get_section(elf, "__ksymtab_strings", &buf, &size);
-	if (err < 0)
-		return err;
-	strings = buf;
-	if (strings == NULL || size == 0)
-		return 0;
-
-	/* skip zero padding */
-	while (strings[0] == '\0' && size > 1) {
-		strings++;
-		size--;
-	}
-	if (size <= 1)
-		return 0;
-
-	last = 0;
-	for (i = 0, count = 0; i < size; i++) {
-		if (strings[i] == '\0') {
-			if (last == i) {
-				last = i + 1;
-				continue;
-			}
-			count++;
-			last = i + 1;
-		}
-	}
-	if (strings[i - 1] != '\0')
-		count++;
-
-	*array = a = malloc(size + 1 + sizeof(struct kmod_modversion) * count);
-	if (*array == NULL)
-		return -errno;
-
-	itr = (char *)(a + count);
-	last = 0;
-	for (i = 0, count = 0; i < size; i++) {
-		if (strings[i] == '\0') {
-			size_t slen = i - last;
-			if (last == i) {
-				last = i + 1;
-				continue;
-			}
-			a[count].crc = 0;
-			a[count].bind = KMOD_SYMBOL_GLOBAL;
-			a[count].symbol = itr;
-			memcpy(itr, strings + last, slen);
-			itr[slen] = '\0';
-			itr += slen + 1;
-			count++;
-			last = i + 1;
-		}
-	}
-	if (strings[i - 1] != '\0') {
-		size_t slen = i - last;
-		a[count].crc = 0;
-		a[count].bind = KMOD_SYMBOL_GLOBAL;
-		a[count].symbol = itr;
-		memcpy(itr, strings + last, slen);
-		itr[slen] = '\0';
-		count++;
-	}
-
-	return count;
-}
-
 static inline uint8_t kmod_symbol_bind_from_elf(uint8_t elf_value)
 {
 	switch (elf_value) {
@@ -772,134 +625,6 @@ static uint64_t kmod_elf_resolve_crc(const struct kmod_elf *elf, uint64_t crc, u
 	return crc;
 }
 
-/* array will be allocated with strings in a single malloc, just free *array */
-int kmod_elf_get_symbols(const struct kmod_elf *elf, struct kmod_modversion **array)
-{
-	static const char crc_str[] = "__crc_";
-	static const size_t crc_strlen = sizeof(crc_str) - 1;
-	uint64_t strtablen, symtablen, str_off, sym_off;
-	const void *strtab, *symtab;
-	struct kmod_modversion *a;
-	char *itr;
-	size_t slen, symlen;
-	int i, count, symcount, err;
-
-	err = kmod_elf_get_section(elf, ".strtab", &strtab, &strtablen);
-	if (err < 0) {
-		ELFDBG(elf, "no .strtab found.\n");
-		goto fallback;
-	}
-
-	err = kmod_elf_get_section(elf, ".symtab", &symtab, &symtablen);
-	if (err < 0) {
-		ELFDBG(elf, "no .symtab found.\n");
-		goto fallback;
-	}
-
-	if (elf->class & KMOD_ELF_32)
-		symlen = sizeof(Elf32_Sym);
-	else
-		symlen = sizeof(Elf64_Sym);
-
-	if (symtablen % symlen != 0) {
-		ELFDBG(elf, "unexpected .symtab of length %"PRIu64", not multiple of %"PRIu64" as expected.\n", symtablen, symlen);
-		goto fallback;
-	}
-
-	symcount = symtablen / symlen;
-	count = 0;
-	slen = 0;
-	str_off = (const uint8_t *)strtab - elf->memory;
-	sym_off = (const uint8_t *)symtab - elf->memory + symlen;
-	for (i = 1; i < symcount; i++, sym_off += symlen) {
-		const char *name;
-		uint32_t name_off;
-
-#define READV(field)							\
-		elf_get_uint(elf, sym_off + offsetof(typeof(*s), field),\
-			     sizeof(s->field))
-		if (elf->class & KMOD_ELF_32) {
-			Elf32_Sym *s;
-			name_off = READV(st_name);
-		} else {
-			Elf64_Sym *s;
-			name_off = READV(st_name);
-		}
-#undef READV
-		if (name_off >= strtablen) {
-			ELFDBG(elf, ".strtab is %"PRIu64" bytes, but .symtab entry %d wants to access offset %"PRIu32".\n", strtablen, i, name_off);
-			goto fallback;
-		}
-
-		name = elf_get_mem(elf, str_off + name_off);
-
-		if (strncmp(name, crc_str, crc_strlen) != 0)
-			continue;
-		slen += strlen(name + crc_strlen) + 1;
-		count++;
-	}
-
-	if (count == 0)
-		goto fallback;
-
-	*array = a = malloc(sizeof(struct kmod_modversion) * count + slen);
-	if (*array == NULL)
-		return -errno;
-
-	itr = (char *)(a + count);
-	count = 0;
-	str_off = (const uint8_t *)strtab - elf->memory;
-	sym_off = (const uint8_t *)symtab - elf->memory + symlen;
-	for (i = 1; i < symcount; i++, sym_off += symlen) {
-		const char *name;
-		uint32_t name_off;
-		uint64_t crc;
-		uint8_t info, bind;
-		uint16_t shndx;
-
-#define READV(field)							\
-		elf_get_uint(elf, sym_off + offsetof(typeof(*s), field),\
-			     sizeof(s->field))
-		if (elf->class & KMOD_ELF_32) {
-			Elf32_Sym *s;
-			name_off = READV(st_name);
-			crc = READV(st_value);
-			info = READV(st_info);
-			shndx = READV(st_shndx);
-		} else {
-			Elf64_Sym *s;
-			name_off = READV(st_name);
-			crc = READV(st_value);
-			info = READV(st_info);
-			shndx = READV(st_shndx);
-		}
-#undef READV
-		name = elf_get_mem(elf, str_off + name_off);
-		if (strncmp(name, crc_str, crc_strlen) != 0)
-			continue;
-		name += crc_strlen;
-
-		if (elf->class & KMOD_ELF_32)
-			bind = ELF32_ST_BIND(info);
-		else
-			bind = ELF64_ST_BIND(info);
-
-		a[count].crc = kmod_elf_resolve_crc(elf, crc, shndx);
-		a[count].bind = kmod_symbol_bind_from_elf(bind);
-		a[count].symbol = itr;
-		slen = strlen(name);
-		memcpy(itr, name, slen);
-		itr[slen] = '\0';
-		itr += slen + 1;
-		count++;
-	}
-	return count;
-
-fallback:
-	ELFDBG(elf, "Falling back to __ksymtab_strings!\n");
-	return kmod_elf_get_symbols_symtab(elf, array);
-}
-
 static int kmod_elf_crc_find(const struct kmod_elf *elf, const void *versions, uint64_t versionslen, const char *name, uint64_t *crc)
 {
 	size_t verlen, crclen, off;
@@ -934,52 +659,93 @@ static int kmod_elf_crc_find(const struct kmod_elf *elf, const void *versions, u
 #define STT_REGISTER    13              /* Global register reserved to app. */
 #endif
 
-/* array will be allocated with strings in a single malloc, just free *array */
-int kmod_elf_get_dependency_symbols(const struct kmod_elf *elf, struct kmod_modversion **array)
+#define MODVERSION_SEC_SIZE (sizeof(struct kmod_modversion64))
+
+struct elf_sym {
+	uint32_t name;
+	uint64_t value;
+	uint64_t size;
+	uint16_t shndx;
+	uint8_t bind;
+	uint8_t type;
+};
+
+static void elf_get_sym(const struct kmod_elf *elf, uint64_t off,
+							struct elf_sym *sym)
 {
-	uint64_t versionslen, strtablen, symtablen, str_off, sym_off, ver_off;
-	const void *versions, *strtab, *symtab;
-	struct kmod_modversion *a;
-	char *itr;
-	size_t slen, verlen, symlen, crclen;
-	int i, count, symcount, vercount, err;
-	bool handle_register_symbols;
-	uint8_t *visited_versions;
-	uint64_t *symcrcs;
-
-	err = kmod_elf_get_section(elf, "__versions", &versions, &versionslen);
-	if (err < 0) {
-		versions = NULL;
-		versionslen = 0;
-		verlen = 0;
-		crclen = 0;
+	uint8_t info;
+
+#define READV(field)							\
+	elf_get_uint(elf, off + offsetof(typeof(*s), field), sizeof(s->field))
+	if (elf->class & KMOD_ELF_32) {
+		Elf32_Sym *s;
+		sym->name = READV(st_name);
+		sym->value = READV(st_value);
+		sym->size = READV(st_size);
+		sym->shndx = READV(st_shndx);
+		info = READV(st_info);
+		sym->bind = ELF32_ST_BIND(info);
+		sym->type = ELF32_ST_TYPE(info);
 	} else {
-		if (elf->class & KMOD_ELF_32) {
-			struct kmod_modversion32 *mv;
-			verlen = sizeof(*mv);
-			crclen = sizeof(mv->crc);
-		} else {
-			struct kmod_modversion64 *mv;
-			verlen = sizeof(*mv);
-			crclen = sizeof(mv->crc);
-		}
-		if (versionslen % verlen != 0) {
-			ELFDBG(elf, "unexpected __versions of length %"PRIu64", not multiple of %zd as expected.\n", versionslen, verlen);
-			versions = NULL;
-			versionslen = 0;
-		}
+		Elf64_Sym *s;
+		sym->name = READV(st_name);
+		sym->value = READV(st_value);
+		sym->size = READV(st_size);
+		sym->shndx = READV(st_shndx);
+		info = READV(st_info);
+		sym->bind = ELF64_ST_BIND(info);
+		sym->type = ELF64_ST_TYPE(info);
+	}
+#undef READV
+}
+
+static int elf_get_versions(const struct kmod_elf *elf, const void **buf,
+					uint64_t *size, size_t *crclen)
+{
+	int err;
+
+	assert_cc(sizeof(struct kmod_modversion64) ==
+					sizeof(struct kmod_modversion32));
+
+	err = kmod_elf_get_section(elf, "__versions", buf, size);
+	if (err < 0)
+		return err;
+
+	if (*buf == NULL)
+		*size = 0;
+
+	if (*size % MODVERSION_SEC_SIZE != 0) {
+		ELFDBG(elf, "unexpected __versions of length %"PRIu64", not multiple of %zu as expected.\n",
+		       *size, MODVERSION_SEC_SIZE);
+		return -EINVAL;
 	}
 
+	if (elf->class & KMOD_ELF_32)
+		*crclen = sizeof(uint32_t);
+	else
+		*crclen = sizeof(uint64_t);
+
+	return 0;
+}
+
+static int symbol_iter_init_symtab(struct kmod_elf_symbol_iter *iter)
+{
+	const struct kmod_elf *elf = iter->elf;
+	uint64_t strtablen, symtablen, symtab_off;
+	const void *strtab, *symtab;
+	size_t symlen;
+	int err;
+
 	err = kmod_elf_get_section(elf, ".strtab", &strtab, &strtablen);
 	if (err < 0) {
 		ELFDBG(elf, "no .strtab found.\n");
-		return -EINVAL;
+		return err;
 	}
 
 	err = kmod_elf_get_section(elf, ".symtab", &symtab, &symtablen);
 	if (err < 0) {
 		ELFDBG(elf, "no .symtab found.\n");
-		return -EINVAL;
+		return err;
 	}
 
 	if (elf->class & KMOD_ELF_32)
@@ -988,227 +754,435 @@ int kmod_elf_get_dependency_symbols(const struct kmod_elf *elf, struct kmod_modv
 		symlen = sizeof(Elf64_Sym);
 
 	if (symtablen % symlen != 0) {
-		ELFDBG(elf, "unexpected .symtab of length %"PRIu64", not multiple of %"PRIu64" as expected.\n", symtablen, symlen);
+		ELFDBG(elf, "unexpected .symtab of length %"PRIu64", not multiple of %zu as expected.\n",
+		       symtablen, symlen);
 		return -EINVAL;
 	}
 
-	if (versionslen == 0) {
-		vercount = 0;
-		visited_versions = NULL;
-	} else {
-		vercount = versionslen / verlen;
-		visited_versions = calloc(vercount, sizeof(uint8_t));
-		if (visited_versions == NULL)
-			return -ENOMEM;
+	symtab_off = (const uint8_t *)symtab - elf->memory;
+	iter->str_off = (const uint8_t *)strtab - elf->memory;
+	iter->strtablen = strtablen;
+	iter->off = symtab_off + symlen; /* skip the null symbol */
+	iter->end = symtab_off + symtablen;
+	iter->entlen = symlen;
+
+	return 0;
+}
+
+/*
+ * Check the names of the symbols the iterator will visit are within .strtab
+ * and count the ones starting with prefix, so the walk itself never fails.
+ */
+static int symbol_iter_check_symtab(const struct kmod_elf_symbol_iter *iter,
+				    bool undef_only, const char *prefix,
+				    unsigned int *count)
+{
+	const struct kmod_elf *elf = iter->elf;
+	size_t prefixlen = prefix != NULL ? strlen(prefix) : 0;
+	uint64_t off;
+
+	*count = 0;
+	for (off = iter->off; off < iter->end; off += iter->entlen) {
+		struct elf_sym sym;
+
+		elf_get_sym(elf, off, &sym);
+		if (undef_only && sym.shndx != SHN_UNDEF)
+			continue;
+
+		if (sym.name >= iter->strtablen) {
+			ELFDBG(elf, ".strtab is %"PRIu64" bytes, but .symtab entry wants to access offset %"PRIu32".\n",
+			       iter->strtablen, sym.name);
+			return -EINVAL;
+		}
+
+		if (prefix != NULL &&
+		    strncmp(elf_get_mem(elf, iter->str_off + sym.name),
+						prefix, prefixlen) == 0)
+			(*count)++;
 	}
 
-	handle_register_symbols = (elf->header.machine == EM_SPARC ||
-				   elf->header.machine == EM_SPARCV9);
+	return 0;
+}
+
+static int symbol_iter_init_versions(struct kmod_elf_symbol_iter *iter)
+{
+	const struct kmod_elf *elf = iter->elf;
+	const void *versions;
+	uint64_t size;
+	int err;
+
+	err = elf_get_versions(elf, &versions, &size, &iter->crclen);
+	if (err < 0)
+		return err;
+
+	iter->off = size > 0 ? (const uint8_t *)versions - elf->memory : 0;
+	iter->end = iter->off + size;
+	iter->entlen = MODVERSION_SEC_SIZE;
+
+	return 0;
+}
+
+static const char crc_str[] = "__crc_";
+static const size_t crc_strlen = sizeof(crc_str) - 1;
+
+/*
+ * Exported symbols are the ones with a "__crc_" companion in .symtab, or
+ * if there are none, the names in __ksymtab_strings.
+ */
+static int symbol_iter_init_symbols(struct kmod_elf_symbol_iter *iter)
+{
+	const struct kmod_elf *elf = iter->elf;
+	unsigned int count;
+	const void *buf;
+	uint64_t size;
+	int err;
+
+	if (symbol_iter_init_symtab(iter) == 0 &&
+	    symbol_iter_check_symtab(iter, false, crc_str, &count) == 0 &&
+	    count > 0)
+		return 0;
+
+	ELFDBG(elf, "Falling back to __ksymtab_strings!\n");
+
+	err = kmod_elf_get_section(elf, "__ksymtab_strings", &buf, &size);
+	if (err < 0)
+		return err;
+
+	iter->ksymtab_strings = true;
+	iter->off = buf != NULL ? (const uint8_t *)buf - elf->memory : 0;
+	iter->end = buf != NULL ? iter->off + size : 0;
 
-	symcount = symtablen / symlen;
-	count = 0;
-	slen = 0;
-	str_off = (const uint8_t *)strtab - elf->memory;
-	sym_off = (const uint8_t *)symtab - elf->memory + symlen;
+	return 0;
+}
+
+static int symbol_iter_init_dependencies(struct kmod_elf_symbol_iter *iter)
+{
+	const struct kmod_elf *elf = iter->elf;
+	unsigned int count;
+	int err;
 
-	symcrcs = calloc(symcount, sizeof(uint64_t));
-	if (symcrcs == NULL) {
-		free(visited_versions);
-		return -ENOMEM;
+	if (elf_get_versions(elf, &iter->versions, &iter->versionslen,
+							&iter->crclen) < 0) {
+		iter->versions = NULL;
+		iter->versionslen = 0;
 	}
 
-	for (i = 1; i < symcount; i++, sym_off += symlen) {
-		const char *name;
-		uint64_t crc;
-		uint32_t name_off;
-		uint16_t secidx;
-		uint8_t info;
-		int idx;
+	err = symbol_iter_init_symtab(iter);
+	if (err < 0)
+		return -EINVAL;
 
-#define READV(field)							\
-		elf_get_uint(elf, sym_off + offsetof(typeof(*s), field),\
-			     sizeof(s->field))
-		if (elf->class & KMOD_ELF_32) {
-			Elf32_Sym *s;
-			name_off = READV(st_name);
-			secidx = READV(st_shndx);
-			info = READV(st_info);
-		} else {
-			Elf64_Sym *s;
-			name_off = READV(st_name);
-			secidx = READV(st_shndx);
-			info = READV(st_info);
-		}
-#undef READV
-		if (secidx != SHN_UNDEF)
-			continue;
+	err = symbol_iter_check_symtab(iter, true, NULL, &count);
+	if (err < 0)
+		return err;
 
-		if (handle_register_symbols) {
-			uint8_t type;
-			if (elf->class & KMOD_ELF_32)
-				type = ELF32_ST_TYPE(info);
-			else
-				type = ELF64_ST_TYPE(info);
-
-			/* Not really undefined: sparc gcc 3.3 creates
-			 * U references when you have global asm
-			 * variables, to avoid anyone else misusing
-			 * them.
-			 */
-			if (type == STT_REGISTER)
-				continue;
-		}
+	if (iter->versionslen > 0) {
+		iter->visited = calloc(iter->versionslen / MODVERSION_SEC_SIZE,
+							sizeof(uint8_t));
+		if (iter->visited == NULL)
+			return -ENOMEM;
+	}
 
-		if (name_off >= strtablen) {
-			ELFDBG(elf, ".strtab is %"PRIu64" bytes, but .symtab entry %d wants to access offset %"PRIu32".\n", strtablen, i, name_off);
-			free(visited_versions);
-			free(symcrcs);
-			return -EINVAL;
-		}
+	iter->handle_register_symbols = (elf->header.machine == EM_SPARC ||
+					 elf->header.machine == EM_SPARCV9);
 
-		name = elf_get_mem(elf, str_off + name_off);
-		if (name[0] == '\0') {
-			ELFDBG(elf, "empty symbol name at index %"PRIu64"\n", i);
-			continue;
-		}
+	return 0;
+}
 
-		slen += strlen(name) + 1;
-		count++;
+/*
+ * Iterators walk the tables of the module as they are mapped and point into
+ * them, so nothing is allocated per entry: the names are valid as long as
+ * elf is.
+ */
+int kmod_elf_symbol_iter_init(struct kmod_elf_symbol_iter *iter,
+				const struct kmod_elf *elf,
+				enum kmod_symbol_iter_type type)
+{
+	memset(iter, 0, sizeof(*iter));
+	iter->elf = elf;
+	iter->type = type;
+
+	switch (type) {
+	case KMOD_SYMBOL_ITER_VERSIONS:
+		return symbol_iter_init_versions(iter);
+	case KMOD_SYMBOL_ITER_SYMBOLS:
+		return symbol_iter_init_symbols(iter);
+	case KMOD_SYMBOL_ITER_DEPENDENCIES:
+		return symbol_iter_init_dependencies(iter);
+	}
+
+	return -EINVAL;
+}
+
+void kmod_elf_symbol_iter_release(struct kmod_elf_symbol_iter *iter)
+{
+	free(iter->visited);
+	iter->visited = NULL;
+}
 
-		idx = kmod_elf_crc_find(elf, versions, versionslen, name, &crc);
-		if (idx >= 0 && visited_versions != NULL)
-			visited_versions[idx] = 1;
-		symcrcs[i] = crc;
+static void symbol_iter_set(struct kmod_elf_symbol_iter *iter,
+			    const char *symbol, size_t len, uint64_t crc,
+			    enum kmod_symbol_bind bind)
+{
+	iter->symbol = symbol;
+	iter->len = len;
+	iter->crc = crc;
+	iter->bind = bind;
+}
+
+/* name of the __versions entry at off, NULL if it's not terminated */
+static const char *symbol_iter_version(struct kmod_elf_symbol_iter *iter,
+					uint64_t off, size_t *len)
+{
+	const char *symbol = elf_get_mem(iter->elf, off + iter->crclen);
+	size_t max = MODVERSION_SEC_SIZE - iter->crclen;
+
+	*len = strnlen(symbol, max);
+	if (*len == max) {
+		ELFDBG(iter->elf, "unterminated __versions entry\n");
+		iter->err = -EINVAL;
+		return NULL;
 	}
 
-	if (visited_versions != NULL) {
-		/* module_layout/struct_module are not visited, but needed */
-		ver_off = (const uint8_t *)versions - elf->memory;
-		for (i = 0; i < vercount; i++) {
-			if (visited_versions[i] == 0) {
-				const char *name;
-				name = elf_get_mem(elf, ver_off + i * verlen + crclen);
-				slen += strlen(name) + 1;
-
-				count++;
-			}
-		}
+	return symbol;
+}
+
+static bool symbol_iter_next_version(struct kmod_elf_symbol_iter *iter)
+{
+	const char *symbol;
+	uint64_t off;
+	size_t len;
+
+	if (iter->off >= iter->end)
+		return false;
+
+	off = iter->off;
+	iter->off += iter->entlen;
+
+	symbol = symbol_iter_version(iter, off, &len);
+	if (symbol == NULL)
+		return false;
+
+	if (symbol[0] == '.') {
+		symbol++;
+		len--;
 	}
 
-	if (count == 0) {
-		free(visited_versions);
-		free(symcrcs);
-		*array = NULL;
-		return 0;
+	symbol_iter_set(iter, symbol, len,
+			elf_get_uint(iter->elf, off, iter->crclen),
+			KMOD_SYMBOL_UNDEF);
+	return true;
+}
+
+static bool symbol_iter_next_ksymtab_string(struct kmod_elf_symbol_iter *iter)
+{
+	const char *symbol;
+	size_t len;
+
+	/* skip zero padding and empty strings */
+	while (iter->off < iter->end &&
+	       *(const char *)elf_get_mem(iter->elf, iter->off) == '\0')
+		iter->off++;
+
+	if (iter->off >= iter->end)
+		return false;
+
+	symbol = elf_get_mem(iter->elf, iter->off);
+	len = strnlen(symbol, iter->end - iter->off);
+	if (len == iter->end - iter->off) {
+		ELFDBG(iter->elf, "__ksymtab_strings is not terminated\n");
+		iter->err = -EINVAL;
+		return false;
 	}
+	iter->off += len + 1;
 
-	*array = a = malloc(sizeof(struct kmod_modversion) * count + slen);
-	if (*array == NULL) {
-		free(visited_versions);
-		free(symcrcs);
-		return -errno;
+	symbol_iter_set(iter, symbol, len, 0, KMOD_SYMBOL_GLOBAL);
+	return true;
+}
+
+static bool symbol_iter_next_symbol(struct kmod_elf_symbol_iter *iter)
+{
+	const struct kmod_elf *elf = iter->elf;
+
+	if (iter->ksymtab_strings)
+		return symbol_iter_next_ksymtab_string(iter);
+
+	while (iter->off < iter->end) {
+		const char *name;
+		struct elf_sym sym;
+
+		elf_get_sym(elf, iter->off, &sym);
+		iter->off += iter->entlen;
+
+		name = elf_get_mem(elf, iter->str_off + sym.name);
+		if (strncmp(name, crc_str, crc_strlen) != 0)
+			continue;
+		name += crc_strlen;
+
+		symbol_iter_set(iter, name, strlen(name),
+				kmod_elf_resolve_crc(elf, sym.value, sym.shndx),
+				kmod_symbol_bind_from_elf(sym.bind));
+		return true;
 	}
 
-	itr = (char *)(a + count);
-	count = 0;
-	str_off = (const uint8_t *)strtab - elf->memory;
-	sym_off = (const uint8_t *)symtab - elf->memory + symlen;
-	for (i = 1; i < symcount; i++, sym_off += symlen) {
+	return false;
+}
+
+static bool symbol_iter_next_dependency(struct kmod_elf_symbol_iter *iter)
+{
+	const struct kmod_elf *elf = iter->elf;
+
+	while (!iter->unvisited && iter->off < iter->end) {
 		const char *name;
+		struct elf_sym sym;
 		uint64_t crc;
-		uint32_t name_off;
-		uint16_t secidx;
-		uint8_t info, bind;
+		int idx;
 
-#define READV(field)							\
-		elf_get_uint(elf, sym_off + offsetof(typeof(*s), field),\
-			     sizeof(s->field))
-		if (elf->class & KMOD_ELF_32) {
-			Elf32_Sym *s;
-			name_off = READV(st_name);
-			secidx = READV(st_shndx);
-			info = READV(st_info);
-		} else {
-			Elf64_Sym *s;
-			name_off = READV(st_name);
-			secidx = READV(st_shndx);
-			info = READV(st_info);
-		}
-#undef READV
-		if (secidx != SHN_UNDEF)
+		elf_get_sym(elf, iter->off, &sym);
+		iter->off += iter->entlen;
+
+		if (sym.shndx != SHN_UNDEF)
 			continue;
 
-		if (handle_register_symbols) {
-			uint8_t type;
-			if (elf->class & KMOD_ELF_32)
-				type = ELF32_ST_TYPE(info);
-			else
-				type = ELF64_ST_TYPE(info);
-
-			/* Not really undefined: sparc gcc 3.3 creates
-			 * U references when you have global asm
-			 * variables, to avoid anyone else misusing
-			 * them.
-			 */
-			if (type == STT_REGISTER)
-				continue;
-		}
+		/*
+		 * Not really undefined: sparc gcc 3.3 creates U references
+		 * when you have global asm variables, to avoid anyone else
+		 * misusing them.
+		 */
+		if (iter->handle_register_symbols && sym.type == STT_REGISTER)
+			continue;
 
-		name = elf_get_mem(elf, str_off + name_off);
+		name = elf_get_mem(elf, iter->str_off + sym.name);
 		if (name[0] == '\0') {
-			ELFDBG(elf, "empty symbol name at index %"PRIu64"\n", i);
+			ELFDBG(elf, "empty symbol name\n");
 			continue;
 		}
 
-		if (elf->class & KMOD_ELF_32)
-			bind = ELF32_ST_BIND(info);
-		else
-			bind = ELF64_ST_BIND(info);
-		if (bind == STB_WEAK)
-			bind = KMOD_SYMBOL_WEAK;
-		else
-			bind = KMOD_SYMBOL_UNDEF;
-
-		slen = strlen(name);
-		crc = symcrcs[i];
-
-		a[count].crc = crc;
-		a[count].bind = bind;
-		a[count].symbol = itr;
-		memcpy(itr, name, slen);
-		itr[slen] = '\0';
-		itr += slen + 1;
+		idx = kmod_elf_crc_find(elf, iter->versions, iter->versionslen,
+								name, &crc);
+		if (idx >= 0 && iter->visited != NULL)
+			iter->visited[idx] = 1;
 
-		count++;
+		symbol_iter_set(iter, name, strlen(name), crc,
+				sym.bind == STB_WEAK ? KMOD_SYMBOL_WEAK :
+						       KMOD_SYMBOL_UNDEF);
+		return true;
 	}
 
-	free(symcrcs);
+	/* then the unvisited versions: module_layout/struct_module are needed */
+	if (!iter->unvisited) {
+		iter->unvisited = true;
+		iter->off = 0;
+		iter->end = iter->versionslen;
+		iter->entlen = MODVERSION_SEC_SIZE;
+	}
 
-	if (visited_versions == NULL)
-		return count;
+	while (iter->off < iter->end) {
+		uint64_t off = (const uint8_t *)iter->versions - elf->memory +
+								iter->off;
+		const char *symbol;
+		size_t len;
+		bool visited = iter->visited[iter->off / MODVERSION_SEC_SIZE];
 
-	/* add unvisited (module_layout/struct_module) */
-	ver_off = (const uint8_t *)versions - elf->memory;
-	for (i = 0; i < vercount; i++) {
-		const char *name;
-		uint64_t crc;
+		iter->off += iter->entlen;
+		if (visited)
+			continue;
+
+		symbol = symbol_iter_version(iter, off, &len);
+		if (symbol == NULL)
+			return false;
+
+		symbol_iter_set(iter, symbol, len,
+				elf_get_uint(elf, off, iter->crclen),
+				KMOD_SYMBOL_UNDEF);
+		return true;
+	}
+
+	return false;
+}
+
+bool kmod_elf_symbol_iter_next(struct kmod_elf_symbol_iter *iter)
+{
+	if (iter->err < 0)
+		return false;
+
+	switch (iter->type) {
+	case KMOD_SYMBOL_ITER_VERSIONS:
+		return symbol_iter_next_version(iter);
+	case KMOD_SYMBOL_ITER_SYMBOLS:
+		return symbol_iter_next_symbol(iter);
+	case KMOD_SYMBOL_ITER_DEPENDENCIES:
+		return symbol_iter_next_dependency(iter);
+	}
+
+	return false;
+}
+
+/*
+ * Functions and objects defined in the module: where they are loaded is the
+ * address of their section, as in /sys/module/<name>/sections, plus value.
+ */
+int kmod_elf_foreach_defined_symbol(const struct kmod_elf *elf,
+		int (*cb)(const struct kmod_elf_defined_symbol *sym, void *data),
+		void *data)
+{
+	struct kmod_elf_symbol_iter iter = { .elf = elf };
+	uint64_t nameslen;
+	const char *names = elf_get_strings_section(elf, &nameslen);
+	unsigned int count;
+	uint64_t off;
+	int err;
 
-		if (visited_versions[i] != 0)
+	err = symbol_iter_init_symtab(&iter);
+	if (err < 0)
+		return err;
+
+	err = symbol_iter_check_symtab(&iter, false, NULL, &count);
+	if (err < 0)
+		return err;
+
+	for (off = iter.off; off < iter.end; off += iter.entlen) {
+		struct kmod_elf_defined_symbol def;
+		const uint8_t *shdr;
+		uint32_t nameoff;
+		struct elf_sym sym;
+
+		elf_get_sym(elf, off, &sym);
+		if (sym.type != STT_FUNC && sym.type != STT_OBJECT)
+			continue;
+
+		if (sym.shndx == SHN_UNDEF || sym.shndx >= SHN_LORESERVE ||
+		    sym.shndx >= elf->header.section.count)
+			continue;
+
+		/* not elf_get_section_info(): .bss has no contents in the file */
+		shdr = elf_get_section_header(elf, sym.shndx);
+		if (elf->class & KMOD_ELF_32) {
+			nameoff = elf_get_uint(elf, shdr - elf->memory +
+					offsetof(Elf32_Shdr, sh_name), sizeof(Elf32_Word));
+			def.section_size = elf_get_uint(elf, shdr - elf->memory +
+					offsetof(Elf32_Shdr, sh_size), sizeof(Elf32_Word));
+		} else {
+			nameoff = elf_get_uint(elf, shdr - elf->memory +
+					offsetof(Elf64_Shdr, sh_name), sizeof(Elf64_Word));
+			def.section_size = elf_get_uint(elf, shdr - elf->memory +
+					offsetof(Elf64_Shdr, sh_size), sizeof(Elf64_Xword));
+		}
+		if (nameoff >= nameslen)
 			continue;
 
-		name = elf_get_mem(elf, ver_off + i * verlen + crclen);
-		slen = strlen(name);
-		crc = elf_get_uint(elf, ver_off + i * verlen, crclen);
+		def.name = elf_get_mem(elf, iter.str_off + sym.name);
+		if (def.name[0] == '\0')
+			continue;
 
-		a[count].crc = crc;
-		a[count].bind = KMOD_SYMBOL_UNDEF;
-		a[count].symbol = itr;
-		memcpy(itr, name, slen);
-		itr[slen] = '\0';
-		itr += slen + 1;
+		def.section = names + nameoff;
+		def.shndx = sym.shndx;
+		def.value = sym.value;
+		def.size = sym.size;
 
-		count++;
+		err = cb(&def, data);
+		if (err < 0)
+			return err;
 	}
-	free(visited_versions);
-	return count;
+
+	return 0;
 }
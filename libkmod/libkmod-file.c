@@ -17,8 +17,12 @@
  * License along with this library; if not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,6 +37,7 @@
 #include <zlib.h>
 #endif
 
+#include <shared/missing.h>
 #include <shared/util.h>
 
 #include "libkmod.h"
@@ -58,9 +63,88 @@ struct kmod_file {
 	const struct file_ops *ops;
 	const struct kmod_ctx *ctx;
 	struct kmod_elf *elf;
+	struct kmod_archive *archive;
 };
 
+/*
+ * Optional libraries, like the decompression ones, are only needed for some
+ * modules, so they are opened the first time one needs them instead of by
+ * the dynamic linker for every program using libkmod. Once opened, a library
+ * stays so until the process exits.
+ *
+ * The libraries and their symbols are shared by all contexts of the process,
+ * that may be used from different threads: the lock serializes the open and
+ * makes the symbols set by it visible to the other threads.
+ */
+static int dl_library_open_locked(const struct kmod_ctx *ctx,
+						struct kmod_dl_library *lib)
+{
+	const struct kmod_dl_symbol *s;
+	void *handle;
+
+	if (lib->handle != NULL)
+		return 0;
+
+	/* don't retry, nor log again, for each module */
+	if (lib->failed)
+		return -ENOTSUP;
+
+	handle = dlopen(lib->soname, RTLD_NOW|RTLD_LOCAL);
+	if (handle == NULL) {
+		ERR(ctx, "could not load %s, needed to %s: %s\n",
+				lib->soname, lib->needed_to, dlerror());
+		goto fail;
+	}
+
+	for (s = lib->symbols; s->name != NULL; s++) {
+		*s->fn = dlsym(handle, s->name);
+		if (*s->fn == NULL) {
+			ERR(ctx, "%s: symbol %s not found\n", lib->soname,
+								s->name);
+			dlclose(handle);
+			goto fail;
+		}
+	}
+
+	lib->handle = handle;
+	return 0;
+
+fail:
+	lib->failed = true;
+	return -ENOTSUP;
+}
+
+int kmod_dl_library_open(const struct kmod_ctx *ctx,
+						struct kmod_dl_library *lib)
+{
+	int err;
+
+	pthread_mutex_lock(&lib->lock);
+	err = dl_library_open_locked(ctx, lib);
+	pthread_mutex_unlock(&lib->lock);
+
+	return err;
+}
+
 #ifdef ENABLE_XZ
+static typeof(lzma_stream_decoder) *sym_lzma_stream_decoder;
+static typeof(lzma_code) *sym_lzma_code;
+static typeof(lzma_end) *sym_lzma_end;
+
+static const struct kmod_dl_symbol xz_symbols[] = {
+	{ "lzma_stream_decoder", (void **) &sym_lzma_stream_decoder },
+	{ "lzma_code", (void **) &sym_lzma_code },
+	{ "lzma_end", (void **) &sym_lzma_end },
+	{ }
+};
+
+static struct kmod_dl_library xz_library = {
+	.soname = "liblzma.so.5",
+	.needed_to = "decompress modules",
+	.symbols = xz_symbols,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 static void xz_uncompress_belch(struct kmod_file *file, lzma_ret ret)
 {
 	switch (ret) {
@@ -109,7 +193,7 @@ static int xz_uncompress(lzma_stream *strm, struct kmod_file *file)
 			if (rdret == 0)
 				action = LZMA_FINISH;
 		}
-		ret = lzma_code(strm, action);
+		ret = sym_lzma_code(strm, action);
 		if (strm->avail_out == 0 || ret != LZMA_OK) {
 			size_t write_size = BUFSIZ - strm->avail_out;
 			char *tmp = realloc(p, total + write_size);
@@ -146,7 +230,11 @@ static int load_xz(struct kmod_file *file)
 	lzma_ret lzret;
 	int ret;
 
-	lzret = lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
+	ret = kmod_dl_library_open(file->ctx, &xz_library);
+	if (ret < 0)
+		return ret;
+
+	lzret = sym_lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED);
 	if (lzret == LZMA_MEM_ERROR) {
 		ERR(file->ctx, "xz: %s\n", strerror(ENOMEM));
 		return -ENOMEM;
@@ -155,7 +243,7 @@ static int load_xz(struct kmod_file *file)
 		return -EINVAL;
 	}
 	ret = xz_uncompress(&strm, file);
-	lzma_end(&strm);
+	sym_lzma_end(&strm);
 	return ret;
 }
 
@@ -170,6 +258,26 @@ static const char magic_xz[] = {0xfd, '7', 'z', 'X', 'Z', 0};
 #endif
 
 #ifdef ENABLE_ZLIB
+static typeof(gzdopen) *sym_gzdopen;
+static typeof(gzread) *sym_gzread;
+static typeof(gzerror) *sym_gzerror;
+static typeof(gzclose) *sym_gzclose;
+
+static const struct kmod_dl_symbol zlib_symbols[] = {
+	{ "gzdopen", (void **) &sym_gzdopen },
+	{ "gzread", (void **) &sym_gzread },
+	{ "gzerror", (void **) &sym_gzerror },
+	{ "gzclose", (void **) &sym_gzclose },
+	{ }
+};
+
+static struct kmod_dl_library zlib_library = {
+	.soname = "libz.so.1",
+	.needed_to = "decompress modules",
+	.symbols = zlib_symbols,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
 #define READ_STEP (4 * 1024 * 1024)
 static int load_zlib(struct kmod_file *file)
 {
@@ -177,8 +285,12 @@ static int load_zlib(struct kmod_file *file)
 	off_t did = 0, total = 0;
 	_cleanup_free_ unsigned char *p = NULL;
 
+	err = kmod_dl_library_open(file->ctx, &zlib_library);
+	if (err < 0)
+		return err;
+
 	errno = 0;
-	file->gzf = gzdopen(file->fd, "rb");
+	file->gzf = sym_gzdopen(file->fd, "rb");
 	if (file->gzf == NULL)
 		return -errno;
 	file->fd = -1; /* now owned by gzf due gzdopen() */
@@ -196,12 +308,12 @@ static int load_zlib(struct kmod_file *file)
 			p = tmp;
 		}
 
-		r = gzread(file->gzf, p + did, total - did);
+		r = sym_gzread(file->gzf, p + did, total - did);
 		if (r == 0)
 			break;
 		else if (r < 0) {
 			int gzerr;
-			const char *gz_errmsg = gzerror(file->gzf, &gzerr);
+			const char *gz_errmsg = sym_gzerror(file->gzf, &gzerr);
 
 			ERR(file->ctx, "gzip: %s\n", gz_errmsg);
 
@@ -218,7 +330,7 @@ static int load_zlib(struct kmod_file *file)
 	return 0;
 
 error:
-	gzclose(file->gzf);
+	sym_gzclose(file->gzf);
 	return err;
 }
 
@@ -227,7 +339,7 @@ static void unload_zlib(struct kmod_file *file)
 	if (file->gzf == NULL)
 		return;
 	free(file->memory);
-	gzclose(file->gzf); /* closes file->fd */
+	sym_gzclose(file->gzf); /* closes file->fd */
 }
 
 static const char magic_zlib[] = {0x1f, 0x8b};
@@ -281,23 +393,22 @@ struct kmod_elf *kmod_file_get_elf(struct kmod_file *file)
 	return file->elf;
 }
 
-struct kmod_file *kmod_file_open(const struct kmod_ctx *ctx,
-						const char *filename)
+/* takes ownership of @fd, even on failure */
+static struct kmod_file *kmod_file_open_fd(const struct kmod_ctx *ctx, int fd)
 {
 	struct kmod_file *file = calloc(1, sizeof(struct kmod_file));
 	const struct comp_type *itr;
 	size_t magic_size_max = 0;
 	int err;
 
-	if (file == NULL)
+	if (file == NULL) {
+		close(fd);
+		errno = ENOMEM;
 		return NULL;
-
-	file->fd = open(filename, O_RDONLY|O_CLOEXEC);
-	if (file->fd < 0) {
-		err = -errno;
-		goto error;
 	}
 
+	file->fd = fd;
+
 	for (itr = comp_types; itr->ops.load != NULL; itr++) {
 		if (magic_size_max < itr->magic_size)
 			magic_size_max = itr->magic_size;
@@ -333,8 +444,8 @@ struct kmod_file *kmod_file_open(const struct kmod_ctx *ctx,
 	if (file->ops == NULL)
 		file->ops = &reg_ops;
 
-	err = file->ops->load(file);
 	file->ctx = ctx;
+	err = file->ops->load(file);
 error:
 	if (err < 0) {
 		if (file->fd >= 0)
@@ -347,6 +458,111 @@ error:
 	return file;
 }
 
+static void unload_archive(struct kmod_file *file)
+{
+	kmod_archive_unref(file->archive);
+}
+
+static const struct file_ops archive_ops = {
+	NULL, unload_archive
+};
+
+/* a copy of a compressed module, for the decompressors that read an fd */
+static int memfd_from(const char *name, const void *mem, size_t size)
+{
+	const char *p = mem;
+	int fd;
+
+	fd = memfd_create(name, MFD_CLOEXEC);
+	if (fd < 0)
+		return -errno;
+
+	while (size > 0) {
+		ssize_t r = write(fd, p, size);
+
+		if (r < 0) {
+			int err = -errno;
+
+			if (errno == EINTR)
+				continue;
+			close(fd);
+			return err;
+		}
+
+		p += r;
+		size -= r;
+	}
+
+	lseek(fd, 0, SEEK_SET);
+	return fd;
+}
+
+/*
+ * Uncompressed modules in the archive are used right from its mapping and
+ * go to init_module(). Compressed ones are copied to a memfd and decompressed
+ * from there like any other file.
+ */
+static struct kmod_file *kmod_file_open_archive(const struct kmod_ctx *ctx,
+						struct kmod_archive *archive,
+						const void *mem, size_t size)
+{
+	const struct comp_type *itr;
+	struct kmod_file *file;
+	int fd;
+
+	for (itr = comp_types; itr->ops.load != NULL; itr++) {
+		if (size >= itr->magic_size &&
+		    memcmp(mem, itr->magic_bytes, itr->magic_size) == 0)
+			break;
+	}
+
+	if (itr->ops.load != NULL) {
+		fd = memfd_from("kmod-archive", mem, size);
+		if (fd < 0) {
+			errno = -fd;
+			return NULL;
+		}
+
+		return kmod_file_open_fd(ctx, fd);
+	}
+
+	file = calloc(1, sizeof(struct kmod_file));
+	if (file == NULL)
+		return NULL;
+
+	file->fd = -1;
+	file->direct = false;
+	file->memory = (void *) mem;
+	file->size = size;
+	file->ops = &archive_ops;
+	file->ctx = ctx;
+	file->archive = kmod_archive_ref(archive);
+
+	return file;
+}
+
+struct kmod_file *kmod_file_open(const struct kmod_ctx *ctx,
+						const char *filename)
+{
+	struct kmod_archive *archive = kmod_get_archive(ctx);
+	int fd;
+
+	if (archive != NULL) {
+		const void *mem;
+		size_t size;
+
+		mem = kmod_archive_find_module(archive, filename, &size);
+		if (mem != NULL)
+			return kmod_file_open_archive(ctx, archive, mem, size);
+	}
+
+	fd = open(filename, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	return kmod_file_open_fd(ctx, fd);
+}
+
 void *kmod_file_get_contents(const struct kmod_file *file)
 {
 	return file->memory;
@@ -0,0 +1,619 @@
+/*
+ * libkmod - interface to kernel module operations
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <shared/array.h>
+#include <shared/hash.h>
+#include <shared/util.h>
+
+#include "libkmod.h"
+#include "libkmod-internal.h"
+
+/**
+ * SECTION:libkmod-holders
+ * @short_description: graph of loaded modules and their holders
+ *
+ * The holder graph tells which loaded modules hold (i.e. use symbols from)
+ * which other loaded modules. It's built from a single read of
+ * /proc/modules, instead of one /sys/module/<name>/holders walk per module,
+ * and can be queried for the direct or transitive holders of a module and
+ * for an order in which modules can be removed.
+ */
+
+/**
+ * kmod_holder_graph:
+ *
+ * Opaque object representing the holder relations of all the modules loaded
+ * at the time it was created.
+ */
+struct kmod_holder_graph {
+	struct kmod_ctx *ctx;
+	struct hash *index;
+	char **names;
+	unsigned int n_modules;
+
+	/*
+	 * Adjacency arrays: the holders of module i are
+	 * holders[holders_start[i]] .. holders[holders_start[i + 1] - 1] and
+	 * the modules it holds are likewise in uses[].
+	 */
+	unsigned int *holders_start;
+	unsigned int *holders;
+	unsigned int *uses_start;
+	unsigned int *uses;
+
+	int refcount;
+};
+
+static int holder_graph_find(const struct kmod_holder_graph *graph,
+							const char *name)
+{
+	uintptr_t v = (uintptr_t) hash_find(graph->index, name);
+
+	return v == 0 ? -ENOENT : (int) (v - 1);
+}
+
+static int holder_graph_find_n(const struct kmod_holder_graph *graph,
+						const char *name, size_t len)
+{
+	char buf[PATH_MAX];
+
+	if (len >= sizeof(buf))
+		return -ENAMETOOLONG;
+
+	memcpy(buf, name, len);
+	buf[len] = '\0';
+
+	return holder_graph_find(graph, buf);
+}
+
+/*
+ * Iterate the "used by" column of /proc/modules: "-" if there's none,
+ * otherwise a list of "name," possibly with "[permanent]," or "[unsafe],"
+ * entries that are not modules.
+ */
+static const char *usedby_next(const char *p, size_t *len)
+{
+	for (;;) {
+		p += strspn(p, ",");
+		if (*p == '\0')
+			return NULL;
+
+		*len = strcspn(p, ",");
+		if (p[0] != '[' && !(p[0] == '-' && *len == 1))
+			return p;
+
+		p += *len;
+	}
+}
+
+static int holder_graph_read(struct kmod_holder_graph *graph,
+					struct array *usedby)
+{
+	struct kmod_ctx *ctx = graph->ctx;
+	struct array names;
+	char line[4096];
+	FILE *fp;
+	int err = 0;
+
+	fp = fopen("/proc/modules", "re");
+	if (fp == NULL) {
+		err = -errno;
+		ERR(ctx, "could not open /proc/modules: %m\n");
+		return err;
+	}
+
+	array_init(&names, 64);
+
+	/* eg. "bluetooth 173424 1 btusb, Live 0xffffffffa0040000" */
+	while (fgets(line, sizeof(line), fp)) {
+		size_t len = strlen(line);
+		char *saveptr, *name, *users;
+
+		name = strtok_r(line, " \t", &saveptr);
+		strtok_r(NULL, " \t", &saveptr);
+		strtok_r(NULL, " \t", &saveptr);
+		users = strtok_r(NULL, " \t\n", &saveptr);
+
+		if (line[len - 1] != '\n') {
+			ERR(ctx, "line too long in /proc/modules\n");
+			err = -EINVAL;
+			goto fail;
+		}
+
+		if (name == NULL || users == NULL)
+			continue;
+
+		name = strdup(name);
+		users = strdup(users);
+		if (name == NULL || users == NULL) {
+			free(name);
+			free(users);
+			err = -ENOMEM;
+			goto fail;
+		}
+
+		if (array_append(&names, name) < 0) {
+			free(name);
+			free(users);
+			err = -ENOMEM;
+			goto fail;
+		}
+
+		if (array_append(usedby, users) < 0) {
+			free(users);
+			err = -ENOMEM;
+			goto fail;
+		}
+
+		err = hash_add_unique(graph->index, name,
+					(void *) (uintptr_t) names.count);
+		if (err < 0)
+			goto fail;
+	}
+
+	fclose(fp);
+
+	graph->names = (char **) names.array;
+	graph->n_modules = names.count;
+	return 0;
+
+fail:
+	fclose(fp);
+	while (names.count > 0) {
+		free(names.array[names.count - 1]);
+		array_pop(&names);
+	}
+	array_free_array(&names);
+	return err;
+}
+
+static int holder_graph_build_edges(struct kmod_holder_graph *graph,
+					const struct array *usedby)
+{
+	unsigned int n = graph->n_modules;
+	unsigned int n_edges = 0;
+	unsigned int *pos;
+	unsigned int i;
+
+	graph->holders_start = calloc(n + 1, sizeof(unsigned int));
+	graph->uses_start = calloc(n + 1, sizeof(unsigned int));
+	pos = calloc(n + 1, sizeof(unsigned int));
+	if (graph->holders_start == NULL || graph->uses_start == NULL
+								|| pos == NULL)
+		goto oom;
+
+	/* count edges in each direction */
+	for (i = 0; i < n; i++) {
+		const char *p = usedby->array[i];
+		size_t len;
+
+		while ((p = usedby_next(p, &len)) != NULL) {
+			int h = holder_graph_find_n(graph, p, len);
+
+			p += len;
+			if (h < 0)
+				continue;
+
+			graph->holders_start[i + 1]++;
+			graph->uses_start[h + 1]++;
+			n_edges++;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		graph->holders_start[i + 1] += graph->holders_start[i];
+		graph->uses_start[i + 1] += graph->uses_start[i];
+	}
+
+	graph->holders = malloc(sizeof(unsigned int) * (n_edges + 1));
+	graph->uses = malloc(sizeof(unsigned int) * (n_edges + 1));
+	if (graph->holders == NULL || graph->uses == NULL)
+		goto oom;
+
+	memcpy(pos, graph->uses_start, sizeof(unsigned int) * (n + 1));
+
+	for (i = 0; i < n; i++) {
+		const char *p = usedby->array[i];
+		unsigned int k = graph->holders_start[i];
+		size_t len;
+
+		while ((p = usedby_next(p, &len)) != NULL) {
+			int h = holder_graph_find_n(graph, p, len);
+
+			p += len;
+			if (h < 0)
+				continue;
+
+			graph->holders[k++] = h;
+			graph->uses[pos[h]++] = i;
+		}
+	}
+
+	free(pos);
+	return 0;
+
+oom:
+	free(pos);
+	return -ENOMEM;
+}
+
+static void holder_graph_free(struct kmod_holder_graph *graph)
+{
+	unsigned int i;
+
+	for (i = 0; i < graph->n_modules; i++)
+		free(graph->names[i]);
+	free(graph->names);
+	free(graph->holders_start);
+	free(graph->holders);
+	free(graph->uses_start);
+	free(graph->uses);
+	hash_free(graph->index);
+	free(graph);
+}
+
+/**
+ * kmod_holder_graph_new:
+ * @ctx: kmod library context
+ * @graph: where to save the created graph. Use kmod_holder_graph_unref() to
+ *         release it.
+ *
+ * Create the holder graph of the modules currently loaded in kernel, reading
+ * /proc/modules once. The graph is a snapshot: it's not updated when modules
+ * are loaded or removed afterwards.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_holder_graph_new(struct kmod_ctx *ctx,
+					struct kmod_holder_graph **graph)
+{
+	struct kmod_holder_graph *g;
+	struct array usedby;
+	unsigned int i;
+	int err;
+
+	if (ctx == NULL || graph == NULL)
+		return -ENOENT;
+
+	g = calloc(1, sizeof(struct kmod_holder_graph));
+	if (g == NULL)
+		return -ENOMEM;
+
+	g->ctx = ctx;
+	g->index = hash_new(256, NULL);
+	if (g->index == NULL) {
+		free(g);
+		return -ENOMEM;
+	}
+
+	array_init(&usedby, 64);
+
+	err = holder_graph_read(g, &usedby);
+	if (err >= 0)
+		err = holder_graph_build_edges(g, &usedby);
+
+	for (i = 0; i < usedby.count; i++)
+		free(usedby.array[i]);
+	array_free_array(&usedby);
+
+	if (err < 0) {
+		holder_graph_free(g);
+		return err;
+	}
+
+	g->ctx = kmod_ref(ctx);
+	g->refcount = 1;
+	*graph = g;
+
+	DBG(ctx, "holder graph %p with %u modules\n", g, g->n_modules);
+
+	return 0;
+}
+
+/**
+ * kmod_holder_graph_ref:
+ * @graph: holder graph
+ *
+ * Take a reference of the holder graph.
+ *
+ * Returns: the passed graph with its refcount incremented.
+ */
+KMOD_EXPORT struct kmod_holder_graph *kmod_holder_graph_ref(
+					struct kmod_holder_graph *graph)
+{
+	if (graph == NULL)
+		return NULL;
+
+	graph->refcount++;
+	return graph;
+}
+
+/**
+ * kmod_holder_graph_unref:
+ * @graph: holder graph
+ *
+ * Drop a reference of the holder graph. If the refcount reaches zero, its
+ * resources are released.
+ *
+ * Returns: NULL if @graph was freed, otherwise @graph itself.
+ */
+KMOD_EXPORT struct kmod_holder_graph *kmod_holder_graph_unref(
+					struct kmod_holder_graph *graph)
+{
+	struct kmod_ctx *ctx;
+
+	if (graph == NULL)
+		return NULL;
+
+	if (--graph->refcount > 0)
+		return graph;
+
+	ctx = graph->ctx;
+	DBG(ctx, "kmod_holder_graph %p released\n", graph);
+	holder_graph_free(graph);
+	kmod_unref(ctx);
+	return NULL;
+}
+
+static int holder_graph_append(const struct kmod_holder_graph *graph,
+					unsigned int i, struct kmod_list **list)
+{
+	struct kmod_module *mod;
+	struct kmod_list *l;
+	int err;
+
+	err = kmod_module_new_from_name(graph->ctx, graph->names[i], &mod);
+	if (err < 0)
+		return err;
+
+	l = kmod_list_append(*list, mod);
+	if (l == NULL) {
+		kmod_module_unref(mod);
+		return -ENOMEM;
+	}
+
+	*list = l;
+	return 0;
+}
+
+/*
+ * Mark @root and everything that transitively holds it in @mark, returning
+ * the marked modules in BFS order in @queue.
+ */
+static unsigned int holder_graph_closure(const struct kmod_holder_graph *graph,
+					unsigned int root, uint8_t *mark,
+					unsigned int *queue)
+{
+	unsigned int head = 0, tail = 0;
+
+	mark[root] = 1;
+	queue[tail++] = root;
+
+	while (head < tail) {
+		unsigned int v = queue[head++];
+		unsigned int k;
+
+		for (k = graph->holders_start[v];
+				k < graph->holders_start[v + 1]; k++) {
+			unsigned int h = graph->holders[k];
+
+			if (mark[h])
+				continue;
+
+			mark[h] = 1;
+			queue[tail++] = h;
+		}
+	}
+
+	return tail;
+}
+
+/**
+ * kmod_holder_graph_get_holders:
+ * @graph: holder graph
+ * @mod: kmod module
+ * @flags: KMOD_HOLDER_GRAPH_TRANSITIVE to also get the holders of the
+ *         holders, recursively
+ * @list: where to save the list of holders
+ *
+ * Get the modules holding @mod, like kmod_module_get_holders() but without
+ * touching /sys. With KMOD_HOLDER_GRAPH_TRANSITIVE, nearer holders come
+ * first. @list is set to NULL if @mod is not held by any module.
+ *
+ * The returned @list must be released by calling kmod_module_unref_list().
+ *
+ * Returns: 0 on success, -ENOENT if @mod was not loaded when @graph was
+ * created or < 0 on other errors.
+ */
+KMOD_EXPORT int kmod_holder_graph_get_holders(
+					const struct kmod_holder_graph *graph,
+					const struct kmod_module *mod,
+					unsigned int flags,
+					struct kmod_list **list)
+{
+	struct kmod_list *l = NULL;
+	unsigned int *queue = NULL;
+	uint8_t *mark = NULL;
+	int i, err = 0;
+
+	if (graph == NULL || mod == NULL || list == NULL)
+		return -ENOENT;
+
+	i = holder_graph_find(graph, kmod_module_get_name(mod));
+	if (i < 0)
+		return i;
+
+	if (!(flags & KMOD_HOLDER_GRAPH_TRANSITIVE)) {
+		unsigned int k;
+
+		for (k = graph->holders_start[i];
+				k < graph->holders_start[i + 1]; k++) {
+			err = holder_graph_append(graph, graph->holders[k], &l);
+			if (err < 0)
+				goto fail;
+		}
+	} else {
+		unsigned int k, n;
+
+		mark = calloc(graph->n_modules, sizeof(uint8_t));
+		queue = malloc(sizeof(unsigned int) * graph->n_modules);
+		if (mark == NULL || queue == NULL) {
+			err = -ENOMEM;
+			goto fail;
+		}
+
+		n = holder_graph_closure(graph, i, mark, queue);
+
+		/* queue[0] is mod itself */
+		for (k = 1; k < n; k++) {
+			err = holder_graph_append(graph, queue[k], &l);
+			if (err < 0)
+				goto fail;
+		}
+	}
+
+	free(mark);
+	free(queue);
+	*list = l;
+	return 0;
+
+fail:
+	free(mark);
+	free(queue);
+	kmod_module_unref_list(l);
+	return err;
+}
+
+/**
+ * kmod_holder_graph_get_unload_order:
+ * @graph: holder graph
+ * @mod: kmod module or NULL
+ * @list: where to save the list of modules
+ *
+ * Get @mod and all the modules transitively holding it, sorted so each
+ * module comes before the modules it holds: removing them in the order of
+ * @list never fails because a module is still in use by another one in the
+ * list. If @mod is NULL, all the loaded modules are returned.
+ *
+ * The returned @list must be released by calling kmod_module_unref_list().
+ *
+ * Returns: 0 on success, -ENOENT if @mod was not loaded when @graph was
+ * created, -ELOOP if the holders form a cycle or < 0 on other errors.
+ */
+KMOD_EXPORT int kmod_holder_graph_get_unload_order(
+					const struct kmod_holder_graph *graph,
+					const struct kmod_module *mod,
+					struct kmod_list **list)
+{
+	struct kmod_list *l = NULL;
+	unsigned int n = graph != NULL ? graph->n_modules : 0;
+	unsigned int *queue = NULL, *indegree = NULL;
+	unsigned int head = 0, tail = 0, n_set, v;
+	uint8_t *mark = NULL;
+	int err = 0;
+
+	if (graph == NULL || list == NULL)
+		return -ENOENT;
+
+	mark = calloc(n, sizeof(uint8_t));
+	queue = malloc(sizeof(unsigned int) * (n + 1));
+	indegree = calloc(n, sizeof(unsigned int));
+	if ((n > 0 && mark == NULL) || queue == NULL
+					|| (n > 0 && indegree == NULL)) {
+		err = -ENOMEM;
+		goto finish;
+	}
+
+	if (mod != NULL) {
+		int i = holder_graph_find(graph, kmod_module_get_name(mod));
+
+		if (i < 0) {
+			err = i;
+			goto finish;
+		}
+
+		n_set = holder_graph_closure(graph, i, mark, queue);
+	} else {
+		if (n > 0)
+			memset(mark, 1, n);
+		n_set = n;
+	}
+
+	/* Kahn's algorithm: a module is ready once no holder is left */
+	for (v = 0; v < n; v++) {
+		unsigned int k;
+
+		if (!mark[v])
+			continue;
+
+		for (k = graph->holders_start[v];
+				k < graph->holders_start[v + 1]; k++) {
+			if (mark[graph->holders[k]])
+				indegree[v]++;
+		}
+	}
+
+	for (v = 0; v < n; v++) {
+		if (mark[v] && indegree[v] == 0)
+			queue[tail++] = v;
+	}
+
+	while (head < tail) {
+		unsigned int k;
+
+		v = queue[head++];
+
+		err = holder_graph_append(graph, v, &l);
+		if (err < 0)
+			goto finish;
+
+		for (k = graph->uses_start[v]; k < graph->uses_start[v + 1];
+									k++) {
+			unsigned int u = graph->uses[k];
+
+			if (mark[u] && --indegree[u] == 0)
+				queue[tail++] = u;
+		}
+	}
+
+	if (tail != n_set) {
+		ERR(graph->ctx, "cycle in the holders of loaded modules\n");
+		err = -ELOOP;
+	}
+
+finish:
+	free(mark);
+	free(queue);
+	free(indegree);
+
+	if (err < 0) {
+		kmod_module_unref_list(l);
+		return err;
+	}
+
+	*list = l;
+	return 0;
+}
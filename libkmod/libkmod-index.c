@@ -26,7 +26,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <shared/crc32c.h>
 #include <shared/macro.h>
+#include <shared/phash.h>
 #include <shared/strbuf.h>
 #include <shared/util.h>
 
@@ -47,8 +49,10 @@
  */
 #define INDEX_MAGIC 0xB007F457
 #define INDEX_VERSION_MAJOR 0x0002
-#define INDEX_VERSION_MINOR 0x0001
+#define INDEX_VERSION_MINOR 0x0003
 #define INDEX_VERSION ((INDEX_VERSION_MAJOR<<16)|INDEX_VERSION_MINOR)
+#define INDEX_TRAILER_MAGIC 0xB007C5C5
+#define INDEX_MAX_DEPTH 4096
 
 /* The index file maps keys to values. Both keys and values are ASCII strings.
  * Each key can have multiple values. Values are sorted by an integer priority.
@@ -82,6 +86,44 @@
  *  (node_offset & INDEX_NODE_FLAGS) indicates which fields are present.
  *  Empty prefixes are omitted, leaf nodes omit the three child-related fields.
  *
+ *  Nodes are written in post-order, so children are always at lower offsets
+ *  than their parent.
+ *
+ *  Since version 2.2 the file ends with a trailer:
+ *
+ *  uint32_t node_count;
+ *  uint32_t value_count;
+ *  uint32_t crc; // CRC32C of all the bytes before the trailer
+ *  uint32_t magic = INDEX_TRAILER_MAGIC;
+ *
+ *  The mmap reader validates such a file once when opening it and then
+ *  follows offsets without any check. Older files and files that fail
+ *  validation are read with bounds checks on every node.
+ *
+ *  Since version 2.3 the trailer is preceded by
+ *
+ *  uint32_t hash_offset; // 0 if there's no hash table
+ *
+ *  Indexes only looked up by exact key, and many times per open
+ *  (modules.dep and modules.builtin), have a minimal perfect hash table of
+ *  all the keys with values after the nodes, so such lookups take a single
+ *  probe:
+ *
+ *  uint32_t n_keys;
+ *  uint32_t n_buckets;
+ *  uint32_t seeds[n_buckets];
+ *  struct {
+ *      uint32_t fingerprint;
+ *      uint32_t entry_offset;
+ *  } slots[n_keys];
+ *  struct {
+ *      uint32_t values_offset; // the values of the key's node
+ *      char key[];
+ *  } entries[n_keys];
+ *
+ *  See shared/phash.h for how a key is mapped to its slot. Keys in these
+ *  indexes never have wildcards, so the table also answers wildcard searches.
+ *
  *  This could be optimised further by adding a sparse child format
  *  (indicated using a new flag).
  *
@@ -615,6 +657,28 @@ struct index_mm {
 	void *mm;
 	uint32_t root_offset;
 	size_t size;
+	bool mapped; /* mm is ours to unmap */
+	bool checked; /* bounds-check every node: file was not validated */
+
+	/* hash table, only set if the file was validated */
+	uint32_t hash_keys;
+	uint32_t hash_buckets;
+	const uint8_t *hash_seeds;
+	const uint8_t *hash_slots;
+	const uint8_t *hash_values_end; /* end of the nodes */
+};
+
+struct index_mm_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t root_offset;
+};
+
+struct index_mm_trailer {
+	uint32_t node_count;
+	uint32_t value_count;
+	uint32_t crc;
+	uint32_t magic;
 };
 
 struct index_mm_value {
@@ -665,6 +729,113 @@ static inline char *read_chars_mm(void **p, unsigned *rlen)
 	return addr;
 }
 
+struct index_mm_node_shape {
+	const uint8_t *children;
+	unsigned int child_count;
+	uint32_t value_count;
+};
+
+/*
+ * Check that the node at @offset lies entirely inside the mapped file, i.e.
+ * that index_mm_read_node() can parse it without any further check. Children
+ * must be at lower offsets, which also makes any walk terminate. If @shape is
+ * given, it's filled with where the children are and how many values the
+ * node has.
+ */
+/* Find where the values at @p end, NULL if they go beyond @end */
+static const uint8_t *index_mm_values_end(const uint8_t *p, const uint8_t *end,
+						uint32_t *value_count)
+{
+	void *q = (void *) p;
+	uint32_t i;
+
+	if (end - p < 4)
+		return NULL;
+
+	*value_count = read_long_mm(&q);
+	p = q;
+
+	for (i = 0; i < *value_count; i++) {
+		const uint8_t *nul;
+
+		if (end - p < 5)
+			return NULL;
+
+		nul = memchr(p + 4, '\0', end - p - 4);
+		if (nul == NULL)
+			return NULL;
+		p = nul + 1;
+	}
+
+	return p;
+}
+
+static bool index_mm_node_is_valid(const struct index_mm *idx, uint32_t offset,
+				   struct index_mm_node_shape *shape)
+{
+	const uint8_t *p, *end = (const uint8_t *) idx->mm + idx->size;
+	uint32_t off = offset & INDEX_NODE_MASK;
+	const uint8_t *children = NULL;
+	unsigned int child_count = 0;
+	uint32_t value_count = 0;
+
+	/* a node without flags (empty index) takes no space at all */
+	if (off < sizeof(struct index_mm_header) || off > idx->size)
+		return false;
+
+	p = (const uint8_t *) idx->mm + off;
+
+	if (offset & INDEX_NODE_PREFIX) {
+		const uint8_t *nul = memchr(p, '\0', end - p);
+
+		if (nul == NULL)
+			return false;
+		p = nul + 1;
+	}
+
+	if (offset & INDEX_NODE_CHILDS) {
+		unsigned int first, last, i;
+
+		if (end - p < 2)
+			return false;
+
+		first = p[0];
+		last = p[1];
+		p += 2;
+
+		if (first > last || last >= INDEX_CHILDMAX)
+			return false;
+
+		child_count = last - first + 1;
+		if ((size_t) (end - p) < child_count * sizeof(uint32_t))
+			return false;
+
+		children = p;
+		for (i = 0; i < child_count; i++) {
+			void *q = (void *) p;
+			uint32_t child = read_long_mm(&q) & INDEX_NODE_MASK;
+
+			if (child >= off)
+				return false;
+			p = q;
+		}
+	}
+
+	if (offset & INDEX_NODE_VALUES) {
+		p = index_mm_values_end(p, end, &value_count);
+		if (p == NULL)
+			return false;
+	}
+
+	if (shape != NULL) {
+		shape->children = children;
+		shape->child_count = child_count;
+		shape->value_count = value_count;
+	}
+
+	return true;
+}
+
 static struct index_mm_node *index_mm_read_node(struct index_mm *idx,
 							uint32_t offset) {
 	void *p = idx->mm;
@@ -677,6 +848,12 @@ static struct index_mm_node *index_mm_read_node(struct index_mm *idx,
 	if ((offset & INDEX_NODE_MASK) == 0)
 		return NULL;
 
+	if (idx->checked && !index_mm_node_is_valid(idx, offset, NULL)) {
+		DBG(idx->ctx, "invalid index node at offset %u\n",
+						offset & INDEX_NODE_MASK);
+		return NULL;
+	}
+
 	p = (char *)p + (offset & INDEX_NODE_MASK);
 
 	if (offset & INDEX_NODE_PREFIX) {
@@ -739,45 +916,184 @@ static void index_mm_free_node(struct index_mm_node *node)
 	free(node);
 }
 
-struct index_mm *index_mm_open(struct kmod_ctx *ctx, const char *filename,
-						unsigned long long *stamp)
+static int index_mm_count_nodes(struct index_mm *idx, uint32_t offset,
+				unsigned int depth, uint32_t *node_count,
+				uint32_t *value_count)
 {
-	int fd;
-	struct stat st;
-	struct index_mm *idx;
-	struct {
-		uint32_t magic;
-		uint32_t version;
-		uint32_t root_offset;
-	} hdr;
-	void *p;
+	struct index_mm_node_shape shape;
+	unsigned int i;
+	int err = 0;
 
-	DBG(ctx, "file=%s\n", filename);
+	if ((offset & INDEX_NODE_MASK) == 0)
+		return 0;
 
-	idx = malloc(sizeof(*idx));
-	if (idx == NULL) {
-		ERR(ctx, "malloc: %m\n");
-		return NULL;
+	/* no real key is that long: don't let a crafted file eat the stack */
+	if (depth > INDEX_MAX_DEPTH)
+		return -EINVAL;
+
+	if (!index_mm_node_is_valid(idx, offset, &shape))
+		return -EINVAL;
+
+	/* nodes are never shared: bounds the walk on crafted files */
+	if (++(*node_count) > idx->size)
+		return -EINVAL;
+	*value_count += shape.value_count;
+
+	for (i = 0; i < shape.child_count && err == 0; i++) {
+		void *p = (void *) (shape.children + i * sizeof(uint32_t));
+
+		err = index_mm_count_nodes(idx, read_long_mm(&p), depth + 1,
+						node_count, value_count);
 	}
 
-	if ((fd = open(filename, O_RDONLY|O_CLOEXEC)) < 0) {
-		DBG(ctx, "open(%s, O_RDONLY|O_CLOEXEC): %m\n", filename);
-		goto fail_open;
+	return err;
+}
+
+/*
+ * Check that the hash table at @offset, ending at @end, only points to keys
+ * inside it and into the nodes, which end at @offset. The values themselves
+ * were already walked with the nodes: the ones of a key are only checked
+ * when it's looked up, instead of walking all of them again here.
+ */
+static bool index_mm_hash_validate(struct index_mm *idx, uint32_t offset,
+								size_t end)
+{
+	const uint8_t *mm = idx->mm;
+	uint32_t n_keys, n_buckets, i;
+	uint64_t entries;
+	void *p;
+
+	if (offset < sizeof(struct index_mm_header)
+			|| end - offset < 2 * sizeof(uint32_t))
+		return false;
+
+	p = (void *) (mm + offset);
+	n_keys = read_long_mm(&p);
+	n_buckets = read_long_mm(&p);
+	if (n_keys == 0 || n_buckets == 0)
+		return false;
+
+	entries = offset + 2 * sizeof(uint32_t)
+			+ (uint64_t) n_buckets * sizeof(uint32_t)
+			+ (uint64_t) n_keys * 2 * sizeof(uint32_t);
+	if (entries > end)
+		return false;
+
+	idx->hash_seeds = p;
+	idx->hash_slots = idx->hash_seeds + n_buckets * sizeof(uint32_t);
+
+	for (i = 0; i < n_keys; i++) {
+		uint32_t entry, values;
+		void *q = (void *) (idx->hash_slots + i * 2 * sizeof(uint32_t));
+
+		read_long_mm(&q);
+		entry = read_long_mm(&q);
+		if (entry < entries || entry >= end
+				|| end - entry < sizeof(uint32_t) + 1)
+			return false;
+
+		q = (void *) (mm + entry);
+		values = read_long_mm(&q);
+		if (memchr(q, '\0', end - entry - sizeof(uint32_t)) == NULL)
+			return false;
+
+		if (values < sizeof(struct index_mm_header) || values >= offset)
+			return false;
 	}
 
-	if (fstat(fd, &st) < 0)
-		goto fail_nommap;
-	if ((size_t) st.st_size < sizeof(hdr))
-		goto fail_nommap;
+	idx->hash_keys = n_keys;
+	idx->hash_buckets = n_buckets;
+	idx->hash_values_end = mm + offset;
 
-	if ((idx->mm = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
-							== MAP_FAILED) {
-		ERR(ctx, "mmap(NULL, %"PRIu64", PROT_READ, %d, MAP_PRIVATE, 0): %m\n",
-							st.st_size, fd);
-		goto fail_nommap;
+	return true;
+}
+
+/*
+ * Validate the whole file against its trailer: checksum first, then a walk
+ * over all nodes with bounds checks, comparing the counts, and the hash
+ * table. After this succeeds, nodes can be read without any check.
+ */
+static bool index_mm_validate(struct index_mm *idx, uint32_t version,
+							const char *filename)
+{
+	struct index_mm_trailer trailer;
+	uint32_t node_count = 0, value_count = 0, hash_offset = 0;
+	size_t size = idx->size, nodes_end;
+	void *p;
+
+	if ((version & 0xffff) < 0x0002) {
+		DBG(idx->ctx, "%s: old format without checksum\n", filename);
+		return false;
 	}
 
-	p = idx->mm;
+	if (size < sizeof(struct index_mm_header) + sizeof(trailer))
+		goto corrupt;
+
+	p = (char *) idx->mm + size - sizeof(trailer);
+	trailer.node_count = read_long_mm(&p);
+	trailer.value_count = read_long_mm(&p);
+	trailer.crc = read_long_mm(&p);
+	trailer.magic = read_long_mm(&p);
+
+	if (trailer.magic != INDEX_TRAILER_MAGIC)
+		goto corrupt;
+
+	if (crc32c(0, idx->mm, size - sizeof(trailer)) != trailer.crc)
+		goto corrupt;
+
+	nodes_end = size - sizeof(trailer);
+	if ((version & 0xffff) >= 0x0003) {
+		if (nodes_end < sizeof(struct index_mm_header) + sizeof(uint32_t))
+			goto corrupt;
+
+		nodes_end -= sizeof(uint32_t);
+		p = (char *) idx->mm + nodes_end;
+		hash_offset = read_long_mm(&p);
+
+		if (hash_offset != 0) {
+			if (hash_offset > nodes_end
+					|| !index_mm_hash_validate(idx, hash_offset,
+								   nodes_end))
+				goto corrupt_hash;
+			nodes_end = hash_offset;
+		}
+	}
+
+	/* nodes can't reach into the hash table or the trailer */
+	idx->size = nodes_end;
+	if (index_mm_count_nodes(idx, idx->root_offset, 0,
+					&node_count, &value_count) < 0
+			|| node_count != trailer.node_count
+			|| value_count != trailer.value_count) {
+		idx->size = size;
+		goto corrupt_hash;
+	}
+	idx->size = size;
+
+	return true;
+
+corrupt_hash:
+	idx->hash_keys = 0;
+	idx->hash_slots = idx->hash_seeds = idx->hash_values_end = NULL;
+
+corrupt:
+	ERR(idx->ctx, "%s: index is corrupted, reading it with extra checks\n",
+								filename);
+	return false;
+}
+
+/* @mm is owned by the caller until this succeeds */
+static struct index_mm *index_mm_new(struct kmod_ctx *ctx, void *mm,
+					size_t size, const char *filename)
+{
+	struct index_mm *idx;
+	struct index_mm_header hdr;
+	void *p;
+
+	if (size < sizeof(hdr))
+		return NULL;
+
+	p = mm;
 	hdr.magic = read_long_mm(&p);
 	hdr.version = read_long_mm(&p);
 	hdr.root_offset = read_long_mm(&p);
@@ -785,39 +1101,102 @@ struct index_mm *index_mm_open(struct kmod_ctx *ctx, const char *filename,
 	if (hdr.magic != INDEX_MAGIC) {
 		ERR(ctx, "magic check fail: %x instead of %x\n", hdr.magic,
 								INDEX_MAGIC);
-		goto fail;
+		return NULL;
 	}
 
 	if (hdr.version >> 16 != INDEX_VERSION_MAJOR) {
 		ERR(ctx, "major version check fail: %u instead of %u\n",
 					hdr.version >> 16, INDEX_VERSION_MAJOR);
-		goto fail;
+		return NULL;
 	}
 
+	idx = malloc(sizeof(*idx));
+	if (idx == NULL) {
+		ERR(ctx, "malloc: %m\n");
+		return NULL;
+	}
+
+	idx->mm = mm;
+	idx->mapped = false;
 	idx->root_offset = hdr.root_offset;
-	idx->size = st.st_size;
+	idx->size = size;
 	idx->ctx = ctx;
-	close(fd);
+	idx->checked = true;
+	idx->hash_keys = idx->hash_buckets = 0;
+	idx->hash_seeds = idx->hash_slots = idx->hash_values_end = NULL;
 
-	*stamp = stat_mstamp(&st);
+	if (index_mm_validate(idx, hdr.version, filename))
+		idx->checked = false;
 
 	return idx;
+}
+
+struct index_mm *index_mm_open(struct kmod_ctx *ctx, const char *filename,
+						unsigned long long *stamp)
+{
+	int fd;
+	struct stat st;
+	struct index_mm *idx = NULL;
+	void *mm;
 
-fail:
-	munmap(idx->mm, st.st_size);
-fail_nommap:
+	DBG(ctx, "file=%s\n", filename);
+
+	if ((fd = open(filename, O_RDONLY|O_CLOEXEC)) < 0) {
+		DBG(ctx, "open(%s, O_RDONLY|O_CLOEXEC): %m\n", filename);
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0)
+		goto out;
+	if ((size_t) st.st_size < sizeof(struct index_mm_header))
+		goto out;
+
+	if ((mm = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+							== MAP_FAILED) {
+		ERR(ctx, "mmap(NULL, %"PRIu64", PROT_READ, %d, MAP_PRIVATE, 0): %m\n",
+							st.st_size, fd);
+		goto out;
+	}
+
+	idx = index_mm_new(ctx, mm, st.st_size, filename);
+	if (idx == NULL) {
+		munmap(mm, st.st_size);
+		goto out;
+	}
+
+	idx->mapped = true;
+	*stamp = stat_mstamp(&st);
+
+out:
 	close(fd);
-fail_open:
-	free(idx);
-	return NULL;
+	return idx;
+}
+
+/*
+ * Use an index that is already in memory, e.g. inside a module archive. @mm
+ * must stay valid until the index is closed.
+ */
+struct index_mm *index_mm_open_mem(struct kmod_ctx *ctx, const void *mm,
+					size_t size, const char *name)
+{
+	DBG(ctx, "%s: %zu bytes in memory\n", name, size);
+
+	return index_mm_new(ctx, (void *) mm, size, name);
 }
 
 void index_mm_close(struct index_mm *idx)
 {
-	munmap(idx->mm, idx->size);
+	if (idx->mapped)
+		munmap(idx->mm, idx->size);
 	free(idx);
 }
 
+/* whether the file passed validation, or is read with extra checks */
+bool index_mm_is_validated(const struct index_mm *idx)
+{
+	return !idx->checked;
+}
+
 static struct index_mm_node *index_mm_readroot(struct index_mm *idx)
 {
 	return index_mm_read_node(idx, idx->root_offset);
@@ -881,6 +1260,152 @@ void index_mm_dump(struct index_mm *idx, int fd, const char *prefix)
 	strbuf_release(&buf);
 }
 
+/*
+ * Iterate over all the keys starting with a prefix, in order, without
+ * reading any node before it's needed. The stack keeps the path from the
+ * node matching the prefix down to the current one.
+ */
+struct index_mm_iter_frame {
+	struct index_mm_node *node;
+	unsigned int next_value;
+	unsigned int next_ch;
+	unsigned int keylen; /* length of the key before this node */
+};
+
+struct index_mm_iter {
+	struct strbuf key;
+	struct index_mm_iter_frame *frames;
+	unsigned int n_frames;
+	unsigned int max_frames;
+};
+
+static bool index_mm_iter_push(struct index_mm_iter *iter,
+					struct index_mm_node *node,
+					unsigned int keylen)
+{
+	struct index_mm_iter_frame *f;
+
+	if (iter->n_frames == iter->max_frames) {
+		unsigned int max = iter->max_frames ? iter->max_frames * 2 : 16;
+
+		f = realloc(iter->frames, max * sizeof(*f));
+		if (f == NULL) {
+			index_mm_free_node(node);
+			return false;
+		}
+		iter->frames = f;
+		iter->max_frames = max;
+	}
+
+	f = &iter->frames[iter->n_frames++];
+	f->node = node;
+	f->next_value = 0;
+	f->next_ch = node->first;
+	f->keylen = keylen;
+	strbuf_pushchars(&iter->key, node->prefix);
+
+	return true;
+}
+
+struct index_mm_iter *index_mm_iter_new(struct index_mm *idx,
+							const char *prefix)
+{
+	struct index_mm_iter *iter;
+	struct index_mm_node *node;
+	int i = 0;
+
+	iter = calloc(1, sizeof(*iter));
+	if (iter == NULL)
+		return NULL;
+
+	strbuf_init(&iter->key);
+
+	/* walk down to the node where the prefix ends, if any */
+	node = index_mm_readroot(idx);
+	while (node != NULL) {
+		struct index_mm_node *child;
+		int j;
+
+		for (j = 0; node->prefix[j] && prefix[i + j]; j++) {
+			if (node->prefix[j] != prefix[i + j]) {
+				index_mm_free_node(node);
+				return iter;
+			}
+		}
+
+		i += j;
+
+		if (prefix[i] == '\0') {
+			if (!index_mm_iter_push(iter, node, iter->key.used)) {
+				index_mm_iter_free(iter);
+				return NULL;
+			}
+			return iter;
+		}
+
+		strbuf_pushchars(&iter->key, node->prefix);
+		strbuf_pushchar(&iter->key, prefix[i]);
+		child = index_mm_readchild(node, prefix[i]);
+		index_mm_free_node(node);
+		node = child;
+		i++;
+	}
+
+	return iter;
+}
+
+/*
+ * Move to the next value. @key is only valid until the next call, @value as
+ * long as the index stays open.
+ */
+bool index_mm_iter_next(struct index_mm_iter *iter, const char **key,
+				const char **value, unsigned int *priority)
+{
+	while (iter->n_frames > 0) {
+		struct index_mm_iter_frame *f = &iter->frames[iter->n_frames - 1];
+		struct index_mm_node *node = f->node;
+		struct index_mm_node *child = NULL;
+		unsigned int keylen;
+
+		if (f->next_value < node->values.len) {
+			const struct index_mm_value *v;
+
+			v = &node->values.values[f->next_value++];
+			*key = strbuf_str(&iter->key);
+			*value = v->value;
+			*priority = v->priority;
+			return true;
+		}
+
+		while (child == NULL && f->next_ch <= node->last)
+			child = index_mm_readchild(node, f->next_ch++);
+
+		if (child != NULL) {
+			keylen = iter->key.used;
+			strbuf_pushchar(&iter->key, f->next_ch - 1);
+			if (!index_mm_iter_push(iter, child, keylen))
+				return false;
+			continue;
+		}
+
+		strbuf_popchars(&iter->key, iter->key.used - f->keylen);
+		index_mm_free_node(node);
+		iter->n_frames--;
+	}
+
+	return false;
+}
+
+void index_mm_iter_free(struct index_mm_iter *iter)
+{
+	while (iter->n_frames > 0)
+		index_mm_free_node(iter->frames[--iter->n_frames].node);
+
+	free(iter->frames);
+	strbuf_release(&iter->key);
+	free(iter);
+}
+
 static char *index_mm_search_node(struct index_mm_node *node, const char *key,
 									int i)
 {
@@ -919,6 +1444,34 @@ static char *index_mm_search_node(struct index_mm_node *node, const char *key,
 	return NULL;
 }
 
+/* Find the values of @key in a single probe of the hash table */
+static void *index_mm_hash_find(const struct index_mm *idx, const char *key)
+{
+	uint64_t h = phash_key(key);
+	uint32_t seed, slot, values, value_count;
+	void *p;
+
+	p = (void *) (idx->hash_seeds
+		+ phash_bucket(h, idx->hash_buckets) * sizeof(uint32_t));
+	seed = read_long_mm(&p);
+
+	slot = phash_slot(h, seed, idx->hash_keys);
+	p = (void *) (idx->hash_slots + slot * 2 * sizeof(uint32_t));
+	if (read_long_mm(&p) != phash_fingerprint(h))
+		return NULL;
+
+	p = (char *) idx->mm + read_long_mm(&p);
+	values = read_long_mm(&p);
+	if (!streq(p, key))
+		return NULL;
+
+	p = (char *) idx->mm + values;
+	if (index_mm_values_end(p, idx->hash_values_end, &value_count) == NULL)
+		return NULL;
+
+	return p;
+}
+
 /*
  * Search the index for a key
  *
@@ -932,6 +1485,16 @@ char *index_mm_search(struct index_mm *idx, const char *key)
 	struct index_mm_node *root;
 	char *value;
 
+	if (idx->hash_slots != NULL) {
+		void *p = index_mm_hash_find(idx, key);
+
+		if (p == NULL || read_long_mm(&p) == 0)
+			return NULL;
+
+		read_long_mm(&p); /* priority */
+		return strdup(p);
+	}
+
 	root = index_mm_readroot(idx);
 	value = index_mm_search_node(root, key, 0);
 
@@ -1064,10 +1627,30 @@ static void index_mm_searchwild_node(struct index_mm_node *node,
  */
 struct index_value *index_mm_searchwild(struct index_mm *idx, const char *key)
 {
-	struct index_mm_node *root = index_mm_readroot(idx);
+	struct index_mm_node *root;
 	struct strbuf buf;
 	struct index_value *out = NULL;
 
+	if (idx->hash_slots != NULL) {
+		void *p = index_mm_hash_find(idx, key);
+		uint32_t i, value_count;
+
+		if (p == NULL)
+			return NULL;
+
+		value_count = read_long_mm(&p);
+		for (i = 0; i < value_count; i++) {
+			unsigned int priority = read_long_mm(&p);
+			unsigned int len;
+			const char *value = read_chars_mm(&p, &len);
+
+			add_value(&out, value, len, priority);
+		}
+
+		return out;
+	}
+
+	root = index_mm_readroot(idx);
 	strbuf_init(&buf);
 	index_mm_searchwild_node(root, &buf, key, 0, &out);
 	strbuf_release(&buf);
@@ -20,6 +20,7 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stdbool.h>
 
 struct index_value {
 	struct index_value *next;
@@ -42,7 +43,17 @@ void index_values_free(struct index_value *values);
 struct index_mm;
 struct index_mm *index_mm_open(struct kmod_ctx *ctx, const char *filename,
 						unsigned long long *stamp);
+struct index_mm *index_mm_open_mem(struct kmod_ctx *ctx, const void *mm,
+					size_t size, const char *name);
 void index_mm_close(struct index_mm *index);
+bool index_mm_is_validated(const struct index_mm *idx);
 char *index_mm_search(struct index_mm *idx, const char *key);
 struct index_value *index_mm_searchwild(struct index_mm *idx, const char *key);
 void index_mm_dump(struct index_mm *idx, int fd, const char *prefix);
+
+struct index_mm_iter;
+struct index_mm_iter *index_mm_iter_new(struct index_mm *idx,
+							const char *prefix);
+bool index_mm_iter_next(struct index_mm_iter *iter, const char **key,
+				const char **value, unsigned int *priority);
+void index_mm_iter_free(struct index_mm_iter *iter);
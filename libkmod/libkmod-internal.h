@@ -1,5 +1,6 @@
 #pragma once
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <syslog.h>
@@ -11,7 +12,7 @@
 #include "libkmod.h"
 
 static _always_inline_ _printf_format_(2, 3) void
-	kmod_log_null(struct kmod_ctx *ctx, const char *format, ...) {}
+	kmod_log_null(const struct kmod_ctx *ctx, const char *format, ...) {}
 
 #define kmod_log_cond(ctx, prio, arg...) \
 	do { \
@@ -102,6 +103,19 @@ void kmod_pool_add_module(struct kmod_ctx *ctx, struct kmod_module *mod, const c
 void kmod_pool_del_module(struct kmod_ctx *ctx, struct kmod_module *mod, const char *key) __attribute__((nonnull(1, 2, 3)));
 
 const struct kmod_config *kmod_get_config(const struct kmod_ctx *ctx) __attribute__((nonnull(1)));
+struct kmod_monitor *kmod_get_monitor(const struct kmod_ctx *ctx) __attribute__((nonnull(1)));
+void kmod_set_monitor(struct kmod_ctx *ctx, struct kmod_monitor *monitor) __attribute__((nonnull(1)));
+struct kmod_archive *kmod_get_archive(const struct kmod_ctx *ctx) __attribute__((nonnull(1)));
+bool kmod_index_is_validated(const struct kmod_ctx *ctx, enum kmod_index type) __attribute__((nonnull(1)));
+
+#define KMOD_FILE_CACHE_BUDGET (64 * 1024 * 1024)
+struct kmod_file_cache {
+	struct kmod_module *first; /* least recently used */
+	struct kmod_module *last;
+	size_t size;
+	size_t budget;
+};
+struct kmod_file_cache *kmod_get_file_cache(struct kmod_ctx *ctx) __attribute__((nonnull(1)));
 
 /* libkmod-config.c */
 struct kmod_config_path {
@@ -119,9 +133,27 @@ struct kmod_config {
 	struct kmod_list *softdeps;
 
 	struct kmod_list *paths;
+	struct kmod_list *files;
+	struct kmod_config_file *kcmdline;
+	char **config_paths;
+};
+
+/*
+ * Entries parsed from a single configuration file. They are shared by
+ * reference between the configs built by kmod_config_reload(), so a file
+ * whose stamp didn't change is not parsed again.
+ */
+struct kmod_config_file {
+	struct kmod_config entries;
+	unsigned long long stamp;
+	int refcount;
+	char path[];
 };
 
 int kmod_config_new(struct kmod_ctx *ctx, struct kmod_config **config, const char * const *config_paths) __attribute__((nonnull(1, 2,3)));
+char **kmod_config_paths_dup(const char * const *config_paths) _must_check_ __attribute__((nonnull(1)));
+int kmod_config_reload(const struct kmod_config *old, struct kmod_config **config) __attribute__((nonnull(1, 2)));
+bool kmod_config_changed_module(const struct kmod_config *old, const struct kmod_config *config, const char *name, const char *alias) __attribute__((nonnull(1, 2, 3)));
 void kmod_config_free(struct kmod_config *config) __attribute__((nonnull(1)));
 const char *kmod_blacklist_get_modname(const struct kmod_list *l) __attribute__((nonnull(1)));
 const char *kmod_alias_get_name(const struct kmod_list *l) __attribute__((nonnull(1)));
@@ -141,6 +173,8 @@ int kmod_module_new_from_alias(struct kmod_ctx *ctx, const char *alias, const ch
 int kmod_module_parse_depline(struct kmod_module *mod, char *line) __attribute__((nonnull(1, 2)));
 void kmod_module_set_install_commands(struct kmod_module *mod, const char *cmd) __attribute__((nonnull(1)));
 void kmod_module_set_remove_commands(struct kmod_module *mod, const char *cmd) __attribute__((nonnull(1)));
+void kmod_module_trim_files(struct kmod_ctx *ctx, size_t budget) __attribute__((nonnull(1)));
+void kmod_module_invalidate_config(struct kmod_module *mod, const struct kmod_config *old, const struct kmod_config *config) __attribute__((nonnull(1, 2, 3)));
 void kmod_module_set_visited(struct kmod_module *mod, bool visited) __attribute__((nonnull(1)));
 void kmod_module_set_builtin(struct kmod_module *mod, bool builtin) __attribute__((nonnull((1))));
 void kmod_module_set_required(struct kmod_module *mod, bool required) __attribute__((nonnull(1)));
@@ -155,21 +189,67 @@ bool kmod_file_get_direct(const struct kmod_file *file) _must_check_ __attribute
 int kmod_file_get_fd(const struct kmod_file *file) _must_check_ __attribute__((nonnull(1)));
 void kmod_file_unref(struct kmod_file *file) __attribute__((nonnull(1)));
 
+/* library opened with dlopen() the first time one of its symbols is needed */
+struct kmod_dl_symbol {
+	const char *name;
+	void **fn;
+};
+
+struct kmod_dl_library {
+	const char *soname;
+	const char *needed_to;
+	const struct kmod_dl_symbol *symbols;
+	pthread_mutex_t lock;
+	void *handle;
+	bool failed;
+};
+
+int kmod_dl_library_open(const struct kmod_ctx *ctx, struct kmod_dl_library *lib) _must_check_ __attribute__((nonnull(2)));
+
 /* libkmod-elf.c */
 struct kmod_elf;
-struct kmod_modversion {
+struct kmod_elf_symbol_iter {
+	const struct kmod_elf *elf;
+	enum kmod_symbol_iter_type type;
+	int err;
+	/* table being walked and size of its entries */
+	uint64_t off;
+	uint64_t end;
+	size_t entlen;
+	/* .strtab, for the names of .symtab entries */
+	uint64_t str_off;
+	uint64_t strtablen;
+	/* __versions, for the crcs of dependency symbols */
+	const void *versions;
+	uint64_t versionslen;
+	size_t crclen;
+	uint8_t *visited;
+	bool ksymtab_strings : 1;
+	bool unvisited : 1;
+	bool handle_register_symbols : 1;
+	/* current entry */
+	const char *symbol;
+	size_t len;
 	uint64_t crc;
 	enum kmod_symbol_bind bind;
-	char *symbol;
 };
 
 struct kmod_elf *kmod_elf_new(const void *memory, off_t size) _must_check_ __attribute__((nonnull(1)));
 void kmod_elf_unref(struct kmod_elf *elf) __attribute__((nonnull(1)));
 const void *kmod_elf_get_memory(const struct kmod_elf *elf) _must_check_ __attribute__((nonnull(1)));
 int kmod_elf_get_strings(const struct kmod_elf *elf, const char *section, char ***array) _must_check_ __attribute__((nonnull(1,2,3)));
-int kmod_elf_get_modversions(const struct kmod_elf *elf, struct kmod_modversion **array) _must_check_ __attribute__((nonnull(1,2)));
-int kmod_elf_get_symbols(const struct kmod_elf *elf, struct kmod_modversion **array) _must_check_ __attribute__((nonnull(1,2)));
-int kmod_elf_get_dependency_symbols(const struct kmod_elf *elf, struct kmod_modversion **array) _must_check_ __attribute__((nonnull(1,2)));
+int kmod_elf_symbol_iter_init(struct kmod_elf_symbol_iter *iter, const struct kmod_elf *elf, enum kmod_symbol_iter_type type) _must_check_ __attribute__((nonnull(1,2)));
+bool kmod_elf_symbol_iter_next(struct kmod_elf_symbol_iter *iter) __attribute__((nonnull(1)));
+void kmod_elf_symbol_iter_release(struct kmod_elf_symbol_iter *iter) __attribute__((nonnull(1)));
+struct kmod_elf_defined_symbol {
+	const char *name;
+	const char *section;
+	uint16_t shndx;
+	uint64_t value; /* offset in section */
+	uint64_t size;
+	uint64_t section_size;
+};
+int kmod_elf_foreach_defined_symbol(const struct kmod_elf *elf, int (*cb)(const struct kmod_elf_defined_symbol *sym, void *data), void *data) __attribute__((nonnull(1, 2)));
 int kmod_elf_strip_section(struct kmod_elf *elf, const char *section) _must_check_ __attribute__((nonnull(1,2)));
 int kmod_elf_strip_vermagic(struct kmod_elf *elf) _must_check_ __attribute__((nonnull(1)));
 
@@ -179,6 +259,46 @@ int kmod_elf_strip_vermagic(struct kmod_elf *elf) _must_check_ __attribute__((no
  */
 int kmod_elf_get_section(const struct kmod_elf *elf, const char *section, const void **buf, uint64_t *buf_size) _must_check_ __attribute__((nonnull(1,2,3,4)));
 
+/* libkmod-symvers.c */
+struct kmod_symver;
+const struct kmod_symver *kmod_symvers_find(const struct kmod_symvers *symvers, const char *symbol) __attribute__((nonnull(1, 2)));
+uint64_t kmod_symver_get_crc(const struct kmod_symver *sv) __attribute__((nonnull(1)));
+const char *kmod_symver_get_owner(const struct kmod_symver *sv) __attribute__((nonnull(1)));
+void kmod_symvers_foreach(const struct kmod_symvers *symvers, void (*cb)(const char *symbol, const struct kmod_symver *sv, void *data), void *data) __attribute__((nonnull(1, 2)));
+
+/*
+ * libkmod-archive.c
+ *
+ * Module archive, as written by "kmod archive": the header, the table of
+ * modules, the table of indexes and then names and contents, 8-byte aligned.
+ * Integers are big endian, like in the indexes. Each table is sorted by name,
+ * module names being their path in modules.dep.
+ */
+#define KMOD_ARCHIVE_MAGIC 0x4b415243 /* "KARC" */
+#define KMOD_ARCHIVE_VERSION 1
+#define KMOD_ARCHIVE_ALIGN 8
+
+struct kmod_archive_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t n_modules;
+	uint32_t n_indexes;
+};
+
+struct kmod_archive_entry {
+	uint32_t name; /* offset of a NUL-terminated string */
+	uint32_t size;
+	uint64_t offset;
+};
+
+struct kmod_archive;
+struct index_mm;
+int kmod_archive_open(struct kmod_ctx *ctx, const char *filename, struct kmod_archive **archive) _must_check_ __attribute__((nonnull(1, 2, 3)));
+struct kmod_archive *kmod_archive_ref(struct kmod_archive *archive) __attribute__((nonnull(1)));
+void kmod_archive_unref(struct kmod_archive *archive);
+const void *kmod_archive_find_module(const struct kmod_archive *archive, const char *path, size_t *size) __attribute__((nonnull(1, 2, 3)));
+struct index_mm *kmod_archive_open_index(struct kmod_archive *archive, const char *name) __attribute__((nonnull(1, 2)));
+
 /* libkmod-signature.c */
 struct kmod_signature_info {
 	const char *signer;
@@ -188,5 +308,8 @@ struct kmod_signature_info {
 	const char *algo, *hash_algo, *id_type;
 	const char *sig;
 	size_t sig_len;
+	void (*free)(void *);
+	void *private;
 };
-bool kmod_module_signature_info(const struct kmod_file *file, struct kmod_signature_info *sig_info) _must_check_ __attribute__((nonnull(1, 2)));
+bool kmod_module_signature_info(const struct kmod_ctx *ctx, const struct kmod_file *file, struct kmod_signature_info *sig_info) _must_check_ __attribute__((nonnull(2, 3)));
+void kmod_module_signature_info_free(struct kmod_signature_info *sig_info) __attribute__((nonnull));
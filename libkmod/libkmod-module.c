@@ -21,6 +21,7 @@
 #include <ctype.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fnmatch.h>
 #include <inttypes.h>
 #include <limits.h>
@@ -34,11 +35,13 @@
 #include <sys/stat.h>
 #include <sys/syscall.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 #ifdef HAVE_LINUX_MODULE_H
 #include <linux/module.h>
 #endif
 
+#include <shared/array.h>
 #include <shared/util.h>
 
 #include "libkmod.h"
@@ -71,6 +74,11 @@ struct kmod_module {
 	const char *remove_commands;	/* owned by kmod_config */
 	char *alias; /* only set if this module was created from an alias */
 	struct kmod_file *file;
+	/* position of file in the ctx file cache, most recently used last */
+	struct kmod_module *file_prev;
+	struct kmod_module *file_next;
+	size_t file_size;
+	int file_pins; /* symbol iterators pointing into file */
 	int n_dep;
 	int refcount;
 	struct {
@@ -107,6 +115,119 @@ struct kmod_module {
 	bool required : 1;
 };
 
+/*
+ * Files of modules are kept open after they are first needed, since callers
+ * usually look at the same module more than once. They stay in a per-ctx
+ * LRU and the least recently used are closed when the cached bytes go over
+ * the ctx budget, so a long-lived ctx doesn't keep every decompressed module
+ * around.
+ */
+static void module_file_unlink(struct kmod_module *mod)
+{
+	struct kmod_file_cache *cache = kmod_get_file_cache(mod->ctx);
+
+	if (mod->file_prev != NULL)
+		mod->file_prev->file_next = mod->file_next;
+	else
+		cache->first = mod->file_next;
+
+	if (mod->file_next != NULL)
+		mod->file_next->file_prev = mod->file_prev;
+	else
+		cache->last = mod->file_prev;
+
+	mod->file_prev = mod->file_next = NULL;
+}
+
+static void module_file_link(struct kmod_module *mod)
+{
+	struct kmod_file_cache *cache = kmod_get_file_cache(mod->ctx);
+
+	mod->file_prev = cache->last;
+	mod->file_next = NULL;
+	if (cache->last != NULL)
+		cache->last->file_next = mod;
+	else
+		cache->first = mod;
+	cache->last = mod;
+}
+
+static void module_release_file(struct kmod_module *mod)
+{
+	struct kmod_file_cache *cache = kmod_get_file_cache(mod->ctx);
+
+	if (mod->file == NULL || mod->file_pins > 0)
+		return;
+
+	module_file_unlink(mod);
+	cache->size -= mod->file_size;
+	kmod_file_unref(mod->file);
+	mod->file = NULL;
+	mod->file_size = 0;
+}
+
+/* close the least recently used files until the cache fits in @budget */
+static void module_trim_files(struct kmod_ctx *ctx, size_t budget,
+						const struct kmod_module *keep)
+{
+	struct kmod_file_cache *cache = kmod_get_file_cache(ctx);
+	struct kmod_module *mod = cache->first;
+
+	while (mod != NULL && cache->size > budget) {
+		struct kmod_module *next = mod->file_next;
+
+		if (mod != keep) {
+			DBG(ctx, "closing %s to stay within the file cache budget\n",
+								mod->name);
+			module_release_file(mod);
+		}
+		mod = next;
+	}
+}
+
+void kmod_module_trim_files(struct kmod_ctx *ctx, size_t budget)
+{
+	module_trim_files(ctx, budget, NULL);
+}
+
+static void module_set_file(struct kmod_module *mod, struct kmod_file *file)
+{
+	struct kmod_file_cache *cache = kmod_get_file_cache(mod->ctx);
+
+	mod->file = file;
+	mod->file_size = kmod_file_get_size(file);
+	cache->size += mod->file_size;
+	module_file_link(mod);
+
+	if (cache->budget > 0)
+		module_trim_files(mod->ctx, cache->budget, mod);
+}
+
+static struct kmod_file *module_get_file(struct kmod_module *mod)
+{
+	struct kmod_file *file;
+	const char *path;
+
+	if (mod->file != NULL) {
+		module_file_unlink(mod);
+		module_file_link(mod);
+		return mod->file;
+	}
+
+	path = kmod_module_get_path(mod);
+	if (path == NULL) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	file = kmod_file_open(mod->ctx, path);
+	if (file == NULL)
+		return NULL;
+
+	module_set_file(mod, file);
+	return file;
+}
+
 static inline const char *path_join(const char *path, size_t prefixlen,
 							char buf[PATH_MAX])
 {
@@ -125,7 +246,15 @@ static inline const char *path_join(const char *path, size_t prefixlen,
 
 static inline bool module_is_inkernel(struct kmod_module *mod)
 {
-	int state = kmod_module_get_initstate(mod);
+	struct kmod_monitor *monitor = kmod_get_monitor(mod->ctx);
+	int state;
+
+	/* answer from memory if the loaded modules are being tracked */
+	if (monitor != NULL)
+		return kmod_module_is_builtin(mod)
+			|| kmod_monitor_is_loaded(monitor, mod->name);
+
+	state = kmod_module_get_initstate(mod);
 
 	if (state == KMOD_MODULE_LIVE ||
 			state == KMOD_MODULE_BUILTIN)
@@ -363,6 +492,16 @@ int kmod_module_new_from_alias(struct kmod_ctx *ctx, const char *alias,
 	return 0;
 }
 
+/* modules from a loaded archive don't need to exist on the filesystem */
+static bool module_in_archive(const struct kmod_ctx *ctx, const char *path)
+{
+	const struct kmod_archive *archive = kmod_get_archive(ctx);
+	size_t size;
+
+	return archive != NULL &&
+		kmod_archive_find_module(archive, path, &size) != NULL;
+}
+
 /**
  * kmod_module_new_from_path:
  * @ctx: kmod library context
@@ -405,7 +544,7 @@ KMOD_EXPORT int kmod_module_new_from_path(struct kmod_ctx *ctx,
 	}
 
 	err = stat(abspath, &st);
-	if (err < 0) {
+	if (err < 0 && !module_in_archive(ctx, abspath)) {
 		err = -errno;
 		DBG(ctx, "stat %s: %s\n", path, strerror(errno));
 		free(abspath);
@@ -469,9 +608,7 @@ KMOD_EXPORT struct kmod_module *kmod_module_unref(struct kmod_module *mod)
 
 	kmod_pool_del_module(mod->ctx, mod, mod->hashkey);
 	kmod_module_unref_list(mod->dep);
-
-	if (mod->file)
-		kmod_file_unref(mod->file);
+	module_release_file(mod);
 
 	kmod_unref(mod->ctx);
 	free(mod->options);
@@ -820,6 +957,7 @@ KMOD_EXPORT int kmod_module_insert_module(struct kmod_module *mod,
 	int err;
 	const void *mem;
 	off_t size;
+	struct kmod_file *file;
 	struct kmod_elf *elf;
 	const char *path;
 	const char *args = options ? options : "";
@@ -833,15 +971,13 @@ KMOD_EXPORT int kmod_module_insert_module(struct kmod_module *mod,
 		return -ENOENT;
 	}
 
-	if (!mod->file) {
-		mod->file = kmod_file_open(mod->ctx, path);
-		if (mod->file == NULL) {
-			err = -errno;
-			return err;
-		}
+	file = module_get_file(mod);
+	if (file == NULL) {
+		err = -errno;
+		return err;
 	}
 
-	if (kmod_file_get_direct(mod->file)) {
+	if (kmod_file_get_direct(file)) {
 		unsigned int kernel_flags = 0;
 
 		if (flags & KMOD_INSERT_FORCE_VERMAGIC)
@@ -849,13 +985,13 @@ KMOD_EXPORT int kmod_module_insert_module(struct kmod_module *mod,
 		if (flags & KMOD_INSERT_FORCE_MODVERSION)
 			kernel_flags |= MODULE_INIT_IGNORE_MODVERSIONS;
 
-		err = finit_module(kmod_file_get_fd(mod->file), args, kernel_flags);
+		err = finit_module(kmod_file_get_fd(file), args, kernel_flags);
 		if (err == 0 || errno != ENOSYS)
 			goto init_finished;
 	}
 
 	if (flags & (KMOD_INSERT_FORCE_VERMAGIC | KMOD_INSERT_FORCE_MODVERSION)) {
-		elf = kmod_file_get_elf(mod->file);
+		elf = kmod_file_get_elf(file);
 		if (elf == NULL) {
 			err = -errno;
 			return err;
@@ -875,17 +1011,21 @@ KMOD_EXPORT int kmod_module_insert_module(struct kmod_module *mod,
 
 		mem = kmod_elf_get_memory(elf);
 	} else {
-		mem = kmod_file_get_contents(mod->file);
+		mem = kmod_file_get_contents(file);
 	}
-	size = kmod_file_get_size(mod->file);
+	size = kmod_file_get_size(file);
 
 	err = init_module(mem, size, args);
 init_finished:
 	if (err < 0) {
 		err = -errno;
 		INFO(mod->ctx, "Failed to insert module '%s': %m\n", path);
+		return err;
 	}
-	return err;
+
+	/* the kernel has its own copy now */
+	module_release_file(mod);
+	return 0;
 }
 
 static bool module_is_blacklisted(struct kmod_module *mod)
@@ -1192,6 +1332,142 @@ static int kmod_module_get_probe_list(struct kmod_module *mod,
 	return err;
 }
 
+/*
+ * Directories searched by the kernel's firmware loader, in its order, after
+ * the one given with firmware_class.path. Release ones are followed by the
+ * running kernel's release.
+ */
+static const struct {
+	const char *dir;
+	bool release;
+} firmware_dirs[] = {
+	{ "/lib/firmware/updates", true },
+	{ "/lib/firmware/updates", false },
+	{ "/lib/firmware", true },
+	{ "/lib/firmware", false },
+};
+
+/* each one is tried in every directory before the next, as the kernel does */
+static const char *const firmware_exts[] = { "", ".zst", ".xz" };
+
+static bool firmware_prefetch_file(struct kmod_ctx *ctx, const char *dir,
+					const char *release, const char *name,
+					const char *ext)
+{
+	char path[PATH_MAX];
+	int fd, len;
+
+	len = snprintf(path, sizeof(path), "%s%s%s/%s%s", dir,
+			release != NULL ? "/" : "", release ?: "", name, ext);
+	if (len < 0 || (size_t) len >= sizeof(path))
+		return false;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	/* only starts the reads, init_module() isn't delayed by them */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+
+	DBG(ctx, "prefetching firmware %s\n", path);
+	return true;
+}
+
+static bool firmware_prefetch(struct kmod_ctx *ctx, const char *custom,
+				const char *release, const char *name)
+{
+	size_t i, d;
+
+	for (i = 0; i < ARRAY_SIZE(firmware_exts); i++) {
+		const char *ext = firmware_exts[i];
+
+		if (custom[0] != '\0' &&
+		    firmware_prefetch_file(ctx, custom, NULL, name, ext))
+			return true;
+
+		for (d = 0; d < ARRAY_SIZE(firmware_dirs); d++) {
+			if (firmware_prefetch_file(ctx, firmware_dirs[d].dir,
+				firmware_dirs[d].release ? release : NULL,
+				name, ext))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+ * Drivers usually request their firmware while they initialize, so start
+ * reading the firmware of every module about to be inserted before inserting
+ * the first one: the reads are in flight while the dependencies are inserted.
+ */
+static void module_prefetch_firmware(struct kmod_ctx *ctx,
+					struct kmod_list *list, unsigned int flags)
+{
+	char custom[PATH_MAX] = "";
+	struct kmod_list *l;
+	struct utsname u;
+	int fd;
+
+	if (uname(&u) < 0)
+		return;
+
+	fd = open("/sys/module/firmware_class/parameters/path",
+							O_RDONLY|O_CLOEXEC);
+	if (fd >= 0) {
+		if (read_str_safe(fd, custom, sizeof(custom)) < 0)
+			custom[0] = '\0';
+		custom[strcspn(custom, "\n")] = '\0';
+		close(fd);
+	}
+
+	kmod_list_foreach(l, list) {
+		struct kmod_module *m = l->data;
+		struct kmod_file *file;
+		struct kmod_elf *elf;
+		char **strings;
+		int i, count;
+
+		if (!(flags & KMOD_PROBE_IGNORE_LOADED) && module_is_inkernel(m))
+			continue;
+
+		if (kmod_module_get_install_commands(m) != NULL && !m->ignorecmd)
+			continue;
+
+		/*
+		 * Only firmware= is needed, so look at the .modinfo strings
+		 * rather than building the whole info list with the signature.
+		 * The file stays open for the insertion that follows.
+		 */
+		file = module_get_file(m);
+		if (file == NULL)
+			continue;
+
+		elf = kmod_file_get_elf(file);
+		if (elf == NULL)
+			continue;
+
+		count = kmod_elf_get_strings(elf, ".modinfo", &strings);
+		if (count < 0)
+			continue;
+
+		for (i = 0; i < count; i++) {
+			const char *name;
+
+			if (!strstartswith(strings[i], "firmware="))
+				continue;
+
+			name = strings[i] + strlen("firmware=");
+			if (!firmware_prefetch(ctx, custom, u.release, name))
+				DBG(ctx, "firmware %s of %s not found\n",
+								name, m->name);
+		}
+
+		free(strings);
+	}
+}
+
 /**
  * kmod_module_probe_insert_module:
  * @mod: kmod module
@@ -1208,6 +1484,9 @@ static int kmod_module_get_probe_list(struct kmod_module *mod,
  * KMOD_PROBE_FAIL_ON_LOADED: if KMOD_PROBE_IGNORE_LOADED is not specified
  * and the module is already live in kernel, the function will fail if this
  * flag is specified;
+ * KMOD_PROBE_PREFETCH_FIRMWARE: before inserting anything, start reading
+ * the firmware files listed in the modinfo of the modules to be inserted, from
+ * the directories the kernel's firmware loader searches;
  * KMOD_PROBE_APPLY_BLACKLIST_ALL: probe will apply KMOD_FILTER_BLACKLIST
  * filter to this module and its dependencies. If any of the dependencies (or
  * the module) is blacklisted, the probe will fail, unless the blacklisted
@@ -1291,6 +1570,10 @@ KMOD_EXPORT int kmod_module_probe_insert_module(struct kmod_module *mod,
 		list = filtered;
 	}
 
+	if ((flags & KMOD_PROBE_PREFETCH_FIRMWARE) &&
+					!(flags & KMOD_PROBE_DRY_RUN))
+		module_prefetch_firmware(mod->ctx, list, flags);
+
 	cb.run_install = run_install;
 	cb.data = (void *) data;
 
@@ -1613,6 +1896,29 @@ void kmod_module_set_remove_commands(struct kmod_module *mod, const char *cmd)
 	mod->remove_commands = cmd;
 }
 
+/*
+ * Drop what was cached from the configuration if it may have changed when
+ * replacing @old with @config. Called before @old is freed since
+ * install/remove commands point inside it.
+ */
+void kmod_module_invalidate_config(struct kmod_module *mod,
+					const struct kmod_config *old,
+					const struct kmod_config *config)
+{
+	if (!kmod_config_changed_module(old, config, mod->name, mod->alias))
+		return;
+
+	DBG(mod->ctx, "configuration of %s changed\n", mod->name);
+
+	free(mod->options);
+	mod->options = NULL;
+	mod->install_commands = NULL;
+	mod->remove_commands = NULL;
+	mod->init.options = false;
+	mod->init.install_commands = false;
+	mod->init.remove_commands = false;
+}
+
 /**
  * SECTION:libkmod-loaded
  * @short_description: currently loaded modules
@@ -2131,126 +2437,569 @@ KMOD_EXPORT void kmod_module_section_free_list(struct kmod_list *list)
 	}
 }
 
-static struct kmod_elf *kmod_module_get_elf(const struct kmod_module *mod)
+struct kmod_module_parameter {
+	const char *modname;
+	const char *value;
+	const char *type;
+	const char *description;
+	char name[];
+};
+
+static size_t strsize(const char *s)
 {
-	if (mod->file == NULL) {
-		const char *path = kmod_module_get_path(mod);
+	return s == NULL ? 0 : strlen(s) + 1;
+}
 
-		if (path == NULL) {
-			errno = ENOENT;
-			return NULL;
-		}
+static const char *strpack(char **p, const char *s)
+{
+	size_t len;
+	char *ret;
 
-		((struct kmod_module *)mod)->file = kmod_file_open(mod->ctx,
-									path);
-		if (mod->file == NULL)
-			return NULL;
-	}
+	if (s == NULL)
+		return NULL;
 
-	return kmod_file_get_elf(mod->file);
-}
+	len = strlen(s) + 1;
+	ret = memcpy(*p, s, len);
+	*p += len;
 
-struct kmod_module_info {
-	char *key;
-	char value[];
-};
+	return ret;
+}
 
-static struct kmod_module_info *kmod_module_info_new(const char *key, size_t keylen, const char *value, size_t valuelen)
+/* Everything is kept in a single allocation */
+static struct kmod_module_parameter *kmod_module_parameter_new(
+			const char *modname, const char *name, size_t namelen,
+			const char *value, const char *type,
+			const char *description)
 {
-	struct kmod_module_info *info;
+	struct kmod_module_parameter *param;
+	char *p;
 
-	info = malloc(sizeof(struct kmod_module_info) + keylen + valuelen + 2);
-	if (info == NULL)
+	param = malloc(sizeof(*param) + namelen + 1 + strsize(modname) +
+			strsize(value) + strsize(type) + strsize(description));
+	if (param == NULL)
 		return NULL;
 
-	info->key = (char *)info + sizeof(struct kmod_module_info)
-		    + valuelen + 1;
-	memcpy(info->key, key, keylen);
-	info->key[keylen] = '\0';
-	memcpy(info->value, value, valuelen);
-	info->value[valuelen] = '\0';
-	return info;
+	memcpy(param->name, name, namelen);
+	param->name[namelen] = '\0';
+
+	p = param->name + namelen + 1;
+	param->modname = strpack(&p, modname);
+	param->value = strpack(&p, value);
+	param->type = strpack(&p, type);
+	param->description = strpack(&p, description);
+
+	return param;
 }
 
-static void kmod_module_info_free(struct kmod_module_info *info)
+/* Field of parameter @name in one of the "parm" or "parmtype" entries */
+static const char *modinfo_parameter_field(const struct kmod_list *info,
+			const char *key, const char *name, size_t namelen)
 {
-	free(info);
+	const struct kmod_list *l;
+
+	kmod_list_foreach(l, info) {
+		const char *value = kmod_module_info_get_value(l);
+
+		if (streq(kmod_module_info_get_key(l), key) &&
+		    strncmp(value, name, namelen) == 0 &&
+		    value[namelen] == ':')
+			return value + namelen + 1;
+	}
+
+	return NULL;
 }
 
-static struct kmod_list *kmod_module_info_append(struct kmod_list **list, const char *key, size_t keylen, const char *value, size_t valuelen)
+static bool parameters_contain(const struct array *params, size_t start,
+					const char *name, size_t namelen)
 {
-	struct kmod_module_info *info;
-	struct kmod_list *n;
+	size_t i;
 
-	info = kmod_module_info_new(key, keylen, value, valuelen);
-	if (info == NULL)
-		return NULL;
-	n = kmod_list_append(*list, info);
-	if (n != NULL)
-		*list = n;
-	else
-		kmod_module_info_free(info);
-	return n;
+	for (i = start; i < params->count; i++) {
+		const struct kmod_module_parameter *param = params->array[i];
+
+		if (strncmp(param->name, name, namelen) == 0 &&
+		    param->name[namelen] == '\0')
+			return true;
+	}
+
+	return false;
 }
 
-static char *kmod_module_hex_to_str(const char *hex, size_t len)
+static int parameter_cmp(const void *pa, const void *pb)
 {
-	char *str;
-	int i;
-	int j;
-	const size_t line_limit = 20;
-	size_t str_len;
+	const struct kmod_module_parameter *a = *(void * const *) pa;
+	const struct kmod_module_parameter *b = *(void * const *) pb;
 
-	str_len = len * 3; /* XX: or XX\0 */
-	str_len += ((str_len + line_limit - 1) / line_limit - 1) * 3; /* \n\t\t */
+	return strcmp(a->name, b->name);
+}
 
-	str = malloc(str_len);
-	if (str == NULL)
-		return NULL;
+/*
+ * Read the value of parameter @name in @buf, or return NULL if it can't be
+ * read: not all of them are readable by everyone.
+ */
+static const char *read_parameter(int dfd, const char *name, char *buf,
+								size_t bufsize)
+{
+	ssize_t r;
+	size_t len = 0;
+	int fd;
 
-	for (i = 0, j = 0; i < (int)len; i++) {
-		j += sprintf(str + j, "%02X", (unsigned char)hex[i]);
-		if (i < (int)len - 1) {
-			str[j++] = ':';
+	fd = openat(dfd, name, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
 
-			if ((i + 1) % line_limit == 0)
-				j += sprintf(str + j, "\n\t\t");
+	while (len < bufsize - 1) {
+		r = read(fd, buf + len, bufsize - 1 - len);
+		if (r == 0)
+			break;
+		if (r < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			close(fd);
+			return NULL;
 		}
+		len += r;
 	}
-	return str;
+
+	close(fd);
+
+	if (len > 0 && buf[len - 1] == '\n')
+		len--;
+	buf[len] = '\0';
+
+	return buf;
 }
 
-static struct kmod_list *kmod_module_info_append_hex(struct kmod_list **list,
-						     const char *key,
-						     size_t keylen,
-						     const char *value,
-						     size_t valuelen)
+static int module_get_parameters(const struct kmod_module *mod, int sysfd,
+					unsigned int flags, char *buf,
+					size_t bufsize, struct array *params)
 {
-	char *hex;
-	struct kmod_list *n;
+	struct kmod_list *info = NULL, *l;
+	size_t start = params->count;
+	char path[PATH_MAX];
+	struct dirent *dent;
+	DIR *d = NULL;
+	int dfd, err = 0;
 
-	if (valuelen > 0) {
-		/* Display as 01:12:DE:AD:BE:EF:... */
-		hex = kmod_module_hex_to_str(value, valuelen);
-		if (hex == NULL)
-			goto list_error;
-		n = kmod_module_info_append(list, key, keylen, hex, strlen(hex));
-		free(hex);
-		if (n == NULL)
-			goto list_error;
-	} else {
-		n = kmod_module_info_append(list, key, keylen, NULL, 0);
-		if (n == NULL)
-			goto list_error;
+	if (flags & KMOD_PARAMETERS_MODINFO)
+		kmod_module_get_info(mod, &info);
+
+	snprintf(path, sizeof(path), "%s/parameters", mod->name);
+	dfd = openat(sysfd, path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dfd >= 0)
+		d = fdopendir(dfd);
+	if (d == NULL) {
+		/* not loaded or without parameters in sysfs */
+		if (errno != ENOENT) {
+			err = -errno;
+			ERR(mod->ctx, "could not open '/sys/module/%s': %m\n",
+									path);
+		}
+		if (dfd >= 0)
+			close(dfd);
+		goto modinfo;
 	}
 
-	return n;
+	for (dent = readdir(d); dent != NULL; dent = readdir(d)) {
+		struct kmod_module_parameter *param;
+		size_t namelen = strlen(dent->d_name);
+		const char *value;
 
-list_error:
-	return NULL;
-}
+		if (dent->d_name[0] == '.')
+			continue;
 
-/**
+		value = read_parameter(dirfd(d), dent->d_name, buf, bufsize);
+		param = kmod_module_parameter_new(mod->name, dent->d_name,
+			namelen, value,
+			modinfo_parameter_field(info, "parmtype", dent->d_name,
+								namelen),
+			modinfo_parameter_field(info, "parm", dent->d_name,
+								namelen));
+		if (param == NULL || array_append(params, param) < 0) {
+			free(param);
+			err = -ENOMEM;
+			goto fail;
+		}
+	}
+
+modinfo:
+	/* the ones that are not exported in sysfs */
+	kmod_list_foreach(l, info) {
+		struct kmod_module_parameter *param;
+		const char *name, *type;
+		size_t namelen;
+
+		if (!streq(kmod_module_info_get_key(l), "parmtype"))
+			continue;
+
+		name = kmod_module_info_get_value(l);
+		type = strchr(name, ':');
+		if (type == NULL)
+			continue;
+		namelen = type - name;
+
+		if (parameters_contain(params, start, name, namelen))
+			continue;
+
+		param = kmod_module_parameter_new(mod->name, name, namelen,
+			NULL, type + 1,
+			modinfo_parameter_field(info, "parm", name, namelen));
+		if (param == NULL || array_append(params, param) < 0) {
+			free(param);
+			err = -ENOMEM;
+			goto fail;
+		}
+	}
+
+	qsort(params->array + start, params->count - start,
+				sizeof(params->array[0]), parameter_cmp);
+
+fail:
+	if (d != NULL)
+		closedir(d);
+	kmod_module_info_free_list(info);
+	return err;
+}
+
+/**
+ * kmod_module_get_parameters_list:
+ * @modules: list of kmod modules
+ * @flags: flags from enum kmod_parameters
+ * @list: where to save the list of parameters
+ *
+ * Get the parameters of all @modules, as exported by the Linux Kernel in
+ * /sys/module/<name>/parameters. /sys/module is opened only once and all
+ * values are read in the same buffer, so it's cheaper than calling
+ * kmod_module_get_parameters() for each module.
+ *
+ * With KMOD_PARAMETERS_MODINFO, the type and description of each parameter
+ * are taken from the module's modinfo and the parameters that are not in
+ * sysfs are listed too, without a value.
+ *
+ * The parameters of each module are sorted by name and come in the order
+ * of @modules. The structure contained in this list is internal to libkmod
+ * and its fields can be obtained by calling
+ * kmod_module_parameter_get_module_name(), kmod_module_parameter_get_name(),
+ * kmod_module_parameter_get_value(), kmod_module_parameter_get_type() and
+ * kmod_module_parameter_get_description().
+ *
+ * After use, free the @list by calling kmod_module_parameter_free_list().
+ *
+ * Returns: the number of parameters in @list on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_module_get_parameters_list(const struct kmod_list *modules,
+						unsigned int flags,
+						struct kmod_list **list)
+{
+	const struct kmod_list *l;
+	struct array params;
+	char buf[4096 + 1];
+	int sysfd, err = 0;
+	size_t i = 0;
+
+	if (modules == NULL || list == NULL || *list != NULL)
+		return -ENOENT;
+
+	sysfd = open("/sys/module", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (sysfd < 0)
+		return -errno;
+
+	array_init(&params, 16);
+
+	kmod_list_foreach(l, modules) {
+		err = module_get_parameters(l->data, sysfd, flags, buf,
+							sizeof(buf), &params);
+		if (err < 0)
+			goto fail;
+	}
+
+	for (i = 0; i < params.count; i++) {
+		struct kmod_list *n = kmod_list_append(*list, params.array[i]);
+
+		if (n == NULL) {
+			err = -ENOMEM;
+			goto fail;
+		}
+		*list = n;
+	}
+
+	err = params.count;
+	array_free_array(&params);
+	close(sysfd);
+
+	return err;
+
+fail:
+	/* entries already in the list are freed with it */
+	for (; i < params.count; i++)
+		free(params.array[i]);
+	array_free_array(&params);
+	kmod_module_parameter_free_list(*list);
+	*list = NULL;
+	close(sysfd);
+
+	return err;
+}
+
+/**
+ * kmod_module_get_parameters:
+ * @mod: kmod module
+ * @flags: flags from enum kmod_parameters
+ * @list: where to save the list of parameters
+ *
+ * Get the parameters of @mod. See kmod_module_get_parameters_list().
+ *
+ * After use, free the @list by calling kmod_module_parameter_free_list().
+ *
+ * Returns: the number of parameters in @list on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_module_get_parameters(const struct kmod_module *mod,
+						unsigned int flags,
+						struct kmod_list **list)
+{
+	struct kmod_list *modules;
+	int err;
+
+	if (mod == NULL)
+		return -ENOENT;
+
+	modules = kmod_list_append(NULL, mod);
+	if (modules == NULL)
+		return -ENOMEM;
+
+	err = kmod_module_get_parameters_list(modules, flags, list);
+	kmod_list_remove(modules);
+
+	return err;
+}
+
+/**
+ * kmod_module_parameter_get_module_name:
+ * @entry: a list entry representing a kmod module parameter
+ *
+ * Get the name of the module of a kmod module parameter.
+ *
+ * Returns: the module name on success or NULL on failure. The string is
+ * owned by the parameter, do not free it.
+ */
+KMOD_EXPORT const char *kmod_module_parameter_get_module_name(const struct kmod_list *entry)
+{
+	struct kmod_module_parameter *param;
+
+	if (entry == NULL)
+		return NULL;
+
+	param = entry->data;
+	return param->modname;
+}
+
+/**
+ * kmod_module_parameter_get_name:
+ * @entry: a list entry representing a kmod module parameter
+ *
+ * Get the name of a kmod module parameter.
+ *
+ * Returns: the name of this parameter on success or NULL on failure. The
+ * string is owned by the parameter, do not free it.
+ */
+KMOD_EXPORT const char *kmod_module_parameter_get_name(const struct kmod_list *entry)
+{
+	struct kmod_module_parameter *param;
+
+	if (entry == NULL)
+		return NULL;
+
+	param = entry->data;
+	return param->name;
+}
+
+/**
+ * kmod_module_parameter_get_value:
+ * @entry: a list entry representing a kmod module parameter
+ *
+ * Get the current value of a kmod module parameter, without the trailing
+ * newline.
+ *
+ * Returns: the value of this parameter or NULL if it could not be read or
+ * is not in sysfs. The string is owned by the parameter, do not free it.
+ */
+KMOD_EXPORT const char *kmod_module_parameter_get_value(const struct kmod_list *entry)
+{
+	struct kmod_module_parameter *param;
+
+	if (entry == NULL)
+		return NULL;
+
+	param = entry->data;
+	return param->value;
+}
+
+/**
+ * kmod_module_parameter_get_type:
+ * @entry: a list entry representing a kmod module parameter
+ *
+ * Get the type of a kmod module parameter, as in the "parmtype" modinfo.
+ *
+ * Returns: the type of this parameter or NULL if unknown. The string is
+ * owned by the parameter, do not free it.
+ */
+KMOD_EXPORT const char *kmod_module_parameter_get_type(const struct kmod_list *entry)
+{
+	struct kmod_module_parameter *param;
+
+	if (entry == NULL)
+		return NULL;
+
+	param = entry->data;
+	return param->type;
+}
+
+/**
+ * kmod_module_parameter_get_description:
+ * @entry: a list entry representing a kmod module parameter
+ *
+ * Get the description of a kmod module parameter, as in the "parm"
+ * modinfo.
+ *
+ * Returns: the description of this parameter or NULL if unknown. The
+ * string is owned by the parameter, do not free it.
+ */
+KMOD_EXPORT const char *kmod_module_parameter_get_description(const struct kmod_list *entry)
+{
+	struct kmod_module_parameter *param;
+
+	if (entry == NULL)
+		return NULL;
+
+	param = entry->data;
+	return param->description;
+}
+
+/**
+ * kmod_module_parameter_free_list:
+ * @list: kmod module parameter list
+ *
+ * Release the resources taken by @list
+ */
+KMOD_EXPORT void kmod_module_parameter_free_list(struct kmod_list *list)
+{
+	while (list) {
+		free(list->data);
+		list = kmod_list_remove(list);
+	}
+}
+
+static struct kmod_elf *kmod_module_get_elf(const struct kmod_module *mod)
+{
+	struct kmod_file *file = module_get_file((struct kmod_module *)mod);
+
+	if (file == NULL)
+		return NULL;
+
+	return kmod_file_get_elf(file);
+}
+
+struct kmod_module_info {
+	char *key;
+	char value[];
+};
+
+static struct kmod_module_info *kmod_module_info_new(const char *key, size_t keylen, const char *value, size_t valuelen)
+{
+	struct kmod_module_info *info;
+
+	info = malloc(sizeof(struct kmod_module_info) + keylen + valuelen + 2);
+	if (info == NULL)
+		return NULL;
+
+	info->key = (char *)info + sizeof(struct kmod_module_info)
+		    + valuelen + 1;
+	memcpy(info->key, key, keylen);
+	info->key[keylen] = '\0';
+	memcpy(info->value, value, valuelen);
+	info->value[valuelen] = '\0';
+	return info;
+}
+
+static void kmod_module_info_free(struct kmod_module_info *info)
+{
+	free(info);
+}
+
+static struct kmod_list *kmod_module_info_append(struct kmod_list **list, const char *key, size_t keylen, const char *value, size_t valuelen)
+{
+	struct kmod_module_info *info;
+	struct kmod_list *n;
+
+	info = kmod_module_info_new(key, keylen, value, valuelen);
+	if (info == NULL)
+		return NULL;
+	n = kmod_list_append(*list, info);
+	if (n != NULL)
+		*list = n;
+	else
+		kmod_module_info_free(info);
+	return n;
+}
+
+static char *kmod_module_hex_to_str(const char *hex, size_t len)
+{
+	char *str;
+	int i;
+	int j;
+	const size_t line_limit = 20;
+	size_t str_len;
+
+	str_len = len * 3; /* XX: or XX\0 */
+	str_len += ((str_len + line_limit - 1) / line_limit - 1) * 3; /* \n\t\t */
+
+	str = malloc(str_len);
+	if (str == NULL)
+		return NULL;
+
+	for (i = 0, j = 0; i < (int)len; i++) {
+		j += sprintf(str + j, "%02X", (unsigned char)hex[i]);
+		if (i < (int)len - 1) {
+			str[j++] = ':';
+
+			if ((i + 1) % line_limit == 0)
+				j += sprintf(str + j, "\n\t\t");
+		}
+	}
+	return str;
+}
+
+static struct kmod_list *kmod_module_info_append_hex(struct kmod_list **list,
+						     const char *key,
+						     size_t keylen,
+						     const char *value,
+						     size_t valuelen)
+{
+	char *hex;
+	struct kmod_list *n;
+
+	if (valuelen > 0) {
+		/* Display as 01:12:DE:AD:BE:EF:... */
+		hex = kmod_module_hex_to_str(value, valuelen);
+		if (hex == NULL)
+			goto list_error;
+		n = kmod_module_info_append(list, key, keylen, hex, strlen(hex));
+		free(hex);
+		if (n == NULL)
+			goto list_error;
+	} else {
+		n = kmod_module_info_append(list, key, keylen, NULL, 0);
+		if (n == NULL)
+			goto list_error;
+	}
+
+	return n;
+
+list_error:
+	return NULL;
+}
+
+/**
  * kmod_module_get_info:
  * @mod: kmod module
  * @list: where to return list of module information. Use
@@ -2310,19 +3059,19 @@ KMOD_EXPORT int kmod_module_get_info(const struct kmod_module *mod, struct kmod_
 			goto list_error;
 	}
 
-	if (kmod_module_signature_info(mod->file, &sig_info)) {
+	if (kmod_module_signature_info(mod->ctx, mod->file, &sig_info)) {
 		struct kmod_list *n;
 
 		n = kmod_module_info_append(list, "sig_id", strlen("sig_id"),
 				sig_info.id_type, strlen(sig_info.id_type));
 		if (n == NULL)
-			goto list_error;
+			goto sig_error;
 		count++;
 
 		n = kmod_module_info_append(list, "signer", strlen("signer"),
 				sig_info.signer, sig_info.signer_len);
 		if (n == NULL)
-			goto list_error;
+			goto sig_error;
 		count++;
 
 
@@ -2330,14 +3079,14 @@ KMOD_EXPORT int kmod_module_get_info(const struct kmod_module *mod, struct kmod_
 						sig_info.key_id,
 						sig_info.key_id_len);
 		if (n == NULL)
-			goto list_error;
+			goto sig_error;
 		count++;
 
 		n = kmod_module_info_append(list,
 				"sig_hashalgo", strlen("sig_hashalgo"),
 				sig_info.hash_algo, strlen(sig_info.hash_algo));
 		if (n == NULL)
-			goto list_error;
+			goto sig_error;
 		count++;
 
 		/*
@@ -2350,11 +3099,16 @@ KMOD_EXPORT int kmod_module_get_info(const struct kmod_module *mod, struct kmod_
 						sig_info.sig_len);
 
 		if (n == NULL)
-			goto list_error;
+			goto sig_error;
 		count++;
 
+		kmod_module_signature_info_free(&sig_info);
 	}
 	ret = count;
+	goto list_error;
+
+sig_error:
+	kmod_module_signature_info_free(&sig_info);
 
 list_error:
 	if (ret < 0) {
@@ -2459,9 +3213,9 @@ static void kmod_module_version_free(struct kmod_module_version *version)
  */
 KMOD_EXPORT int kmod_module_get_versions(const struct kmod_module *mod, struct kmod_list **list)
 {
+	struct kmod_elf_symbol_iter iter;
 	struct kmod_elf *elf;
-	struct kmod_modversion *versions;
-	int i, count, ret = 0;
+	int count = 0, ret;
 
 	if (mod == NULL || list == NULL)
 		return -ENOENT;
@@ -2472,37 +3226,39 @@ KMOD_EXPORT int kmod_module_get_versions(const struct kmod_module *mod, struct k
 	if (elf == NULL)
 		return -errno;
 
-	count = kmod_elf_get_modversions(elf, &versions);
-	if (count < 0)
-		return count;
+	ret = kmod_elf_symbol_iter_init(&iter, elf, KMOD_SYMBOL_ITER_VERSIONS);
+	if (ret < 0)
+		return ret;
 
-	for (i = 0; i < count; i++) {
+	while (kmod_elf_symbol_iter_next(&iter)) {
 		struct kmod_module_version *mv;
 		struct kmod_list *n;
 
-		mv = kmod_module_versions_new(versions[i].crc, versions[i].symbol);
+		mv = kmod_module_versions_new(iter.crc, iter.symbol);
 		if (mv == NULL) {
 			ret = -errno;
-			kmod_module_versions_free_list(*list);
-			*list = NULL;
 			goto list_error;
 		}
 
 		n = kmod_list_append(*list, mv);
-		if (n != NULL)
-			*list = n;
-		else {
+		if (n == NULL) {
 			kmod_module_version_free(mv);
-			kmod_module_versions_free_list(*list);
-			*list = NULL;
 			ret = -ENOMEM;
 			goto list_error;
 		}
+		*list = n;
+		count++;
 	}
-	ret = count;
+
+	ret = iter.err < 0 ? iter.err : count;
+	if (ret >= 0)
+		goto out;
 
 list_error:
-	free(versions);
+	kmod_module_versions_free_list(*list);
+	*list = NULL;
+out:
+	kmod_elf_symbol_iter_release(&iter);
 	return ret;
 }
 
@@ -2599,9 +3355,9 @@ static void kmod_module_symbol_free(struct kmod_module_symbol *symbol)
  */
 KMOD_EXPORT int kmod_module_get_symbols(const struct kmod_module *mod, struct kmod_list **list)
 {
+	struct kmod_elf_symbol_iter iter;
 	struct kmod_elf *elf;
-	struct kmod_modversion *symbols;
-	int i, count, ret = 0;
+	int count = 0, ret;
 
 	if (mod == NULL || list == NULL)
 		return -ENOENT;
@@ -2612,37 +3368,39 @@ KMOD_EXPORT int kmod_module_get_symbols(const struct kmod_module *mod, struct km
 	if (elf == NULL)
 		return -errno;
 
-	count = kmod_elf_get_symbols(elf, &symbols);
-	if (count < 0)
-		return count;
+	ret = kmod_elf_symbol_iter_init(&iter, elf, KMOD_SYMBOL_ITER_SYMBOLS);
+	if (ret < 0)
+		return ret;
 
-	for (i = 0; i < count; i++) {
+	while (kmod_elf_symbol_iter_next(&iter)) {
 		struct kmod_module_symbol *mv;
 		struct kmod_list *n;
 
-		mv = kmod_module_symbols_new(symbols[i].crc, symbols[i].symbol);
+		mv = kmod_module_symbols_new(iter.crc, iter.symbol);
 		if (mv == NULL) {
 			ret = -errno;
-			kmod_module_symbols_free_list(*list);
-			*list = NULL;
 			goto list_error;
 		}
 
 		n = kmod_list_append(*list, mv);
-		if (n != NULL)
-			*list = n;
-		else {
+		if (n == NULL) {
 			kmod_module_symbol_free(mv);
-			kmod_module_symbols_free_list(*list);
-			*list = NULL;
 			ret = -ENOMEM;
 			goto list_error;
 		}
+		*list = n;
+		count++;
 	}
-	ret = count;
+
+	ret = iter.err < 0 ? iter.err : count;
+	if (ret >= 0)
+		goto out;
 
 list_error:
-	free(symbols);
+	kmod_module_symbols_free_list(*list);
+	*list = NULL;
+out:
+	kmod_elf_symbol_iter_release(&iter);
 	return ret;
 }
 
@@ -2742,9 +3500,9 @@ static void kmod_module_dependency_symbol_free(struct kmod_module_dependency_sym
  */
 KMOD_EXPORT int kmod_module_get_dependency_symbols(const struct kmod_module *mod, struct kmod_list **list)
 {
+	struct kmod_elf_symbol_iter iter;
 	struct kmod_elf *elf;
-	struct kmod_modversion *symbols;
-	int i, count, ret = 0;
+	int count = 0, ret;
 
 	if (mod == NULL || list == NULL)
 		return -ENOENT;
@@ -2755,39 +3513,41 @@ KMOD_EXPORT int kmod_module_get_dependency_symbols(const struct kmod_module *mod
 	if (elf == NULL)
 		return -errno;
 
-	count = kmod_elf_get_dependency_symbols(elf, &symbols);
-	if (count < 0)
-		return count;
+	ret = kmod_elf_symbol_iter_init(&iter, elf,
+					KMOD_SYMBOL_ITER_DEPENDENCIES);
+	if (ret < 0)
+		return ret;
 
-	for (i = 0; i < count; i++) {
+	while (kmod_elf_symbol_iter_next(&iter)) {
 		struct kmod_module_dependency_symbol *mv;
 		struct kmod_list *n;
 
-		mv = kmod_module_dependency_symbols_new(symbols[i].crc,
-							symbols[i].bind,
-							symbols[i].symbol);
+		mv = kmod_module_dependency_symbols_new(iter.crc, iter.bind,
+							iter.symbol);
 		if (mv == NULL) {
 			ret = -errno;
-			kmod_module_dependency_symbols_free_list(*list);
-			*list = NULL;
 			goto list_error;
 		}
 
 		n = kmod_list_append(*list, mv);
-		if (n != NULL)
-			*list = n;
-		else {
+		if (n == NULL) {
 			kmod_module_dependency_symbol_free(mv);
-			kmod_module_dependency_symbols_free_list(*list);
-			*list = NULL;
 			ret = -ENOMEM;
 			goto list_error;
 		}
+		*list = n;
+		count++;
 	}
-	ret = count;
+
+	ret = iter.err < 0 ? iter.err : count;
+	if (ret >= 0)
+		goto out;
 
 list_error:
-	free(symbols);
+	kmod_module_dependency_symbols_free_list(*list);
+	*list = NULL;
+out:
+	kmod_elf_symbol_iter_release(&iter);
 	return ret;
 }
 
@@ -2863,3 +3623,400 @@ KMOD_EXPORT void kmod_module_dependency_symbols_free_list(struct kmod_list *list
 		list = kmod_list_remove(list);
 	}
 }
+
+/**
+ * kmod_symbol_iter:
+ *
+ * Opaque object to iterate over the symbols of a module without copying
+ * them out of the module's file.
+ */
+struct kmod_symbol_iter {
+	struct kmod_module *mod;
+	struct kmod_elf_symbol_iter elf;
+};
+
+/**
+ * kmod_symbol_iter_new:
+ * @mod: kmod module
+ * @type: symbols to visit: the entries of the "__versions" section
+ *        (KMOD_SYMBOL_ITER_VERSIONS), the exported symbols
+ *        (KMOD_SYMBOL_ITER_SYMBOLS) or the symbols the module needs from
+ *        others (KMOD_SYMBOL_ITER_DEPENDENCIES)
+ * @iter: where to save the created iterator. Use kmod_symbol_iter_free() to
+ *        release it.
+ *
+ * Create an iterator over the same entries kmod_module_get_versions(),
+ * kmod_module_get_symbols() or kmod_module_get_dependency_symbols() return,
+ * in the same order. Entries are read in place from the module's file,
+ * which is kept open until @iter is freed: nothing is allocated per entry,
+ * so this is the cheaper way for callers that look at each symbol once.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_symbol_iter_new(const struct kmod_module *mod,
+					enum kmod_symbol_iter_type type,
+					struct kmod_symbol_iter **iter)
+{
+	struct kmod_symbol_iter *it;
+	struct kmod_elf *elf;
+	int err;
+
+	if (mod == NULL || iter == NULL)
+		return -ENOENT;
+
+	elf = kmod_module_get_elf(mod);
+	if (elf == NULL)
+		return -errno;
+
+	it = malloc(sizeof(*it));
+	if (it == NULL)
+		return -ENOMEM;
+
+	err = kmod_elf_symbol_iter_init(&it->elf, elf, type);
+	if (err < 0) {
+		kmod_elf_symbol_iter_release(&it->elf);
+		free(it);
+		return err;
+	}
+
+	it->mod = kmod_module_ref((struct kmod_module *) mod);
+	it->mod->file_pins++;
+
+	*iter = it;
+	return 0;
+}
+
+/**
+ * kmod_symbol_iter_next:
+ * @iter: symbol iterator
+ *
+ * Move @iter to the next entry. It must be called once before getting the
+ * first entry.
+ *
+ * Returns: true if @iter points to a new entry, false if there are no more
+ * entries or the module is malformed.
+ */
+KMOD_EXPORT bool kmod_symbol_iter_next(struct kmod_symbol_iter *iter)
+{
+	if (iter == NULL)
+		return false;
+
+	return kmod_elf_symbol_iter_next(&iter->elf);
+}
+
+/**
+ * kmod_symbol_iter_get_symbol:
+ * @iter: symbol iterator
+ * @len: where to save the length of the symbol, or NULL
+ *
+ * Returns: the name of the current symbol. It points into the module's file
+ * and is valid until @iter is freed.
+ */
+KMOD_EXPORT const char *kmod_symbol_iter_get_symbol(const struct kmod_symbol_iter *iter,
+								size_t *len)
+{
+	if (iter == NULL)
+		return NULL;
+
+	if (len != NULL)
+		*len = iter->elf.len;
+
+	return iter->elf.symbol;
+}
+
+/**
+ * kmod_symbol_iter_get_crc:
+ * @iter: symbol iterator
+ *
+ * Returns: the crc of the current symbol.
+ */
+KMOD_EXPORT uint64_t kmod_symbol_iter_get_crc(const struct kmod_symbol_iter *iter)
+{
+	if (iter == NULL)
+		return 0;
+
+	return iter->elf.crc;
+}
+
+/**
+ * kmod_symbol_iter_get_bind:
+ * @iter: symbol iterator
+ *
+ * Returns: the bind of the current symbol, one of enum kmod_symbol_bind.
+ */
+KMOD_EXPORT int kmod_symbol_iter_get_bind(const struct kmod_symbol_iter *iter)
+{
+	if (iter == NULL)
+		return KMOD_SYMBOL_NONE;
+
+	return iter->elf.bind;
+}
+
+/**
+ * kmod_symbol_iter_free:
+ * @iter: symbol iterator
+ *
+ * Release the resources taken by @iter.
+ */
+KMOD_EXPORT void kmod_symbol_iter_free(struct kmod_symbol_iter *iter)
+{
+	if (iter == NULL)
+		return;
+
+	kmod_elf_symbol_iter_release(&iter->elf);
+	iter->mod->file_pins--;
+	kmod_module_unref(iter->mod);
+	free(iter);
+}
+
+struct kmod_module_symvers_mismatch {
+	enum kmod_symvers_mismatch type;
+	uint64_t crc;
+	uint64_t expected_crc;
+	char symbol[];
+};
+
+static struct kmod_list *kmod_module_symvers_mismatch_append(
+					struct kmod_list **list,
+					enum kmod_symvers_mismatch type,
+					const char *symbol, uint64_t crc,
+					uint64_t expected_crc)
+{
+	struct kmod_module_symvers_mismatch *mm;
+	size_t symbollen = strlen(symbol) + 1;
+	struct kmod_list *n;
+
+	mm = malloc(sizeof(struct kmod_module_symvers_mismatch) + symbollen);
+	if (mm == NULL)
+		return NULL;
+
+	mm->type = type;
+	mm->crc = crc;
+	mm->expected_crc = expected_crc;
+	memcpy(mm->symbol, symbol, symbollen);
+
+	n = kmod_list_append(*list, mm);
+	if (n == NULL) {
+		free(mm);
+		return NULL;
+	}
+
+	*list = n;
+	return n;
+}
+
+/*
+ * Same as the kernel's same_magic(): when the module has symbol versions, the
+ * kernel release part of vermagic is covered by the CRCs and not compared.
+ */
+static bool vermagic_matches(const char *a, const char *b, bool has_crcs)
+{
+	if (has_crcs) {
+		a += strcspn(a, " ");
+		b += strcspn(b, " ");
+	}
+
+	return streq(a, b);
+}
+
+/**
+ * kmod_module_check_symvers:
+ * @mod: kmod module
+ * @symvers: symbol versions of the target kernel, as returned by
+ *           kmod_symvers_new_from_file()
+ * @vermagic: vermagic string of the target kernel or NULL to skip this check
+ * @flags: bitmask of #kmod_symvers_check; KMOD_SYMVERS_CHECK_UNKNOWN also
+ *         reports symbols required by @mod that are not in @symvers
+ * @list: where to return the list of mismatches. Use
+ *        kmod_module_symvers_mismatch_get_type(),
+ *        kmod_module_symvers_mismatch_get_symbol(),
+ *        kmod_module_symvers_mismatch_get_crc() and
+ *        kmod_module_symvers_mismatch_get_expected_crc(). Release this list
+ *        with kmod_module_symvers_mismatch_free_list()
+ *
+ * Check every entry in the "__versions" section of @mod against the CRCs in
+ * @symvers and, if @vermagic is given, the module's vermagic against it.
+ * Nothing is written to disk and no index is needed, so this is suitable to
+ * check many modules against a kernel that is not installed.
+ *
+ * Returns: the number of mismatches found or < 0 on error.
+ */
+KMOD_EXPORT int kmod_module_check_symvers(const struct kmod_module *mod,
+					const struct kmod_symvers *symvers,
+					const char *vermagic,
+					unsigned int flags,
+					struct kmod_list **list)
+{
+	struct kmod_elf_symbol_iter iter;
+	struct kmod_elf *elf;
+	char **strings = NULL;
+	bool has_versions = false;
+	int i, n = 0, ret;
+
+	if (mod == NULL || symvers == NULL || list == NULL)
+		return -ENOENT;
+
+	assert(*list == NULL);
+
+	elf = kmod_module_get_elf(mod);
+	if (elf == NULL)
+		return -errno;
+
+	ret = kmod_elf_symbol_iter_init(&iter, elf, KMOD_SYMBOL_ITER_VERSIONS);
+	while (ret == 0 && kmod_elf_symbol_iter_next(&iter)) {
+		const char *symbol = iter.symbol;
+		const struct kmod_symver *sv;
+		enum kmod_symvers_mismatch type;
+		uint64_t expected = 0;
+
+		has_versions = true;
+
+		sv = kmod_symvers_find(symvers, symbol);
+		if (sv == NULL) {
+			if (!(flags & KMOD_SYMVERS_CHECK_UNKNOWN))
+				continue;
+			type = KMOD_SYMVERS_MISMATCH_UNKNOWN;
+		} else {
+			expected = kmod_symver_get_crc(sv);
+			if (expected == iter.crc)
+				continue;
+			type = KMOD_SYMVERS_MISMATCH_CRC;
+		}
+
+		if (kmod_module_symvers_mismatch_append(list, type, symbol,
+						iter.crc, expected) == NULL) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+		n++;
+	}
+
+	if (vermagic != NULL) {
+		const char *modvermagic = "";
+		int n_strings;
+
+		n_strings = kmod_elf_get_strings(elf, ".modinfo", &strings);
+		for (i = 0; i < n_strings; i++) {
+			if (strstartswith(strings[i], "vermagic=")) {
+				modvermagic = strings[i] + strlen("vermagic=");
+				break;
+			}
+		}
+
+		if (!vermagic_matches(modvermagic, vermagic, has_versions)) {
+			if (kmod_module_symvers_mismatch_append(list,
+					KMOD_SYMVERS_MISMATCH_VERMAGIC,
+					modvermagic, 0, 0) == NULL) {
+				ret = -ENOMEM;
+				goto fail;
+			}
+			n++;
+		}
+	}
+
+	ret = n;
+	goto out;
+
+fail:
+	kmod_module_symvers_mismatch_free_list(*list);
+	*list = NULL;
+out:
+	free(strings);
+	kmod_elf_symbol_iter_release(&iter);
+	return ret;
+}
+
+/**
+ * kmod_module_symvers_mismatch_get_type:
+ * @entry: a list entry representing a symvers mismatch
+ *
+ * Get the kind of mismatch: a CRC that differs from the one in symvers
+ * (KMOD_SYMVERS_MISMATCH_CRC), a symbol not present in symvers
+ * (KMOD_SYMVERS_MISMATCH_UNKNOWN) or a vermagic that differs from the
+ * expected one (KMOD_SYMVERS_MISMATCH_VERMAGIC).
+ *
+ * Returns: the type of this mismatch or < 0 on failure.
+ */
+KMOD_EXPORT int kmod_module_symvers_mismatch_get_type(const struct kmod_list *entry)
+{
+	struct kmod_module_symvers_mismatch *mm;
+
+	if (entry == NULL || entry->data == NULL)
+		return -ENOENT;
+
+	mm = entry->data;
+	return mm->type;
+}
+
+/**
+ * kmod_module_symvers_mismatch_get_symbol:
+ * @entry: a list entry representing a symvers mismatch
+ *
+ * Get the symbol this mismatch refers to. For KMOD_SYMVERS_MISMATCH_VERMAGIC
+ * this is the vermagic string of the module.
+ *
+ * Returns: the symbol of this mismatch on success or NULL on failure. The
+ * string is owned by the mismatch, do not free it.
+ */
+KMOD_EXPORT const char *kmod_module_symvers_mismatch_get_symbol(const struct kmod_list *entry)
+{
+	struct kmod_module_symvers_mismatch *mm;
+
+	if (entry == NULL || entry->data == NULL)
+		return NULL;
+
+	mm = entry->data;
+	return mm->symbol;
+}
+
+/**
+ * kmod_module_symvers_mismatch_get_crc:
+ * @entry: a list entry representing a symvers mismatch
+ *
+ * Get the CRC the module was built against.
+ *
+ * Returns: the crc recorded in the module, otherwise default to 0.
+ */
+KMOD_EXPORT uint64_t kmod_module_symvers_mismatch_get_crc(const struct kmod_list *entry)
+{
+	struct kmod_module_symvers_mismatch *mm;
+
+	if (entry == NULL || entry->data == NULL)
+		return 0;
+
+	mm = entry->data;
+	return mm->crc;
+}
+
+/**
+ * kmod_module_symvers_mismatch_get_expected_crc:
+ * @entry: a list entry representing a symvers mismatch
+ *
+ * Get the CRC the target kernel exports the symbol with.
+ *
+ * Returns: the crc found in symvers, otherwise default to 0.
+ */
+KMOD_EXPORT uint64_t kmod_module_symvers_mismatch_get_expected_crc(const struct kmod_list *entry)
+{
+	struct kmod_module_symvers_mismatch *mm;
+
+	if (entry == NULL || entry->data == NULL)
+		return 0;
+
+	mm = entry->data;
+	return mm->expected_crc;
+}
+
+/**
+ * kmod_module_symvers_mismatch_free_list:
+ * @list: kmod module symvers mismatch list
+ *
+ * Release the resources taken by @list
+ */
+KMOD_EXPORT void kmod_module_symvers_mismatch_free_list(struct kmod_list *list)
+{
+	while (list) {
+		free(list->data);
+		list = kmod_list_remove(list);
+	}
+}
@@ -0,0 +1,537 @@
+/*
+ * libkmod - interface to kernel module operations
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include <shared/hash.h>
+#include <shared/util.h>
+
+#include "libkmod.h"
+#include "libkmod-internal.h"
+
+#define MONITOR_HASH_SIZE (256)
+#define MONITOR_RCVBUF_SIZE (128 * 1024)
+#define UEVENT_BUFFER_SIZE (8192)
+
+/* multicast group of the uevents sent by the kernel itself */
+#define UEVENT_GROUP_KERNEL (1)
+
+/**
+ * SECTION:libkmod-monitor
+ * @short_description: track loaded modules through kernel uevents
+ *
+ * A monitor takes one snapshot of /proc/modules and then keeps an in-memory
+ * table of the loaded modules up to date by listening to the "module"
+ * uevents sent by the kernel. The events are only read when the user calls
+ * kmod_monitor_process(), usually after kmod_monitor_get_fd() becomes
+ * readable.
+ *
+ * While a monitor is alive, libkmod uses its table to check if a module is
+ * already loaded, e.g. in kmod_module_probe_insert_module(), instead of
+ * reading /sys every time.
+ */
+
+/**
+ * kmod_monitor:
+ *
+ * Opaque object tracking the modules loaded in kernel.
+ */
+struct kmod_monitor {
+	struct kmod_ctx *ctx;
+	struct hash *loaded;
+	int fd;
+	int refcount;
+};
+
+static int loaded_add(struct hash *loaded, const char *name)
+{
+	char *key;
+	int err;
+
+	if (hash_find(loaded, name) != NULL)
+		return 0;
+
+	key = strdup(name);
+	if (key == NULL)
+		return -ENOMEM;
+
+	err = hash_add_unique(loaded, key, key);
+	if (err < 0) {
+		free(key);
+		return err;
+	}
+
+	return 1;
+}
+
+static int loaded_del(struct hash *loaded, const char *name)
+{
+	return hash_del(loaded, name) == 0 ? 1 : 0;
+}
+
+static int monitor_read_snapshot(struct kmod_ctx *ctx, struct hash *loaded)
+{
+	char line[4096];
+	FILE *fp;
+	int err = 0;
+
+	fp = fopen("/proc/modules", "re");
+	if (fp == NULL) {
+		err = -errno;
+		ERR(ctx, "could not open /proc/modules: %m\n");
+		return err;
+	}
+
+	while (fgets(line, sizeof(line), fp)) {
+		size_t len = strlen(line);
+		char *saveptr, *name = strtok_r(line, " \t", &saveptr);
+
+		if (name != NULL) {
+			err = loaded_add(loaded, name);
+			if (err < 0)
+				break;
+		}
+
+		while (line[len - 1] != '\n' && fgets(line, sizeof(line), fp))
+			len = strlen(line);
+	}
+
+	fclose(fp);
+	return err < 0 ? err : 0;
+}
+
+/*
+ * Discard the uevents queued on the socket: they were sent before the
+ * snapshot about to be taken and applying them after it would undo it.
+ */
+static int monitor_drain(struct kmod_monitor *monitor)
+{
+	char c;
+	int err;
+
+	for (;;) {
+		/* datagrams are dropped whole, even if not fully read */
+		if (recv(monitor->fd, &c, sizeof(c), MSG_DONTWAIT) >= 0)
+			continue;
+		if (errno == EINTR || errno == ENOBUFS)
+			continue;
+		if (errno == EAGAIN)
+			return 0;
+
+		err = -errno;
+		ERR(monitor->ctx, "could not drain uevents: %m\n");
+		return err;
+	}
+}
+
+/*
+ * Read the table again from /proc/modules. Used when the socket buffer
+ * overflowed and we can't know which events were lost. The current table is
+ * kept if the new one can't be read.
+ */
+static int monitor_resync(struct kmod_monitor *monitor)
+{
+	struct hash *loaded;
+	int err;
+
+	err = monitor_drain(monitor);
+	if (err < 0)
+		return err;
+
+	loaded = hash_new(MONITOR_HASH_SIZE, free);
+	if (loaded == NULL)
+		return -ENOMEM;
+
+	err = monitor_read_snapshot(monitor->ctx, loaded);
+	if (err < 0) {
+		hash_free(loaded);
+		return err;
+	}
+
+	hash_free(monitor->loaded);
+	monitor->loaded = loaded;
+
+	return 1;
+}
+
+/*
+ * Apply one uevent to the table. The kernel sends "ACTION@DEVPATH" followed
+ * by a list of NUL-terminated KEY=VALUE pairs. Modules are announced in
+ * /module/<name> with SUBSYSTEM=module: "add" once they're live and "remove"
+ * when they're gone.
+ */
+static int monitor_handle_uevent(struct kmod_monitor *monitor,
+						const char *buf, size_t len)
+{
+	const char *action = NULL, *devpath = NULL, *subsystem = NULL;
+	const char *p, *end = buf + len;
+	const char *name;
+
+	/* skip header */
+	p = memchr(buf, '\0', len);
+	if (p == NULL || memchr(buf, '@', p - buf) == NULL)
+		return 0;
+
+	for (p++; p < end; p += strlen(p) + 1) {
+		if (strstartswith(p, "ACTION="))
+			action = p + sizeof("ACTION=") - 1;
+		else if (strstartswith(p, "DEVPATH="))
+			devpath = p + sizeof("DEVPATH=") - 1;
+		else if (strstartswith(p, "SUBSYSTEM="))
+			subsystem = p + sizeof("SUBSYSTEM=") - 1;
+	}
+
+	if (action == NULL || devpath == NULL || subsystem == NULL
+					|| !streq(subsystem, "module"))
+		return 0;
+
+	if (!strstartswith(devpath, "/module/"))
+		return 0;
+
+	name = devpath + sizeof("/module/") - 1;
+	if (name[0] == '\0' || strchr(name, '/') != NULL)
+		return 0;
+
+	if (streq(action, "add")) {
+		DBG(monitor->ctx, "module '%s' loaded\n", name);
+		return loaded_add(monitor->loaded, name);
+	} else if (streq(action, "remove")) {
+		DBG(monitor->ctx, "module '%s' removed\n", name);
+		return loaded_del(monitor->loaded, name);
+	}
+
+	return 0;
+}
+
+static int monitor_open_socket(struct kmod_ctx *ctx)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = UEVENT_GROUP_KERNEL,
+	};
+	int rcvbuf = MONITOR_RCVBUF_SIZE;
+	int fd, err;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM|SOCK_CLOEXEC|SOCK_NONBLOCK,
+						NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) {
+		err = -errno;
+		ERR(ctx, "could not create uevent socket: %m\n");
+		return err;
+	}
+
+	/* best effort: a larger buffer only makes resyncs less likely */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		err = -errno;
+		ERR(ctx, "could not bind uevent socket: %m\n");
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+/**
+ * kmod_monitor_new:
+ * @ctx: kmod library context
+ * @monitor: where to save the created monitor. Use kmod_monitor_unref() to
+ *           release it.
+ *
+ * Create a monitor of the modules loaded in kernel. The uevent socket is
+ * opened before reading /proc/modules so no change is lost between the
+ * snapshot and the first call to kmod_monitor_process().
+ *
+ * There's at most one monitor per @ctx: if one already exists, a new
+ * reference to it is returned.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_monitor_new(struct kmod_ctx *ctx,
+					struct kmod_monitor **monitor)
+{
+	struct kmod_monitor *m;
+	int err;
+
+	if (ctx == NULL || monitor == NULL)
+		return -ENOENT;
+
+	m = kmod_get_monitor(ctx);
+	if (m != NULL) {
+		*monitor = kmod_monitor_ref(m);
+		return 0;
+	}
+
+	m = calloc(1, sizeof(struct kmod_monitor));
+	if (m == NULL)
+		return -ENOMEM;
+
+	m->ctx = ctx;
+	m->loaded = hash_new(MONITOR_HASH_SIZE, free);
+	if (m->loaded == NULL) {
+		err = -ENOMEM;
+		goto fail_free;
+	}
+
+	m->fd = monitor_open_socket(ctx);
+	if (m->fd < 0) {
+		err = m->fd;
+		goto fail_hash;
+	}
+
+	err = monitor_read_snapshot(ctx, m->loaded);
+	if (err < 0)
+		goto fail_socket;
+
+	m->ctx = kmod_ref(ctx);
+	m->refcount = 1;
+	kmod_set_monitor(ctx, m);
+	*monitor = m;
+
+	DBG(ctx, "monitor %p tracking %u loaded modules\n", m,
+					hash_get_count(m->loaded));
+
+	return 0;
+
+fail_socket:
+	close(m->fd);
+fail_hash:
+	hash_free(m->loaded);
+fail_free:
+	free(m);
+	return err;
+}
+
+/**
+ * kmod_monitor_ref:
+ * @monitor: kmod monitor
+ *
+ * Take a reference of the monitor.
+ *
+ * Returns: the passed monitor with its refcount incremented.
+ */
+KMOD_EXPORT struct kmod_monitor *kmod_monitor_ref(struct kmod_monitor *monitor)
+{
+	if (monitor == NULL)
+		return NULL;
+
+	monitor->refcount++;
+	return monitor;
+}
+
+/**
+ * kmod_monitor_unref:
+ * @monitor: kmod monitor
+ *
+ * Drop a reference of the monitor. If the refcount reaches zero, the socket
+ * is closed and libkmod goes back to checking /sys for the state of modules.
+ *
+ * Returns: NULL if @monitor was freed, otherwise @monitor itself.
+ */
+KMOD_EXPORT struct kmod_monitor *kmod_monitor_unref(struct kmod_monitor *monitor)
+{
+	if (monitor == NULL)
+		return NULL;
+
+	if (--monitor->refcount > 0)
+		return monitor;
+
+	DBG(monitor->ctx, "kmod_monitor %p released\n", monitor);
+
+	kmod_set_monitor(monitor->ctx, NULL);
+	close(monitor->fd);
+	hash_free(monitor->loaded);
+	kmod_unref(monitor->ctx);
+	free(monitor);
+	return NULL;
+}
+
+/**
+ * kmod_monitor_get_fd:
+ * @monitor: kmod monitor
+ *
+ * Get the file descriptor to watch for changes. It becomes readable when
+ * there are events to be handled with kmod_monitor_process(). It's owned by
+ * @monitor and must not be closed.
+ *
+ * Returns: the file descriptor or < 0 on error.
+ */
+KMOD_EXPORT int kmod_monitor_get_fd(const struct kmod_monitor *monitor)
+{
+	if (monitor == NULL)
+		return -ENOENT;
+
+	return monitor->fd;
+}
+
+/**
+ * kmod_monitor_process:
+ * @monitor: kmod monitor
+ *
+ * Read all the pending uevents and update the table of loaded modules. It
+ * never blocks. If the kernel dropped events because they were not read
+ * fast enough, the events still queued are discarded and the table is read
+ * again from /proc/modules.
+ *
+ * Returns: the number of modules that were loaded or removed, or < 0 on
+ * error.
+ */
+KMOD_EXPORT int kmod_monitor_process(struct kmod_monitor *monitor)
+{
+	char buf[UEVENT_BUFFER_SIZE];
+	int changes = 0;
+
+	if (monitor == NULL)
+		return -ENOENT;
+
+	for (;;) {
+		struct sockaddr_nl addr;
+		struct iovec iov = {
+			.iov_base = buf,
+			.iov_len = sizeof(buf) - 1,
+		};
+		struct msghdr msg = {
+			.msg_name = &addr,
+			.msg_namelen = sizeof(addr),
+			.msg_iov = &iov,
+			.msg_iovlen = 1,
+		};
+		ssize_t len;
+		int err;
+
+		len = recvmsg(monitor->fd, &msg, MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			if (errno == ENOBUFS) {
+				DBG(monitor->ctx, "uevents lost, resyncing\n");
+				err = monitor_resync(monitor);
+				if (err < 0)
+					return err;
+				changes += err;
+				continue;
+			}
+
+			err = -errno;
+			ERR(monitor->ctx, "could not read uevent: %m\n");
+			return err;
+		}
+
+		if (len == 0)
+			break;
+
+		/* only trust the kernel */
+		if (msg.msg_namelen >= sizeof(addr) && addr.nl_pid != 0)
+			continue;
+
+		buf[len] = '\0';
+		err = monitor_handle_uevent(monitor, buf, len);
+		if (err < 0)
+			return err;
+		changes += err;
+	}
+
+	return changes;
+}
+
+/**
+ * kmod_monitor_get_loaded:
+ * @monitor: kmod monitor
+ * @list: where to save the list of loaded modules
+ *
+ * Create a list of kmod modules with all modules loaded in kernel, as
+ * currently known by @monitor. It's the equivalent of
+ * kmod_module_new_from_loaded() without reading /proc/modules. Call
+ * kmod_monitor_process() before to take pending events into account.
+ *
+ * The returned @list must be released by calling kmod_module_unref_list().
+ *
+ * Returns: 0 on success or < 0 on error.
+ */
+KMOD_EXPORT int kmod_monitor_get_loaded(const struct kmod_monitor *monitor,
+						struct kmod_list **list)
+{
+	struct kmod_list *l = NULL;
+	struct hash_iter iter;
+	const char *name;
+	const void *v;
+
+	if (monitor == NULL || list == NULL)
+		return -ENOENT;
+
+	hash_iter_init(monitor->loaded, &iter);
+	while (hash_iter_next(&iter, &name, &v)) {
+		struct kmod_module *m;
+		struct kmod_list *node;
+		int err;
+
+		err = kmod_module_new_from_name(monitor->ctx, name, &m);
+		if (err < 0) {
+			ERR(monitor->ctx, "could not get module from name '%s': %s\n",
+				name, strerror(-err));
+			continue;
+		}
+
+		node = kmod_list_append(l, m);
+		if (node == NULL) {
+			ERR(monitor->ctx, "out of memory\n");
+			kmod_module_unref(m);
+			kmod_module_unref_list(l);
+			return -ENOMEM;
+		}
+		l = node;
+	}
+
+	*list = l;
+	return 0;
+}
+
+/**
+ * kmod_monitor_is_loaded:
+ * @monitor: kmod monitor
+ * @name: module name
+ *
+ * Check if module @name is loaded according to the events processed so far.
+ * Builtin modules are not considered.
+ *
+ * Returns: true if it's loaded, false otherwise.
+ */
+KMOD_EXPORT bool kmod_monitor_is_loaded(const struct kmod_monitor *monitor,
+							const char *name)
+{
+	char buf[PATH_MAX];
+
+	if (monitor == NULL || name == NULL)
+		return false;
+
+	if (modname_normalize(name, buf, NULL) == NULL)
+		return false;
+
+	return hash_find(monitor->loaded, buf) != NULL;
+}
@@ -22,39 +22,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef ENABLE_OPENSSL
+#include <openssl/bn.h>
+#include <openssl/opensslv.h>
+#include <openssl/pkcs7.h>
+#include <openssl/x509.h>
+#endif
 
 #include <shared/missing.h>
+#include <shared/signature.h>
 #include <shared/util.h>
 
 #include "libkmod-internal.h"
 
-/* These types and tables were copied from the 3.7 kernel sources.
- * As this is just description of the signature format, it should not be
- * considered derived work (so libkmod can use the LGPL license).
+/* These tables were copied from the 3.7 kernel sources, like the types in
+ * shared/signature.h.
  */
-enum pkey_algo {
-	PKEY_ALGO_DSA,
-	PKEY_ALGO_RSA,
-	PKEY_ALGO__LAST
-};
-
 static const char *const pkey_algo[PKEY_ALGO__LAST] = {
 	[PKEY_ALGO_DSA]		= "DSA",
 	[PKEY_ALGO_RSA]		= "RSA",
 };
 
-enum pkey_hash_algo {
-	PKEY_HASH_MD4,
-	PKEY_HASH_MD5,
-	PKEY_HASH_SHA1,
-	PKEY_HASH_RIPE_MD_160,
-	PKEY_HASH_SHA256,
-	PKEY_HASH_SHA384,
-	PKEY_HASH_SHA512,
-	PKEY_HASH_SHA224,
-	PKEY_HASH__LAST
-};
-
 const char *const pkey_hash_algo[PKEY_HASH__LAST] = {
 	[PKEY_HASH_MD4]		= "md4",
 	[PKEY_HASH_MD5]		= "md5",
@@ -66,75 +54,245 @@ const char *const pkey_hash_algo[PKEY_HASH__LAST] = {
 	[PKEY_HASH_SHA224]	= "sha224",
 };
 
-enum pkey_id_type {
-	PKEY_ID_PGP,		/* OpenPGP generated key ID */
-	PKEY_ID_X509,		/* X.509 arbitrary subjectKeyIdentifier */
-	PKEY_ID_PKCS7,		/* Signature in PKCS#7 message */
-	PKEY_ID_TYPE__LAST
-};
-
 const char *const pkey_id_type[PKEY_ID_TYPE__LAST] = {
 	[PKEY_ID_PGP]		= "PGP",
 	[PKEY_ID_X509]		= "X509",
 	[PKEY_ID_PKCS7]		= "PKCS#7",
 };
 
+#ifdef ENABLE_OPENSSL
 /*
- * Module signature information block.
+ * Only modules with a PKCS#7 signature need libcrypto, and only when their
+ * info is asked for: like the decompression libraries, it's opened then.
  */
-struct module_signature {
-	uint8_t algo;        /* Public-key crypto algorithm [enum pkey_algo] */
-	uint8_t hash;        /* Digest algorithm [enum pkey_hash_algo] */
-	uint8_t id_type;     /* Key identifier type [enum pkey_id_type] */
-	uint8_t signer_len;  /* Length of signer's name */
-	uint8_t key_id_len;  /* Length of key identifier */
-	uint8_t __pad[3];
-	uint32_t sig_len;    /* Length of signature data (big endian) */
+static typeof(d2i_PKCS7) *sym_d2i_PKCS7;
+static typeof(PKCS7_free) *sym_PKCS7_free;
+static typeof(PKCS7_get_signer_info) *sym_PKCS7_get_signer_info;
+static typeof(PKCS7_SIGNER_INFO_get0_algs) *sym_PKCS7_SIGNER_INFO_get0_algs;
+static typeof(OPENSSL_sk_num) *sym_OPENSSL_sk_num;
+static typeof(OPENSSL_sk_value) *sym_OPENSSL_sk_value;
+static typeof(X509_ALGOR_get0) *sym_X509_ALGOR_get0;
+static typeof(OBJ_obj2nid) *sym_OBJ_obj2nid;
+static typeof(ASN1_INTEGER_to_BN) *sym_ASN1_INTEGER_to_BN;
+static typeof(ASN1_STRING_get0_data) *sym_ASN1_STRING_get0_data;
+static typeof(ASN1_STRING_length) *sym_ASN1_STRING_length;
+static typeof(BN_num_bits) *sym_BN_num_bits;
+static typeof(BN_bn2bin) *sym_BN_bn2bin;
+static typeof(BN_free) *sym_BN_free;
+static typeof(X509_NAME_get_index_by_NID) *sym_X509_NAME_get_index_by_NID;
+static typeof(X509_NAME_get_entry) *sym_X509_NAME_get_entry;
+static typeof(X509_NAME_ENTRY_get_data) *sym_X509_NAME_ENTRY_get_data;
+
+static const struct kmod_dl_symbol crypto_symbols[] = {
+	{ "d2i_PKCS7", (void **) &sym_d2i_PKCS7 },
+	{ "PKCS7_free", (void **) &sym_PKCS7_free },
+	{ "PKCS7_get_signer_info", (void **) &sym_PKCS7_get_signer_info },
+	{ "PKCS7_SIGNER_INFO_get0_algs",
+				(void **) &sym_PKCS7_SIGNER_INFO_get0_algs },
+	{ "OPENSSL_sk_num", (void **) &sym_OPENSSL_sk_num },
+	{ "OPENSSL_sk_value", (void **) &sym_OPENSSL_sk_value },
+	{ "X509_ALGOR_get0", (void **) &sym_X509_ALGOR_get0 },
+	{ "OBJ_obj2nid", (void **) &sym_OBJ_obj2nid },
+	{ "ASN1_INTEGER_to_BN", (void **) &sym_ASN1_INTEGER_to_BN },
+	{ "ASN1_STRING_get0_data", (void **) &sym_ASN1_STRING_get0_data },
+	{ "ASN1_STRING_length", (void **) &sym_ASN1_STRING_length },
+	{ "BN_num_bits", (void **) &sym_BN_num_bits },
+	{ "BN_bn2bin", (void **) &sym_BN_bn2bin },
+	{ "BN_free", (void **) &sym_BN_free },
+	{ "X509_NAME_get_index_by_NID",
+				(void **) &sym_X509_NAME_get_index_by_NID },
+	{ "X509_NAME_get_entry", (void **) &sym_X509_NAME_get_entry },
+	{ "X509_NAME_ENTRY_get_data",
+				(void **) &sym_X509_NAME_ENTRY_get_data },
+	{ }
 };
 
-#define SIG_MAGIC "~Module signature appended~\n"
+static struct kmod_dl_library crypto_library = {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	.soname = "libcrypto.so.3",
+#else
+	.soname = "libcrypto.so.1.1",
+#endif
+	.needed_to = "decode PKCS#7 signatures",
+	.symbols = crypto_symbols,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
 
-/*
- * A signed module has the following layout:
- *
- * [ module                  ]
- * [ signer's name           ]
- * [ key identifier          ]
- * [ signature data          ]
- * [ struct module_signature ]
- * [ SIG_MAGIC               ]
- */
+struct pkcs7_private {
+	PKCS7 *pkcs7;
+	unsigned char *key_id;
+};
+
+static void pkcs7_free(void *s)
+{
+	struct kmod_signature_info *si = s;
+	struct pkcs7_private *pvt = si->private;
+
+	sym_PKCS7_free(pvt->pkcs7);
+	free(pvt->key_id);
+	free(pvt);
+	si->private = NULL;
+}
+
+static int obj_to_hash_algo(const ASN1_OBJECT *o)
+{
+	switch (sym_OBJ_obj2nid(o)) {
+	case NID_md4:
+		return PKEY_HASH_MD4;
+	case NID_md5:
+		return PKEY_HASH_MD5;
+	case NID_sha1:
+		return PKEY_HASH_SHA1;
+	case NID_ripemd160:
+		return PKEY_HASH_RIPE_MD_160;
+	case NID_sha256:
+		return PKEY_HASH_SHA256;
+	case NID_sha384:
+		return PKEY_HASH_SHA384;
+	case NID_sha512:
+		return PKEY_HASH_SHA512;
+	case NID_sha224:
+		return PKEY_HASH_SHA224;
+	default:
+		return -1;
+	}
+}
+
+/* the signer is the common name of the certificate issuer */
+static const ASN1_STRING *x509_name_to_cn(X509_NAME *name)
+{
+	int i = sym_X509_NAME_get_index_by_NID(name, NID_commonName, -1);
+
+	if (i < 0)
+		return NULL;
+
+	return sym_X509_NAME_ENTRY_get_data(sym_X509_NAME_get_entry(name, i));
+}
+
+static bool fill_pkcs7(const char *mem, size_t sig_len,
+				const struct module_signature *modsig,
+				struct kmod_signature_info *sig_info)
+{
+	const unsigned char *p = (const unsigned char *)mem;
+	STACK_OF(PKCS7_SIGNER_INFO) *sis;
+	PKCS7_SIGNER_INFO *si;
+	PKCS7 *pkcs7;
+	X509_ALGOR *dig_alg;
+	const ASN1_OBJECT *o;
+	const ASN1_STRING *cn;
+	struct pkcs7_private *pvt;
+	BIGNUM *sno;
+	int hash_algo;
 
-bool kmod_module_signature_info(const struct kmod_file *file, struct kmod_signature_info *sig_info)
+	pkcs7 = sym_d2i_PKCS7(NULL, &p, sig_len);
+	if (pkcs7 == NULL)
+		return false;
+
+	sis = sym_PKCS7_get_signer_info(pkcs7);
+	if (sis == NULL || sym_OPENSSL_sk_num((const OPENSSL_STACK *)sis) < 1)
+		goto err;
+	si = sym_OPENSSL_sk_value((const OPENSSL_STACK *)sis, 0);
+	if (si->issuer_and_serial == NULL || si->enc_digest == NULL)
+		goto err;
+
+	sym_PKCS7_SIGNER_INFO_get0_algs(si, NULL, &dig_alg, NULL);
+	sym_X509_ALGOR_get0(&o, NULL, NULL, dig_alg);
+	hash_algo = obj_to_hash_algo(o);
+	if (hash_algo < 0)
+		goto err;
+
+	pvt = calloc(1, sizeof(*pvt));
+	if (pvt == NULL)
+		goto err;
+
+	/* the key is identified by the serial number of its certificate */
+	sno = sym_ASN1_INTEGER_to_BN(si->issuer_and_serial->serial, NULL);
+	if (sno == NULL)
+		goto err_pvt;
+	sig_info->key_id_len = (sym_BN_num_bits(sno) + 7) / 8;
+	pvt->key_id = malloc(sig_info->key_id_len + 1);
+	if (pvt->key_id == NULL) {
+		sym_BN_free(sno);
+		goto err_pvt;
+	}
+	sym_BN_bn2bin(sno, pvt->key_id);
+	sym_BN_free(sno);
+	sig_info->key_id = (const char *)pvt->key_id;
+
+	cn = x509_name_to_cn(si->issuer_and_serial->issuer);
+	if (cn != NULL) {
+		sig_info->signer = (const char *)sym_ASN1_STRING_get0_data(cn);
+		sig_info->signer_len = sym_ASN1_STRING_length(cn);
+	} else {
+		sig_info->signer = NULL;
+		sig_info->signer_len = 0;
+	}
+
+	sig_info->sig = (const char *)sym_ASN1_STRING_get0_data(si->enc_digest);
+	sig_info->sig_len = sym_ASN1_STRING_length(si->enc_digest);
+
+	sig_info->algo = pkey_algo[PKEY_ALGO_RSA];
+	sig_info->hash_algo = pkey_hash_algo[hash_algo];
+	sig_info->id_type = pkey_id_type[modsig->id_type];
+
+	pvt->pkcs7 = pkcs7;
+	sig_info->private = pvt;
+	sig_info->free = pkcs7_free;
+
+	return true;
+
+err_pvt:
+	free(pvt);
+err:
+	sym_PKCS7_free(pkcs7);
+	return false;
+}
+#endif
+
+bool kmod_module_signature_info(const struct kmod_ctx *ctx,
+				const struct kmod_file *file,
+				struct kmod_signature_info *sig_info)
 {
 	const char *mem;
 	off_t size;
 	const struct module_signature *modsig;
 	size_t sig_len;
 
-
 	size = kmod_file_get_size(file);
 	mem = kmod_file_get_contents(file);
-	if (size < (off_t)strlen(SIG_MAGIC))
-		return false;
-	size -= strlen(SIG_MAGIC);
-	if (memcmp(SIG_MAGIC, mem + size, strlen(SIG_MAGIC)) != 0)
-		return false;
-
-	if (size < (off_t)sizeof(struct module_signature))
-		return false;
-	size -= sizeof(struct module_signature);
-	modsig = (struct module_signature *)(mem + size);
-	if (modsig->algo >= PKEY_ALGO__LAST ||
-			modsig->hash >= PKEY_HASH__LAST ||
-			modsig->id_type >= PKEY_ID_TYPE__LAST)
+	modsig = modsig_get(mem, &size);
+	if (modsig == NULL)
 		return false;
 	sig_len = be32toh(get_unaligned(&modsig->sig_len));
-	if (sig_len == 0 ||
-	    size < (int64_t)(modsig->signer_len + modsig->key_id_len + sig_len))
+	if (sig_len == 0)
 		return false;
 
+	sig_info->free = NULL;
+	sig_info->private = NULL;
+
 	size -= sig_len;
+
+	if (modsig->id_type == PKEY_ID_PKCS7) {
+#ifdef ENABLE_OPENSSL
+		if (kmod_dl_library_open(ctx, &crypto_library) == 0)
+			return fill_pkcs7(mem + size, sig_len, modsig, sig_info);
+#endif
+		/*
+		 * Everything is in the PKCS#7 message and there's nothing
+		 * to parse it with: only tell the module is signed.
+		 */
+		sig_info->sig = mem + size;
+		sig_info->sig_len = sig_len;
+		sig_info->key_id = NULL;
+		sig_info->key_id_len = 0;
+		sig_info->signer = NULL;
+		sig_info->signer_len = 0;
+		sig_info->algo = "unknown";
+		sig_info->hash_algo = "unknown";
+		sig_info->id_type = pkey_id_type[modsig->id_type];
+		return true;
+	}
+
 	sig_info->sig = mem + size;
 	sig_info->sig_len = sig_len;
 
@@ -152,3 +310,9 @@ bool kmod_module_signature_info(const struct kmod_file *file, struct kmod_signat
 
 	return true;
 }
+
+void kmod_module_signature_info_free(struct kmod_signature_info *sig_info)
+{
+	if (sig_info->free != NULL)
+		sig_info->free(sig_info);
+}
@@ -0,0 +1,749 @@
+/*
+ * libkmod - interface to kernel module operations
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <shared/strbuf.h>
+#include <shared/util.h>
+
+#include "libkmod.h"
+#include "libkmod-internal.h"
+
+/**
+ * SECTION:libkmod-symbol-map
+ * @short_description: address to symbol map of loaded modules
+ *
+ * The symbol map resolves addresses inside loaded modules to the module and
+ * symbol they belong to, e.g. to symbolize samples of a profiler. It's built
+ * from the .symtab of each module loaded in kernel and the addresses its
+ * sections were loaded at, reading only the section files that are needed
+ * from /sys/module. The map can be written to a file and later mapped back,
+ * so it can be taken while the modules are loaded and used afterwards.
+ */
+
+/*
+ * The map is kept in memory the same way it's stored in files: the header,
+ * the symbols sorted by address and then the strings they refer to.
+ * Integers are big endian, like in the indexes.
+ */
+#define SYMBOL_MAP_MAGIC 0x4b53594d /* "KSYM" */
+#define SYMBOL_MAP_VERSION 1
+
+struct symbol_map_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t n_modules;
+	uint32_t n_symbols;
+};
+
+struct symbol_map_entry {
+	uint64_t address;
+	uint64_t size;
+	uint32_t name; /* offsets of NUL-terminated strings */
+	uint32_t module;
+};
+
+/**
+ * kmod_symbol_map:
+ *
+ * Opaque object mapping addresses to the symbols of the modules that were
+ * loaded at the time it was created.
+ */
+struct kmod_symbol_map {
+	struct kmod_ctx *ctx;
+	void *mem;
+	size_t size;
+	bool mapped;
+	uint32_t n_modules;
+	uint32_t n_symbols;
+	const struct symbol_map_entry *entries;
+	int refcount;
+};
+
+static const char *map_string(const struct kmod_symbol_map *map,
+								uint32_t off)
+{
+	return (const char *) map->mem + be32toh(off);
+}
+
+static bool symbol_map_is_valid(struct kmod_symbol_map *map,
+							const char *filename)
+{
+	const struct symbol_map_header *hdr = map->mem;
+	const char *mem = map->mem;
+	uint64_t prev = 0;
+	size_t strings;
+	uint32_t i;
+
+	if (map->size < sizeof(*hdr)) {
+		ERR(map->ctx, "%s: too small for a symbol map\n", filename);
+		return false;
+	}
+
+	if (be32toh(hdr->magic) != SYMBOL_MAP_MAGIC) {
+		ERR(map->ctx, "%s: magic check fail: %x instead of %x\n",
+			filename, be32toh(hdr->magic), SYMBOL_MAP_MAGIC);
+		return false;
+	}
+
+	if (be32toh(hdr->version) != SYMBOL_MAP_VERSION) {
+		ERR(map->ctx, "%s: version check fail: %u instead of %u\n",
+			filename, be32toh(hdr->version), SYMBOL_MAP_VERSION);
+		return false;
+	}
+
+	map->n_modules = be32toh(hdr->n_modules);
+	map->n_symbols = be32toh(hdr->n_symbols);
+	if ((size_t) map->n_symbols * sizeof(struct symbol_map_entry) >
+						map->size - sizeof(*hdr))
+		goto corrupt;
+
+	map->entries = (const void *) (hdr + 1);
+	strings = sizeof(*hdr) +
+		(size_t) map->n_symbols * sizeof(struct symbol_map_entry);
+
+	/* a terminated string area makes every string in it terminated */
+	if (map->n_symbols > 0 &&
+	    (strings == map->size || mem[map->size - 1] != '\0'))
+		goto corrupt;
+
+	for (i = 0; i < map->n_symbols; i++) {
+		const struct symbol_map_entry *e = &map->entries[i];
+		uint64_t address = be64toh(e->address);
+
+		if (be32toh(e->name) < strings || be32toh(e->name) >= map->size ||
+		    be32toh(e->module) < strings ||
+		    be32toh(e->module) >= map->size)
+			goto corrupt;
+
+		/* lookups are a binary search over the mapped table */
+		if (address < prev)
+			goto corrupt;
+		prev = address;
+	}
+
+	return true;
+
+corrupt:
+	ERR(map->ctx, "%s: symbol map is corrupted\n", filename);
+	return false;
+}
+
+static void symbol_map_free(struct kmod_symbol_map *map)
+{
+	if (map->mapped)
+		munmap(map->mem, map->size);
+	else
+		free(map->mem);
+	free(map);
+}
+
+/* symbols as they are collected, before they are sorted and stored */
+struct symbol_map_sym {
+	uint64_t address;
+	uint64_t size;
+	uint32_t name; /* offsets in strings */
+	uint32_t module;
+};
+
+struct symbol_map_section {
+	uint64_t address; /* 0 if the section isn't loaded */
+	bool read;
+};
+
+struct symbol_map_builder {
+	struct kmod_ctx *ctx;
+	int dirfd; /* /sys/module */
+	struct strbuf strings;
+	struct symbol_map_sym *syms;
+	size_t n_syms;
+	size_t syms_size;
+	uint32_t n_modules;
+	unsigned int n_hidden;
+
+	/* module being added and its sections, by index */
+	const char *modname;
+	uint32_t module;
+	struct symbol_map_section *sections;
+	size_t n_sections;
+};
+
+static int builder_push_string(struct symbol_map_builder *b, const char *s,
+								uint32_t *off)
+{
+	size_t len = strlen(s);
+
+	if (b->strings.used > UINT32_MAX - len - 1)
+		return -EFBIG;
+
+	*off = b->strings.used;
+	if ((len > 0 && strbuf_pushchars(&b->strings, s) != len) ||
+	    !strbuf_pushchar(&b->strings, '\0'))
+		return -ENOMEM;
+
+	return 0;
+}
+
+static int builder_read_section(struct symbol_map_builder *b,
+					const char *section, uint64_t *address)
+{
+	char path[PATH_MAX];
+	unsigned long addr;
+	int fd, err;
+
+	*address = 0;
+
+	if (snprintf(path, sizeof(path), "%s/sections/%s", b->modname,
+						section) >= (int) sizeof(path))
+		return -ENAMETOOLONG;
+
+	/* not there if not allocated, as .modinfo */
+	fd = openat(b->dirfd, path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	err = read_str_ulong(fd, &addr, 16);
+	close(fd);
+	if (err < 0) {
+		DBG(b->ctx, "could not read the address of %s\n", path);
+		return 0;
+	}
+
+	/* with kptr_restrict, addresses read as 0 */
+	if (addr == 0)
+		b->n_hidden++;
+
+	*address = addr;
+	return 0;
+}
+
+static int builder_get_section(struct symbol_map_builder *b,
+				const struct kmod_elf_defined_symbol *def,
+				struct symbol_map_section **sec)
+{
+	struct symbol_map_section *s;
+
+	if (def->shndx >= b->n_sections) {
+		size_t n = def->shndx + 1;
+
+		s = realloc(b->sections, n * sizeof(*s));
+		if (s == NULL)
+			return -ENOMEM;
+
+		memset(s + b->n_sections, 0, (n - b->n_sections) * sizeof(*s));
+		b->sections = s;
+		b->n_sections = n;
+	}
+
+	s = &b->sections[def->shndx];
+	*sec = s;
+	if (s->read)
+		return 0;
+
+	s->read = true;
+
+	/*
+	 * The kernel frees the init sections once the module is initialized
+	 * and their addresses may since have been reused.
+	 */
+	if (strstartswith(def->section, ".init")) {
+		s->address = 0;
+		return 0;
+	}
+
+	return builder_read_section(b, def->section, &s->address);
+}
+
+static int builder_add_symbol(const struct kmod_elf_defined_symbol *def,
+								void *data)
+{
+	struct symbol_map_builder *b = data;
+	struct symbol_map_section *sec;
+	struct symbol_map_sym *sym;
+	int err;
+
+	err = builder_get_section(b, def, &sec);
+	if (err < 0 || sec->address == 0)
+		return err;
+
+	if (b->n_syms == UINT32_MAX)
+		return -EFBIG;
+
+	if (b->n_syms == b->syms_size) {
+		size_t n = b->syms_size == 0 ? 256 : b->syms_size * 2;
+
+		sym = realloc(b->syms, n * sizeof(*sym));
+		if (sym == NULL)
+			return -ENOMEM;
+
+		b->syms = sym;
+		b->syms_size = n;
+	}
+
+	sym = &b->syms[b->n_syms];
+	err = builder_push_string(b, def->name, &sym->name);
+	if (err < 0)
+		return err;
+
+	sym->address = sec->address + def->value;
+	sym->size = def->size;
+
+	/* symbols without a size, as asm labels, end with their section */
+	if (sym->size == 0 && def->section_size > def->value)
+		sym->size = def->section_size - def->value;
+	sym->module = b->module;
+	b->n_syms++;
+
+	return 0;
+}
+
+static int builder_add_module(struct symbol_map_builder *b,
+						struct kmod_module *mod)
+{
+	const char *path = kmod_module_get_path(mod);
+	struct kmod_file *file;
+	struct kmod_elf *elf;
+	int err;
+
+	if (path == NULL) {
+		DBG(b->ctx, "no path for %s, skipping its symbols\n",
+						kmod_module_get_name(mod));
+		return 0;
+	}
+
+	file = kmod_file_open(b->ctx, path);
+	if (file == NULL) {
+		DBG(b->ctx, "could not open %s: %m\n", path);
+		return 0;
+	}
+
+	elf = kmod_file_get_elf(file);
+	if (elf == NULL) {
+		kmod_file_unref(file);
+		return 0;
+	}
+
+	b->modname = kmod_module_get_name(mod);
+	b->n_sections = 0;
+	free(b->sections);
+	b->sections = NULL;
+
+	err = builder_push_string(b, b->modname, &b->module);
+	if (err >= 0)
+		err = kmod_elf_foreach_defined_symbol(elf, builder_add_symbol,
+									b);
+
+	kmod_file_unref(file);
+
+	if (err == -ENOMEM || err == -EFBIG)
+		return err;
+	if (err < 0)
+		DBG(b->ctx, "could not read the symbols of %s: %s\n", path,
+								strerror(-err));
+	else
+		b->n_modules++;
+
+	return 0;
+}
+
+static int symbol_map_sym_cmp(const void *pa, const void *pb)
+{
+	const struct symbol_map_sym *a = pa, *b = pb;
+
+	if (a->address != b->address)
+		return a->address < b->address ? -1 : 1;
+
+	/* aliases stay in .symtab order */
+	return a->name < b->name ? -1 : a->name > b->name;
+}
+
+static int builder_store(struct symbol_map_builder *b,
+						struct kmod_symbol_map *map)
+{
+	struct symbol_map_header *hdr;
+	struct symbol_map_entry *entries;
+	size_t strings, i;
+
+	strings = sizeof(*hdr) + b->n_syms * sizeof(*entries);
+	if (b->strings.used > UINT32_MAX - strings)
+		return -EFBIG;
+
+	map->size = strings + b->strings.used;
+	map->mem = malloc(map->size);
+	if (map->mem == NULL)
+		return -ENOMEM;
+
+	qsort(b->syms, b->n_syms, sizeof(*b->syms), symbol_map_sym_cmp);
+
+	hdr = map->mem;
+	hdr->magic = htobe32(SYMBOL_MAP_MAGIC);
+	hdr->version = htobe32(SYMBOL_MAP_VERSION);
+	hdr->n_modules = htobe32(b->n_modules);
+	hdr->n_symbols = htobe32(b->n_syms);
+
+	entries = (void *) (hdr + 1);
+	for (i = 0; i < b->n_syms; i++) {
+		const struct symbol_map_sym *sym = &b->syms[i];
+
+		entries[i].address = htobe64(sym->address);
+		entries[i].size = htobe64(sym->size);
+		entries[i].name = htobe32(strings + sym->name);
+		entries[i].module = htobe32(strings + sym->module);
+	}
+
+	if (b->strings.used > 0)
+		memcpy((char *) map->mem + strings, b->strings.bytes,
+							b->strings.used);
+
+	map->n_modules = b->n_modules;
+	map->n_symbols = b->n_syms;
+	map->entries = entries;
+
+	return 0;
+}
+
+/**
+ * kmod_symbol_map_new:
+ * @ctx: kmod library context
+ * @map: where to save the created map. Use kmod_symbol_map_unref() to
+ *       release it.
+ *
+ * Create the symbol map of the modules currently loaded in kernel: the
+ * functions and objects in the .symtab of each module, at the addresses of
+ * the sections they were loaded in. Modules are looked up in the indexes of
+ * @ctx to find their files; the ones not there are left out, as are symbols
+ * in init sections. The map is a snapshot: it's not updated when modules are
+ * loaded or removed afterwards.
+ *
+ * Section addresses are hidden from users without CAP_SYSLOG by the
+ * kernel.kptr_restrict sysctl, in which case -EPERM is returned.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_symbol_map_new(struct kmod_ctx *ctx,
+					struct kmod_symbol_map **map)
+{
+	struct symbol_map_builder b = { .ctx = ctx, .dirfd = -1 };
+	struct kmod_list *list = NULL, *itr;
+	struct kmod_symbol_map *m;
+	int err;
+
+	if (ctx == NULL || map == NULL)
+		return -ENOENT;
+
+	strbuf_init(&b.strings);
+
+	err = kmod_module_new_from_loaded(ctx, &list);
+	if (err < 0)
+		goto out;
+
+	b.dirfd = open("/sys/module", O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (b.dirfd < 0) {
+		err = -errno;
+		ERR(ctx, "could not open /sys/module: %m\n");
+		goto out;
+	}
+
+	kmod_list_foreach(itr, list) {
+		struct kmod_module *mod = kmod_module_get_module(itr);
+
+		err = builder_add_module(&b, mod);
+		kmod_module_unref(mod);
+		if (err < 0)
+			goto out;
+	}
+
+	if (b.n_syms == 0 && b.n_hidden > 0) {
+		ERR(ctx, "section addresses are hidden, see kernel.kptr_restrict\n");
+		err = -EPERM;
+		goto out;
+	}
+
+	m = calloc(1, sizeof(struct kmod_symbol_map));
+	if (m == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = builder_store(&b, m);
+	if (err < 0) {
+		free(m);
+		goto out;
+	}
+
+	m->ctx = kmod_ref(ctx);
+	m->refcount = 1;
+	*map = m;
+
+	DBG(ctx, "symbol map %p with %u symbols of %u modules\n", m,
+						m->n_symbols, m->n_modules);
+
+out:
+	if (b.dirfd >= 0)
+		close(b.dirfd);
+	kmod_module_unref_list(list);
+	free(b.sections);
+	free(b.syms);
+	strbuf_release(&b.strings);
+	return err;
+}
+
+/**
+ * kmod_symbol_map_new_from_file:
+ * @ctx: kmod library context
+ * @filename: file written by kmod_symbol_map_write()
+ * @map: where to save the map. Use kmod_symbol_map_unref() to release it.
+ *
+ * Map a symbol map previously written to @filename. Lookups are done in
+ * place, without reading the whole file.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_symbol_map_new_from_file(struct kmod_ctx *ctx,
+						const char *filename,
+						struct kmod_symbol_map **map)
+{
+	struct kmod_symbol_map *m;
+	struct stat st;
+	int fd, err;
+
+	if (ctx == NULL || filename == NULL || map == NULL)
+		return -ENOENT;
+
+	fd = open(filename, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) {
+		err = -errno;
+		DBG(ctx, "open(%s): %m\n", filename);
+		return err;
+	}
+
+	m = calloc(1, sizeof(struct kmod_symbol_map));
+	if (m == NULL) {
+		err = -ENOMEM;
+		goto fail_close;
+	}
+
+	m->ctx = ctx;
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		goto fail_free;
+	}
+
+	if (st.st_size < (off_t) sizeof(struct symbol_map_header)) {
+		ERR(ctx, "%s: too small for a symbol map\n", filename);
+		err = -EINVAL;
+		goto fail_free;
+	}
+
+	m->size = st.st_size;
+	m->mem = mmap(NULL, m->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m->mem == MAP_FAILED) {
+		err = -errno;
+		ERR(ctx, "mmap(%s, %zu): %m\n", filename, m->size);
+		goto fail_free;
+	}
+	m->mapped = true;
+
+	if (!symbol_map_is_valid(m, filename)) {
+		err = -EINVAL;
+		symbol_map_free(m);
+		goto fail_close;
+	}
+
+	close(fd);
+
+	m->ctx = kmod_ref(ctx);
+	m->refcount = 1;
+	*map = m;
+
+	DBG(ctx, "%s: %u symbols of %u modules\n", filename, m->n_symbols,
+								m->n_modules);
+
+	return 0;
+
+fail_free:
+	free(m);
+fail_close:
+	close(fd);
+	return err;
+}
+
+/**
+ * kmod_symbol_map_ref:
+ * @map: symbol map
+ *
+ * Take a reference of the symbol map.
+ *
+ * Returns: the passed map with its refcount incremented.
+ */
+KMOD_EXPORT struct kmod_symbol_map *kmod_symbol_map_ref(
+					struct kmod_symbol_map *map)
+{
+	if (map == NULL)
+		return NULL;
+
+	map->refcount++;
+	return map;
+}
+
+/**
+ * kmod_symbol_map_unref:
+ * @map: symbol map
+ *
+ * Drop a reference of the symbol map. If the refcount reaches zero, its
+ * resources are released.
+ *
+ * Returns: NULL if @map was freed, otherwise @map itself.
+ */
+KMOD_EXPORT struct kmod_symbol_map *kmod_symbol_map_unref(
+					struct kmod_symbol_map *map)
+{
+	struct kmod_ctx *ctx;
+
+	if (map == NULL)
+		return NULL;
+
+	if (--map->refcount > 0)
+		return map;
+
+	ctx = map->ctx;
+	DBG(ctx, "kmod_symbol_map %p released\n", map);
+	symbol_map_free(map);
+	kmod_unref(ctx);
+	return NULL;
+}
+
+/**
+ * kmod_symbol_map_write:
+ * @map: symbol map
+ * @fd: file descriptor to write to
+ *
+ * Write @map to @fd, to be mapped back with kmod_symbol_map_new_from_file().
+ * The format is the same regardless of the endianness of the machine.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_symbol_map_write(const struct kmod_symbol_map *map,
+									int fd)
+{
+	ssize_t r;
+
+	if (map == NULL || fd < 0)
+		return -ENOENT;
+
+	r = write_str_safe(fd, map->mem, map->size);
+	if (r < 0)
+		return r;
+	if ((size_t) r != map->size)
+		return -EIO;
+
+	return 0;
+}
+
+/**
+ * kmod_symbol_map_get_count:
+ * @map: symbol map
+ *
+ * Get the number of symbols in @map.
+ *
+ * Returns: the number of symbols.
+ */
+KMOD_EXPORT unsigned int kmod_symbol_map_get_count(
+					const struct kmod_symbol_map *map)
+{
+	if (map == NULL)
+		return 0;
+
+	return map->n_symbols;
+}
+
+/**
+ * kmod_symbol_map_lookup:
+ * @map: symbol map
+ * @address: address to look up
+ * @module: where to save the name of the module, or NULL
+ * @symbol: where to save the name of the symbol, or NULL
+ * @offset: where to save the offset of @address in the symbol, or NULL
+ *
+ * Find the symbol @address belongs to: the one at or closest before it,
+ * provided @address is within its size. Symbols without a size in .symtab,
+ * as labels defined in assembly, extend to the end of their section. The
+ * strings returned are owned by @map and valid while it's referenced.
+ *
+ * Returns: 0 on success, -ENOENT if no symbol contains @address.
+ */
+KMOD_EXPORT int kmod_symbol_map_lookup(const struct kmod_symbol_map *map,
+					uint64_t address, const char **module,
+					const char **symbol, uint64_t *offset)
+{
+	const struct symbol_map_entry *e, *last;
+	uint64_t start;
+	uint32_t lo, hi;
+
+	if (map == NULL)
+		return -ENOENT;
+
+	/* first entry after address */
+	lo = 0;
+	hi = map->n_symbols;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+
+		if (be64toh(map->entries[mid].address) <= address)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == 0)
+		return -ENOENT;
+
+	/* of aliases, the first one containing address */
+	last = &map->entries[lo - 1];
+	start = be64toh(last->address);
+	e = last;
+	while (e > map->entries && be64toh(e[-1].address) == start)
+		e--;
+
+	for (; e <= last; e++) {
+		if (address - start < be64toh(e->size) || address == start)
+			break;
+	}
+	if (e > last)
+		return -ENOENT;
+
+	if (module != NULL)
+		*module = map_string(map, e->module);
+	if (symbol != NULL)
+		*symbol = map_string(map, e->name);
+	if (offset != NULL)
+		*offset = address - start;
+
+	return 0;
+}
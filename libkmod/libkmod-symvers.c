@@ -0,0 +1,277 @@
+/*
+ * libkmod - interface to kernel module operations
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <shared/hash.h>
+#include <shared/util.h>
+
+#include "libkmod.h"
+#include "libkmod-internal.h"
+
+#define SYMVERS_HASH_SIZE (4096)
+
+/**
+ * SECTION:libkmod-symvers
+ * @short_description: symbol versions of a kernel build
+ *
+ * A Module.symvers file, as generated by the kernel build, lists the CRC of
+ * every exported symbol together with who exports it. It's loaded once into
+ * a hash table so any number of modules can be checked against it.
+ */
+
+/**
+ * kmod_symvers:
+ *
+ * Opaque object representing the contents of a Module.symvers file.
+ */
+struct kmod_symvers {
+	struct kmod_ctx *ctx;
+	struct hash *symbols;
+	int refcount;
+};
+
+struct kmod_symver {
+	uint64_t crc;
+	const char *owner; /* points inside name[] */
+	char name[];
+};
+
+static struct kmod_symver *kmod_symver_new(const char *name, const char *owner,
+								uint64_t crc)
+{
+	struct kmod_symver *sv;
+	size_t namelen = strlen(name) + 1;
+	size_t ownerlen = strlen(owner) + 1;
+
+	sv = malloc(sizeof(struct kmod_symver) + namelen + ownerlen);
+	if (sv == NULL)
+		return NULL;
+
+	sv->crc = crc;
+	memcpy(sv->name, name, namelen);
+	memcpy(sv->name + namelen, owner, ownerlen);
+	sv->owner = sv->name + namelen;
+
+	return sv;
+}
+
+/**
+ * kmod_symvers_new_from_file:
+ * @ctx: kmod library context
+ * @filename: path to a Module.symvers file
+ * @symvers: where to save the created symvers object. Use
+ *           kmod_symvers_unref() to release it.
+ *
+ * Load all the symbol versions from @filename. Lines are in the format
+ * generated by modpost: CRC, symbol, module (or vmlinux) and export type,
+ * separated by whitespace.
+ *
+ * Returns: 0 on success or < 0 otherwise. It fails if the file can't be
+ * read or on lack of memory; malformed lines are logged and skipped.
+ */
+KMOD_EXPORT int kmod_symvers_new_from_file(struct kmod_ctx *ctx,
+						const char *filename,
+						struct kmod_symvers **symvers)
+{
+	struct kmod_symvers *sv;
+	char line[10240];
+	unsigned int linenum = 0;
+	FILE *fp;
+	int err = 0;
+
+	if (ctx == NULL || filename == NULL || symvers == NULL)
+		return -ENOENT;
+
+	fp = fopen(filename, "re");
+	if (fp == NULL) {
+		err = -errno;
+		DBG(ctx, "could not open '%s': %m\n", filename);
+		return err;
+	}
+
+	sv = calloc(1, sizeof(struct kmod_symvers));
+	if (sv == NULL) {
+		err = -ENOMEM;
+		goto fail_close;
+	}
+
+	sv->symbols = hash_new(SYMVERS_HASH_SIZE, free);
+	if (sv->symbols == NULL) {
+		err = -ENOMEM;
+		goto fail_free;
+	}
+
+	/* eg. "0xb352177e\tfind_first_bit\tvmlinux\tEXPORT_SYMBOL" */
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		const char *ver, *sym, *where;
+		struct kmod_symver *s;
+		char *verend;
+		uint64_t crc;
+
+		linenum++;
+
+		ver = strtok(line, " \t\n");
+		sym = strtok(NULL, " \t\n");
+		where = strtok(NULL, " \t\n");
+		if (!ver || !sym || !where)
+			continue;
+
+		crc = strtoull(ver, &verend, 16);
+		if (verend[0] != '\0') {
+			ERR(ctx, "%s:%u Invalid symbol version %s\n",
+			    filename, linenum, ver);
+			continue;
+		}
+
+		s = kmod_symver_new(sym, where, crc);
+		if (s == NULL) {
+			err = -ENOMEM;
+			goto fail_hash;
+		}
+
+		err = hash_add(sv->symbols, s->name, s);
+		if (err < 0) {
+			free(s);
+			goto fail_hash;
+		}
+	}
+
+	fclose(fp);
+
+	sv->ctx = kmod_ref(ctx);
+	sv->refcount = 1;
+	*symvers = sv;
+
+	DBG(ctx, "loaded %u symbol versions from %s\n",
+	    hash_get_count(sv->symbols), filename);
+
+	return 0;
+
+fail_hash:
+	hash_free(sv->symbols);
+fail_free:
+	free(sv);
+fail_close:
+	fclose(fp);
+	return err;
+}
+
+/**
+ * kmod_symvers_ref:
+ * @symvers: symvers object
+ *
+ * Take a reference of the symvers object.
+ *
+ * Returns: the passed symvers object with its refcount incremented.
+ */
+KMOD_EXPORT struct kmod_symvers *kmod_symvers_ref(struct kmod_symvers *symvers)
+{
+	if (symvers == NULL)
+		return NULL;
+
+	symvers->refcount++;
+	return symvers;
+}
+
+/**
+ * kmod_symvers_unref:
+ * @symvers: symvers object
+ *
+ * Drop a reference of the symvers object. If the refcount reaches zero,
+ * its resources are released.
+ *
+ * Returns: NULL if @symvers was freed, otherwise @symvers itself.
+ */
+KMOD_EXPORT struct kmod_symvers *kmod_symvers_unref(struct kmod_symvers *symvers)
+{
+	if (symvers == NULL)
+		return NULL;
+
+	if (--symvers->refcount > 0)
+		return symvers;
+
+	DBG(symvers->ctx, "kmod_symvers %p released\n", symvers);
+
+	hash_free(symvers->symbols);
+	kmod_unref(symvers->ctx);
+	free(symvers);
+	return NULL;
+}
+
+/**
+ * kmod_symvers_get_crc:
+ * @symvers: symvers object
+ * @symbol: name of the exported symbol
+ * @crc: where to save the symbol's CRC
+ *
+ * Look up @symbol in @symvers.
+ *
+ * Returns: 0 if the symbol was found, -ENOENT otherwise.
+ */
+KMOD_EXPORT int kmod_symvers_get_crc(const struct kmod_symvers *symvers,
+						const char *symbol,
+						uint64_t *crc)
+{
+	const struct kmod_symver *sv;
+
+	if (symvers == NULL || symbol == NULL || crc == NULL)
+		return -ENOENT;
+
+	sv = kmod_symvers_find(symvers, symbol);
+	if (sv == NULL)
+		return -ENOENT;
+
+	*crc = sv->crc;
+	return 0;
+}
+
+const struct kmod_symver *kmod_symvers_find(const struct kmod_symvers *symvers,
+							const char *symbol)
+{
+	return hash_find(symvers->symbols, symbol);
+}
+
+uint64_t kmod_symver_get_crc(const struct kmod_symver *sv)
+{
+	return sv->crc;
+}
+
+const char *kmod_symver_get_owner(const struct kmod_symver *sv)
+{
+	return sv->owner;
+}
+
+void kmod_symvers_foreach(const struct kmod_symvers *symvers,
+			  void (*cb)(const char *symbol,
+				     const struct kmod_symver *sv, void *data),
+			  void *data)
+{
+	struct hash_iter iter;
+	const char *key;
+	const void *v;
+
+	hash_iter_init(symvers->symbols, &iter);
+	while (hash_iter_next(&iter, &key, &v))
+		cb(key, v, data);
+}
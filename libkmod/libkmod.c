@@ -28,6 +28,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 
@@ -42,6 +43,11 @@
 #define KMOD_LRU_MAX (128)
 #define _KMOD_INDEX_MODULES_SIZE KMOD_INDEX_MODULES_BUILTIN + 1
 
+/* anything that would change the stamp of a watched file or directory */
+#define NOTIFY_MASK (IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE \
+		     | IN_DELETE_SELF | IN_MOVE_SELF | IN_MOVED_FROM \
+		     | IN_MOVED_TO)
+
 /**
  * SECTION:libkmod
  * @short_description: libkmod context
@@ -81,10 +87,27 @@ struct kmod_ctx {
 	void *log_data;
 	const void *userdata;
 	char *dirname;
-	struct kmod_config *config;
+	char **config_paths;
+	struct kmod_config *config; /* NULL until first needed */
+	int config_err; /* why it couldn't be read, not to retry every lookup */
 	struct hash *modules_by_name;
 	struct index_mm *indexes[_KMOD_INDEX_MODULES_SIZE];
 	unsigned long long indexes_stamp[_KMOD_INDEX_MODULES_SIZE];
+	struct kmod_monitor *monitor;
+	struct kmod_archive *archive;
+	struct kmod_file_cache file_cache;
+
+	/*
+	 * inotify fd watching the config paths and dirname, used by
+	 * kmod_validate_resources() instead of stat()'ing everything. It's -1
+	 * until first needed, and stays so if inotify is not available.
+	 */
+	int notify_fd;
+	int notify_dir_wd;
+	bool notify_unavailable : 1;
+	bool notify_overflow : 1;
+	bool notify_config : 1;
+	unsigned int notify_indexes;
 };
 
 void kmod_log(const struct kmod_ctx *ctx,
@@ -238,8 +261,9 @@ static char *get_kernel_release(const char *dirname)
  *                /lib/modprobe.d. Give an empty vector if configuration should
  *                not be read. This array must be null terminated.
  *
- * Create kmod library context. This reads the kmod configuration
- * and fills in the default values.
+ * Create kmod library context. The configuration is read the first time it's
+ * needed, e.g. to look up aliases or options, so operations that don't use it,
+ * as listing the loaded modules, don't pay for reading it.
  *
  * The initial refcount is 1, and needs to be decremented to
  * release the resources of the kmod library context.
@@ -251,7 +275,6 @@ KMOD_EXPORT struct kmod_ctx *kmod_new(const char *dirname,
 {
 	const char *env;
 	struct kmod_ctx *ctx;
-	int err;
 
 	ctx = calloc(1, sizeof(struct kmod_ctx));
 	if (!ctx)
@@ -261,6 +284,8 @@ KMOD_EXPORT struct kmod_ctx *kmod_new(const char *dirname,
 	ctx->log_fn = log_filep;
 	ctx->log_data = stderr;
 	ctx->log_priority = LOG_ERR;
+	ctx->notify_fd = -1;
+	ctx->file_cache.budget = KMOD_FILE_CACHE_BUDGET;
 
 	ctx->dirname = get_kernel_release(dirname);
 
@@ -271,8 +296,8 @@ KMOD_EXPORT struct kmod_ctx *kmod_new(const char *dirname,
 
 	if (config_paths == NULL)
 		config_paths = default_config_paths;
-	err = kmod_config_new(ctx, &ctx->config, config_paths);
-	if (err < 0) {
+	ctx->config_paths = kmod_config_paths_dup(config_paths);
+	if (ctx->config_paths == NULL) {
 		ERR(ctx, "could not create config\n");
 		goto fail;
 	}
@@ -290,6 +315,7 @@ KMOD_EXPORT struct kmod_ctx *kmod_new(const char *dirname,
 
 fail:
 	free(ctx->modules_by_name);
+	free(ctx->config_paths);
 	free(ctx->dirname);
 	free(ctx);
 	return NULL;
@@ -331,10 +357,14 @@ KMOD_EXPORT struct kmod_ctx *kmod_unref(struct kmod_ctx *ctx)
 	INFO(ctx, "context %p released\n", ctx);
 
 	kmod_unload_resources(ctx);
+	kmod_archive_unref(ctx->archive);
 	hash_free(ctx->modules_by_name);
 	free(ctx->dirname);
+	free(ctx->config_paths);
 	if (ctx->config)
 		kmod_config_free(ctx->config);
+	if (ctx->notify_fd >= 0)
+		close(ctx->notify_fd);
 
 	free(ctx);
 	return NULL;
@@ -630,7 +660,7 @@ finish:
 int kmod_lookup_alias_from_config(struct kmod_ctx *ctx, const char *name,
 						struct kmod_list **list)
 {
-	struct kmod_config *config = ctx->config;
+	const struct kmod_config *config = kmod_get_config(ctx);
 	struct kmod_list *l;
 	int err, nmatch = 0;
 
@@ -664,7 +694,7 @@ fail:
 int kmod_lookup_alias_from_commands(struct kmod_ctx *ctx, const char *name,
 						struct kmod_list **list)
 {
-	struct kmod_config *config = ctx->config;
+	const struct kmod_config *config = kmod_get_config(ctx);
 	struct kmod_list *l, *node;
 	int err, nmatch = 0;
 
@@ -760,6 +790,189 @@ void kmod_set_modules_required(struct kmod_ctx *ctx, bool required)
 		kmod_module_set_required((struct kmod_module *)v, required);
 }
 
+static void notify_watch_config(struct kmod_ctx *ctx)
+{
+	struct kmod_list *l;
+
+	/* watched once read, see ctx_load_config() */
+	if (ctx->config == NULL)
+		return;
+
+	kmod_list_foreach(l, ctx->config->paths) {
+		struct kmod_config_path *cf = l->data;
+
+		if (inotify_add_watch(ctx->notify_fd, cf->path, NOTIFY_MASK) < 0)
+			DBG(ctx, "could not watch '%s': %m\n", cf->path);
+	}
+}
+
+static int notify_setup(struct kmod_ctx *ctx)
+{
+	int err;
+
+	ctx->notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (ctx->notify_fd < 0) {
+		err = -errno;
+		goto fail;
+	}
+
+	/* indexes and modules.softdep */
+	ctx->notify_dir_wd = inotify_add_watch(ctx->notify_fd, ctx->dirname,
+								NOTIFY_MASK);
+	if (ctx->notify_dir_wd < 0) {
+		err = -errno;
+		close(ctx->notify_fd);
+		ctx->notify_fd = -1;
+		goto fail;
+	}
+
+	notify_watch_config(ctx);
+
+	return 0;
+
+fail:
+	DBG(ctx, "change notification not available: %s\n", strerror(-err));
+	ctx->notify_unavailable = true;
+	return err;
+}
+
+static void notify_process(struct kmod_ctx *ctx,
+					const struct inotify_event *ev)
+{
+	size_t i;
+
+	if (ev->mask & IN_Q_OVERFLOW) {
+		ctx->notify_overflow = true;
+		return;
+	}
+
+	if (ev->wd != ctx->notify_dir_wd) {
+		ctx->notify_config = true;
+		return;
+	}
+
+	/* dirname itself was touched, moved or removed */
+	if (ev->len == 0) {
+		ctx->notify_config = true;
+		ctx->notify_indexes = ~0U;
+		return;
+	}
+
+	if (streq(ev->name, "modules.softdep")) {
+		ctx->notify_config = true;
+		return;
+	}
+
+	for (i = 0; i < _KMOD_INDEX_MODULES_SIZE; i++) {
+		size_t len = strlen(index_files[i].fn);
+
+		if (strncmp(ev->name, index_files[i].fn, len) == 0
+					&& streq(ev->name + len, ".bin")) {
+			ctx->notify_indexes |= 1U << i;
+			return;
+		}
+	}
+}
+
+/* fold all pending events into the notify_* flags, never blocks */
+static void notify_read(struct kmod_ctx *ctx)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+	if (ctx->notify_fd < 0)
+		return;
+
+	for (;;) {
+		const char *p;
+		ssize_t len;
+
+		len = read(ctx->notify_fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				ctx->notify_overflow = true;
+			return;
+		}
+
+		for (p = buf; p < buf + len; ) {
+			const struct inotify_event *ev = (const void *)p;
+
+			notify_process(ctx, ev);
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+}
+
+static int ctx_load_config(struct kmod_ctx *ctx)
+{
+	int err;
+
+	if (ctx->config != NULL)
+		return 0;
+
+	if (ctx->config_err < 0)
+		return ctx->config_err;
+
+	/* events up to here are about what is going to be read now */
+	notify_read(ctx);
+
+	err = kmod_config_new(ctx, &ctx->config,
+				(const char * const *)ctx->config_paths);
+	if (err < 0) {
+		ERR(ctx, "could not create config\n");
+		ctx->config_err = err;
+		return err;
+	}
+
+	ctx->notify_config = false;
+	if (ctx->notify_fd >= 0)
+		notify_watch_config(ctx);
+
+	return 0;
+}
+
+/**
+ * kmod_get_resources_fd:
+ * @ctx: kmod library context
+ *
+ * Get a file descriptor that becomes readable when the configuration or the
+ * indexes may have changed on disk. It can be added to the user's event loop
+ * and, when it's readable, kmod_validate_resources() tells what to do. Do not
+ * read from it nor close it: it belongs to @ctx.
+ *
+ * The same mechanism is used internally by kmod_validate_resources() so it
+ * doesn't need to stat every file on each call. When it's not available,
+ * e.g. because the inotify limits were reached, validation falls back to
+ * checking the timestamps.
+ *
+ * Returns: the file descriptor or < 0 on error.
+ */
+KMOD_EXPORT int kmod_get_resources_fd(struct kmod_ctx *ctx)
+{
+	int err;
+
+	if (ctx == NULL)
+		return -ENOENT;
+
+	if (ctx->notify_fd >= 0)
+		return ctx->notify_fd;
+
+	if (ctx->notify_unavailable)
+		return -ENOTSUP;
+
+	/* changes are reported relative to what's loaded in ctx */
+	err = ctx_load_config(ctx);
+	if (err < 0)
+		return err;
+
+	err = notify_setup(ctx);
+	if (err < 0)
+		return err;
+
+	return ctx->notify_fd;
+}
+
 static bool is_cache_invalid(const char *path, unsigned long long stamp)
 {
 	struct stat st;
@@ -778,21 +991,54 @@ static bool is_cache_invalid(const char *path, unsigned long long stamp)
  * @ctx: kmod library context
  *
  * Check if indexes and configuration files changed on disk and the current
- * context is not valid anymore.
+ * context is not valid anymore. The first call starts watching them as
+ * described in kmod_get_resources_fd(), so the following ones only need to
+ * look at the pending events.
  *
  * Returns: KMOD_RESOURCES_OK if resources are still valid,
  * KMOD_RESOURCES_MUST_RELOAD if it's sufficient to call
  * kmod_unload_resources() and kmod_load_resources() or
- * KMOD_RESOURCES_MUST_RECREATE if @ctx must be re-created.
+ * KMOD_RESOURCES_MUST_RECREATE if @ctx must be re-created. The latter is
+ * also returned when only the configuration changed: in that case calling
+ * kmod_reload_config() is enough to make @ctx valid again.
  */
 KMOD_EXPORT int kmod_validate_resources(struct kmod_ctx *ctx)
 {
 	struct kmod_list *l;
 	size_t i;
 
-	if (ctx == NULL || ctx->config == NULL)
+	if (ctx == NULL || ctx_load_config(ctx) < 0)
 		return KMOD_RESOURCES_MUST_RECREATE;
 
+	if (ctx->notify_fd >= 0) {
+		notify_read(ctx);
+
+		if (!ctx->notify_overflow) {
+			if (ctx->notify_config)
+				return KMOD_RESOURCES_MUST_RECREATE;
+
+			for (i = 0; i < _KMOD_INDEX_MODULES_SIZE; i++) {
+				if (ctx->indexes[i] != NULL &&
+					ctx->archive == NULL &&
+					(ctx->notify_indexes & (1U << i)))
+					return KMOD_RESOURCES_MUST_RELOAD;
+			}
+
+			return KMOD_RESOURCES_OK;
+		}
+
+		/* events were lost, the stamps below are the reference */
+		ctx->notify_overflow = false;
+		ctx->notify_config = false;
+		ctx->notify_indexes = 0;
+	} else if (!ctx->notify_unavailable) {
+		/*
+		 * Start watching now; what changed before is still caught by
+		 * the stamps checked below.
+		 */
+		notify_setup(ctx);
+	}
+
 	kmod_list_foreach(l, ctx->config->paths) {
 		struct kmod_config_path *cf = l->data;
 
@@ -800,10 +1046,19 @@ KMOD_EXPORT int kmod_validate_resources(struct kmod_ctx *ctx)
 			return KMOD_RESOURCES_MUST_RECREATE;
 	}
 
+	/* files may be rewritten in place without touching their directory */
+	kmod_list_foreach(l, ctx->config->files) {
+		struct kmod_config_file *cf = l->data;
+
+		if (is_cache_invalid(cf->path, cf->stamp))
+			return KMOD_RESOURCES_MUST_RECREATE;
+	}
+
 	for (i = 0; i < _KMOD_INDEX_MODULES_SIZE; i++) {
 		char path[PATH_MAX];
 
-		if (ctx->indexes[i] == NULL)
+		/* the archive stays mapped, whatever happens to its file */
+		if (ctx->indexes[i] == NULL || ctx->archive != NULL)
 			continue;
 
 		snprintf(path, sizeof(path), "%s/%s.bin", ctx->dirname,
@@ -816,13 +1071,85 @@ KMOD_EXPORT int kmod_validate_resources(struct kmod_ctx *ctx)
 	return KMOD_RESOURCES_OK;
 }
 
+/**
+ * kmod_reload_config:
+ * @ctx: kmod library context
+ *
+ * Read the configuration again from the paths given to kmod_new(). Only the
+ * files that were added, removed or changed since the configuration was last
+ * read are parsed; the others keep their entries. Indexes loaded with
+ * kmod_load_resources() and module objects remain valid: modules affected by
+ * the changed files just drop the options and commands they had cached.
+ *
+ * The new configuration is fully read before it replaces the current one, so
+ * on failure @ctx keeps using the previous configuration. Iterators returned
+ * by kmod_config_get_blacklists() and friends must be released before
+ * calling this function.
+ *
+ * Returns: 1 if the configuration changed, 0 if it's up to date or < 0 on
+ * error.
+ */
+KMOD_EXPORT int kmod_reload_config(struct kmod_ctx *ctx)
+{
+	struct kmod_config *config;
+	struct hash_iter iter;
+	const void *v;
+	int ret;
+
+	if (ctx == NULL)
+		return -ENOENT;
+
+	/* asked explicitly, so try again if it failed before */
+	ctx->config_err = 0;
+	ret = ctx_load_config(ctx);
+	if (ret < 0)
+		return ret;
+
+	notify_read(ctx);
+
+	ret = kmod_config_reload(ctx->config, &config);
+	if (ret < 0) {
+		ERR(ctx, "could not reload config: %s\n", strerror(-ret));
+		return ret;
+	}
+
+	if (ret > 0) {
+		hash_iter_init(ctx->modules_by_name, &iter);
+		while (hash_iter_next(&iter, NULL, &v))
+			kmod_module_invalidate_config((struct kmod_module *)v,
+							ctx->config, config);
+	}
+
+	kmod_config_free(ctx->config);
+	ctx->config = config;
+	ctx->notify_config = false;
+
+	/* config paths may have been created since they were first watched */
+	if (ctx->notify_fd >= 0)
+		notify_watch_config(ctx);
+
+	DBG(ctx, "config reloaded, changed=%d\n", ret);
+
+	return ret;
+}
+
+static struct index_mm *archive_open_index(struct kmod_archive *archive,
+								size_t i)
+{
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), "%s.bin", index_files[i].fn);
+	return kmod_archive_open_index(archive, name);
+}
+
 /**
  * kmod_load_resources:
  * @ctx: kmod library context
  *
  * Load indexes and keep them open in @ctx. This way it's faster to lookup
  * information within the indexes. If this function is not called before a
- * search, the necessary index is always opened and closed.
+ * search, the necessary index is always opened and closed. The configuration
+ * is read too, if it wasn't yet.
  *
  * If user will do more than one or two lookups, insertions, deletions, most
  * likely it's good to call this function first. Particularly in a daemon like
@@ -838,6 +1165,12 @@ KMOD_EXPORT int kmod_load_resources(struct kmod_ctx *ctx)
 	if (ctx == NULL)
 		return -ENOENT;
 
+	if (ctx_load_config(ctx) < 0)
+		return -ENOMEM;
+
+	/* events up to here are about what is going to be loaded now */
+	notify_read(ctx);
+
 	for (i = 0; i < _KMOD_INDEX_MODULES_SIZE; i++) {
 		char path[PATH_MAX];
 
@@ -847,6 +1180,13 @@ KMOD_EXPORT int kmod_load_resources(struct kmod_ctx *ctx)
 			continue;
 		}
 
+		ctx->notify_indexes &= ~(1U << i);
+
+		if (ctx->archive != NULL) {
+			ctx->indexes[i] = archive_open_index(ctx->archive, i);
+			continue;
+		}
+
 		snprintf(path, sizeof(path), "%s/%s.bin", ctx->dirname,
 							index_files[i].fn);
 		ctx->indexes[i] = index_mm_open(ctx, path,
@@ -893,6 +1233,120 @@ KMOD_EXPORT void kmod_unload_resources(struct kmod_ctx *ctx)
 	}
 }
 
+/**
+ * kmod_load_archive:
+ * @ctx: kmod library context
+ * @filename: module archive, as created by "kmod archive"
+ *
+ * Use the modules and indexes packed in @filename instead of the ones under
+ * the dirname of @ctx. The indexes are loaded right away as if
+ * kmod_load_resources() was called, and later calls to it load them from the
+ * archive again; an index that is empty or missing in the archive is not
+ * loaded, so it's searched on the filesystem as usual. Modules found in the
+ * archive are inserted straight from its mapping, so they don't need to exist
+ * as separate files.
+ *
+ * This is meant for the early boot, where an initramfs can ship a single
+ * archive instead of a module tree.
+ *
+ * Returns: 0 on success or < 0 otherwise. On failure @ctx keeps using
+ * whatever it was using before.
+ */
+KMOD_EXPORT int kmod_load_archive(struct kmod_ctx *ctx, const char *filename)
+{
+	struct kmod_archive *archive;
+	size_t i;
+	int err;
+
+	if (ctx == NULL || filename == NULL)
+		return -ENOENT;
+
+	err = kmod_archive_open(ctx, filename, &archive);
+	if (err < 0) {
+		ERR(ctx, "could not load module archive %s: %s\n", filename,
+								strerror(-err));
+		return err;
+	}
+
+	kmod_unload_resources(ctx);
+	kmod_archive_unref(ctx->archive);
+	ctx->archive = archive;
+
+	for (i = 0; i < _KMOD_INDEX_MODULES_SIZE; i++)
+		ctx->indexes[i] = archive_open_index(archive, i);
+
+	return 0;
+}
+
+/**
+ * kmod_set_file_cache_budget:
+ * @ctx: kmod library context
+ * @budget: bytes, 0 for no limit
+ *
+ * Files of modules are kept open once libkmod needs to look inside them,
+ * decompressed if they are compressed, so asking for more information about
+ * the same module is cheap. When the size of these files goes over @budget,
+ * the least recently used ones are closed, and opened again if needed later.
+ * The file of a module is closed right away once it's inserted.
+ *
+ * The default budget is 64 MiB.
+ */
+KMOD_EXPORT void kmod_set_file_cache_budget(struct kmod_ctx *ctx,
+								size_t budget)
+{
+	if (ctx == NULL)
+		return;
+
+	ctx->file_cache.budget = budget;
+	if (budget > 0)
+		kmod_module_trim_files(ctx, budget);
+}
+
+/**
+ * kmod_get_file_cache_budget:
+ * @ctx: kmod library context
+ *
+ * Returns: the size in bytes over which module files are closed, 0 if
+ * there's no limit. See kmod_set_file_cache_budget().
+ */
+KMOD_EXPORT size_t kmod_get_file_cache_budget(const struct kmod_ctx *ctx)
+{
+	if (ctx == NULL)
+		return 0;
+
+	return ctx->file_cache.budget;
+}
+
+/**
+ * kmod_get_file_cache_size:
+ * @ctx: kmod library context
+ *
+ * Returns: the size in bytes of the module files @ctx currently keeps open.
+ */
+KMOD_EXPORT size_t kmod_get_file_cache_size(const struct kmod_ctx *ctx)
+{
+	if (ctx == NULL)
+		return 0;
+
+	return ctx->file_cache.size;
+}
+
+/**
+ * kmod_ctx_trim:
+ * @ctx: kmod library context
+ *
+ * Close all module files kept open by @ctx, e.g. after a burst of module
+ * insertions or lookups. They are opened again when needed. Indexes are
+ * left alone: use kmod_unload_resources() for them.
+ */
+KMOD_EXPORT void kmod_ctx_trim(struct kmod_ctx *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	kmod_module_trim_files(ctx, 0);
+}
+
 /**
  * kmod_dump_index:
  * @ctx: kmod library context
@@ -942,7 +1396,212 @@ KMOD_EXPORT int kmod_dump_index(struct kmod_ctx *ctx, enum kmod_index type,
 	return 0;
 }
 
+/**
+ * kmod_index_iter:
+ *
+ * Opaque object to iterate over the entries of an index.
+ */
+struct kmod_index_iter {
+	struct kmod_ctx *ctx;
+	struct index_mm *idx; /* only if not loaded by kmod_load_resources() */
+	struct index_mm_iter *iter;
+	const char *key;
+	const char *value;
+	unsigned int priority;
+};
+
+/**
+ * kmod_index_iter_new:
+ * @ctx: kmod library context
+ * @type: index to iterate over, see kmod_dump_index() for valid indexes
+ * @prefix: only visit keys starting with this prefix; use "" to visit all
+ * @iter: where to save the created iterator. Use kmod_index_iter_free() to
+ *        release it.
+ *
+ * Create an iterator over the entries of the index @type whose key starts
+ * with @prefix, in alphabetical order of keys. The index is only read as
+ * iteration proceeds. Keys are as they are stored in the index: symbols are
+ * prefixed with "symbol:", e.g. use "symbol:mlx5_" to get all the symbols
+ * starting with "mlx5_".
+ *
+ * If the index was loaded with kmod_load_resources(), that mapping is used
+ * and the iterator must be released before calling kmod_unload_resources().
+ * Otherwise the index is mapped only for the lifetime of the iterator.
+ *
+ * Returns: 0 on success or < 0 otherwise.
+ */
+KMOD_EXPORT int kmod_index_iter_new(struct kmod_ctx *ctx, enum kmod_index type,
+						const char *prefix,
+						struct kmod_index_iter **iter)
+{
+	struct kmod_index_iter *it;
+	struct index_mm *idx;
+
+	if (ctx == NULL || prefix == NULL || iter == NULL)
+		return -ENOENT;
+
+	if (type < 0 || type >= _KMOD_INDEX_MODULES_SIZE)
+		return -ENOENT;
+
+	it = calloc(1, sizeof(*it));
+	if (it == NULL)
+		return -ENOMEM;
+
+	idx = ctx->indexes[type];
+	if (idx == NULL) {
+		char fn[PATH_MAX];
+		unsigned long long stamp;
+
+		snprintf(fn, sizeof(fn), "%s/%s.bin", ctx->dirname,
+						index_files[type].fn);
+
+		idx = it->idx = index_mm_open(ctx, fn, &stamp);
+		if (idx == NULL) {
+			free(it);
+			return -ENOSYS;
+		}
+	}
+
+	it->iter = index_mm_iter_new(idx, prefix);
+	if (it->iter == NULL) {
+		if (it->idx != NULL)
+			index_mm_close(it->idx);
+		free(it);
+		return -ENOMEM;
+	}
+
+	it->ctx = kmod_ref(ctx);
+	*iter = it;
+
+	return 0;
+}
+
+/**
+ * kmod_index_iter_next:
+ * @iter: index iterator
+ *
+ * Move @iter to the next entry. It must be called once before getting the
+ * first entry. Keys with more than one value produce one entry per value.
+ *
+ * Returns: true if @iter points to a new entry, false if there are no more
+ * entries.
+ */
+KMOD_EXPORT bool kmod_index_iter_next(struct kmod_index_iter *iter)
+{
+	if (iter == NULL)
+		return false;
+
+	if (!index_mm_iter_next(iter->iter, &iter->key, &iter->value,
+							&iter->priority)) {
+		iter->key = iter->value = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * kmod_index_iter_get_key:
+ * @iter: index iterator
+ *
+ * Returns: the key of the current entry. It's only valid until the next call
+ * to kmod_index_iter_next().
+ */
+KMOD_EXPORT const char *kmod_index_iter_get_key(const struct kmod_index_iter *iter)
+{
+	if (iter == NULL)
+		return NULL;
+
+	return iter->key;
+}
+
+/**
+ * kmod_index_iter_get_value:
+ * @iter: index iterator
+ *
+ * Returns: the value of the current entry. It's valid until @iter is freed.
+ */
+KMOD_EXPORT const char *kmod_index_iter_get_value(const struct kmod_index_iter *iter)
+{
+	if (iter == NULL)
+		return NULL;
+
+	return iter->value;
+}
+
+/**
+ * kmod_index_iter_get_priority:
+ * @iter: index iterator
+ *
+ * Returns: the priority of the current entry, i.e. the position in depmod's
+ * search order of the module that added it. The values of a key are visited
+ * in order of priority.
+ */
+KMOD_EXPORT unsigned int kmod_index_iter_get_priority(const struct kmod_index_iter *iter)
+{
+	if (iter == NULL)
+		return 0;
+
+	return iter->priority;
+}
+
+/**
+ * kmod_index_iter_free:
+ * @iter: index iterator
+ *
+ * Release the resources taken by @iter.
+ */
+KMOD_EXPORT void kmod_index_iter_free(struct kmod_index_iter *iter)
+{
+	if (iter == NULL)
+		return;
+
+	index_mm_iter_free(iter->iter);
+	if (iter->idx != NULL)
+		index_mm_close(iter->idx);
+	kmod_unref(iter->ctx);
+	free(iter);
+}
+
+/*
+ * Without memory for the configuration, behave as if there was none: callers
+ * are lookups that have no way to report the error.
+ */
 const struct kmod_config *kmod_get_config(const struct kmod_ctx *ctx)
 {
+	static const struct kmod_config empty_config;
+
+	/* lazy init */
+	if (ctx_load_config((struct kmod_ctx *)ctx) < 0)
+		return &empty_config;
+
 	return ctx->config;
 }
+
+struct kmod_monitor *kmod_get_monitor(const struct kmod_ctx *ctx)
+{
+	return ctx->monitor;
+}
+
+void kmod_set_monitor(struct kmod_ctx *ctx, struct kmod_monitor *monitor)
+{
+	ctx->monitor = monitor;
+}
+
+struct kmod_archive *kmod_get_archive(const struct kmod_ctx *ctx)
+{
+	return ctx->archive;
+}
+
+bool kmod_index_is_validated(const struct kmod_ctx *ctx, enum kmod_index type)
+{
+	if (type >= _KMOD_INDEX_MODULES_SIZE || ctx->indexes[type] == NULL)
+		return false;
+
+	return index_mm_is_validated(ctx->indexes[type]);
+}
+
+struct kmod_file_cache *kmod_get_file_cache(struct kmod_ctx *ctx)
+{
+	return &ctx->file_cache;
+}
@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <inttypes.h>
 
 #ifdef __cplusplus
@@ -65,6 +66,14 @@ enum kmod_resources {
 	KMOD_RESOURCES_MUST_RECREATE = 2,
 };
 int kmod_validate_resources(struct kmod_ctx *ctx);
+int kmod_reload_config(struct kmod_ctx *ctx);
+int kmod_get_resources_fd(struct kmod_ctx *ctx);
+int kmod_load_archive(struct kmod_ctx *ctx, const char *filename);
+
+void kmod_set_file_cache_budget(struct kmod_ctx *ctx, size_t budget);
+size_t kmod_get_file_cache_budget(const struct kmod_ctx *ctx);
+size_t kmod_get_file_cache_size(const struct kmod_ctx *ctx);
+void kmod_ctx_trim(struct kmod_ctx *ctx);
 
 enum kmod_index {
 	KMOD_INDEX_MODULES_DEP = 0,
@@ -76,6 +85,15 @@ enum kmod_index {
 };
 int kmod_dump_index(struct kmod_ctx *ctx, enum kmod_index type, int fd);
 
+struct kmod_index_iter;
+int kmod_index_iter_new(struct kmod_ctx *ctx, enum kmod_index type,
+			const char *prefix, struct kmod_index_iter **iter);
+bool kmod_index_iter_next(struct kmod_index_iter *iter);
+const char *kmod_index_iter_get_key(const struct kmod_index_iter *iter);
+const char *kmod_index_iter_get_value(const struct kmod_index_iter *iter);
+unsigned int kmod_index_iter_get_priority(const struct kmod_index_iter *iter);
+void kmod_index_iter_free(struct kmod_index_iter *iter);
+
 /*
  * kmod_list
  *
@@ -157,6 +175,7 @@ enum kmod_probe {
 	KMOD_PROBE_IGNORE_LOADED =		0x00008,
 	KMOD_PROBE_DRY_RUN =			0x00010,
 	KMOD_PROBE_FAIL_ON_LOADED =		0x00020,
+	KMOD_PROBE_PREFETCH_FIRMWARE =		0x00040,
 
 	/* codes below can be used in return value, too */
 	KMOD_PROBE_APPLY_BLACKLIST_ALL =	0x10000,
@@ -223,6 +242,22 @@ unsigned long kmod_module_section_get_address(const struct kmod_list *entry);
 void kmod_module_section_free_list(struct kmod_list *list);
 long kmod_module_get_size(const struct kmod_module *mod);
 
+/* Flags to kmod_module_get_parameters() */
+enum kmod_parameters {
+	KMOD_PARAMETERS_MODINFO = 0x1,
+};
+
+int kmod_module_get_parameters(const struct kmod_module *mod,
+				unsigned int flags, struct kmod_list **list);
+int kmod_module_get_parameters_list(const struct kmod_list *modules,
+				unsigned int flags, struct kmod_list **list);
+const char *kmod_module_parameter_get_module_name(const struct kmod_list *entry);
+const char *kmod_module_parameter_get_name(const struct kmod_list *entry);
+const char *kmod_module_parameter_get_value(const struct kmod_list *entry);
+const char *kmod_module_parameter_get_type(const struct kmod_list *entry);
+const char *kmod_module_parameter_get_description(const struct kmod_list *entry);
+void kmod_module_parameter_free_list(struct kmod_list *list);
+
 
 
 /*
@@ -258,6 +293,118 @@ int kmod_module_dependency_symbol_get_bind(const struct kmod_list *entry);
 uint64_t kmod_module_dependency_symbol_get_crc(const struct kmod_list *entry);
 void kmod_module_dependency_symbols_free_list(struct kmod_list *list);
 
+enum kmod_symbol_iter_type {
+	KMOD_SYMBOL_ITER_VERSIONS,
+	KMOD_SYMBOL_ITER_SYMBOLS,
+	KMOD_SYMBOL_ITER_DEPENDENCIES,
+};
+
+struct kmod_symbol_iter;
+int kmod_symbol_iter_new(const struct kmod_module *mod,
+				enum kmod_symbol_iter_type type,
+				struct kmod_symbol_iter **iter);
+bool kmod_symbol_iter_next(struct kmod_symbol_iter *iter);
+const char *kmod_symbol_iter_get_symbol(const struct kmod_symbol_iter *iter,
+								size_t *len);
+uint64_t kmod_symbol_iter_get_crc(const struct kmod_symbol_iter *iter);
+int kmod_symbol_iter_get_bind(const struct kmod_symbol_iter *iter);
+void kmod_symbol_iter_free(struct kmod_symbol_iter *iter);
+
+
+
+/*
+ * kmod_symvers
+ *
+ * Symbol versions of a kernel build, used to check if modules are compatible
+ * with it
+ */
+struct kmod_symvers;
+int kmod_symvers_new_from_file(struct kmod_ctx *ctx, const char *filename,
+						struct kmod_symvers **symvers);
+struct kmod_symvers *kmod_symvers_ref(struct kmod_symvers *symvers);
+struct kmod_symvers *kmod_symvers_unref(struct kmod_symvers *symvers);
+int kmod_symvers_get_crc(const struct kmod_symvers *symvers,
+					const char *symbol, uint64_t *crc);
+
+/* Flags to kmod_module_check_symvers() */
+enum kmod_symvers_check {
+	KMOD_SYMVERS_CHECK_UNKNOWN = 0x1,
+};
+
+enum kmod_symvers_mismatch {
+	KMOD_SYMVERS_MISMATCH_CRC = 1,
+	KMOD_SYMVERS_MISMATCH_UNKNOWN,
+	KMOD_SYMVERS_MISMATCH_VERMAGIC,
+};
+
+int kmod_module_check_symvers(const struct kmod_module *mod,
+				const struct kmod_symvers *symvers,
+				const char *vermagic, unsigned int flags,
+				struct kmod_list **list);
+int kmod_module_symvers_mismatch_get_type(const struct kmod_list *entry);
+const char *kmod_module_symvers_mismatch_get_symbol(const struct kmod_list *entry);
+uint64_t kmod_module_symvers_mismatch_get_crc(const struct kmod_list *entry);
+uint64_t kmod_module_symvers_mismatch_get_expected_crc(const struct kmod_list *entry);
+void kmod_module_symvers_mismatch_free_list(struct kmod_list *list);
+
+/*
+ * kmod_monitor
+ *
+ * Table of loaded modules kept up to date by listening to kernel uevents
+ */
+struct kmod_monitor;
+int kmod_monitor_new(struct kmod_ctx *ctx, struct kmod_monitor **monitor);
+struct kmod_monitor *kmod_monitor_ref(struct kmod_monitor *monitor);
+struct kmod_monitor *kmod_monitor_unref(struct kmod_monitor *monitor);
+int kmod_monitor_get_fd(const struct kmod_monitor *monitor);
+int kmod_monitor_process(struct kmod_monitor *monitor);
+int kmod_monitor_get_loaded(const struct kmod_monitor *monitor,
+						struct kmod_list **list);
+bool kmod_monitor_is_loaded(const struct kmod_monitor *monitor,
+						const char *name);
+
+/*
+ * kmod_holder_graph
+ *
+ * Which loaded modules hold which other loaded modules, read in one pass
+ */
+struct kmod_holder_graph;
+
+/* Flags to kmod_holder_graph_get_holders() */
+enum kmod_holder_graph_flags {
+	KMOD_HOLDER_GRAPH_TRANSITIVE = 0x1,
+};
+
+int kmod_holder_graph_new(struct kmod_ctx *ctx,
+					struct kmod_holder_graph **graph);
+struct kmod_holder_graph *kmod_holder_graph_ref(struct kmod_holder_graph *graph);
+struct kmod_holder_graph *kmod_holder_graph_unref(struct kmod_holder_graph *graph);
+int kmod_holder_graph_get_holders(const struct kmod_holder_graph *graph,
+					const struct kmod_module *mod,
+					unsigned int flags,
+					struct kmod_list **list);
+int kmod_holder_graph_get_unload_order(const struct kmod_holder_graph *graph,
+					const struct kmod_module *mod,
+					struct kmod_list **list);
+
+/*
+ * kmod_symbol_map
+ *
+ * Addresses of loaded modules to their symbols, looked up by binary search
+ */
+struct kmod_symbol_map;
+
+int kmod_symbol_map_new(struct kmod_ctx *ctx, struct kmod_symbol_map **map);
+int kmod_symbol_map_new_from_file(struct kmod_ctx *ctx, const char *filename,
+					struct kmod_symbol_map **map);
+struct kmod_symbol_map *kmod_symbol_map_ref(struct kmod_symbol_map *map);
+struct kmod_symbol_map *kmod_symbol_map_unref(struct kmod_symbol_map *map);
+int kmod_symbol_map_write(const struct kmod_symbol_map *map, int fd);
+unsigned int kmod_symbol_map_get_count(const struct kmod_symbol_map *map);
+int kmod_symbol_map_lookup(const struct kmod_symbol_map *map,
+					uint64_t address, const char **module,
+					const char **symbol, uint64_t *offset);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -43,6 +43,25 @@ cdef extern from 'libkmod/libkmod.h':
     int kmod_load_resources(kmod_ctx *ctx)
     void kmod_unload_resources(kmod_ctx *ctx)
 
+    # Iteration over the contents of the indexes
+    cdef enum kmod_index:
+        KMOD_INDEX_MODULES_DEP
+        KMOD_INDEX_MODULES_ALIAS
+        KMOD_INDEX_MODULES_SYMBOL
+        KMOD_INDEX_MODULES_BUILTIN
+
+    cdef struct kmod_index_iter:
+        pass
+    ctypedef kmod_index_iter* const_kmod_index_iter_ptr 'const struct kmod_index_iter *'
+    int kmod_index_iter_new(
+        kmod_ctx *ctx, kmod_index type, const_char_ptr prefix,
+        kmod_index_iter **iter)
+    bint kmod_index_iter_next(kmod_index_iter *iter)
+    const_char_ptr kmod_index_iter_get_key(const_kmod_index_iter_ptr iter)
+    const_char_ptr kmod_index_iter_get_value(const_kmod_index_iter_ptr iter)
+    unsigned int kmod_index_iter_get_priority(const_kmod_index_iter_ptr iter)
+    void kmod_index_iter_free(kmod_index_iter *iter)
+
     # access to kmod generated lists
     cdef struct kmod_list:
         pass
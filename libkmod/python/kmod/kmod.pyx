@@ -24,6 +24,16 @@ cimport module as _module
 import module as _module
 cimport list as _list
 import list as _list
+cimport _util
+import _util
+
+
+_INDEXES = {
+    'dep': _libkmod_h.KMOD_INDEX_MODULES_DEP,
+    'alias': _libkmod_h.KMOD_INDEX_MODULES_ALIAS,
+    'symbols': _libkmod_h.KMOD_INDEX_MODULES_SYMBOL,
+    'builtin': _libkmod_h.KMOD_INDEX_MODULES_BUILTIN,
+    }
 
 
 cdef class Kmod (object):
@@ -97,6 +107,31 @@ cdef class Kmod (object):
             raise _KmodError('Could not get module')
         return mod
 
+    def index(self, index, prefix=''):
+        """
+        iterate through (key, value, priority) entries of an index, one of
+        'dep', 'alias', 'symbols' or 'builtin', whose key starts with `prefix`
+        e.g. km.index('symbols', 'symbol:mlx5_')
+        """
+        cdef _libkmod_h.kmod_index_iter *it = NULL
+        if index not in _INDEXES:
+            raise _KmodError('Unknown index %s' % index)
+        if hasattr(prefix, 'encode'):
+            prefix = prefix.encode('ascii')
+        err = _libkmod_h.kmod_index_iter_new(
+            self._kmod_ctx, _INDEXES[index], prefix, &it)
+        if err < 0:
+            raise _KmodError('Could not open index %s' % index)
+        try:
+            while _libkmod_h.kmod_index_iter_next(it):
+                yield (_util.char_ptr_to_str(
+                        _libkmod_h.kmod_index_iter_get_key(it)),
+                       _util.char_ptr_to_str(
+                        _libkmod_h.kmod_index_iter_get_value(it)),
+                       _libkmod_h.kmod_index_iter_get_priority(it))
+        finally:
+            _libkmod_h.kmod_index_iter_free(it)
+
     def list(self):
         "iterate through currently loaded modules and sizes"
         for mod in self.loaded():
@@ -268,6 +268,7 @@ AC_DEFUN([CC_CHECK_FUNC_BUILTIN], [
          [__builtin_types_compatible_p], [$1(int, int)],
          [__builtin_uaddl_overflow], [$1(0UL, 0UL, (void*)0)],
          [__builtin_uaddll_overflow], [$1(0ULL, 0ULL, (void*)0)],
+         [__builtin_cpu_supports], [$1("sse4.2")],
          [__builtin_expect], [$1(0, 0)]
        )])],
        [cc_cv_have_$1=yes],
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * CRC-32C (Castagnoli), as used by iSCSI, ext4 and btrfs. Pass 0 as @crc to
+ * start and the previous result to continue over more data.
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
@@ -33,6 +33,28 @@ static inline int finit_module(int fd, const char *uargs, int flags)
 }
 #endif
 
+#ifndef __NR_memfd_create
+# define __NR_memfd_create -1
+#endif
+
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC 0x0001U
+#endif
+
+#ifndef HAVE_MEMFD_CREATE
+#include <errno.h>
+
+static inline int memfd_create(const char *name, unsigned int flags)
+{
+	if (__NR_memfd_create == -1) {
+		errno = ENOSYS;
+		return -1;
+	}
+
+	return syscall(__NR_memfd_create, name, flags);
+}
+#endif
+
 #if !HAVE_DECL_STRNDUPA
 #define strndupa(s, n)							\
 	({								\
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Hash functions of the minimal perfect hash tables in the binary indexes.
+ * depmod and libkmod must agree on them, so they can't change without a new
+ * index version.
+ *
+ * A key goes to bucket phash_bucket(), and the bucket's seed decides its
+ * slot through phash_slot(). The seeds are chosen by depmod so no two keys
+ * share a slot.
+ */
+uint64_t phash_key(const char *key);
+
+static inline uint32_t phash_bucket(uint64_t h, uint32_t n_buckets)
+{
+	return (h >> 32) % n_buckets;
+}
+
+static inline uint32_t phash_slot(uint64_t h, uint32_t seed, uint32_t n_slots)
+{
+	/* splitmix64 finalizer */
+	h ^= seed * 0x9e3779b97f4a7c15ULL;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+
+	return h % n_slots;
+}
+
+static inline uint32_t phash_fingerprint(uint64_t h)
+{
+	return (uint32_t) h;
+}
@@ -0,0 +1,79 @@
+/*
+ * kmod - interface to kernel module operations
+ *
+ * Copyright (C) 2013 Michal Marek, SUSE
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <string.h>
+
+#include <shared/macro.h>
+#include <shared/signature.h>
+#include <shared/util.h>
+
+assert_cc(sizeof(struct module_signature) + sizeof(SIG_MAGIC) - 1 ==
+						MODSIG_TRAILER_SIZE);
+
+const struct module_signature *modsig_get(const char *mem, off_t *size)
+{
+	const struct module_signature *modsig;
+	off_t sz = *size;
+
+	if (sz < (off_t)strlen(SIG_MAGIC))
+		return NULL;
+	sz -= strlen(SIG_MAGIC);
+	if (memcmp(SIG_MAGIC, mem + sz, strlen(SIG_MAGIC)) != 0)
+		return NULL;
+
+	if (sz < (off_t)sizeof(struct module_signature))
+		return NULL;
+	sz -= sizeof(struct module_signature);
+	modsig = (const struct module_signature *)(mem + sz);
+	if (modsig->algo >= PKEY_ALGO__LAST ||
+			modsig->hash >= PKEY_HASH__LAST ||
+			modsig->id_type >= PKEY_ID_TYPE__LAST)
+		return NULL;
+	if (sz < (int64_t)(modsig->signer_len + modsig->key_id_len +
+				be32toh(get_unaligned(&modsig->sig_len))))
+		return NULL;
+
+	*size = sz;
+	return modsig;
+}
+
+size_t modsig_strip(const char *mem, size_t size)
+{
+	const struct module_signature *modsig;
+	off_t sz = size;
+
+	modsig = modsig_get(mem, &sz);
+	if (modsig == NULL)
+		return size;
+
+	return sz - modsig->signer_len - modsig->key_id_len -
+				be32toh(get_unaligned(&modsig->sig_len));
+}
+
+void modsig_pkcs7_trailer(uint32_t sig_len, char trailer[MODSIG_TRAILER_SIZE])
+{
+	struct module_signature modsig = {
+		.id_type = PKEY_ID_PKCS7,
+		.sig_len = htobe32(sig_len),
+	};
+
+	memcpy(trailer, &modsig, sizeof(modsig));
+	memcpy(trailer + sizeof(modsig), SIG_MAGIC, strlen(SIG_MAGIC));
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/* These types were copied from the 3.7 kernel sources.
+ * As this is just description of the signature format, it should not be
+ * considered derived work (so libkmod can use the LGPL license).
+ */
+enum pkey_algo {
+	PKEY_ALGO_DSA,
+	PKEY_ALGO_RSA,
+	PKEY_ALGO__LAST
+};
+
+enum pkey_hash_algo {
+	PKEY_HASH_MD4,
+	PKEY_HASH_MD5,
+	PKEY_HASH_SHA1,
+	PKEY_HASH_RIPE_MD_160,
+	PKEY_HASH_SHA256,
+	PKEY_HASH_SHA384,
+	PKEY_HASH_SHA512,
+	PKEY_HASH_SHA224,
+	PKEY_HASH__LAST
+};
+
+enum pkey_id_type {
+	PKEY_ID_PGP,		/* OpenPGP generated key ID */
+	PKEY_ID_X509,		/* X.509 arbitrary subjectKeyIdentifier */
+	PKEY_ID_PKCS7,		/* Signature in PKCS#7 message */
+	PKEY_ID_TYPE__LAST
+};
+
+/*
+ * Module signature information block.
+ */
+struct module_signature {
+	uint8_t algo;        /* Public-key crypto algorithm [enum pkey_algo] */
+	uint8_t hash;        /* Digest algorithm [enum pkey_hash_algo] */
+	uint8_t id_type;     /* Key identifier type [enum pkey_id_type] */
+	uint8_t signer_len;  /* Length of signer's name */
+	uint8_t key_id_len;  /* Length of key identifier */
+	uint8_t __pad[3];
+	uint32_t sig_len;    /* Length of signature data (big endian) */
+};
+
+#define SIG_MAGIC "~Module signature appended~\n"
+
+/*
+ * A signed module has the following layout:
+ *
+ * [ module                  ]
+ * [ signer's name           ]
+ * [ key identifier          ]
+ * [ signature data          ]
+ * [ struct module_signature ]
+ * [ SIG_MAGIC               ]
+ */
+
+/* struct module_signature and SIG_MAGIC appended after the signature data */
+#define MODSIG_TRAILER_SIZE 40
+
+/*
+ * Find the signature information block. On success @size is updated to
+ * the size of the module and signature data that come before it.
+ */
+const struct module_signature *modsig_get(const char *mem, off_t *size);
+/* size of the module in @mem without its signature, if any */
+size_t modsig_strip(const char *mem, size_t size);
+/* trailer for a PKCS#7 signature of @sig_len bytes */
+void modsig_pkcs7_trailer(uint32_t sig_len, char trailer[MODSIG_TRAILER_SIZE]);
@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "testsuite.h"
+
+/*
+ * Calls are counted where libkmod and the tools enter libc: the syscalls
+ * libc does on its own, as the getdents() behind readdir(), can't be
+ * trapped.
+ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static struct test_counters *counters;
+static bool need_init = true;
+
+static void *get_libc_func(const char *f)
+{
+	void *fp;
+
+	fp = dlsym(RTLD_NEXT, f);
+	if (fp == NULL) {
+		fprintf(stderr, "FIXME: could not load %s symbol: %s\n",
+			f, dlerror());
+		abort();
+	}
+
+	return fp;
+}
+
+static void init_counters(void)
+{
+	void *(*_mmap)(void *addr, size_t len, int prot, int flags, int fd,
+								off_t off);
+	const char *s;
+	char *end;
+	long fd;
+	void *p;
+
+	need_init = false;
+
+	s = getenv(S_TC_COUNTERS);
+	if (s == NULL) {
+		fprintf(stderr, "TRAP counters: missing export %s?\n",
+							S_TC_COUNTERS);
+		return;
+	}
+
+	fd = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || fd < 0)
+		return;
+
+	_mmap = get_libc_func("mmap");
+	p = _mmap(NULL, sizeof(struct test_counters), PROT_READ | PROT_WRITE,
+						MAP_SHARED, (int) fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "TRAP counters: could not map counters: %m\n");
+		return;
+	}
+
+	counters = p;
+}
+
+#define COUNT(field, n)							\
+	do {								\
+		if (need_init)						\
+			init_counters();				\
+		if (counters != NULL)					\
+			__atomic_add_fetch(&counters->field, (n),	\
+						__ATOMIC_RELAXED);	\
+	} while (false)
+
+TS_EXPORT void *malloc(size_t size)
+{
+	COUNT(mallocs, 1);
+	COUNT(malloc_bytes, size);
+	return __libc_malloc(size);
+}
+
+TS_EXPORT void *calloc(size_t nmemb, size_t size)
+{
+	COUNT(mallocs, 1);
+	COUNT(malloc_bytes, nmemb * size);
+	return __libc_calloc(nmemb, size);
+}
+
+TS_EXPORT void *realloc(void *ptr, size_t size)
+{
+	COUNT(mallocs, 1);
+	COUNT(malloc_bytes, size);
+	return __libc_realloc(ptr, size);
+}
+
+TS_EXPORT void free(void *ptr)
+{
+	if (ptr != NULL)
+		COUNT(frees, 1);
+	__libc_free(ptr);
+}
+
+/* wrapper template for a function counted as a call to field */
+#define WRAP_COUNT(field, rettype, name, proto, args)			\
+TS_EXPORT rettype name proto						\
+{									\
+	static rettype (*_fn) proto;					\
+									\
+	if (_fn == NULL)						\
+		_fn = get_libc_func(#name);				\
+	COUNT(field, 1);						\
+	return _fn args;						\
+}
+
+/* wrapper template for open family */
+#define WRAP_OPEN(name, proto, args)					\
+TS_EXPORT int name proto						\
+{									\
+	static int (*_fn)(const char *path, ...);			\
+	mode_t mode = 0;						\
+									\
+	if (_fn == NULL)						\
+		_fn = get_libc_func(#name);				\
+	COUNT(opens, 1);						\
+									\
+	if (flags & O_CREAT) {						\
+		va_list ap;						\
+									\
+		va_start(ap, flags);					\
+		mode = va_arg(ap, mode_t);				\
+		va_end(ap);						\
+	}								\
+									\
+	return _fn args;						\
+}
+
+WRAP_OPEN(open, (const char *path, int flags, ...), (path, flags, mode));
+WRAP_COUNT(opens, FILE *, fopen, (const char *path, const char *mode),
+	   (path, mode));
+WRAP_COUNT(opens, DIR *, opendir, (const char *path), (path));
+WRAP_COUNT(readdirs, struct dirent *, readdir, (DIR *dir), (dir));
+WRAP_COUNT(stats, int, stat, (const char *path, struct stat *st),
+	   (path, st));
+WRAP_COUNT(stats, int, lstat, (const char *path, struct stat *st),
+	   (path, st));
+WRAP_COUNT(stats, int, fstat, (int fd, struct stat *st), (fd, st));
+WRAP_COUNT(stats, int, fstatat,
+	   (int dirfd, const char *path, struct stat *st, int flags),
+	   (dirfd, path, st, flags));
+WRAP_COUNT(stats, int, access, (const char *path, int mode), (path, mode));
+WRAP_COUNT(reads, ssize_t, read, (int fd, void *buf, size_t count),
+	   (fd, buf, count));
+WRAP_COUNT(reads, ssize_t, pread,
+	   (int fd, void *buf, size_t count, off_t offset),
+	   (fd, buf, count, offset));
+WRAP_COUNT(mmaps, void *, mmap,
+	   (void *addr, size_t len, int prot, int flags, int fd, off_t off),
+	   (addr, len, prot, flags, fd, off));
+WRAP_COUNT(syncs, int, fsync, (int fd), (fd));
+WRAP_COUNT(syncs, int, fdatasync, (int fd), (fd));
+WRAP_COUNT(syncs, int, syncfs, (int fd), (fd));
+WRAP_COUNT(readaheads, int, posix_fadvise,
+	   (int fd, off_t off, off_t len, int advice), (fd, off, len, advice));
+WRAP_COUNT(readaheads, ssize_t, readahead,
+	   (int fd, off64_t off, size_t count), (fd, off, count));
+
+TS_EXPORT void sync(void)
+{
+	static void (*_fn)(void);
+
+	if (_fn == NULL)
+		_fn = get_libc_func("sync");
+	COUNT(syncs, 1);
+	_fn();
+}
+
+TS_EXPORT int openat(int dirfd, const char *path, int flags, ...)
+{
+	static int (*_fn)(int dirfd, const char *path, int flags, ...);
+	mode_t mode = 0;
+
+	if (_fn == NULL)
+		_fn = get_libc_func("openat");
+	COUNT(opens, 1);
+
+	if (flags & O_CREAT) {
+		va_list ap;
+
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return _fn(dirfd, path, flags, mode);
+}
+
+#ifndef _FILE_OFFSET_BITS
+WRAP_OPEN(open64, (const char *path, int flags, ...), (path, flags, mode));
+WRAP_COUNT(opens, FILE *, fopen64, (const char *path, const char *mode),
+	   (path, mode));
+WRAP_COUNT(readdirs, struct dirent64 *, readdir64, (DIR *dir), (dir));
+WRAP_COUNT(stats, int, stat64, (const char *path, struct stat64 *st),
+	   (path, st));
+WRAP_COUNT(stats, int, lstat64, (const char *path, struct stat64 *st),
+	   (path, st));
+WRAP_COUNT(stats, int, fstat64, (int fd, struct stat64 *st), (fd, st));
+WRAP_COUNT(reads, ssize_t, pread64,
+	   (int fd, void *buf, size_t count, off64_t offset),
+	   (fd, buf, count, offset));
+WRAP_COUNT(mmaps, void *, mmap64,
+	   (void *addr, size_t len, int prot, int flags, int fd, off64_t off),
+	   (addr, len, prot, flags, fd, off));
+WRAP_COUNT(readaheads, int, posix_fadvise64,
+	   (int fd, off64_t off, off64_t len, int advice),
+	   (fd, off, len, advice));
+#endif
+
+#ifdef HAVE___XSTAT
+/* newer glibc headers no longer declare the versioned stat functions */
+int __xstat(int ver, const char *path, struct stat *st);
+int __lxstat(int ver, const char *path, struct stat *st);
+int __fxstat(int ver, int fd, struct stat *st);
+
+WRAP_COUNT(stats, int, __xstat, (int ver, const char *path, struct stat *st),
+	   (ver, path, st));
+WRAP_COUNT(stats, int, __lxstat, (int ver, const char *path, struct stat *st),
+	   (ver, path, st));
+WRAP_COUNT(stats, int, __fxstat, (int ver, int fd, struct stat *st),
+	   (ver, fd, st));
+#endif
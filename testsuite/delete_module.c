@@ -32,6 +32,7 @@
 
 #include <shared/util.h>
 
+#include "latency.h"
 #include "testsuite.h"
 
 struct mod {
@@ -42,6 +43,7 @@ struct mod {
 };
 
 static struct mod *modules;
+static struct latency *latencies;
 static bool need_init = true;
 
 static void parse_retcodes(struct mod **_modules, const char *s)
@@ -121,12 +123,13 @@ static void init_retcodes(void)
 
 	need_init = false;
 	s = getenv(S_TC_DELETE_MODULE_RETCODES);
-	if (s == NULL) {
+	if (s == NULL && getenv(S_TC_DELETE_MODULE_LATENCIES) == NULL) {
 		ERR("TRAP delete_module(): missing export %s?\n",
 						S_TC_DELETE_MODULE_RETCODES);
 	}
 
 	parse_retcodes(&modules, s);
+	latencies = latencies_parse(getenv(S_TC_DELETE_MODULE_LATENCIES));
 
 	for (mod = modules; mod != NULL; mod = mod->next) {
 		LOG("Added module to test delete_module:\n");
@@ -141,13 +144,16 @@ TS_EXPORT long delete_module(const char *name, unsigned int flags);
  * FIXME: change /sys/module/<modname> to fake-remove a module
  *
  * Default behavior is to exit successfully. If this is not the intended
- * behavior, set TESTSUITE_DELETE_MODULE_RETCODES env var.
+ * behavior, set TESTSUITE_DELETE_MODULE_RETCODES env var. The time the
+ * module takes to go away is set by TESTSUITE_DELETE_MODULE_LATENCIES.
  */
 long delete_module(const char *modname, unsigned int flags)
 {
 	struct mod *mod;
 
 	init_retcodes();
+	usleep(latencies_find(latencies, modname));
+
 	mod = find_module(modules, modname);
 	if (mod == NULL)
 		return 0;
@@ -165,4 +171,6 @@ void free_resources(void)
 		free(modules);
 		modules = mod;
 	}
+
+	latencies_free(latencies);
 }
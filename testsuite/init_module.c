@@ -46,6 +46,7 @@
 
 /* FIXME: hack, change name so we don't clash */
 #undef ERR
+#include "latency.h"
 #include "testsuite.h"
 #include "stripped-module.h"
 
@@ -57,10 +58,13 @@ struct mod {
 };
 
 static struct mod *modules;
+static struct latency *latencies;
+static struct test_kernel_stats *stats;
+static bool check_deps;
 static bool need_init = true;
 static struct kmod_ctx *ctx;
 
-static void parse_retcodes(struct mod *_modules, const char *s)
+static void parse_retcodes(struct mod **_modules, const char *s)
 {
 	const char *p;
 
@@ -79,7 +83,7 @@ static void parse_retcodes(struct mod *_modules, const char *s)
 		if (modname == NULL || modname[0] == '\0')
 			break;
 
-		modnamelen = strcspn(s, ":");
+		modnamelen = strcspn(p, ":");
 		if (modname[modnamelen] != ':')
 			break;
 
@@ -109,11 +113,60 @@ static void parse_retcodes(struct mod *_modules, const char *s)
 		mod->name[modnamelen] = '\0';
 		mod->ret = ret;
 		mod->errcode = errcode;
-		mod->next = _modules;
-		_modules = mod;
+		mod->next = *_modules;
+		*_modules = mod;
 	}
 }
 
+static struct test_kernel_stats *map_stats(void)
+{
+	const char *s = getenv(S_TC_KERNEL_STATS);
+	void *p;
+	char *end;
+	long fd;
+
+	if (s == NULL)
+		return NULL;
+
+	fd = strtol(s, &end, 10);
+	if (end == s || *end != '\0' || fd < 0)
+		return NULL;
+
+	p = mmap(NULL, sizeof(struct test_kernel_stats),
+			PROT_READ | PROT_WRITE, MAP_SHARED, (int) fd, 0);
+	if (p == MAP_FAILED) {
+		fprintf(stderr, "TRAP init_module(): could not map stats: %m\n");
+		return NULL;
+	}
+
+	return p;
+}
+
+static void stats_insert_begin(void)
+{
+	unsigned int n, max;
+
+	if (stats == NULL)
+		return;
+
+	__atomic_add_fetch(&stats->inserts, 1, __ATOMIC_SEQ_CST);
+	n = __atomic_add_fetch(&stats->in_flight, 1, __ATOMIC_SEQ_CST);
+
+	max = __atomic_load_n(&stats->max_in_flight, __ATOMIC_SEQ_CST);
+	while (n > max && !__atomic_compare_exchange_n(&stats->max_in_flight,
+					&max, n, false, __ATOMIC_SEQ_CST,
+					__ATOMIC_SEQ_CST))
+		;
+}
+
+static void stats_insert_end(void)
+{
+	if (stats == NULL)
+		return;
+
+	__atomic_sub_fetch(&stats->in_flight, 1, __ATOMIC_SEQ_CST);
+}
+
 static int write_one_line_file(const char *fn, const char *line, int len)
 {
         FILE *f;
@@ -184,14 +237,17 @@ static void init_retcodes(void)
 
 	need_init = false;
 	s = getenv(S_TC_INIT_MODULE_RETCODES);
-	if (s == NULL) {
+	if (s == NULL && getenv(S_TC_INIT_MODULE_LATENCIES) == NULL) {
 		fprintf(stderr, "TRAP init_module(): missing export %s?\n",
 						S_TC_INIT_MODULE_RETCODES);
 	}
 
 	ctx = kmod_new(NULL, NULL);
 
-	parse_retcodes(modules, s);
+	parse_retcodes(&modules, s);
+	latencies = latencies_parse(getenv(S_TC_INIT_MODULE_LATENCIES));
+	stats = map_stats();
+	check_deps = getenv(S_TC_INIT_MODULE_CHECK_DEPS) != NULL;
 }
 
 static inline bool module_is_inkernel(const char *modname)
@@ -216,6 +272,36 @@ static inline bool module_is_inkernel(const char *modname)
 	return ret;
 }
 
+/*
+ * The kernel would fail to resolve the symbols of a module whose
+ * dependencies are not live yet. Check with what modules.dep says.
+ */
+static bool deps_are_inkernel(const char *modname)
+{
+	struct kmod_module *mod;
+	struct kmod_list *deps, *l;
+	bool ret = true;
+
+	if (kmod_module_new_from_name(ctx, modname, &mod) < 0)
+		return true;
+
+	deps = kmod_module_get_dependencies(mod);
+	kmod_list_foreach(l, deps) {
+		const char *depname = kmod_module_get_name(l->data);
+
+		if (!module_is_inkernel(depname)) {
+			fprintf(stderr, "TRAP init_module(): %s inserted before its dependency %s\n",
+							modname, depname);
+			ret = false;
+		}
+	}
+
+	kmod_module_unref_list(deps);
+	kmod_module_unref(mod);
+
+	return ret;
+}
+
 static uint8_t elf_identify(void *mem)
 {
 	uint8_t *p = mem;
@@ -227,7 +313,8 @@ TS_EXPORT long init_module(void *mem, unsigned long len, const char *args);
 /*
  * Default behavior is to try to mimic init_module behavior inside the kernel.
  * If it is a simple test that you know the error code, set the return code
- * in TESTSUITE_INIT_MODULE_RETCODES env var instead.
+ * in TESTSUITE_INIT_MODULE_RETCODES env var instead. The time each module
+ * takes to initialize is set by TESTSUITE_INIT_MODULE_LATENCIES.
  *
  * The exception is when the module name is not find in the memory passed.
  * This is because we want to be able to pass dummy modules (and not real
@@ -266,6 +353,10 @@ long init_module(void *mem, unsigned long len, const char *args)
 		offset = MODULE_NAME_OFFSET_32;
 
 	modname = (char *)buf + offset;
+
+	stats_insert_begin();
+	usleep(latencies_find(latencies, modname));
+
 	mod = find_module(modules, modname);
 	if (mod != NULL) {
 		errno = mod->errcode;
@@ -273,12 +364,21 @@ long init_module(void *mem, unsigned long len, const char *args)
 	} else if (module_is_inkernel(modname)) {
 		err = -1;
 		errno = EEXIST;
+	} else if (check_deps && !deps_are_inkernel(modname)) {
+		if (stats != NULL)
+			__atomic_add_fetch(&stats->dep_violations, 1,
+							__ATOMIC_SEQ_CST);
+		err = -1;
+		errno = ENOENT;
 	} else
 		err = 0;
 
+	/* only live after the latency, as in the kernel */
 	if (err == 0)
 		create_sysfs_files(modname);
 
+	stats_insert_end();
+
 	return err;
 }
 
@@ -398,6 +498,11 @@ void free_resources(void)
 		modules = mod;
 	}
 
+	latencies_free(latencies);
+
+	if (stats)
+		munmap(stats, sizeof(struct test_kernel_stats));
+
 	if (ctx)
 		kmod_unref(ctx);
 }
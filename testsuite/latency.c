@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <shared/util.h>
+
+#include "latency.h"
+
+struct latency {
+	struct latency *next;
+	unsigned long usec;
+	char name[];
+};
+
+/*
+ * Parse "modname:usec[,modname:usec...]". Names are stored with '-'
+ * turned into '_', so they match the names the kernel sees.
+ */
+struct latency *latencies_parse(const char *s)
+{
+	struct latency *latencies = NULL;
+	const char *p;
+
+	if (s == NULL)
+		return NULL;
+
+	for (p = s; *p != '\0';) {
+		struct latency *lat;
+		const char *modname = p;
+		size_t i, modnamelen;
+		unsigned long usec;
+		char *end;
+
+		modnamelen = strcspn(p, ":");
+		if (modname[modnamelen] != ':')
+			break;
+
+		p = modname + modnamelen + 1;
+		usec = strtoul(p, &end, 0);
+		if (end == p || (*end != ',' && *end != '\0'))
+			break;
+		p = *end == ',' ? end + 1 : end;
+
+		lat = malloc(sizeof(*lat) + modnamelen + 1);
+		if (lat == NULL)
+			break;
+
+		for (i = 0; i < modnamelen; i++)
+			lat->name[i] = modname[i] == '-' ? '_' : modname[i];
+		lat->name[modnamelen] = '\0';
+		lat->usec = usec;
+		lat->next = latencies;
+		latencies = lat;
+	}
+
+	return latencies;
+}
+
+unsigned long latencies_find(const struct latency *latencies,
+							const char *modname)
+{
+	const struct latency *lat;
+	unsigned long usec = 0;
+
+	for (lat = latencies; lat != NULL; lat = lat->next) {
+		if (streq(lat->name, modname))
+			return lat->usec;
+		if (streq(lat->name, "*"))
+			usec = lat->usec;
+	}
+
+	return usec;
+}
+
+void latencies_free(struct latency *latencies)
+{
+	while (latencies) {
+		struct latency *lat = latencies->next;
+		free(latencies);
+		latencies = lat;
+	}
+}
@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+/*
+ * Latencies of the fake init_module(2) and delete_module(2), parsed from
+ * TESTSUITE_INIT_MODULE_LATENCIES and TESTSUITE_DELETE_MODULE_LATENCIES.
+ */
+struct latency;
+
+struct latency *latencies_parse(const char *s);
+unsigned long latencies_find(const struct latency *latencies,
+							const char *modname);
+void latencies_free(struct latency *latencies);
@@ -0,0 +1,17 @@
+#include <linux/init.h>
+#include <linux/module.h>
+
+static int __init test_module_init(void)
+{
+	return 0;
+}
+
+static void test_module_exit(void)
+{
+}
+module_init(test_module_init);
+module_exit(test_module_exit);
+
+MODULE_FIRMWARE("kmod-test.fw");
+MODULE_FIRMWARE("kmod-missing.fw");
+MODULE_LICENSE("LGPL");
@@ -0,0 +1,22 @@
+#include <linux/init.h>
+#include <linux/module.h>
+
+/* an object without a size in .symtab, as defined in assembly */
+asm(".pushsection .rodata\n"
+    ".type nosize_table, %object\n"
+    "nosize_table:\n"
+    ".long 0, 1, 2, 3\n"
+    ".popsection\n");
+
+static int __init test_module_init(void)
+{
+	return 0;
+}
+
+static void test_module_exit(void)
+{
+}
+module_init(test_module_init);
+module_exit(test_module_exit);
+
+MODULE_LICENSE("LGPL");
@@ -0,0 +1,25 @@
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+static int debug;
+module_param(debug, int, 0644);
+MODULE_PARM_DESC(debug, "Verbosity of the messages");
+
+/* no permissions: not exported in /sys/module/mod_param/parameters */
+static bool quiet;
+module_param(quiet, bool, 0);
+MODULE_PARM_DESC(quiet, "Do not print anything");
+
+static int __init test_module_init(void)
+{
+	return 0;
+}
+
+static void test_module_exit(void)
+{
+}
+module_init(test_module_init);
+module_exit(test_module_exit);
+
+MODULE_LICENSE("LGPL");
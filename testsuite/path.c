@@ -26,6 +26,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
@@ -195,6 +196,22 @@ WRAP_OPEN(64);
 
 WRAP_OPEN();
 
+TS_EXPORT int inotify_add_watch(int fd, const char *path, uint32_t mask)
+{
+	const char *p;
+	char buf[PATH_MAX * 2];
+	static int (*_fn)(int fd, const char *path, uint32_t mask);
+
+	if (!get_rootpath(__func__))
+		return -1;
+	_fn = get_libc_func("inotify_add_watch");
+	p = trap_path(path, buf);
+	if (p == NULL)
+		return -1;
+
+	return _fn(fd, p, mask);
+}
+
 #ifdef HAVE___XSTAT
 WRAP_VERSTAT(__x,);
 WRAP_VERSTAT(__lx,);
@@ -30,19 +30,51 @@ map=(
     ["test-depmod/search-order-external-last/lib/modules/external/"]="mod-simple.ko"
     ["test-depmod/search-order-override/lib/modules/4.4.4/foo/"]="mod-simple.ko"
     ["test-depmod/search-order-override/lib/modules/4.4.4/override/"]="mod-simple.ko"
+    ["test-depmod/watch-idle/lib/modules/4.4.4/kernel/crypto/"]="mod-simple.ko"
+    ["test-depmod/watch-idle/lib/modules/4.4.4/updates/"]="mod-simple.ko"
+    ["test-depmod/watch-changes/lib/modules/4.4.4/kernel/crypto/"]="mod-simple.ko"
+    ["test-depmod/watch-changes/lib/modules/4.4.4/updates/"]="mod-simple.ko"
+    ["test-depmod/watch-changes/staging/mod-fake-cciss.ko"]="mod-fake-cciss.ko"
+    ["test-depmod/output-sync/lib/modules/4.4.4/kernel/crypto/"]="mod-simple.ko"
+    ["test-depmod/output-sync/lib/modules/4.4.4/updates/"]="mod-simple.ko"
     ["test-dependencies/lib/modules/4.0.20-kmod/kernel/fs/foo/"]="mod-foo-b.ko"
     ["test-dependencies/lib/modules/4.0.20-kmod/kernel/"]="mod-foo-c.ko"
     ["test-dependencies/lib/modules/4.0.20-kmod/kernel/lib/"]="mod-foo-a.ko"
     ["test-dependencies/lib/modules/4.0.20-kmod/kernel/fs/"]="mod-foo.ko"
+    ["test-dependencies-index/good/lib/modules/4.0.20-kmod/kernel/fs/foo/"]="mod-foo-b.ko"
+    ["test-dependencies-index/good/lib/modules/4.0.20-kmod/kernel/"]="mod-foo-c.ko"
+    ["test-dependencies-index/good/lib/modules/4.0.20-kmod/kernel/lib/"]="mod-foo-a.ko"
+    ["test-dependencies-index/good/lib/modules/4.0.20-kmod/kernel/fs/"]="mod-foo.ko"
+    ["test-dependencies-index/corrupt/lib/modules/4.0.20-kmod/kernel/fs/foo/"]="mod-foo-b.ko"
+    ["test-dependencies-index/corrupt/lib/modules/4.0.20-kmod/kernel/"]="mod-foo-c.ko"
+    ["test-dependencies-index/corrupt/lib/modules/4.0.20-kmod/kernel/lib/"]="mod-foo-a.ko"
+    ["test-dependencies-index/corrupt/lib/modules/4.0.20-kmod/kernel/fs/"]="mod-foo.ko"
     ["test-init/"]="mod-simple.ko"
     ["test-remove/"]="mod-simple.ko"
     ["test-modprobe/show-depends/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
     ["test-modprobe/show-depends/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
     ["test-modprobe/show-depends/lib/modules/4.4.4/kernel/mod-simple.ko"]="mod-simple.ko"
+    ["test-modprobe/deps-order/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
+    ["test-modprobe/deps-order/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
+    ["test-modprobe/firmware/lib/modules/4.4.4/kernel/mod-firmware.ko"]="mod-firmware.ko"
+    ["test-modprobe/firmware-no-prefetch/lib/modules/4.4.4/kernel/mod-firmware.ko"]="mod-firmware.ko"
+    ["test-preload/load/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
+    ["test-preload/load/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
+    ["test-preload/load/lib/modules/4.4.4/kernel/mod-simple.ko"]="mod-simple.ko"
+    ["test-preload/load/lib/modules/4.4.4/kernel/mod-softdep.ko"]="mod-softdep.ko"
+    ["test-symbol-map/lib/modules/4.4.4/kernel/mod-simple.ko"]="mod-simple.ko"
+    ["test-symbol-map/lib/modules/4.4.4/kernel/mod-nosize.ko"]="mod-nosize.ko"
+    ["test-loaded-parameters/lib/modules/4.4.4/kernel/mod-param.ko"]="mod-param.ko"
+    ["test-init-deps/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
+    ["test-init-deps/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
+    ["test-init-firmware/lib/modules/4.4.4/kernel/mod-firmware.ko"]="mod-firmware.ko"
     ["test-modprobe/softdep-loop/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
     ["test-modprobe/softdep-loop/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
     ["test-modprobe/install-cmd-loop/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
     ["test-modprobe/install-cmd-loop/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
+    ["test-modprobe/archive/lib/modules/4.4.4/kernel/mod-loop-a.ko"]="mod-loop-a.ko"
+    ["test-modprobe/archive/lib/modules/4.4.4/kernel/mod-loop-b.ko"]="mod-loop-b.ko"
+    ["test-modprobe/archive/lib/modules/4.4.4/kernel/mod-simple.ko"]="mod-simple.ko"
     ["test-modprobe/force/lib/modules/4.4.4/kernel/"]="mod-simple.ko"
     ["test-modprobe/oldkernel/lib/modules/3.3.3/kernel/"]="mod-simple.ko"
     ["test-modprobe/oldkernel-force/lib/modules/3.3.3/kernel/"]="mod-simple.ko"
@@ -60,6 +92,13 @@ map=(
     ["test-modinfo/external/lib/modules/external/mod-simple.ko"]="mod-simple.ko"
     ["test-tools/insert/lib/modules/4.4.4/kernel/"]="mod-simple.ko"
     ["test-tools/remove/lib/modules/4.4.4/kernel/"]="mod-simple.ko"
+    ["test-symvers/lib/modules/4.4.4/kernel/mod-foo.ko"]="mod-foo.ko"
+    ["test-symvers/lib/modules/4.4.4/kernel/mod-foo-a.ko"]="mod-foo-a.ko"
+    ["test-symvers/lib/modules/4.4.4/build/"]="mod-foo-b.ko"
+    ["test-symvers/lib/modules/4.4.4/source/"]="mod-foo-b.ko"
+    ["test-sign/lib/modules/4.4.4/kernel/mod-foo.ko"]="mod-foo.ko"
+    ["test-sign/lib/modules/4.4.4/kernel/mod-simple.ko"]="mod-simple.ko"
+    ["test-sign/lib/modules/4.4.4/kernel/mod-signed.ko"]="mod-simple.ko"
 )
 
 gzip_array=(
@@ -70,6 +109,7 @@ gzip_array=(
 
 attach_sha256_array=(
     "test-modinfo/mod-simple-sha256.ko"
+    "test-sign/lib/modules/4.4.4/kernel/mod-signed.ko"
     )
 
 attach_sha1_array=(
@@ -17,6 +17,7 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -26,12 +27,16 @@
 #include <shared/util.h>
 
 #include <libkmod/libkmod.h>
+#include <libkmod/libkmod-internal.h>
 
+/* FIXME: hack, change name so we don't clash */
+#undef ERR
 #include "testsuite.h"
 
 #define TEST_UNAME "4.0.20-kmod"
 
-static noreturn int test_dependencies(const struct test *t)
+static noreturn void check_dependencies(bool load_resources,
+					unsigned int expected_corrupted)
 {
 	struct kmod_ctx *ctx;
 	struct kmod_module *mod = NULL;
@@ -44,6 +49,28 @@ static noreturn int test_dependencies(const struct test *t)
 	if (ctx == NULL)
 		exit(EXIT_FAILURE);
 
+	if (load_resources) {
+		unsigned int i, n_corrupted = 0;
+
+		if (kmod_load_resources(ctx) < 0) {
+			kmod_unref(ctx);
+			exit(EXIT_FAILURE);
+		}
+
+		/* tell if indexes were validated or taken with extra checks */
+		for (i = 0; i <= KMOD_INDEX_MODULES_BUILTIN; i++) {
+			if (!kmod_index_is_validated(ctx, i))
+				n_corrupted++;
+		}
+
+		if (n_corrupted != expected_corrupted) {
+			fprintf(stderr, "%u corrupted indexes, expected %u\n",
+					n_corrupted, expected_corrupted);
+			kmod_unref(ctx);
+			exit(EXIT_FAILURE);
+		}
+	}
+
 	err = kmod_module_new_from_name(ctx, "mod-foo", &mod);
 	if (err < 0 || mod == NULL) {
 		kmod_unref(ctx);
@@ -78,6 +105,11 @@ static noreturn int test_dependencies(const struct test *t)
 
 	exit(EXIT_SUCCESS);
 }
+
+static noreturn int test_dependencies(const struct test *t)
+{
+	check_dependencies(false, 0);
+}
 DEFINE_TEST(test_dependencies,
 	.description = "test if kmod_module_get_dependencies works",
 	.config = {
@@ -86,4 +118,29 @@ DEFINE_TEST(test_dependencies,
 	},
 	.need_spawn = true);
 
+static noreturn int test_dependencies_index(const struct test *t)
+{
+	check_dependencies(true, 0);
+}
+DEFINE_TEST(test_dependencies_index,
+	.description = "test kmod_module_get_dependencies with checksummed indexes loaded",
+	.config = {
+		[TC_UNAME_R] = TEST_UNAME,
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-dependencies-index/good/",
+	},
+	.need_spawn = true);
+
+static noreturn int test_dependencies_index_corrupt(const struct test *t)
+{
+	/* only modules.dep.bin is damaged */
+	check_dependencies(true, 1);
+}
+DEFINE_TEST(test_dependencies_index_corrupt,
+	.description = "test kmod_module_get_dependencies falling back to checked index reads",
+	.config = {
+		[TC_UNAME_R] = TEST_UNAME,
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-dependencies-index/corrupt/",
+	},
+	.need_spawn = true);
+
 TESTSUITE_MAIN();
@@ -17,11 +17,16 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include "testsuite.h"
 
@@ -209,4 +214,224 @@ DEFINE_TEST(depmod_search_order_override,
 		},
 	});
 
+#define OUTPUT_SYNC_ROOTFS TESTSUITE_ROOTFS "test-depmod/output-sync"
+static noreturn int depmod_output_sync(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/depmod";
+	const char *const args[] = {
+		progname,
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(depmod_output_sync,
+	.description = "check if depmod publishes the indexes with one syncfs() and one fsync() of the directory",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = OUTPUT_SYNC_ROOTFS,
+	},
+	.counters = {
+		/* syncfs() for the indexes, fsync() for the renames */
+		.budget = { .syncs = 2 },
+	},
+	.output = {
+		.files = (const struct keyval[]) {
+			{ OUTPUT_SYNC_ROOTFS "/lib/modules/4.4.4/correct-modules.dep",
+			  OUTPUT_SYNC_ROOTFS "/lib/modules/4.4.4/modules.dep" },
+			{ OUTPUT_SYNC_ROOTFS "/lib/modules/4.4.4/correct-modules.manifest",
+			  OUTPUT_SYNC_ROOTFS "/lib/modules/4.4.4/modules.manifest" },
+			{ }
+		},
+	});
+
+#define WATCH_IDLE_ROOTFS TESTSUITE_ROOTFS "test-depmod/watch-idle"
+static noreturn int depmod_watch_idle(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/depmod";
+	const char *const args[] = {
+		progname,
+		"--watch=1",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(depmod_watch_idle,
+	.description = "check if depmod --watch writes the files and exits when idle",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = WATCH_IDLE_ROOTFS,
+	},
+	.output = {
+		.files = (const struct keyval[]) {
+			{ WATCH_IDLE_ROOTFS "/lib/modules/4.4.4/correct-modules.dep",
+			  WATCH_IDLE_ROOTFS "/lib/modules/4.4.4/modules.dep" },
+			{ }
+		},
+	});
+
+#define WATCH_CHANGES_ROOTFS TESTSUITE_ROOTFS "test-depmod/watch-changes"
+#define WATCH_CHANGES_LIB_MODULES WATCH_CHANGES_ROOTFS "/lib/modules/4.4.4"
+
+/* outputs checked after the changes, with their stat before them */
+static struct watch_output {
+	const char *name;
+	bool changes;
+	struct stat st;
+} watch_outputs[] = {
+	{ "modules.dep", true },
+	{ "modules.alias", true },
+	{ "modules.softdep", false },
+	{ "modules.symbols", false },
+	{ "modules.devname", false },
+	{ }
+};
+
+static unsigned long watch_generation(void)
+{
+	unsigned long generation = 0;
+	FILE *fp;
+
+	fp = fopen(WATCH_CHANGES_LIB_MODULES "/modules.manifest", "re");
+	if (fp == NULL)
+		return 0;
+
+	if (fscanf(fp, "generation %lu", &generation) != 1)
+		generation = 0;
+
+	fclose(fp);
+	return generation;
+}
+
+static bool watch_wait_generation(unsigned long generation)
+{
+	int i;
+
+	/* 10s at most */
+	for (i = 0; i < 1000; i++) {
+		if (watch_generation() >= generation)
+			return true;
+		usleep(10000);
+	}
+
+	ERR("depmod did not publish generation %lu\n", generation);
+	return false;
+}
+
+static int watch_stat(const char *name, struct stat *st)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), WATCH_CHANGES_LIB_MODULES "/%s", name);
+	if (stat(path, st) < 0) {
+		int err = -errno;
+		ERR("could not stat %s: %m\n", path);
+		return err;
+	}
+
+	return 0;
+}
+
+static noreturn int depmod_watch_changes(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/depmod";
+	const char *const args[] = {
+		progname,
+		"--watch=1",
+		NULL,
+	};
+	struct watch_output *o;
+	FILE *fp;
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0)
+		exit(EXIT_FAILURE);
+	if (pid == 0) {
+		test_spawn_prog(progname, args);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!watch_wait_generation(1))
+		goto fail;
+
+	for (o = watch_outputs; o->name != NULL; o++) {
+		if (watch_stat(o->name, &o->st) < 0)
+			goto fail;
+	}
+
+	/*
+	 * Two changes in a row: built-in modules now win over updates and a
+	 * new module shows up. Both must be picked up by the same run.
+	 */
+	fp = fopen(WATCH_CHANGES_ROOTFS "/etc/depmod.d/search.conf", "we");
+	if (fp == NULL) {
+		ERR("could not open search.conf: %m\n");
+		goto fail;
+	}
+	fputs("search built-in updates\n", fp);
+	fclose(fp);
+
+	if (rename(WATCH_CHANGES_ROOTFS "/staging/mod-fake-cciss.ko",
+		   WATCH_CHANGES_LIB_MODULES "/kernel/mod-fake-cciss.ko") < 0) {
+		ERR("could not add mod-fake-cciss.ko: %m\n");
+		goto fail;
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS) {
+		ERR("depmod --watch failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (watch_generation() != 2) {
+		ERR("expected a single run after the changes, got generation %lu\n",
+							watch_generation());
+		exit(EXIT_FAILURE);
+	}
+
+	for (o = watch_outputs; o->name != NULL; o++) {
+		struct stat st;
+		bool replaced;
+
+		if (watch_stat(o->name, &st) < 0)
+			exit(EXIT_FAILURE);
+
+		replaced = st.st_ino != o->st.st_ino ||
+			   st.st_mtim.tv_sec != o->st.st_mtim.tv_sec ||
+			   st.st_mtim.tv_nsec != o->st.st_mtim.tv_nsec;
+		if (replaced != o->changes) {
+			ERR("%s was %s\n", o->name, o->changes ?
+				"not regenerated" : "replaced, but did not change");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	exit(EXIT_SUCCESS);
+
+fail:
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(depmod_watch_changes,
+	.description = "check if depmod --watch regenerates only the files that change",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = WATCH_CHANGES_ROOTFS,
+	},
+	.output = {
+		.files = (const struct keyval[]) {
+			{ WATCH_CHANGES_LIB_MODULES "/correct-modules.dep",
+			  WATCH_CHANGES_LIB_MODULES "/modules.dep" },
+			{ WATCH_CHANGES_LIB_MODULES "/correct-modules.alias",
+			  WATCH_CHANGES_LIB_MODULES "/modules.alias" },
+			{ }
+		},
+	});
+
 TESTSUITE_MAIN();
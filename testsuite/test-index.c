@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <libkmod/libkmod.h>
+
+#include "testsuite.h"
+
+#define TEST_UNAME "4.0.20-kmod"
+
+static int dump_prefix(struct kmod_ctx *ctx, enum kmod_index type,
+							const char *prefix)
+{
+	struct kmod_index_iter *iter;
+	int err;
+
+	err = kmod_index_iter_new(ctx, type, prefix, &iter);
+	if (err < 0)
+		return err;
+
+	printf("prefix '%s':\n", prefix);
+	while (kmod_index_iter_next(iter))
+		printf("%s %s %u\n", kmod_index_iter_get_key(iter),
+					kmod_index_iter_get_value(iter),
+					kmod_index_iter_get_priority(iter));
+
+	kmod_index_iter_free(iter);
+	return 0;
+}
+
+static noreturn void dump_indexes(bool load_resources)
+{
+	struct kmod_ctx *ctx;
+
+	ctx = kmod_new(NULL, NULL);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (load_resources && kmod_load_resources(ctx) < 0)
+		exit(EXIT_FAILURE);
+
+	if (dump_prefix(ctx, KMOD_INDEX_MODULES_DEP, "") < 0 ||
+	    dump_prefix(ctx, KMOD_INDEX_MODULES_DEP, "mod_foo_") < 0 ||
+	    dump_prefix(ctx, KMOD_INDEX_MODULES_DEP, "mod-bar") < 0 ||
+	    dump_prefix(ctx, KMOD_INDEX_MODULES_SYMBOL, "symbol:print_") < 0 ||
+	    dump_prefix(ctx, KMOD_INDEX_MODULES_SYMBOL, "symbol:print_fooB") < 0)
+		exit(EXIT_FAILURE);
+
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+
+static noreturn int test_index_iter(const struct test *t)
+{
+	dump_indexes(false);
+}
+DEFINE_TEST(test_index_iter,
+	.description = "test iterating over index entries by prefix",
+	.config = {
+		[TC_UNAME_R] = TEST_UNAME,
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-dependencies-index/good/",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-dependencies-index/correct-iter.txt",
+	});
+
+static noreturn int test_index_iter_loaded(const struct test *t)
+{
+	dump_indexes(true);
+}
+DEFINE_TEST(test_index_iter_loaded,
+	.description = "test iterating over index entries with resources loaded",
+	.config = {
+		[TC_UNAME_R] = TEST_UNAME,
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-dependencies-index/good/",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-dependencies-index/correct-iter.txt",
+	});
+
+TESTSUITE_MAIN();
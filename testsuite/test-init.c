@@ -17,13 +17,16 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <shared/macro.h>
+#include <shared/util.h>
 
 #include <libkmod/libkmod.h>
 
@@ -67,6 +70,12 @@ static noreturn int test_insert(const struct test *t)
 		ERR("could not insert module: %m\n");
 		exit(EXIT_FAILURE);
 	}
+
+	if (kmod_get_file_cache_size(ctx) != 0) {
+		ERR("module file still open after insertion\n");
+		exit(EXIT_FAILURE);
+	}
+	kmod_module_unref(mod);
 	kmod_unref(ctx);
 
 	exit(EXIT_SUCCESS);
@@ -80,6 +89,115 @@ DEFINE_TEST(test_insert,
 	.modules_loaded = "mod_simple",
 	.need_spawn = true);
 
+static noreturn int test_insert_before_deps(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod;
+	const char *null_config = NULL;
+	int err;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	err = kmod_module_new_from_name(ctx, "mod-loop-a", &mod);
+	if (err != 0)
+		exit(EXIT_FAILURE);
+
+	/* mod-loop-b is not inserted first, as modprobe would do */
+	err = kmod_module_insert_module(mod, 0, NULL);
+	if (err != -ENOENT) {
+		ERR("insert returned %s, expected %s\n", strerror(-err),
+							strerror(ENOENT));
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_module_unref(mod);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_insert_before_deps,
+	.description = "test if inserting a module before its dependencies fails",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-init-deps/",
+		[TC_INIT_MODULE_LATENCIES] = "mod-loop-a:10000",
+	},
+	.inserts = {
+		.check_deps = true,
+		.dep_violations = 1,
+	},
+	.need_spawn = true);
+
+static size_t file_cache_size_after_info(struct kmod_ctx *ctx,
+						struct kmod_module *mod)
+{
+	struct kmod_list *list = NULL;
+
+	if (kmod_module_get_info(mod, &list) < 0) {
+		ERR("could not get info of %s\n", kmod_module_get_name(mod));
+		exit(EXIT_FAILURE);
+	}
+	kmod_module_info_free_list(list);
+
+	return kmod_get_file_cache_size(ctx);
+}
+
+static noreturn int test_file_cache(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	struct kmod_module *a, *b;
+	const char *null_config = NULL;
+	size_t size_a, size_b;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_module_new_from_path(ctx, "/mod-simple-x86_64.ko", &a) < 0 ||
+	    kmod_module_new_from_path(ctx, "/mod-simple-i386.ko", &b) < 0) {
+		ERR("could not create modules from path\n");
+		exit(EXIT_FAILURE);
+	}
+
+	size_a = file_cache_size_after_info(ctx, a);
+	size_b = file_cache_size_after_info(ctx, b) - size_a;
+	if (size_a == 0 || size_b == 0) {
+		ERR("module files are not accounted\n");
+		exit(EXIT_FAILURE);
+	}
+
+	/* only the file in use is kept once the budget is exceeded */
+	kmod_set_file_cache_budget(ctx, 1);
+	if (kmod_get_file_cache_size(ctx) != 0 ||
+	    file_cache_size_after_info(ctx, a) != size_a ||
+	    file_cache_size_after_info(ctx, b) != size_b) {
+		ERR("wrong file cache size with budget\n");
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_set_file_cache_budget(ctx, 0);
+	file_cache_size_after_info(ctx, a);
+	kmod_ctx_trim(ctx);
+	if (kmod_get_file_cache_size(ctx) != 0) {
+		ERR("module files still open after trim\n");
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_module_unref(a);
+	kmod_module_unref(b);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_file_cache,
+	.description = "test if libkmod's file cache keeps to its budget",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-modinfo/",
+	},
+	.need_spawn = true);
+
 static noreturn int test_remove(const struct test *t)
 {
 	struct kmod_ctx *ctx;
@@ -128,4 +246,318 @@ DEFINE_TEST(test_remove,
 	},
 	.need_spawn = true);
 
+static unsigned long long now_usec(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		return 0;
+
+	return ts_usec(&ts);
+}
+
+static noreturn int test_remove_latency(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod;
+	const char *null_config = NULL;
+	unsigned long long start, elapsed;
+	int err;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	err = kmod_module_new_from_name(ctx, "mod-simple", &mod);
+	if (err != 0) {
+		ERR("could not create module from name: %s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+
+	start = now_usec();
+	err = kmod_module_remove_module(mod, 0);
+	elapsed = now_usec() - start;
+	if (err != 0) {
+		ERR("could not remove module: %s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+
+	if (elapsed < 50000) {
+		ERR("removal took %llu usec, expected at least 50000\n",
+								elapsed);
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_module_unref(mod);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_remove_latency,
+	.description = "test if the fake delete_module(2) honors its latency",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-remove/",
+		[TC_DELETE_MODULE_LATENCIES] = "bla:0,mod-simple:50000",
+	},
+	.need_spawn = true);
+
+static void write_config(const char *path, const char *content)
+{
+	FILE *fp = fopen(path, "we");
+
+	if (fp == NULL || fputs(content, fp) < 0) {
+		ERR("could not write %s: %m\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	fclose(fp);
+}
+
+static noreturn int test_reload_config(const struct test *t)
+{
+	static const char *a_conf = "/etc/modprobe.d/a.conf";
+	const char *config_paths[] = { "/etc/modprobe.d", NULL };
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod_a, *mod_b, *mod_c;
+	const char *opts_c;
+	int err;
+
+	ctx = kmod_new(NULL, config_paths);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	kmod_module_new_from_name(ctx, "mod_a", &mod_a);
+	kmod_module_new_from_name(ctx, "mod_b", &mod_b);
+	kmod_module_new_from_name(ctx, "mod_c", &mod_c);
+
+	opts_c = kmod_module_get_options(mod_c);
+	if (!streq(kmod_module_get_options(mod_a), "x=1") ||
+			kmod_module_get_install_commands(mod_b) == NULL ||
+			opts_c == NULL || !streq(opts_c, "z=3")) {
+		ERR("unexpected initial configuration\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = kmod_reload_config(ctx);
+	if (err != 0) {
+		ERR("reload without changes returned %d\n", err);
+		exit(EXIT_FAILURE);
+	}
+
+	write_config(a_conf, "options mod_a x=2\n");
+
+	if (kmod_validate_resources(ctx) != KMOD_RESOURCES_MUST_RECREATE) {
+		ERR("change of %s not detected\n", a_conf);
+		exit(EXIT_FAILURE);
+	}
+
+	err = kmod_reload_config(ctx);
+	if (err != 1) {
+		ERR("reload after change returned %d\n", err);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!streq(kmod_module_get_options(mod_a), "x=2") ||
+			kmod_module_get_install_commands(mod_b) != NULL) {
+		ERR("changes in %s not applied\n", a_conf);
+		exit(EXIT_FAILURE);
+	}
+
+	/* c.conf didn't change: mod_c keeps its cached options */
+	if (kmod_module_get_options(mod_c) != opts_c) {
+		ERR("options of mod_c were invalidated\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (kmod_validate_resources(ctx) != KMOD_RESOURCES_OK) {
+		ERR("resources not valid after reload\n");
+		exit(EXIT_FAILURE);
+	}
+
+	write_config(a_conf, "options mod_a x=1\ninstall mod_b /bin/true\n");
+
+	kmod_module_unref(mod_a);
+	kmod_module_unref(mod_b);
+	kmod_module_unref(mod_c);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_reload_config,
+	.description = "test if libkmod's reload_config only applies changed files",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-reload-config/",
+	},
+	.need_spawn = true);
+
+static noreturn int test_resources_fd(const struct test *t)
+{
+	static const char *softdep = "/lib/modules/4.4.4/modules.softdep";
+	const char *config_paths[] = { "/etc/modprobe.d", NULL };
+	struct kmod_ctx *ctx;
+	struct pollfd pfd;
+	int err;
+
+	ctx = kmod_new(NULL, config_paths);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	pfd.fd = kmod_get_resources_fd(ctx);
+	pfd.events = POLLIN;
+	if (pfd.fd < 0) {
+		ERR("could not get resources fd: %s\n", strerror(-pfd.fd));
+		exit(EXIT_FAILURE);
+	}
+
+	if (kmod_validate_resources(ctx) != KMOD_RESOURCES_OK ||
+						poll(&pfd, 1, 0) != 0) {
+		ERR("resources changed without touching them\n");
+		exit(EXIT_FAILURE);
+	}
+
+	write_config(softdep, "softdep mod_a pre: mod_c\n");
+
+	if (poll(&pfd, 1, 1000) != 1) {
+		ERR("no event after changing %s\n", softdep);
+		exit(EXIT_FAILURE);
+	}
+
+	if (kmod_validate_resources(ctx) != KMOD_RESOURCES_MUST_RECREATE) {
+		ERR("change of %s not detected\n", softdep);
+		exit(EXIT_FAILURE);
+	}
+
+	err = kmod_reload_config(ctx);
+	if (err != 1) {
+		ERR("reload after change returned %d\n", err);
+		exit(EXIT_FAILURE);
+	}
+
+	if (kmod_validate_resources(ctx) != KMOD_RESOURCES_OK) {
+		ERR("resources not valid after reload\n");
+		exit(EXIT_FAILURE);
+	}
+
+	write_config(softdep,
+		"# Soft dependencies extracted from modules themselves.\n");
+
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_resources_fd,
+	.description = "test if libkmod's resources fd reports changes",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-reload-config/",
+	},
+	.need_spawn = true);
+
+static noreturn int test_lazy_config(const struct test *t)
+{
+	const char *config_paths[] = { "/etc/modprobe.d", NULL };
+	struct test_counters before, c;
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod;
+	const char *opts;
+
+	test_counters_get(&before);
+	ctx = kmod_new(NULL, config_paths);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_module_new_from_name(ctx, "mod_a", &mod) < 0)
+		exit(EXIT_FAILURE);
+	test_counters_get(&c);
+	test_counters_sub(&c, &before);
+
+	if (c.opens > 0 || c.readdirs > 0) {
+		ERR("config read before it's used: %lu opens, %lu readdirs\n",
+			c.opens, c.readdirs);
+		exit(EXIT_FAILURE);
+	}
+
+	opts = kmod_module_get_options(mod);
+	if (opts == NULL || !streq(opts, "x=1")) {
+		ERR("unexpected options of mod_a: %s\n", opts);
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_module_unref(mod);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_lazy_config,
+	.description = "test if libkmod reads the configuration on first use",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-reload-config/",
+	},
+	.need_spawn = true,
+	.counters = {
+		.enabled = true,
+	});
+
+static noreturn int test_prefetch_firmware(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod;
+	struct test_counters before, c;
+	const char *null_config = NULL;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_module_new_from_name(ctx, "mod-firmware", &mod) < 0)
+		exit(EXIT_FAILURE);
+
+	/* nothing is read ahead for a dry run */
+	test_counters_get(&before);
+	if (kmod_module_probe_insert_module(mod, KMOD_PROBE_DRY_RUN |
+					KMOD_PROBE_PREFETCH_FIRMWARE,
+					NULL, NULL, NULL, NULL) < 0)
+		exit(EXIT_FAILURE);
+	test_counters_get(&c);
+	test_counters_sub(&c, &before);
+
+	if (c.readaheads > 0) {
+		ERR("dry run: %lu readaheads\n", c.readaheads);
+		exit(EXIT_FAILURE);
+	}
+
+	/* kmod-test.fw is there, kmod-missing.fw isn't */
+	test_counters_get(&before);
+	if (kmod_module_probe_insert_module(mod, KMOD_PROBE_PREFETCH_FIRMWARE,
+					NULL, NULL, NULL, NULL) < 0)
+		exit(EXIT_FAILURE);
+	test_counters_get(&c);
+	test_counters_sub(&c, &before);
+
+	if (c.readaheads != 1) {
+		ERR("probe: %lu readaheads, expected 1\n", c.readaheads);
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_module_unref(mod);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(test_prefetch_firmware,
+	.description = "check if the firmware of modules is read ahead of insertion",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-init-firmware/",
+		[TC_INIT_MODULE_RETCODES] = "",
+	},
+	.need_spawn = true,
+	.counters = {
+		.enabled = true,
+	},
+	.modules_loaded = "mod-firmware",
+	);
+
 TESTSUITE_MAIN();
@@ -16,6 +16,7 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -23,6 +24,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <shared/macro.h>
+
 #include <libkmod/libkmod.h>
 
 #include "testsuite.h"
@@ -88,4 +91,368 @@ DEFINE_TEST(loaded_1,
 		.out = TESTSUITE_ROOTFS "test-loaded/correct.txt",
 	});
 
+static int cmp_names(const void *pa, const void *pb)
+{
+	const char *a = *(const char **) pa;
+	const char *b = *(const char **) pb;
+
+	return strcmp(a, b);
+}
+
+static void print_monitor_loaded(struct kmod_monitor *monitor)
+{
+	struct kmod_list *list, *itr;
+	const char *names[16];
+	size_t i, n = 0;
+
+	if (kmod_monitor_get_loaded(monitor, &list) < 0)
+		exit(EXIT_FAILURE);
+
+	kmod_list_foreach(itr, list) {
+		struct kmod_module *mod = kmod_module_get_module(itr);
+
+		if (n < sizeof(names) / sizeof(names[0]))
+			names[n++] = kmod_module_get_name(mod);
+		kmod_module_unref(mod);
+	}
+
+	qsort(names, n, sizeof(names[0]), cmp_names);
+
+	printf("loaded:");
+	for (i = 0; i < n; i++)
+		printf(" %s", names[i]);
+	putchar('\n');
+
+	kmod_module_unref_list(list);
+}
+
+static int loaded_monitor(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	const char *null_config = NULL;
+	struct kmod_monitor *monitor;
+	struct kmod_module *mod;
+	int err;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	err = kmod_monitor_new(ctx, &monitor);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+
+	print_monitor_loaded(monitor);
+
+	err = kmod_monitor_process(monitor);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+	printf("changes: %d\n", err);
+
+	print_monitor_loaded(monitor);
+	printf("btusb: %s\n",
+	       kmod_monitor_is_loaded(monitor, "btusb") ? "yes" : "no");
+	printf("mod-foo: %s\n",
+	       kmod_monitor_is_loaded(monitor, "mod-foo") ? "yes" : "no");
+
+	/* there's no mod_foo in /sys: only the monitor knows it's loaded */
+	err = kmod_module_new_from_name(ctx, "mod-foo", &mod);
+	if (err < 0)
+		exit(EXIT_FAILURE);
+	err = kmod_module_probe_insert_module(mod, KMOD_PROBE_FAIL_ON_LOADED,
+						NULL, NULL, NULL, NULL);
+	printf("probe mod-foo: %s\n", strerror(-err));
+	kmod_module_unref(mod);
+
+	kmod_monitor_unref(monitor);
+	kmod_unref(ctx);
+
+	return EXIT_SUCCESS;
+}
+DEFINE_TEST(loaded_monitor,
+	.description = "check if loaded modules are tracked with uevents",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-loaded/",
+		[TC_UEVENTS] = "add:module:mod_foo,add:pci:pci0000,"
+			       "remove:module:btusb,add:module:mod_bar,"
+			       "remove:module:mod_none,add:module:mod_foo",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-loaded/correct-monitor.txt",
+	});
+
+static int loaded_monitor_overflow(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	const char *null_config = NULL;
+	struct kmod_monitor *monitor;
+	int err;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	err = kmod_monitor_new(ctx, &monitor);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+
+	print_monitor_loaded(monitor);
+
+	/* events queued before the resync must not undo it */
+	err = kmod_monitor_process(monitor);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+	printf("changes: %d\n", err);
+
+	print_monitor_loaded(monitor);
+
+	kmod_monitor_unref(monitor);
+	kmod_unref(ctx);
+
+	return EXIT_SUCCESS;
+}
+DEFINE_TEST(loaded_monitor_overflow,
+	.description = "check if the monitor resyncs after losing uevents",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-loaded/",
+		[TC_UEVENTS] = "add:module:mod_foo,remove:module:btusb,"
+			       "overflow",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-loaded/correct-monitor-overflow.txt",
+	});
+
+static void print_parameters(struct kmod_list *list)
+{
+	struct kmod_list *itr;
+
+	kmod_list_foreach(itr, list) {
+		const char *value = kmod_module_parameter_get_value(itr);
+		const char *type = kmod_module_parameter_get_type(itr);
+		const char *desc = kmod_module_parameter_get_description(itr);
+
+		printf("%s.%s=%s type=%s desc=%s\n",
+		       kmod_module_parameter_get_module_name(itr),
+		       kmod_module_parameter_get_name(itr),
+		       value != NULL ? value : "(null)",
+		       type != NULL ? type : "(null)",
+		       desc != NULL ? desc : "(null)");
+	}
+
+	kmod_module_parameter_free_list(list);
+}
+
+static int loaded_parameters(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	const char *null_config = NULL;
+	struct kmod_list *loaded = NULL, *list = NULL;
+	struct kmod_module *mod;
+	int err;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	/* mod-foo is not loaded: it has no parameters */
+	if (kmod_module_new_from_name(ctx, "mod-foo", &mod) < 0)
+		exit(EXIT_FAILURE);
+
+	err = kmod_module_get_parameters(mod, 0, &list);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+	printf("mod-foo: %d parameters\n", err);
+	print_parameters(list);
+	kmod_module_unref(mod);
+
+	err = kmod_module_new_from_loaded(ctx, &loaded);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+
+	list = NULL;
+	err = kmod_module_get_parameters_list(loaded,
+					KMOD_PARAMETERS_MODINFO, &list);
+	if (err < 0) {
+		fprintf(stderr, "%s\n", strerror(-err));
+		exit(EXIT_FAILURE);
+	}
+	printf("loaded: %d parameters\n", err);
+	print_parameters(list);
+
+	kmod_module_unref_list(loaded);
+	kmod_unref(ctx);
+
+	return EXIT_SUCCESS;
+}
+DEFINE_TEST(loaded_parameters,
+	.description = "check if parameters of loaded modules are read",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-loaded-parameters/",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-loaded-parameters/correct-parameters.txt",
+	});
+
+static void print_module_list(const char *prefix, struct kmod_list *list)
+{
+	struct kmod_list *itr;
+
+	fputs(prefix, stdout);
+	kmod_list_foreach(itr, list) {
+		struct kmod_module *mod = kmod_module_get_module(itr);
+
+		printf(" %s", kmod_module_get_name(mod));
+		kmod_module_unref(mod);
+	}
+	putchar('\n');
+	kmod_module_unref_list(list);
+}
+
+static int loaded_holders(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	const char *null_config = NULL;
+	struct kmod_holder_graph *graph;
+	struct kmod_module *mod_b, *mod_c, *mod_x;
+	struct kmod_list *list;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_holder_graph_new(ctx, &graph) < 0)
+		exit(EXIT_FAILURE);
+
+	if (kmod_module_new_from_name(ctx, "mod-b", &mod_b) < 0 ||
+	    kmod_module_new_from_name(ctx, "mod-c", &mod_c) < 0 ||
+	    kmod_module_new_from_name(ctx, "mod-x", &mod_x) < 0)
+		exit(EXIT_FAILURE);
+
+	if (kmod_holder_graph_get_holders(graph, mod_b, 0, &list) < 0)
+		exit(EXIT_FAILURE);
+	print_module_list("holders of mod_b:", list);
+
+	if (kmod_holder_graph_get_holders(graph, mod_b,
+				KMOD_HOLDER_GRAPH_TRANSITIVE, &list) < 0)
+		exit(EXIT_FAILURE);
+	print_module_list("transitive holders of mod_b:", list);
+
+	if (kmod_holder_graph_get_holders(graph, mod_x, 0, &list) < 0)
+		exit(EXIT_FAILURE);
+	print_module_list("holders of mod_x:", list);
+
+	if (kmod_holder_graph_get_unload_order(graph, mod_c, &list) < 0)
+		exit(EXIT_FAILURE);
+	print_module_list("unload order of mod_c:", list);
+
+	if (kmod_holder_graph_get_unload_order(graph, NULL, &list) < 0)
+		exit(EXIT_FAILURE);
+	print_module_list("unload order:", list);
+
+	kmod_module_unref(mod_b);
+	kmod_module_unref(mod_c);
+	kmod_module_unref(mod_x);
+	kmod_holder_graph_unref(graph);
+	kmod_unref(ctx);
+
+	return EXIT_SUCCESS;
+}
+DEFINE_TEST(loaded_holders,
+	.description = "check holder graph of loaded modules",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-holders/",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-holders/correct.txt",
+	});
+
+static void print_lookups(const char *prefix,
+					const struct kmod_symbol_map *map)
+{
+	static const uint64_t addresses[] = {
+		0xffffffffc0000fff, /* before the module */
+		0xffffffffc0001004, /* test_module_exit, aliased */
+		0xffffffffc000100b, /* past its end */
+		0xffffffffc0003010, /* __this_module */
+		0xffffffffc0005000, /* .init.text, freed */
+		0xffffffffc0007008, /* nosize_table, without a size */
+		0xffffffffc0007010, /* past the end of its section */
+		0xffffffffc0100000, /* past the last module */
+	};
+	size_t i;
+
+	printf("%s: %u symbols\n", prefix, kmod_symbol_map_get_count(map));
+
+	for (i = 0; i < ARRAY_SIZE(addresses); i++) {
+		const char *module, *symbol;
+		uint64_t offset;
+
+		if (kmod_symbol_map_lookup(map, addresses[i], &module, &symbol,
+								&offset) < 0)
+			printf("%#"PRIx64" ?\n", addresses[i]);
+		else
+			printf("%#"PRIx64" %s+%#"PRIx64" [%s]\n", addresses[i],
+						symbol, offset, module);
+	}
+}
+
+static int loaded_symbol_map(const struct test *t)
+{
+	static const char *path = "/symbol-map";
+	struct kmod_ctx *ctx;
+	const char *null_config = NULL;
+	struct kmod_symbol_map *map;
+	int fd;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_symbol_map_new(ctx, &map) < 0)
+		exit(EXIT_FAILURE);
+	print_lookups("loaded", map);
+
+	fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0 || kmod_symbol_map_write(map, fd) < 0)
+		exit(EXIT_FAILURE);
+	close(fd);
+	kmod_symbol_map_unref(map);
+
+	if (kmod_symbol_map_new_from_file(ctx, path, &map) < 0)
+		exit(EXIT_FAILURE);
+	print_lookups("file", map);
+
+	kmod_symbol_map_unref(map);
+	kmod_unref(ctx);
+
+	return EXIT_SUCCESS;
+}
+DEFINE_TEST(loaded_symbol_map,
+	.description = "check symbol map of loaded modules",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-symbol-map/",
+	},
+	.need_spawn = true,
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-symbol-map/correct.txt",
+	});
+
 TESTSUITE_MAIN();
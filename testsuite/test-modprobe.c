@@ -22,6 +22,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/wait.h>
+
+#include <libkmod/libkmod.h>
 
 #include "testsuite.h"
 
@@ -393,4 +396,159 @@ DEFINE_TEST(modprobe_external,
 	.modules_loaded = "mod-simple",
 	);
 
+static noreturn int modprobe_archive(const struct test *t)
+{
+	const char *kmod = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *progname = ABS_TOP_BUILDDIR "/tools/modprobe";
+	const char *const archive_args[] = {
+		kmod,
+		"archive", "-o", "/lib/modules/4.4.4/modules.kar", "mod-loop-a",
+		NULL,
+	};
+	/* 5.5.5 doesn't exist: modules and indexes only come from the archive */
+	const char *const args[] = {
+		progname,
+		"--archive=/lib/modules/4.4.4/modules.kar", "-S", "5.5.5",
+		"mod-loop-a",
+		NULL,
+	};
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		test_spawn_prog(kmod, archive_args);
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS) {
+		ERR("kmod archive failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(modprobe_archive,
+	.description = "check if modprobe loads modules from an archive",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-modprobe/archive",
+		[TC_INIT_MODULE_RETCODES] = "",
+	},
+	.modules_loaded = "mod-loop-b,mod-loop-a",
+	);
+
+static noreturn int modprobe_deps_order(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/modprobe";
+	const char *const args[] = {
+		progname,
+		"mod-loop-a",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(modprobe_deps_order,
+	.description = "check if modprobe waits for dependencies to be live",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-modprobe/deps-order",
+		[TC_INIT_MODULE_LATENCIES] = "*:20000",
+	},
+	.inserts = {
+		.check_deps = true,
+		.min_concurrent = 1,
+		.max_concurrent = 1,
+	},
+	.modules_loaded = "mod-loop-b,mod-loop-a",
+	);
+
+/* readaheads done by modprobe inserting mod-firmware with extra_arg */
+static unsigned long modprobe_firmware_readaheads(const char *extra_arg)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/modprobe";
+	const char *const args[] = {
+		progname,
+		"mod-firmware",
+		extra_arg,
+		NULL,
+	};
+	struct test_counters c;
+	pid_t pid;
+	int status;
+
+	pid = fork();
+	if (pid < 0)
+		exit(EXIT_FAILURE);
+	if (pid == 0) {
+		test_spawn_prog(progname, args);
+		exit(EXIT_FAILURE);
+	}
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS) {
+		ERR("modprobe failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (test_counters_get(&c) < 0)
+		exit(EXIT_FAILURE);
+
+	return c.readaheads;
+}
+
+static noreturn int modprobe_firmware_prefetch(const struct test *t)
+{
+	unsigned long readaheads = modprobe_firmware_readaheads(NULL);
+
+	/* kmod-test.fw is there, kmod-missing.fw isn't */
+	if (readaheads != 1) {
+		ERR("%lu readaheads, expected 1\n", readaheads);
+		exit(EXIT_FAILURE);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(modprobe_firmware_prefetch,
+	.description = "check if modprobe reads the firmware of modules ahead",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-modprobe/firmware",
+		[TC_INIT_MODULE_RETCODES] = "",
+	},
+	.counters = {
+		.enabled = true,
+	},
+	.modules_loaded = "mod-firmware",
+	);
+
+static noreturn int modprobe_no_firmware_prefetch(const struct test *t)
+{
+	unsigned long readaheads;
+
+	readaheads = modprobe_firmware_readaheads("--no-firmware-prefetch");
+	if (readaheads != 0) {
+		ERR("%lu readaheads, expected none\n", readaheads);
+		exit(EXIT_FAILURE);
+	}
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(modprobe_no_firmware_prefetch,
+	.description = "check if modprobe --no-firmware-prefetch reads no firmware ahead",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-modprobe/firmware-no-prefetch",
+		[TC_INIT_MODULE_RETCODES] = "",
+	},
+	.counters = {
+		.enabled = true,
+	},
+	.modules_loaded = "mod-firmware",
+	);
+
 TESTSUITE_MAIN();
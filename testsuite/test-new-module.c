@@ -23,6 +23,8 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <shared/macro.h>
+
 #include <libkmod/libkmod.h>
 
 #include "testsuite.h"
@@ -115,4 +117,141 @@ DEFINE_TEST(from_alias,
 		.out = TESTSUITE_ROOTFS "test-new-module/from_alias/correct.txt",
 	});
 
+static noreturn int from_name_warm(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod, *mod2;
+	struct kmod_list *list = NULL;
+	struct test_counters before, c;
+	const char *null_config = NULL;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_load_resources(ctx) < 0 ||
+	    kmod_module_new_from_name(ctx, "mod-foo", &mod) < 0)
+		exit(EXIT_FAILURE);
+
+	/* the module is already in the context's pool */
+	test_counters_get(&before);
+	if (kmod_module_new_from_name(ctx, "mod-foo", &mod2) < 0)
+		exit(EXIT_FAILURE);
+	test_counters_get(&c);
+	test_counters_sub(&c, &before);
+
+	if (c.mallocs > 0 || c.opens > 0 || c.stats > 0 || c.reads > 0 ||
+						c.mmaps > 0) {
+		ERR("new module from name: %lu mallocs, %lu opens, %lu stats, %lu reads, %lu mmaps\n",
+			c.mallocs, c.opens, c.stats, c.reads, c.mmaps);
+		exit(EXIT_FAILURE);
+	}
+
+	/* the indexes are already loaded */
+	test_counters_get(&before);
+	if (kmod_module_new_from_lookup(ctx, "mod-foo", &list) < 0)
+		exit(EXIT_FAILURE);
+	test_counters_get(&c);
+	test_counters_sub(&c, &before);
+
+	if (c.opens > 0 || c.reads > 0 || c.mmaps > 0) {
+		ERR("new module from lookup: %lu opens, %lu reads, %lu mmaps\n",
+			c.opens, c.reads, c.mmaps);
+		exit(EXIT_FAILURE);
+	}
+
+	kmod_module_unref_list(list);
+	kmod_module_unref(mod2);
+	kmod_module_unref(mod);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(from_name_warm,
+	.description = "check that a warm context doesn't go to the filesystem",
+	.config = {
+		[TC_UNAME_R] = "4.0.20-kmod",
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-dependencies/",
+	},
+	.need_spawn = true,
+	.counters = {
+		/* the 4 indexes and the counters themselves */
+		.budget = {
+			.mmaps = 5,
+		},
+	});
+
+static const char *symbol_iter_types[] = {
+	[KMOD_SYMBOL_ITER_VERSIONS] = "versions",
+	[KMOD_SYMBOL_ITER_SYMBOLS] = "symbols",
+	[KMOD_SYMBOL_ITER_DEPENDENCIES] = "dependencies",
+};
+
+static noreturn int symbol_iter(const struct test *t)
+{
+	struct kmod_ctx *ctx;
+	struct kmod_module *mod;
+	const char *null_config = NULL;
+	int type;
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL)
+		exit(EXIT_FAILURE);
+
+	if (kmod_module_new_from_path(ctx,
+			"/lib/modules/4.4.4/kernel/mod-loop-a.ko", &mod) < 0)
+		exit(EXIT_FAILURE);
+
+	for (type = 0; type < (int) ARRAY_SIZE(symbol_iter_types); type++) {
+		struct kmod_symbol_iter *iter;
+		struct test_counters before, c;
+
+		if (kmod_symbol_iter_new(mod, type, &iter) < 0)
+			exit(EXIT_FAILURE);
+
+		printf("%s:\n", symbol_iter_types[type]);
+
+		test_counters_get(&before);
+		while (kmod_symbol_iter_next(iter)) {
+			size_t len;
+			const char *name = kmod_symbol_iter_get_symbol(iter,
+									&len);
+
+			if (strlen(name) != len)
+				exit(EXIT_FAILURE);
+
+			printf("\t%s crc=%#"PRIx64" bind=%c\n", name,
+				kmod_symbol_iter_get_crc(iter),
+				kmod_symbol_iter_get_bind(iter) ?: '-');
+		}
+		test_counters_get(&c);
+		test_counters_sub(&c, &before);
+
+		if (c.mallocs > 0) {
+			ERR("%s: %lu mallocs while iterating\n",
+				symbol_iter_types[type], c.mallocs);
+			exit(EXIT_FAILURE);
+		}
+
+		kmod_symbol_iter_free(iter);
+	}
+
+	kmod_module_unref(mod);
+	kmod_unref(ctx);
+
+	exit(EXIT_SUCCESS);
+}
+DEFINE_TEST(symbol_iter,
+	.description = "check that symbols are iterated without allocations",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-depmod/detect-loop/",
+	},
+	.need_spawn = true,
+	.counters = {
+		.enabled = true,
+	},
+	.output = {
+		.out = TESTSUITE_ROOTFS "test-new-module/symbol_iter/correct.txt",
+	});
+
 TESTSUITE_MAIN();
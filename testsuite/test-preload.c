@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testsuite.h"
+
+#define PRELOAD_ROOTFS TESTSUITE_ROOTFS "test-preload"
+
+static noreturn int kmod_tool_preload(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *const args[] = {
+		progname,
+		"preload", "-j", "2",
+		"/etc/modules-load.d",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_preload,
+	.description = "check if kmod preload inserts independent modules in parallel",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = PRELOAD_ROOTFS "/load",
+		[TC_INIT_MODULE_LATENCIES] = "*:20000",
+	},
+	.inserts = {
+		.check_deps = true,
+		.min_concurrent = 2,
+		.max_concurrent = 2,
+	},
+	.modules_loaded = "mod-loop-b,mod-simple,mod-loop-a,mod-softdep",
+	);
+
+static noreturn int kmod_tool_preload_dry_run(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *const args[] = {
+		progname,
+		"preload", "--dry-run",
+		"/etc/modules-load.d",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_preload_dry_run,
+	.description = "check if kmod preload inserts dependencies first and once",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = PRELOAD_ROOTFS "/load",
+	},
+	.output = {
+		.out = PRELOAD_ROOTFS "/load/correct-dry-run.txt",
+	});
+
+static noreturn int kmod_tool_preload_record(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *const args[] = {
+		progname,
+		"preload", "--record=/boot-profile.conf",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_preload_record,
+	.description = "check if kmod preload records the loaded modules",
+	.config = {
+		[TC_ROOTFS] = PRELOAD_ROOTFS "/record",
+	},
+	.output = {
+		.files = (const struct keyval[]) {
+			{ PRELOAD_ROOTFS "/record/correct-boot-profile.conf",
+			  PRELOAD_ROOTFS "/record/boot-profile.conf" },
+			{ }
+		},
+	});
+
+TESTSUITE_MAIN();
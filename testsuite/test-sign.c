@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "testsuite.h"
+
+#define SIGN_ROOTFS TESTSUITE_ROOTFS "test-sign"
+
+static const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+
+static noreturn int kmod_tool_sig_report(const struct test *t)
+{
+	const char *const args[] = {
+		progname,
+		"sig-report", "-j", "2",
+		"/mod-simple-sha1.ko",
+		"/mod-simple-sha256.ko",
+		"/mod-simple-x86_64.ko",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_sig_report,
+	.description = "check if kmod sig-report reports signed and unsigned modules",
+	.config = {
+		[TC_ROOTFS] = TESTSUITE_ROOTFS "test-modinfo/",
+	},
+	.output = {
+		.out = SIGN_ROOTFS "/correct-report.txt",
+	});
+
+#ifdef ENABLE_OPENSSL
+static noreturn int kmod_tool_sign(const struct test *t)
+{
+	const char *const sign_args[] = {
+		progname,
+		"sign", "-j", "2", "-k", "/signing_key.pem",
+		"/lib/modules/4.4.4",
+		NULL,
+	};
+	const char *const args[] = {
+		progname,
+		"sig-report", "-j", "2",
+		"/lib/modules/4.4.4",
+		NULL,
+	};
+	int status;
+	pid_t pid;
+
+	pid = fork();
+	if (pid == 0) {
+		test_spawn_prog(progname, sign_args);
+		exit(EXIT_FAILURE);
+	}
+
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS) {
+		ERR("kmod sign failed\n");
+		exit(EXIT_FAILURE);
+	}
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_sign,
+	.description = "check if kmod sign signs modules not signed yet",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = SIGN_ROOTFS,
+	},
+	.output = {
+		.out = SIGN_ROOTFS "/correct-sign.txt",
+	});
+#endif
+
+TESTSUITE_MAIN();
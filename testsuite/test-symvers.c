@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testsuite.h"
+
+#define CHECK_SYMVERS_ROOTFS TESTSUITE_ROOTFS "test-symvers"
+static noreturn int kmod_tool_check_symvers(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *const args[] = {
+		progname,
+		"check-symvers", "-j", "2",
+		"-s", "/Module.symvers",
+		"/lib/modules/4.4.4",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_check_symvers,
+	.description = "check if kmod check-symvers reports CRC mismatches",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = CHECK_SYMVERS_ROOTFS,
+	},
+	.expected_fail = true,
+	.output = {
+		.out = CHECK_SYMVERS_ROOTFS "/correct.txt",
+	});
+
+static noreturn int kmod_tool_check_symvers_vermagic(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *const args[] = {
+		progname,
+		"check-symvers", "-j", "2",
+		"-s", "/Module.symvers",
+		"-m", "4.4.4 SMP mod_unload",
+		"/lib/modules/4.4.4",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_check_symvers_vermagic,
+	.description = "check if kmod check-symvers reports vermagic mismatches",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = CHECK_SYMVERS_ROOTFS,
+	},
+	.expected_fail = true,
+	.output = {
+		.out = CHECK_SYMVERS_ROOTFS "/correct-vermagic.txt",
+	});
+
+static noreturn int kmod_tool_check_symvers_unknown(const struct test *t)
+{
+	const char *progname = ABS_TOP_BUILDDIR "/tools/kmod";
+	const char *const args[] = {
+		progname,
+		"check-symvers", "-u",
+		"-s", "/Module.symvers",
+		"/lib/modules/4.4.4",
+		NULL,
+	};
+
+	test_spawn_prog(progname, args);
+	exit(EXIT_FAILURE);
+}
+DEFINE_TEST(kmod_tool_check_symvers_unknown,
+	.description = "check if kmod check-symvers -u reports symbols missing from Module.symvers",
+	.config = {
+		[TC_UNAME_R] = "4.4.4",
+		[TC_ROOTFS] = CHECK_SYMVERS_ROOTFS,
+	},
+	.expected_fail = true,
+	.output = {
+		.out = CHECK_SYMVERS_ROOTFS "/correct-unknown.txt",
+	});
+
+TESTSUITE_MAIN();
@@ -27,10 +27,12 @@
 #include <time.h>
 #include <unistd.h>
 #include <sys/epoll.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <shared/missing.h>
 #include <shared/util.h>
 
 #include "testsuite.h"
@@ -41,6 +43,8 @@ static const char *ANSI_HIGHLIGHT_OFF = "\x1B[0m";
 
 static const char *progname;
 static int oneshot = 0;
+static int fdstats = -1;
+static int fdcounters = -1;
 static const char options_short[] = "lhn";
 static const struct option options[] = {
 	{ "list", no_argument, 0, 'l' },
@@ -58,6 +62,9 @@ struct _env_config {
 	[TC_ROOTFS] = { S_TC_ROOTFS, OVERRIDE_LIBDIR "path.so" },
 	[TC_INIT_MODULE_RETCODES] = { S_TC_INIT_MODULE_RETCODES, OVERRIDE_LIBDIR "init_module.so" },
 	[TC_DELETE_MODULE_RETCODES] = { S_TC_DELETE_MODULE_RETCODES, OVERRIDE_LIBDIR "delete_module.so" },
+	[TC_UEVENTS] = { S_TC_UEVENTS, OVERRIDE_LIBDIR "uevent.so" },
+	[TC_INIT_MODULE_LATENCIES] = { S_TC_INIT_MODULE_LATENCIES, OVERRIDE_LIBDIR "init_module.so" },
+	[TC_DELETE_MODULE_LATENCIES] = { S_TC_DELETE_MODULE_LATENCIES, OVERRIDE_LIBDIR "delete_module.so" },
 };
 
 #define USEC_PER_SEC  1000000ULL
@@ -173,6 +180,36 @@ int test_spawn_prog(const char *prog, const char *const args[])
 	return EXIT_FAILURE;
 }
 
+static bool preload_append(char **preload, size_t *preloadlen,
+						const char *ldpreload)
+{
+	size_t ldpreloadlen = strlen(ldpreload);
+	char *tmp;
+
+	tmp = realloc(*preload, *preloadlen + 2 + ldpreloadlen);
+	if (tmp == NULL) {
+		ERR("oom: test_export_environ()\n");
+		return false;
+	}
+	*preload = tmp;
+
+	if (*preloadlen > 0)
+		tmp[(*preloadlen)++] = ' ';
+	memcpy(tmp + *preloadlen, ldpreload, ldpreloadlen);
+	*preloadlen += ldpreloadlen;
+	tmp[*preloadlen] = '\0';
+
+	return true;
+}
+
+static void setenv_fd(const char *key, int fd)
+{
+	char buf[16];
+
+	snprintf(buf, sizeof(buf), "%d", fd);
+	setenv(key, buf, 1);
+}
+
 static void test_export_environ(const struct test *t)
 {
 	char *preload = NULL;
@@ -183,29 +220,25 @@ static void test_export_environ(const struct test *t)
 	unsetenv("LD_PRELOAD");
 
 	for (i = 0; i < _TC_LAST; i++) {
-		const char *ldpreload;
-		size_t ldpreloadlen;
-		char *tmp;
-
 		if (t->config[i] == NULL)
 			continue;
 
 		setenv(env_config[i].key, t->config[i], 1);
 
-		ldpreload = env_config[i].ldpreload;
-		ldpreloadlen = strlen(ldpreload);
-		tmp = realloc(preload, preloadlen + 2 + ldpreloadlen);
-		if (tmp == NULL) {
-			ERR("oom: test_export_environ()\n");
+		if (!preload_append(&preload, &preloadlen,
+						env_config[i].ldpreload)) {
+			free(preload);
 			return;
 		}
-		preload = tmp;
+	}
 
-		if (preloadlen > 0)
-			preload[preloadlen++] = ' ';
-		memcpy(preload + preloadlen, ldpreload, ldpreloadlen);
-		preloadlen += ldpreloadlen;
-		preload[preloadlen] = '\0';
+	if (fdcounters >= 0) {
+		setenv_fd(S_TC_COUNTERS, fdcounters);
+		if (!preload_append(&preload, &preloadlen,
+					OVERRIDE_LIBDIR "counters.so")) {
+			free(preload);
+			return;
+		}
 	}
 
 	if (preload != NULL)
@@ -215,6 +248,12 @@ static void test_export_environ(const struct test *t)
 
 	for (env = t->env_vars; env && env->key; env++)
 		setenv(env->key, env->val, 1);
+
+	if (fdstats >= 0) {
+		setenv_fd(S_TC_KERNEL_STATS, fdstats);
+		if (t->inserts.check_deps)
+			setenv(S_TC_INIT_MODULE_CHECK_DEPS, "1", 1);
+	}
 }
 
 static inline int test_run_child(const struct test *t, int fdout[2],
@@ -277,10 +316,21 @@ static int check_activity(int fd, bool activity,  const char *path,
 {
 	struct stat st;
 
-	/* not monitoring or monitoring and it has activity */
-	if (fd < 0 || activity)
+	char c;
+
+	if (fd < 0)
 		return 0;
 
+	/* monitoring and it has activity: all the output must be there */
+	if (activity) {
+		if (read(fd, &c, 1) == 0)
+			return 0;
+
+		ERR("Test output on %s ended before the expected one\n",
+									stream);
+		return -1;
+	}
+
 	/* monitoring, there was no activity and size matches */
 	if (stat(path, &st) == 0 && st.st_size == 0)
 		return 0;
@@ -738,6 +788,166 @@ out_a1:
 	return err;
 }
 
+static bool test_needs_kernel_stats(const struct test *t)
+{
+	return t->inserts.check_deps || t->inserts.min_concurrent > 0 ||
+					t->inserts.max_concurrent > 0;
+}
+
+static bool test_needs_counters(const struct test *t)
+{
+	static const struct test_counters unlimited;
+
+	return t->counters.enabled ||
+		memcmp(&t->counters.budget, &unlimited, sizeof(unlimited)) != 0;
+}
+
+static int open_shared(const char *name, size_t size)
+{
+	int fd;
+
+	/* inherited by all the processes of the test */
+	fd = memfd_create(name, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (ftruncate(fd, size) < 0) {
+		int err = -errno;
+		close(fd);
+		return err;
+	}
+
+	return fd;
+}
+
+static bool check_kernel_stats(const struct test *t)
+{
+	struct test_kernel_stats *stats;
+	bool ret = true;
+
+	if (fdstats < 0)
+		return true;
+
+	stats = mmap(NULL, sizeof(*stats), PROT_READ, MAP_SHARED, fdstats, 0);
+	if (stats == MAP_FAILED) {
+		ERR("could not map kernel stats: %m\n");
+		return false;
+	}
+
+	LOG("init_module: %u calls, at most %u at the same time\n",
+			stats->inserts, stats->max_in_flight);
+
+	if (stats->dep_violations != t->inserts.dep_violations) {
+		ERR("%u modules inserted before their dependencies, expected %u\n",
+			stats->dep_violations, t->inserts.dep_violations);
+		ret = false;
+	}
+
+	if (t->inserts.min_concurrent > 0 &&
+			stats->max_in_flight < t->inserts.min_concurrent) {
+		ERR("at most %u modules inserted at the same time, expected at least %u\n",
+			stats->max_in_flight, t->inserts.min_concurrent);
+		ret = false;
+	}
+
+	if (t->inserts.max_concurrent > 0 &&
+			stats->max_in_flight > t->inserts.max_concurrent) {
+		ERR("%u modules inserted at the same time, expected at most %u\n",
+			stats->max_in_flight, t->inserts.max_concurrent);
+		ret = false;
+	}
+
+	munmap(stats, sizeof(*stats));
+	return ret;
+}
+
+#define CHECK_COUNTER(c, budget, field)					\
+	do {								\
+		if ((budget)->field > 0 && (c)->field > (budget)->field) { \
+			ERR("%lu " #field ", expected at most %lu\n",	\
+				(c)->field, (budget)->field);		\
+			ret = false;					\
+		}							\
+	} while (false)
+
+static bool check_counters(const struct test *t)
+{
+	const struct test_counters *budget = &t->counters.budget;
+	struct test_counters *c;
+	bool ret = true;
+
+	if (fdcounters < 0)
+		return true;
+
+	c = mmap(NULL, sizeof(*c), PROT_READ, MAP_SHARED, fdcounters, 0);
+	if (c == MAP_FAILED) {
+		ERR("could not map counters: %m\n");
+		return false;
+	}
+
+	LOG("%lu mallocs (%lu bytes), %lu frees\n", c->mallocs,
+					c->malloc_bytes, c->frees);
+	LOG("%lu opens, %lu stats, %lu reads, %lu mmaps, %lu readdirs\n",
+		c->opens, c->stats, c->reads, c->mmaps, c->readdirs);
+	LOG("%lu syncs, %lu readaheads\n", c->syncs, c->readaheads);
+
+	CHECK_COUNTER(c, budget, mallocs);
+	CHECK_COUNTER(c, budget, malloc_bytes);
+	CHECK_COUNTER(c, budget, frees);
+	CHECK_COUNTER(c, budget, opens);
+	CHECK_COUNTER(c, budget, stats);
+	CHECK_COUNTER(c, budget, reads);
+	CHECK_COUNTER(c, budget, mmaps);
+	CHECK_COUNTER(c, budget, readdirs);
+	CHECK_COUNTER(c, budget, syncs);
+	CHECK_COUNTER(c, budget, readaheads);
+
+	munmap(c, sizeof(*c));
+	return ret;
+}
+
+/*
+ * In a test with counters enabled, get what all its processes did so far.
+ * Return -1 if nothing is being counted.
+ */
+int test_counters_get(struct test_counters *c)
+{
+	static const struct test_counters *counters;
+
+	if (counters == NULL) {
+		const char *s = getenv(S_TC_COUNTERS);
+		void *p;
+
+		if (s == NULL)
+			return -1;
+
+		p = mmap(NULL, sizeof(*counters), PROT_READ, MAP_SHARED,
+								atoi(s), 0);
+		if (p == MAP_FAILED)
+			return -1;
+		counters = p;
+	}
+
+	*c = *counters;
+	return 0;
+}
+
+/* What was done since before was got by test_counters_get() */
+void test_counters_sub(struct test_counters *c,
+		       const struct test_counters *before)
+{
+	c->mallocs -= before->mallocs;
+	c->malloc_bytes -= before->malloc_bytes;
+	c->frees -= before->frees;
+	c->opens -= before->opens;
+	c->stats -= before->stats;
+	c->reads -= before->reads;
+	c->mmaps -= before->mmaps;
+	c->readdirs -= before->readdirs;
+	c->syncs -= before->syncs;
+	c->readaheads -= before->readaheads;
+}
+
 static inline int test_run_parent(const struct test *t, int fdout[2],
 				int fderr[2], int fdmonitor[2], pid_t child)
 {
@@ -794,6 +1004,10 @@ static inline int test_run_parent(const struct test *t, int fdout[2],
 		match_modules = check_loaded_modules(t);
 	else
 		match_modules = true;
+	if (!check_kernel_stats(t))
+		match_modules = false;
+	if (!check_counters(t))
+		match_modules = false;
 
 	if (t->expected_fail == false) {
 		if (err == 0) {
@@ -842,6 +1056,14 @@ static inline int test_run_parent(const struct test *t, int fdout[2],
 	}
 
 exit:
+	if (fdstats >= 0) {
+		close(fdstats);
+		fdstats = -1;
+	}
+	if (fdcounters >= 0) {
+		close(fdcounters);
+		fdcounters = -1;
+	}
 	LOG("------\n");
 	return err;
 }
@@ -903,6 +1125,26 @@ int test_run(const struct test *t)
 		return EXIT_FAILURE;
 	}
 
+	if (test_needs_kernel_stats(t)) {
+		fdstats = open_shared("testsuite-kernel-stats",
+					sizeof(struct test_kernel_stats));
+		if (fdstats < 0) {
+			ERR("could not create kernel stats for %s: %s\n",
+						t->name, strerror(-fdstats));
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (test_needs_counters(t)) {
+		fdcounters = open_shared("testsuite-counters",
+					sizeof(struct test_counters));
+		if (fdcounters < 0) {
+			ERR("could not create counters for %s: %s\n",
+					t->name, strerror(-fdcounters));
+			return EXIT_FAILURE;
+		}
+	}
+
 	LOG("running %s, in forked context\n", t->name);
 
 	pid = fork();
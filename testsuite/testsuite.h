@@ -66,6 +66,36 @@ enum test_config {
 	 */
 	TC_DELETE_MODULE_RETCODES,
 
+	/*
+	 * Fake the uevents sent by the kernel. Calls to socket(2) creating a
+	 * NETLINK_KOBJECT_UEVENT socket are trapped and return a local socket
+	 * on which the following events are already queued:
+	 *
+	 *        action:subsystem:name[,action:subsystem:name...]
+	 *
+	 * e.g. "add:module:mod_foo,remove:module:btusb". Module events are
+	 * sent for /module/<name>, other subsystems for /devices/<name>.
+	 * An "overflow" entry makes the first read of the socket fail with
+	 * ENOBUFS, as if the kernel had dropped events.
+	 */
+	TC_UEVENTS,
+
+	/*
+	 * Make the fake init_module(2) take some time, as the init function
+	 * of the module would in the kernel. Set this variable with the
+	 * following format:
+	 *
+	 *        modname:usec[,modname:usec...]
+	 *
+	 * "*" as modname applies to all modules not in the list. As in
+	 * module names, '-' and '_' are the same, so "mod-foo" also matches
+	 * mod_foo. The module only becomes live after that time.
+	 */
+	TC_INIT_MODULE_LATENCIES,
+
+	/* Same as TC_INIT_MODULE_LATENCIES, for delete_module(2) */
+	TC_DELETE_MODULE_LATENCIES,
+
 	_TC_LAST,
 };
 
@@ -73,6 +103,50 @@ enum test_config {
 #define S_TC_UNAME_R "TESTSUITE_UNAME_R"
 #define S_TC_INIT_MODULE_RETCODES "TESTSUITE_INIT_MODULE_RETCODES"
 #define S_TC_DELETE_MODULE_RETCODES "TESTSUITE_DELETE_MODULE_RETCODES"
+#define S_TC_UEVENTS "TESTSUITE_UEVENTS"
+#define S_TC_INIT_MODULE_LATENCIES "TESTSUITE_INIT_MODULE_LATENCIES"
+#define S_TC_DELETE_MODULE_LATENCIES "TESTSUITE_DELETE_MODULE_LATENCIES"
+
+/*
+ * Shared between the testsuite and the init_module(2) fake, in all the
+ * processes of a test: the fd of a memfd holding a struct
+ * test_kernel_stats is exported in this variable.
+ */
+#define S_TC_KERNEL_STATS "TESTSUITE_KERNEL_STATS"
+#define S_TC_INIT_MODULE_CHECK_DEPS "TESTSUITE_INIT_MODULE_CHECK_DEPS"
+
+struct test_kernel_stats {
+	unsigned int inserts;
+	unsigned int in_flight;
+	unsigned int max_in_flight;
+	unsigned int dep_violations;
+};
+
+/*
+ * Work done by all the processes of a test, counted by counters.so and
+ * shared the same way as struct test_kernel_stats.
+ */
+#define S_TC_COUNTERS "TESTSUITE_COUNTERS"
+
+struct test_counters {
+	/* malloc(), calloc() and realloc() */
+	unsigned long mallocs;
+	unsigned long malloc_bytes;
+	unsigned long frees;
+	/* open(), openat(), fopen() and opendir() */
+	unsigned long opens;
+	/* stat() family and access() */
+	unsigned long stats;
+	/* read() and pread() */
+	unsigned long reads;
+	unsigned long mmaps;
+	/* readdir() */
+	unsigned long readdirs;
+	/* fsync(), fdatasync(), syncfs() and sync() */
+	unsigned long syncs;
+	/* posix_fadvise() and readahead() */
+	unsigned long readaheads;
+};
 
 struct keyval {
 	const char *key;
@@ -97,6 +171,38 @@ struct test {
 	} output;
 	/* comma-separated list of loaded modules at the end of the test */
 	const char *modules_loaded;
+	/*
+	 * Checks on the calls to the fake init_module(2), see
+	 * TC_INIT_MODULE_RETCODES
+	 */
+	struct {
+		/*
+		 * Fail with ENOENT, as for an unknown symbol, inserting a module
+		 * whose dependencies in modules.dep are not live yet
+		 */
+		bool check_deps;
+		/*
+		 * Number of modules expected to be inserted before their
+		 * dependencies with check_deps, any other count fails the test
+		 */
+		unsigned int dep_violations;
+		/*
+		 * Bounds to the number of modules being inserted at the same
+		 * time during the test, 0 to not check
+		 */
+		unsigned int min_concurrent;
+		unsigned int max_concurrent;
+	} inserts;
+	/*
+	 * Count allocations and filesystem calls in all the processes of the
+	 * test, which needs need_spawn. The fields of budget that are not 0
+	 * are the maximum allowed for the whole test: use
+	 * test_counters_get() for the ones of a single operation.
+	 */
+	struct {
+		bool enabled;
+		struct test_counters budget;
+	} counters;
 	testfunc func;
 	const char *config[_TC_LAST];
 	const char *path;
@@ -113,6 +219,9 @@ const struct test *test_find(const struct test *start, const struct test *stop,
 			     const char *name);
 int test_spawn_prog(const char *prog, const char *const args[]);
 int test_run(const struct test *t);
+int test_counters_get(struct test_counters *c);
+void test_counters_sub(struct test_counters *c,
+		       const struct test_counters *before);
 
 #define TS_EXPORT __attribute__ ((visibility("default")))
 
@@ -0,0 +1,173 @@
+/*
+ * Copyright (C) 2012-2013  ProFUSION embedded systems
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "testsuite.h"
+
+/* the other end of the fake uevent socket, kept open until exit */
+static int fake_fd = -1;
+static int peer_fd = -1;
+static bool overflow;
+
+static void *get_libc_func(const char *f)
+{
+	void *fp;
+
+	fp = dlsym(RTLD_NEXT, f);
+	if (fp == NULL) {
+		fprintf(stderr, "FIXME: could not load %s symbol: %s\n",
+			f, dlerror());
+		abort();
+	}
+
+	return fp;
+}
+
+static void send_uevent(int fd, const char *action, const char *subsystem,
+					const char *name, unsigned int seqnum)
+{
+	char buf[4096];
+	const char *dir = strcmp(subsystem, "module") == 0 ? "module" : "devices";
+	int len;
+
+	/* "add@/module/foo\0ACTION=add\0DEVPATH=/module/foo\0..." */
+	len = snprintf(buf, sizeof(buf),
+		       "%s@/%s/%s%cACTION=%s%cDEVPATH=/%s/%s%cSUBSYSTEM=%s%cSEQNUM=%u",
+		       action, dir, name, '\0', action, '\0', dir, name, '\0',
+		       subsystem, '\0', seqnum);
+	if (len < 0 || len >= (int) sizeof(buf)) {
+		fprintf(stderr, "TRAP socket(): uevent too long\n");
+		return;
+	}
+
+	if (send(fd, buf, len + 1, 0) < 0)
+		fprintf(stderr, "TRAP socket(): could not send uevent: %m\n");
+}
+
+static void send_uevents(int fd, const char *s)
+{
+	char *events, *saveptr, *ev;
+	unsigned int seqnum = 1;
+
+	events = strdup(s);
+	if (events == NULL)
+		return;
+
+	for (ev = strtok_r(events, ",", &saveptr); ev != NULL;
+				ev = strtok_r(NULL, ",", &saveptr)) {
+		char *action = ev, *subsystem, *name;
+
+		if (strcmp(ev, "overflow") == 0) {
+			overflow = true;
+			continue;
+		}
+
+		subsystem = strchr(action, ':');
+		if (subsystem == NULL)
+			break;
+		*subsystem++ = '\0';
+
+		name = strchr(subsystem, ':');
+		if (name == NULL)
+			break;
+		*name++ = '\0';
+
+		send_uevent(fd, action, subsystem, name, seqnum++);
+	}
+
+	free(events);
+}
+
+TS_EXPORT int socket(int domain, int type, int protocol)
+{
+	static int (*_socket)(int domain, int type, int protocol);
+	const char *s;
+	int sv[2];
+
+	if (_socket == NULL)
+		_socket = get_libc_func("socket");
+
+	if (domain != AF_NETLINK || protocol != NETLINK_KOBJECT_UEVENT)
+		return _socket(domain, type, protocol);
+
+	s = getenv(S_TC_UEVENTS);
+	if (s == NULL) {
+		fprintf(stderr, "TRAP socket(): missing export %s?\n",
+							S_TC_UEVENTS);
+		return _socket(domain, type, protocol);
+	}
+
+	/* keep SOCK_CLOEXEC, SOCK_NONBLOCK */
+	type = SOCK_DGRAM | (type & (SOCK_CLOEXEC | SOCK_NONBLOCK));
+	if (socketpair(AF_UNIX, type, 0, sv) < 0)
+		return -1;
+
+	send_uevents(sv[1], s);
+
+	fake_fd = sv[0];
+	peer_fd = sv[1];
+
+	return fake_fd;
+}
+
+TS_EXPORT int bind(int fd, const struct sockaddr *addr, socklen_t addrlen)
+{
+	static int (*_bind)(int fd, const struct sockaddr *addr,
+							socklen_t addrlen);
+
+	if (_bind == NULL)
+		_bind = get_libc_func("bind");
+
+	if (fd >= 0 && fd == fake_fd)
+		return 0;
+
+	return _bind(fd, addr, addrlen);
+}
+
+TS_EXPORT ssize_t recvmsg(int fd, struct msghdr *msg, int flags)
+{
+	static ssize_t (*_recvmsg)(int fd, struct msghdr *msg, int flags);
+
+	if (_recvmsg == NULL)
+		_recvmsg = get_libc_func("recvmsg");
+
+	/* like the kernel, report the overflow once and keep what's queued */
+	if (fd >= 0 && fd == fake_fd && overflow) {
+		overflow = false;
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	return _recvmsg(fd, msg, flags);
+}
+
+/* the test is going away anyway, but lets keep valgrind happy */
+void free_resources(void) __attribute__((destructor));
+void free_resources(void)
+{
+	if (peer_fd >= 0)
+		close(peer_fd);
+}
@@ -0,0 +1,586 @@
+/*
+ * kmod-archive - pack modules and their indexes into a single file
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include <shared/array.h>
+#include <shared/hash.h>
+#include <shared/strbuf.h>
+#include <shared/util.h>
+
+#include <libkmod/libkmod-internal.h>
+
+#undef ERR
+#undef DBG
+
+#include "kmod.h"
+
+static const char cmdopts_s[] = "o:d:S:uh";
+static const struct option cmdopts[] = {
+	{ "output", required_argument, 0, 'o' },
+	{ "dirname", required_argument, 0, 'd' },
+	{ "set-version", required_argument, 0, 'S' },
+	{ "uncompress", no_argument, 0, 'u' },
+	{ "help", no_argument, 0, 'h' },
+	{ },
+};
+
+/* indexes libkmod needs, looked up in the archive by these names */
+#define N_ARCHIVE_INDEXES 4
+static const char *const archive_indexes[N_ARCHIVE_INDEXES] = {
+	"modules.alias.bin",
+	"modules.builtin.bin",
+	"modules.dep.bin",
+	"modules.symbols.bin",
+};
+
+static void help(void)
+{
+	printf("Usage:\n"
+	       "\t%s archive [options] -o FILE [module...]\n"
+	       "\n"
+	       "Pack modules and the indexes of a kernel into a single archive that\n"
+	       "libkmod can load modules from, e.g. with modprobe --archive. If modules\n"
+	       "are given, by name or alias, only they and their dependencies are\n"
+	       "packed, otherwise all the modules in modules.dep are. Modules are stored\n"
+	       "compressed or not, as they are installed.\n"
+	       "\n"
+	       "Options:\n"
+	       "\t-o, --output=FILE           write the archive to FILE\n"
+	       "\t-d, --dirname=DIR           use DIR as filesystem root for /lib/modules\n"
+	       "\t-S, --set-version=VERSION   use VERSION instead of `uname -r`\n"
+	       "\t-u, --uncompress            store modules uncompressed, so they can\n"
+	       "\t                            be inserted straight from the archive\n"
+	       "\t-h, --help                  show this help\n",
+	       program_invocation_short_name);
+}
+
+struct archive_item {
+	char *name; /* as in modules.dep, or the index file name */
+	char *path; /* where it's read from */
+	struct kmod_archive_entry entry;
+};
+
+struct archive {
+	struct kmod_ctx *ctx;
+	const char *dirname;
+	struct array modules;
+	struct hash *names;
+	bool uncompress;
+	int fd;
+	uint64_t offset;
+};
+
+static inline uint64_t archive_align(uint64_t offset)
+{
+	return (offset + KMOD_ARCHIVE_ALIGN - 1) &
+					~(uint64_t) (KMOD_ARCHIVE_ALIGN - 1);
+}
+
+static int item_cmp(const void *a, const void *b)
+{
+	const struct archive_item *ia = *(const struct archive_item **) a;
+	const struct archive_item *ib = *(const struct archive_item **) b;
+
+	return strcmp(ia->name, ib->name);
+}
+
+static void item_free(struct archive_item *item)
+{
+	free(item->name);
+	free(item->path);
+	free(item);
+}
+
+static struct archive_item *item_new(const char *dirname, const char *name)
+{
+	struct archive_item *item;
+
+	item = calloc(1, sizeof(*item));
+	if (item == NULL)
+		return NULL;
+
+	if (name[0] == '/')
+		item->path = strdup(name);
+	else if (asprintf(&item->path, "%s/%s", dirname, name) < 0)
+		item->path = NULL;
+
+	item->name = strdup(name);
+	if (item->name == NULL || item->path == NULL) {
+		item_free(item);
+		return NULL;
+	}
+
+	return item;
+}
+
+static int archive_add_module(struct archive *ar, const char *name)
+{
+	struct archive_item *item;
+	int err;
+
+	if (hash_find(ar->names, name) != NULL)
+		return 0;
+
+	item = item_new(ar->dirname, name);
+	if (item == NULL)
+		return -ENOMEM;
+
+	err = array_append(&ar->modules, item);
+	if (err < 0) {
+		item_free(item);
+		return err;
+	}
+
+	return hash_add(ar->names, item->name, item);
+}
+
+/* modules.dep values are "path: dependencies..." */
+static int archive_add_all(struct archive *ar)
+{
+	struct kmod_index_iter *iter;
+	int err;
+
+	err = kmod_index_iter_new(ar->ctx, KMOD_INDEX_MODULES_DEP, "", &iter);
+	if (err < 0) {
+		ERR("could not read modules.dep.bin: %s\n", strerror(-err));
+		return err;
+	}
+
+	while (err >= 0 && kmod_index_iter_next(iter)) {
+		const char *value = kmod_index_iter_get_value(iter);
+		const char *colon = strchr(value, ':');
+
+		if (colon == NULL)
+			continue;
+
+		err = archive_add_module(ar, strndupa(value, colon - value));
+	}
+
+	kmod_index_iter_free(iter);
+	return err;
+}
+
+static int archive_add_path(struct archive *ar, const char *path)
+{
+	size_t len = strlen(ar->dirname);
+
+	/* keep the same name modules.dep has */
+	if (strncmp(path, ar->dirname, len) == 0 && path[len] == '/')
+		path += len + 1;
+
+	return archive_add_module(ar, path);
+}
+
+static int archive_add_lookup(struct archive *ar, const char *alias)
+{
+	struct kmod_list *list = NULL, *l;
+	int err;
+
+	err = kmod_module_new_from_lookup(ar->ctx, alias, &list);
+	if (err < 0 || list == NULL) {
+		ERR("module %s not found\n", alias);
+		return err < 0 ? err : -ENOENT;
+	}
+
+	kmod_list_foreach(l, list) {
+		struct kmod_module *mod = kmod_module_get_module(l);
+		struct kmod_list *deps, *d;
+		const char *path = kmod_module_get_path(mod);
+
+		/* builtin */
+		if (path == NULL)
+			goto next;
+
+		err = archive_add_path(ar, path);
+
+		/* modules.dep already lists the indirect dependencies */
+		deps = kmod_module_get_dependencies(mod);
+		kmod_list_foreach(d, deps) {
+			struct kmod_module *dep = kmod_module_get_module(d);
+
+			path = kmod_module_get_path(dep);
+			if (err >= 0 && path != NULL)
+				err = archive_add_path(ar, path);
+			kmod_module_unref(dep);
+		}
+		kmod_module_unref_list(deps);
+next:
+		kmod_module_unref(mod);
+		if (err < 0)
+			break;
+	}
+
+	kmod_module_unref_list(list);
+	return err;
+}
+
+static int write_at(int fd, const void *buf, size_t size, uint64_t offset)
+{
+	const char *p = buf;
+
+	while (size > 0) {
+		ssize_t r = pwrite(fd, p, size, offset);
+
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		p += r;
+		size -= r;
+		offset += r;
+	}
+
+	return 0;
+}
+
+static int archive_write_contents(struct archive *ar,
+				struct archive_item *item, const void *mem,
+				size_t size)
+{
+	int err;
+
+	if (size > UINT32_MAX) {
+		ERR("%s: too big for an archive\n", item->path);
+		return -EFBIG;
+	}
+
+	err = write_at(ar->fd, mem, size, ar->offset);
+	if (err < 0) {
+		ERR("could not write %s: %s\n", item->name, strerror(-err));
+		return err;
+	}
+
+	item->entry.size = htobe32(size);
+	item->entry.offset = htobe64(ar->offset);
+	ar->offset = archive_align(ar->offset + size);
+
+	return 0;
+}
+
+static int archive_write_file(struct archive *ar, struct archive_item *item)
+{
+	struct stat st;
+	void *mem = NULL;
+	int fd, err;
+
+	fd = open(item->path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) {
+		err = -errno;
+		ERR("could not open %s: %m\n", item->path);
+		return err;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		goto out;
+	}
+
+	if (st.st_size > 0) {
+		mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mem == MAP_FAILED) {
+			err = -errno;
+			ERR("could not map %s: %m\n", item->path);
+			goto out;
+		}
+	}
+
+	err = archive_write_contents(ar, item, mem, st.st_size);
+
+	if (mem != NULL)
+		munmap(mem, st.st_size);
+out:
+	close(fd);
+	return err;
+}
+
+static int archive_write_module(struct archive *ar,
+						struct archive_item *item)
+{
+	struct kmod_file *file;
+	int err;
+
+	if (!ar->uncompress)
+		return archive_write_file(ar, item);
+
+	file = kmod_file_open(ar->ctx, item->path);
+	if (file == NULL) {
+		err = -errno;
+		ERR("could not load %s: %m\n", item->path);
+		return err;
+	}
+
+	err = archive_write_contents(ar, item, kmod_file_get_contents(file),
+						kmod_file_get_size(file));
+	kmod_file_unref(file);
+
+	return err;
+}
+
+static int archive_write(struct archive *ar, const char *output)
+{
+	const char *dir, *base = strrchr(output, '/');
+	int dfd;
+	struct archive_item *indexes[N_ARCHIVE_INDEXES] = { };
+	struct archive_item **modules = (struct archive_item **) ar->modules.array;
+	struct kmod_archive_header hdr;
+	struct kmod_archive_entry *table = NULL;
+	size_t n_modules = ar->modules.count, n_indexes = N_ARCHIVE_INDEXES;
+	size_t i, n_entries = n_modules + n_indexes;
+	char tmp[PATH_MAX];
+	struct strbuf names;
+	uint64_t names_offset;
+	int err = -ENOMEM;
+
+	/* like depmod, write a temporary file next to the output and rename */
+	if (base == NULL) {
+		dir = ".";
+		base = output;
+	} else {
+		dir = strndupa(output, base - output + 1);
+		base++;
+	}
+
+	dfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dfd < 0) {
+		err = -errno;
+		ERR("could not open directory %s: %m\n", dir);
+		return err;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", base);
+	strbuf_init(&names);
+
+	for (i = 0; i < n_indexes; i++) {
+		indexes[i] = item_new(ar->dirname, archive_indexes[i]);
+		if (indexes[i] == NULL)
+			goto out;
+	}
+
+	table = calloc(n_entries, sizeof(*table));
+	if (table == NULL)
+		goto out;
+
+	ar->fd = openat(dfd, tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (ar->fd < 0) {
+		err = -errno;
+		ERR("could not create %s: %m\n", tmp);
+		goto out;
+	}
+
+	/* names go right after the tables, then the contents */
+	names_offset = sizeof(hdr) + n_entries * sizeof(*table);
+	for (i = 0; i < n_entries; i++) {
+		struct archive_item *item = i < n_modules ? modules[i] :
+						indexes[i - n_modules];
+
+		item->entry.name = htobe32(names_offset + names.used);
+		if (!strbuf_pushchars(&names, item->name) ||
+		    !strbuf_pushchar(&names, '\0'))
+			goto fail;
+	}
+
+	if (names_offset + names.used > UINT32_MAX) {
+		err = -EFBIG;
+		goto fail;
+	}
+
+	err = write_at(ar->fd, names.bytes, names.used, names_offset);
+	if (err < 0)
+		goto fail;
+	ar->offset = archive_align(names_offset + names.used);
+
+	for (i = 0; i < n_modules && err >= 0; i++)
+		err = archive_write_module(ar, modules[i]);
+	for (i = 0; i < n_indexes && err >= 0; i++)
+		err = archive_write_file(ar, indexes[i]);
+	if (err < 0)
+		goto fail;
+
+	for (i = 0; i < n_entries; i++)
+		table[i] = i < n_modules ? modules[i]->entry :
+						indexes[i - n_modules]->entry;
+
+	hdr.magic = htobe32(KMOD_ARCHIVE_MAGIC);
+	hdr.version = htobe32(KMOD_ARCHIVE_VERSION);
+	hdr.n_modules = htobe32(n_modules);
+	hdr.n_indexes = htobe32(n_indexes);
+
+	err = write_at(ar->fd, &hdr, sizeof(hdr), 0);
+	if (err >= 0)
+		err = write_at(ar->fd, table, n_entries * sizeof(*table),
+								sizeof(hdr));
+	if (err >= 0 && ftruncate(ar->fd, ar->offset) < 0)
+		err = -errno;
+	if (err < 0) {
+		ERR("could not write %s: %s\n", tmp, strerror(-err));
+		goto fail;
+	}
+
+	if (close(ar->fd) < 0) {
+		err = -errno;
+		ar->fd = -1;
+		ERR("could not write %s: %m\n", tmp);
+		goto fail;
+	}
+	ar->fd = -1;
+
+	if (renameat(dfd, tmp, dfd, base) < 0) {
+		err = -errno;
+		ERR("could not rename %s to %s: %m\n", tmp, output);
+		goto fail;
+	}
+
+	goto out;
+
+fail:
+	if (ar->fd >= 0)
+		close(ar->fd);
+	unlinkat(dfd, tmp, 0);
+out:
+	close(dfd);
+	for (i = 0; i < n_indexes; i++) {
+		if (indexes[i] != NULL)
+			item_free(indexes[i]);
+	}
+	free(table);
+	strbuf_release(&names);
+	return err;
+}
+
+static int do_archive(int argc, char *argv[])
+{
+	struct archive ar = { .fd = -1 };
+	const char *output = NULL;
+	const char *root = NULL;
+	const char *kversion = NULL;
+	char dirname_buf[PATH_MAX];
+	const char *dirname = NULL;
+	size_t i;
+	int err;
+
+	for (;;) {
+		int opt, idx = 0;
+
+		opt = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'd':
+			root = optarg;
+			break;
+		case 'S':
+			kversion = optarg;
+			break;
+		case 'u':
+			ar.uncompress = true;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case '?':
+			return EXIT_FAILURE;
+		default:
+			ERR("unexpected getopt_long() value '%c'.\n", opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (output == NULL) {
+		ERR("missing output file, use -o/--output\n");
+		return EXIT_FAILURE;
+	}
+
+	if (root != NULL || kversion != NULL) {
+		struct utsname u;
+
+		if (root == NULL)
+			root = "";
+		if (kversion == NULL) {
+			if (uname(&u) < 0) {
+				ERR("uname() failed: %m\n");
+				return EXIT_FAILURE;
+			}
+			kversion = u.release;
+		}
+		snprintf(dirname_buf, sizeof(dirname_buf), "%s/lib/modules/%s",
+								root, kversion);
+		dirname = dirname_buf;
+	}
+
+	ar.ctx = kmod_new(dirname, NULL);
+	if (ar.ctx == NULL) {
+		ERR("kmod_new() failed!\n");
+		return EXIT_FAILURE;
+	}
+	log_setup_kmod_log(ar.ctx, LOG_WARNING);
+	kmod_load_resources(ar.ctx);
+
+	ar.dirname = kmod_get_dirname(ar.ctx);
+	array_init(&ar.modules, 256);
+	ar.names = hash_new(1024, NULL);
+	if (ar.names == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	if (optind >= argc)
+		err = archive_add_all(&ar);
+	else {
+		for (i = optind, err = 0; (int)i < argc && err >= 0; i++)
+			err = archive_add_lookup(&ar, argv[i]);
+	}
+
+	if (err >= 0) {
+		array_sort(&ar.modules, item_cmp);
+		err = archive_write(&ar, output);
+	}
+
+out:
+	for (i = 0; i < ar.modules.count; i++)
+		item_free(ar.modules.array[i]);
+	array_free_array(&ar.modules);
+	hash_free(ar.names);
+	kmod_unref(ar.ctx);
+
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+const struct kmod_cmd kmod_cmd_archive = {
+	.name = "archive",
+	.cmd = do_archive,
+	.help = "pack modules and indexes into an archive for the initramfs",
+};
@@ -0,0 +1,231 @@
+/*
+ * kmod-check-symvers - check modules against the symbol versions of a kernel
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <shared/array.h>
+
+#include <libkmod/libkmod.h>
+
+#include "jobs.h"
+#include "kmod.h"
+
+static const char cmdopts_s[] = "s:m:uj:h";
+static const struct option cmdopts[] = {
+	{ "symvers", required_argument, 0, 's' },
+	{ "vermagic", required_argument, 0, 'm' },
+	{ "unknown", no_argument, 0, 'u' },
+	{ "jobs", required_argument, 0, 'j' },
+	{ "help", no_argument, 0, 'h' },
+	{ },
+};
+
+static void help(void)
+{
+	printf("Usage:\n"
+	       "\t%s check-symvers [options] -s Module.symvers [module|dir...]\n"
+	       "\n"
+	       "Check the symbol versions (__versions) and vermagic of modules against\n"
+	       "the Module.symvers of a kernel build. Directories are searched\n"
+	       "recursively. If none is given, the modules of the running kernel are\n"
+	       "checked. One line is printed per mismatch, with tab-separated fields:\n"
+	       "module, kind (crc, unknown or vermagic), symbol, expected, found.\n"
+	       "\n"
+	       "Options:\n"
+	       "\t-s, --symvers=FILE    Module.symvers of the target kernel\n"
+	       "\t-m, --vermagic=STR    also check vermagic against STR\n"
+	       "\t-u, --unknown         report symbols missing from Module.symvers\n"
+	       "\t-j, --jobs=N          number of parallel workers\n"
+	       "\t-h, --help            show this help\n",
+	       program_invocation_short_name);
+}
+
+struct check {
+	struct kmod_ctx *ctx;
+	struct kmod_symvers *symvers;
+	const char *vermagic;
+	unsigned int flags;
+};
+
+static const char *mismatch_kind(int type)
+{
+	switch (type) {
+	case KMOD_SYMVERS_MISMATCH_CRC:
+		return "crc";
+	case KMOD_SYMVERS_MISMATCH_UNKNOWN:
+		return "unknown";
+	case KMOD_SYMVERS_MISMATCH_VERMAGIC:
+		return "vermagic";
+	default:
+		return "?";
+	}
+}
+
+static int check_one(const struct check *c, const char *path, FILE *out)
+{
+	struct kmod_module *mod;
+	struct kmod_list *l, *list = NULL;
+	int err;
+
+	err = kmod_module_new_from_path(c->ctx, path, &mod);
+	if (err < 0) {
+		ERR("could not open module %s: %s\n", path, strerror(-err));
+		return err;
+	}
+
+	err = kmod_module_check_symvers(mod, c->symvers, c->vermagic,
+					c->flags, &list);
+	if (err < 0) {
+		ERR("could not check module %s: %s\n", path, strerror(-err));
+		goto end;
+	}
+
+	kmod_list_foreach(l, list) {
+		int type = kmod_module_symvers_mismatch_get_type(l);
+		const char *symbol = kmod_module_symvers_mismatch_get_symbol(l);
+
+		if (type == KMOD_SYMVERS_MISMATCH_VERMAGIC) {
+			fprintf(out, "%s\t%s\t-\t%s\t%s\n", path,
+				mismatch_kind(type), c->vermagic, symbol);
+			continue;
+		}
+
+		fprintf(out, "%s\t%s\t%s\t", path, mismatch_kind(type), symbol);
+		if (type == KMOD_SYMVERS_MISMATCH_UNKNOWN)
+			fputs("-", out);
+		else
+			fprintf(out, "0x%08"PRIx64,
+				kmod_module_symvers_mismatch_get_expected_crc(l));
+		fprintf(out, "\t0x%08"PRIx64"\n",
+			kmod_module_symvers_mismatch_get_crc(l));
+	}
+
+	kmod_module_symvers_mismatch_free_list(list);
+
+end:
+	kmod_module_unref(mod);
+	return err;
+}
+
+static int check_range(void *data, const struct array *paths,
+					size_t start, size_t end, FILE *out)
+{
+	const struct check *c = data;
+	size_t i;
+	int n = 0, err = 0;
+
+	for (i = start; i < end; i++) {
+		int r = check_one(c, paths->array[i], out);
+
+		if (r < 0)
+			err = r;
+		else if (r > 0)
+			n++;
+	}
+
+	return err < 0 ? err : n;
+}
+
+static int do_check_symvers(int argc, char *argv[])
+{
+	struct check c = { };
+	const char *symvers_file = NULL;
+	const char *null_config = NULL;
+	struct array paths;
+	long n_jobs;
+	int err, ret = EXIT_FAILURE;
+
+	n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (;;) {
+		int opt, idx = 0;
+
+		opt = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 's':
+			symvers_file = optarg;
+			break;
+		case 'm':
+			c.vermagic = optarg;
+			break;
+		case 'u':
+			c.flags |= KMOD_SYMVERS_CHECK_UNKNOWN;
+			break;
+		case 'j':
+			n_jobs = jobs_parse(optarg);
+			if (n_jobs < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case '?':
+			return EXIT_FAILURE;
+		default:
+			ERR("unexpected getopt_long() value '%c'.\n", opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (symvers_file == NULL) {
+		ERR("missing Module.symvers, use -s/--symvers\n");
+		return EXIT_FAILURE;
+	}
+
+	c.ctx = kmod_new(NULL, &null_config);
+	if (c.ctx == NULL) {
+		ERR("kmod_new() failed!\n");
+		return EXIT_FAILURE;
+	}
+	log_setup_kmod_log(c.ctx, LOG_WARNING);
+
+	err = kmod_symvers_new_from_file(c.ctx, symvers_file, &c.symvers);
+	if (err < 0) {
+		ERR("could not load %s: %s\n", symvers_file, strerror(-err));
+		goto fail_ctx;
+	}
+
+	err = jobs_collect_modules(c.ctx, argc - optind, argv + optind, &paths);
+	if (err < 0)
+		goto fail_symvers;
+
+	ret = jobs_run(check_range, &c, &paths, n_jobs);
+
+	jobs_free_modules(&paths);
+fail_symvers:
+	kmod_symvers_unref(c.symvers);
+fail_ctx:
+	kmod_unref(c.ctx);
+	return ret;
+}
+
+const struct kmod_cmd kmod_cmd_check_symvers = {
+	.name = "check-symvers",
+	.cmd = do_check_symvers,
+	.help = "check modules against the symbol versions of a kernel",
+};
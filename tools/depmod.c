@@ -23,19 +23,24 @@
 #include <errno.h>
 #include <getopt.h>
 #include <limits.h>
+#include <poll.h>
 #include <regex.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/inotify.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 
 #include <shared/array.h>
+#include <shared/crc32c.h>
 #include <shared/hash.h>
 #include <shared/macro.h>
+#include <shared/phash.h>
 #include <shared/util.h>
 #include <shared/scratchbuf.h>
+#include <shared/strbuf.h>
 
 #include <libkmod/libkmod-internal.h>
 
@@ -45,6 +50,10 @@
 #include "kmod.h"
 
 #define DEFAULT_VERBOSE LOG_WARNING
+#define DEPMOD_OUTPUT_BUFSIZE (128 * 1024)
+#define DEPMOD_MANIFEST "modules.manifest"
+#define DEPMOD_WATCH_SETTLE_MSEC 250
+#define DEPMOD_WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVE)
 static int verbose = DEFAULT_VERBOSE;
 
 static const char CFG_BUILTIN_KEY[] = "built-in";
@@ -73,6 +82,7 @@ static const struct option cmdopts[] = {
 	{ "dry-run", no_argument, 0, 'n' },
 	{ "symbol-prefix", required_argument, 0, 'P' },
 	{ "warn", no_argument, 0, 'w' },
+	{ "watch", optional_argument, 0, 'W' },
 	{ "map", no_argument, 0, 'm' }, /* deprecated */
 	{ "version", no_argument, 0, 'V' },
 	{ "help", no_argument, 0, 'h' },
@@ -97,6 +107,9 @@ static void help(void)
 		"\t-C, --config=PATH    Read configuration from PATH\n"
 		"\t-v, --verbose        Enable verbose mode\n"
 		"\t-w, --warn           Warn on duplicates\n"
+		"\t    --watch[=SECS]   Keep running and regenerate the files when\n"
+		"\t                     modules or configuration change. Exit after\n"
+		"\t                     SECS seconds without changes\n"
 		"\t-V, --version        show version\n"
 		"\t-h, --help           show this help\n"
 		"\n"
@@ -151,8 +164,9 @@ static inline void _show(const char *fmt, ...)
 
 #define INDEX_MAGIC 0xB007F457
 #define INDEX_VERSION_MAJOR 0x0002
-#define INDEX_VERSION_MINOR 0x0001
+#define INDEX_VERSION_MINOR 0x0003
 #define INDEX_VERSION ((INDEX_VERSION_MAJOR<<16)|INDEX_VERSION_MINOR)
+#define INDEX_TRAILER_MAGIC 0xB007C5C5
 #define INDEX_CHILDMAX 128
 
 struct index_value {
@@ -336,15 +350,59 @@ static int index__haschildren(const struct index_node *node)
    However, index reading is already fast enough.
    Pre-order is simpler for writing, and depmod is already slow.
  */
-static uint32_t index_write__node(const struct index_node *node, FILE *out)
+/* a key with values, to be found through the hash table */
+struct index_hash_entry {
+	char *key;
+	uint64_t hash;
+	uint32_t values_offset;
+};
+
+struct index_write_state {
+	uint32_t node_count;
+	uint32_t value_count;
+
+	/* only filled for indexes that get a hash table */
+	bool exact;
+	struct strbuf key;
+	struct index_hash_entry *entries;
+	uint32_t n_entries;
+	uint32_t max_entries;
+};
+
+static void index_write_add_entry(struct index_write_state *state,
+							uint32_t values_offset)
+{
+	struct index_hash_entry *e;
+
+	if (state->n_entries == state->max_entries) {
+		state->max_entries = state->max_entries ?
+						state->max_entries * 2 : 1024;
+		state->entries = NOFAIL(realloc(state->entries,
+			state->max_entries * sizeof(struct index_hash_entry)));
+	}
+
+	e = &state->entries[state->n_entries++];
+	e->key = NOFAIL(strdup(strbuf_str(&state->key)));
+	e->hash = phash_key(e->key);
+	e->values_offset = values_offset;
+}
+
+static uint32_t index_write__node(const struct index_node *node, FILE *out,
+					struct index_write_state *state)
 {
 	uint32_t *child_offs = NULL;
 	int child_count = 0;
+	unsigned int pushed = 0;
 	long offset;
 
 	if (!node)
 		return 0;
 
+	state->node_count++;
+
+	if (state->exact)
+		pushed = strbuf_pushchars(&state->key, node->prefix);
+
 	/* Write children and save their offsets */
 	if (index__haschildren(node)) {
 		const struct index_node *child;
@@ -355,7 +413,12 @@ static uint32_t index_write__node(const struct index_node *node, FILE *out)
 
 		for (i = 0; i < child_count; i++) {
 			child = node->children[node->first + i];
-			child_offs[i] = htonl(index_write__node(child, out));
+			if (state->exact)
+				strbuf_pushchar(&state->key, node->first + i);
+			child_offs[i] = htonl(index_write__node(child, out,
+								state));
+			if (state->exact)
+				strbuf_popchar(&state->key);
 		}
 	}
 
@@ -382,9 +445,13 @@ static uint32_t index_write__node(const struct index_node *node, FILE *out)
 		unsigned int value_count;
 		uint32_t u;
 
+		if (state->exact)
+			index_write_add_entry(state, ftell(out));
+
 		value_count = 0;
 		for (v = node->values; v != NULL; v = v->next)
 			value_count++;
+		state->value_count += value_count;
 		u = htonl(value_count);
 		fwrite(&u, sizeof(u), 1, out);
 
@@ -397,34 +464,215 @@ static uint32_t index_write__node(const struct index_node *node, FILE *out)
 		offset |= INDEX_NODE_VALUES;
 	}
 
+	if (state->exact)
+		strbuf_popchars(&state->key, pushed);
+
+	return offset;
+}
+
+/*
+ * Write a minimal perfect hash table of all the keys with values, for exact
+ * lookups in a single probe. Keys are spread over buckets of ~4 keys and,
+ * biggest buckets first, each bucket gets the first seed that puts all its
+ * keys in free slots (CHD, "hash, displace and compress", without the
+ * compression).
+ *
+ * Returns the offset of the table, or 0 if no table was written.
+ */
+#define INDEX_HASH_MAX_SEED (1U << 24)
+static uint32_t index_write_hash(FILE *out, struct index_write_state *state)
+{
+	const struct index_hash_entry *entries = state->entries;
+	uint32_t n = state->n_entries, n_buckets = n / 4 + 1;
+	uint32_t *bucket_start, *bucket_keys, *seeds, *slot_entry, *slots;
+	uint32_t b, i, u, size, max_size = 0, entry_offset;
+	uint8_t *taken;
+	long offset;
+
+	if (n == 0)
+		return 0;
+
+	bucket_start = NOFAIL(calloc(n_buckets + 1, sizeof(uint32_t)));
+	bucket_keys = NOFAIL(malloc(n * sizeof(uint32_t)));
+	seeds = NOFAIL(calloc(n_buckets, sizeof(uint32_t)));
+	slot_entry = NOFAIL(malloc(n * sizeof(uint32_t)));
+	taken = NOFAIL(calloc(n, 1));
+
+	/* group keys by bucket */
+	for (i = 0; i < n; i++)
+		bucket_start[phash_bucket(entries[i].hash, n_buckets) + 1]++;
+	for (b = 0; b < n_buckets; b++) {
+		if (bucket_start[b + 1] > max_size)
+			max_size = bucket_start[b + 1];
+		bucket_start[b + 1] += bucket_start[b];
+	}
+	for (i = 0; i < n; i++) {
+		b = phash_bucket(entries[i].hash, n_buckets);
+		bucket_keys[bucket_start[b]++] = i;
+	}
+	for (b = n_buckets; b > 0; b--)
+		bucket_start[b] = bucket_start[b - 1];
+	bucket_start[0] = 0;
+
+	slots = NOFAIL(malloc(max_size * sizeof(uint32_t)));
+
+	for (size = max_size; size > 0; size--) {
+		for (b = 0; b < n_buckets; b++) {
+			const uint32_t *keys = &bucket_keys[bucket_start[b]];
+			uint32_t seed;
+
+			if (bucket_start[b + 1] - bucket_start[b] != size)
+				continue;
+
+			for (seed = 0; seed < INDEX_HASH_MAX_SEED; seed++) {
+				uint32_t j;
+
+				for (i = 0; i < size; i++) {
+					slots[i] = phash_slot(entries[keys[i]].hash,
+								seed, n);
+					if (taken[slots[i]])
+						break;
+					for (j = 0; j < i; j++)
+						if (slots[j] == slots[i])
+							break;
+					if (j < i)
+						break;
+				}
+
+				if (i == size)
+					break;
+			}
+
+			if (seed == INDEX_HASH_MAX_SEED) {
+				WRN("could not build hash table of %u keys, only the trie will be used\n",
+				    n);
+				offset = 0;
+				goto out;
+			}
+
+			seeds[b] = seed;
+			for (i = 0; i < size; i++) {
+				taken[slots[i]] = 1;
+				slot_entry[slots[i]] = keys[i];
+			}
+		}
+	}
+
+	offset = ftell(out);
+	assert(offset >= 0);
+
+	/* header, seeds, then slots with entries laid out in slot order */
+	entry_offset = offset + 2 * sizeof(uint32_t)
+			+ n_buckets * sizeof(uint32_t)
+			+ n * 2 * sizeof(uint32_t);
+
+	u = htonl(n);
+	fwrite(&u, sizeof(u), 1, out);
+	u = htonl(n_buckets);
+	fwrite(&u, sizeof(u), 1, out);
+	for (b = 0; b < n_buckets; b++) {
+		u = htonl(seeds[b]);
+		fwrite(&u, sizeof(u), 1, out);
+	}
+
+	for (i = 0; i < n; i++) {
+		const struct index_hash_entry *e = &entries[slot_entry[i]];
+		uint32_t slot[2];
+
+		slot[0] = htonl(phash_fingerprint(e->hash));
+		slot[1] = htonl(entry_offset);
+		fwrite(slot, sizeof(uint32_t), 2, out);
+		entry_offset += sizeof(uint32_t) + strlen(e->key) + 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		const struct index_hash_entry *e = &entries[slot_entry[i]];
+
+		u = htonl(e->values_offset);
+		fwrite(&u, sizeof(u), 1, out);
+		fputs(e->key, out);
+		fputc('\0', out);
+	}
+
+out:
+	free(slots);
+	free(taken);
+	free(slot_entry);
+	free(seeds);
+	free(bucket_keys);
+	free(bucket_start);
+
 	return offset;
 }
 
-static void index_write(const struct index_node *node, FILE *out)
+/*
+ * The index is built in memory so the trailer can carry a checksum of
+ * everything before it, which lets libkmod validate the file once when
+ * opening it instead of bounds-checking every read.
+ */
+static int index_write(const struct index_node *node, FILE *out, bool exact)
 {
+	struct index_write_state state = { .exact = exact };
 	long initial_offset, final_offset;
-	uint32_t u;
+	uint32_t u, hash_offset = 0, trailer[4];
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *mem;
+
+	mem = open_memstream(&buf, &size);
+	if (mem == NULL)
+		return -errno;
 
 	u = htonl(INDEX_MAGIC);
-	fwrite(&u, sizeof(u), 1, out);
+	fwrite(&u, sizeof(u), 1, mem);
 	u = htonl(INDEX_VERSION);
-	fwrite(&u, sizeof(u), 1, out);
+	fwrite(&u, sizeof(u), 1, mem);
 
 	/* Second word is reserved for the offset of the root node */
-	initial_offset = ftell(out);
+	initial_offset = ftell(mem);
 	assert(initial_offset >= 0);
 	u = 0;
-	fwrite(&u, sizeof(uint32_t), 1, out);
+	fwrite(&u, sizeof(uint32_t), 1, mem);
 
 	/* Dump trie */
-	u = htonl(index_write__node(node, out));
+	strbuf_init(&state.key);
+	u = htonl(index_write__node(node, mem, &state));
 
 	/* Update first word */
-	final_offset = ftell(out);
+	final_offset = ftell(mem);
 	assert(final_offset >= 0);
-	(void)fseek(out, initial_offset, SEEK_SET);
-	fwrite(&u, sizeof(uint32_t), 1, out);
-	(void)fseek(out, final_offset, SEEK_SET);
+	(void)fseek(mem, initial_offset, SEEK_SET);
+	fwrite(&u, sizeof(uint32_t), 1, mem);
+	(void)fseek(mem, final_offset, SEEK_SET);
+
+	if (exact) {
+		uint32_t i;
+
+		hash_offset = index_write_hash(mem, &state);
+		for (i = 0; i < state.n_entries; i++)
+			free(state.entries[i].key);
+		free(state.entries);
+	}
+	strbuf_release(&state.key);
+
+	u = htonl(hash_offset);
+	fwrite(&u, sizeof(uint32_t), 1, mem);
+
+	if (fclose(mem) != 0 || buf == NULL) {
+		free(buf);
+		return -ENOMEM;
+	}
+
+	trailer[0] = htonl(state.node_count);
+	trailer[1] = htonl(state.value_count);
+	trailer[2] = htonl(crc32c(0, buf, size));
+	trailer[3] = htonl(INDEX_TRAILER_MAGIC);
+
+	fwrite(buf, 1, size, out);
+	fwrite(trailer, sizeof(uint32_t), 4, out);
+	free(buf);
+
+	return 0;
 }
 
 /* END: code from module-init-tools/index.c just modified to compile here.
@@ -859,14 +1107,36 @@ static void cfg_free(struct cfg *cfg)
 
 
 /* depmod calculations ***********************************************/
-struct vertex;
+
+/*
+ * Symbols read from a module, packed in a single allocation with their
+ * names stored right after the entries.
+ */
+struct mod_syms {
+	size_t count;
+	struct mod_sym {
+		uint64_t crc;
+		const char *name;
+		int bind;
+	} entries[];
+};
+
+/* identifies the file contents a module's metadata was read from */
+struct mod_stamp {
+	struct timespec mtim;
+	off_t size;
+	ino_t ino;
+};
+
 struct mod {
 	struct kmod_module *kmod;
 	char *path;
 	const char *relpath; /* path relative to '$ROOT/lib/modules/$VER/' */
 	char *uncrelpath; /* same as relpath but ending in .ko */
+	struct mod_syms *syms; /* only kept for the cache */
 	struct kmod_list *info_list;
-	struct kmod_list *dep_sym_list;
+	struct mod_syms *dep_syms;
+	struct mod_stamp stamp;
 	struct array deps; /* struct symbol */
 	size_t baselen; /* points to start of basename/filename */
 	size_t modnamesz;
@@ -874,8 +1144,7 @@ struct mod {
 	int dep_sort_idx; /* topological sort index */
 	uint16_t idx; /* index in depmod->modules.array */
 	uint16_t users; /* how many modules depend on this one */
-	bool visited; /* helper field to report cycles */
-	struct vertex *vertex; /* helper field to report cycles */
+	uint32_t mark; /* last walk that reached this module */
 	char modname[];
 };
 
@@ -885,6 +1154,18 @@ struct symbol {
 	char name[];
 };
 
+/*
+ * Metadata read from a module, kept by --watch from one run to the next so
+ * only the modules that changed in between are opened again.
+ */
+struct mod_cache {
+	struct mod_stamp stamp;
+	struct mod_syms *syms;
+	struct kmod_list *info_list;
+	struct mod_syms *dep_syms;
+	char path[];
+};
+
 struct depmod {
 	const struct cfg *cfg;
 	struct kmod_ctx *ctx;
@@ -892,36 +1173,56 @@ struct depmod {
 	struct hash *modules_by_uncrelpath;
 	struct hash *modules_by_name;
 	struct hash *symbols;
+	struct hash *cache; /* struct mod_cache by path, NULL if not watching */
+	struct {
+		/* scratch space to pack the symbols of each module */
+		struct mod_sym *entries;
+		size_t count;
+		size_t size;
+		struct strbuf names;
+	} symbuf;
+	uint32_t mark;
 };
 
+/*
+ * Start a new walk over the dependency graph: modules whose mark equals the
+ * returned value were already reached by it, so duplicates are detected in
+ * O(1) without clearing any state between walks.
+ */
+static inline uint32_t depmod_next_mark(struct depmod *depmod)
+{
+	return ++depmod->mark;
+}
+
 static void mod_free(struct mod *mod)
 {
 	DBG("free %p kmod=%p, path=%s\n", mod, mod->kmod, mod->path);
 	array_free_array(&mod->deps);
 	kmod_module_unref(mod->kmod);
+	free(mod->syms);
 	kmod_module_info_free_list(mod->info_list);
-	kmod_module_dependency_symbols_free_list(mod->dep_sym_list);
+	free(mod->dep_syms);
 	free(mod->uncrelpath);
 	free(mod->path);
 	free(mod);
 }
 
-static int mod_add_dependency(struct mod *mod, struct symbol *sym)
+static int mod_add_dependency(struct mod *mod, struct symbol *sym,
+								uint32_t mark)
 {
 	int err;
 
 	DBG("%s depends on %s %s\n", mod->path, sym->name,
 	    sym->owner != NULL ? sym->owner->path : "(unknown)");
 
-	if (sym->owner == NULL)
+	if (sym->owner == NULL || sym->owner->mark == mark)
 		return 0;
 
-	err = array_append_unique(&mod->deps, sym->owner);
-	if (err == -EEXIST)
-		return 0;
+	err = array_append(&mod->deps, sym->owner);
 	if (err < 0)
 		return err;
 
+	sym->owner->mark = mark;
 	sym->owner->users++;
 	SHOW("%s needs \"%s\": %s\n", mod->path, sym->name, sym->owner->path);
 	return 0;
@@ -944,6 +1245,10 @@ static int depmod_init(struct depmod *depmod, struct cfg *cfg,
 
 	array_init(&depmod->modules, 128);
 
+	depmod->symbuf.entries = NULL;
+	depmod->symbuf.count = depmod->symbuf.size = 0;
+	strbuf_init(&depmod->symbuf.names);
+
 	depmod->modules_by_uncrelpath = hash_new(512, NULL);
 	if (depmod->modules_by_uncrelpath == NULL) {
 		err = -errno;
@@ -986,6 +1291,9 @@ static void depmod_shutdown(struct depmod *depmod)
 		mod_free(depmod->modules.array[i]);
 	array_free_array(&depmod->modules);
 
+	free(depmod->symbuf.entries);
+	strbuf_release(&depmod->symbuf.names);
+
 	kmod_unref(depmod->ctx);
 }
 
@@ -1483,37 +1791,266 @@ static struct symbol *depmod_symbol_find(const struct depmod *depmod,
 	return hash_find(depmod->symbols, name);
 }
 
+static void mod_cache_free(void *data)
+{
+	struct mod_cache *c = data;
+
+	free(c->syms);
+	kmod_module_info_free_list(c->info_list);
+	free(c->dep_syms);
+	free(c);
+}
+
+static bool mod_stamp_eq(const struct mod_stamp *a, const struct mod_stamp *b)
+{
+	return a->mtim.tv_sec == b->mtim.tv_sec &&
+	       a->mtim.tv_nsec == b->mtim.tv_nsec &&
+	       a->size == b->size && a->ino == b->ino;
+}
+
+/*
+ * Move the cached metadata of the modules that didn't change into them and
+ * drop their kmod: only the modules still having one are opened.
+ */
+static void depmod_cache_take(struct depmod *depmod)
+{
+	struct mod **itr, **itr_end;
+
+	itr = (struct mod **)depmod->modules.array;
+	itr_end = itr + depmod->modules.count;
+	for (; itr < itr_end; itr++) {
+		struct mod *mod = *itr;
+		struct mod_cache *c;
+		struct stat st;
+
+		if (stat(mod->path, &st) < 0)
+			continue;
+
+		mod->stamp.mtim = st.st_mtim;
+		mod->stamp.size = st.st_size;
+		mod->stamp.ino = st.st_ino;
+
+		c = hash_find(depmod->cache, mod->path);
+		if (c == NULL || !mod_stamp_eq(&c->stamp, &mod->stamp))
+			continue;
+
+		DBG("cached %s\n", mod->path);
+		mod->syms = c->syms;
+		mod->info_list = c->info_list;
+		mod->dep_syms = c->dep_syms;
+		c->syms = c->dep_syms = NULL;
+		c->info_list = NULL;
+		hash_del(depmod->cache, mod->path);
+
+		kmod_module_unref(mod->kmod);
+		mod->kmod = NULL;
+	}
+}
+
+/* replace the cache with the metadata of the modules loaded by this run */
+static int depmod_cache_save(struct depmod *depmod)
+{
+	struct hash *cache;
+	size_t i;
+	int err;
+
+	cache = hash_new(512, mod_cache_free);
+	if (cache == NULL)
+		return -errno;
+
+	for (i = 0; i < depmod->modules.count; i++) {
+		struct mod *mod = depmod->modules.array[i];
+		size_t pathsz = strlen(mod->path) + 1;
+		struct mod_cache *c;
+
+		/* not loaded */
+		if (mod->kmod != NULL)
+			continue;
+
+		c = malloc(sizeof(struct mod_cache) + pathsz);
+		if (c == NULL) {
+			err = -ENOMEM;
+			goto fail;
+		}
+
+		c->stamp = mod->stamp;
+		c->syms = mod->syms;
+		c->info_list = mod->info_list;
+		c->dep_syms = mod->dep_syms;
+		memcpy(c->path, mod->path, pathsz);
+
+		err = hash_add(cache, c->path, c);
+		if (err < 0) {
+			free(c);
+			goto fail;
+		}
+		mod->syms = mod->dep_syms = NULL;
+		mod->info_list = NULL;
+	}
+
+	hash_free(depmod->cache);
+	depmod->cache = cache;
+	return 0;
+
+fail:
+	hash_free(cache);
+	return err;
+}
+
+/*
+ * Read the symbols of a module into a single allocation: entries are
+ * gathered in depmod's scratch space, reused from one module to the next,
+ * with names pointing into the module's file until they are copied out.
+ */
+static int depmod_pack_symbols(struct depmod *depmod, struct mod *mod,
+				enum kmod_symbol_iter_type type,
+				struct mod_syms **syms)
+{
+	struct kmod_symbol_iter *iter;
+	struct mod_syms *s;
+	char *names;
+	size_t i;
+	int err;
+
+	err = kmod_symbol_iter_new(mod->kmod, type, &iter);
+	if (err < 0)
+		return err;
+
+	depmod->symbuf.count = 0;
+	strbuf_clear(&depmod->symbuf.names);
+
+	while (kmod_symbol_iter_next(iter)) {
+		struct mod_sym *e;
+
+		if (depmod->symbuf.count == depmod->symbuf.size) {
+			size_t size = depmod->symbuf.size * 2 ?: 256;
+
+			e = realloc(depmod->symbuf.entries, size * sizeof(*e));
+			if (e == NULL) {
+				err = -ENOMEM;
+				goto out;
+			}
+			depmod->symbuf.entries = e;
+			depmod->symbuf.size = size;
+		}
+
+		e = &depmod->symbuf.entries[depmod->symbuf.count++];
+		e->crc = kmod_symbol_iter_get_crc(iter);
+		e->bind = kmod_symbol_iter_get_bind(iter);
+		/* an offset into names until they are copied out */
+		e->name = (const char *)(uintptr_t) depmod->symbuf.names.used;
+
+		strbuf_pushchars(&depmod->symbuf.names,
+				 kmod_symbol_iter_get_symbol(iter, NULL));
+		if (!strbuf_pushchar(&depmod->symbuf.names, '\0')) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (depmod->symbuf.count == 0) {
+		err = -ENOENT;
+		goto out;
+	}
+
+	s = malloc(sizeof(*s) + depmod->symbuf.count * sizeof(struct mod_sym) +
+					depmod->symbuf.names.used);
+	if (s == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	s->count = depmod->symbuf.count;
+	names = (char *)(s->entries + s->count);
+	memcpy(names, depmod->symbuf.names.bytes, depmod->symbuf.names.used);
+	for (i = 0; i < s->count; i++) {
+		s->entries[i] = depmod->symbuf.entries[i];
+		s->entries[i].name = names + (uintptr_t) s->entries[i].name;
+	}
+
+	*syms = s;
+
+out:
+	kmod_symbol_iter_free(iter);
+	return err;
+}
+
+/*
+ * Exported symbols go straight from the module's file into the symbol
+ * table: they are only packed when --watch needs them for the next run.
+ */
+static int depmod_load_module_symbols(struct depmod *depmod, struct mod *mod)
+{
+	struct kmod_symbol_iter *iter;
+	size_t i;
+	int err;
+
+	if (mod->syms != NULL)
+		goto add_packed;
+
+	if (depmod->cache != NULL) {
+		err = depmod_pack_symbols(depmod, mod, KMOD_SYMBOL_ITER_SYMBOLS,
+								&mod->syms);
+		if (err < 0)
+			return err;
+		goto add_packed;
+	}
+
+	err = kmod_symbol_iter_new(mod->kmod, KMOD_SYMBOL_ITER_SYMBOLS, &iter);
+	if (err < 0)
+		return err;
+
+	while (kmod_symbol_iter_next(iter)) {
+		const char *name = kmod_symbol_iter_get_symbol(iter, NULL);
+		uint64_t crc = kmod_symbol_iter_get_crc(iter);
+		depmod_symbol_add(depmod, name, false, crc, mod);
+	}
+
+	kmod_symbol_iter_free(iter);
+	return 0;
+
+add_packed:
+	for (i = 0; i < mod->syms->count; i++) {
+		const struct mod_sym *e = &mod->syms->entries[i];
+		depmod_symbol_add(depmod, e->name, false, e->crc, mod);
+	}
+
+	return 0;
+}
+
 static int depmod_load_modules(struct depmod *depmod)
 {
 	struct mod **itr, **itr_end;
 
 	DBG("load symbols (%zd modules)\n", depmod->modules.count);
 
+	if (depmod->cache != NULL)
+		depmod_cache_take(depmod);
+
 	itr = (struct mod **)depmod->modules.array;
 	itr_end = itr + depmod->modules.count;
 	for (; itr < itr_end; itr++) {
 		struct mod *mod = *itr;
-		struct kmod_list *l, *list = NULL;
-		int err = kmod_module_get_symbols(mod->kmod, &list);
+		int err;
+
+		if (mod->kmod == NULL) {
+			if (mod->syms != NULL)
+				depmod_load_module_symbols(depmod, mod);
+			continue;
+		}
+
+		err = depmod_load_module_symbols(depmod, mod);
 		if (err < 0) {
 			if (err == -ENOENT)
 				DBG("ignoring %s: no symbols\n", mod->path);
 			else
 				ERR("failed to load symbols from %s: %s\n",
 						mod->path, strerror(-err));
-			goto load_info;
 		}
-		kmod_list_foreach(l, list) {
-			const char *name = kmod_module_symbol_get_symbol(l);
-			uint64_t crc = kmod_module_symbol_get_crc(l);
-			depmod_symbol_add(depmod, name, false, crc, mod);
-		}
-		kmod_module_symbols_free_list(list);
 
-load_info:
 		kmod_module_get_info(mod->kmod, &mod->info_list);
-		kmod_module_get_dependency_symbols(mod->kmod,
-						   &mod->dep_sym_list);
+		depmod_pack_symbols(depmod, mod, KMOD_SYMBOL_ITER_DEPENDENCIES,
+							&mod->dep_syms);
 		kmod_module_unref(mod->kmod);
 		mod->kmod = NULL;
 	}
@@ -1527,13 +2064,14 @@ load_info:
 static int depmod_load_module_dependencies(struct depmod *depmod, struct mod *mod)
 {
 	const struct cfg *cfg = depmod->cfg;
-	struct kmod_list *l;
+	uint32_t mark = depmod_next_mark(depmod);
+	size_t i;
 
 	DBG("do dependencies of %s\n", mod->path);
-	kmod_list_foreach(l, mod->dep_sym_list) {
-		const char *name = kmod_module_dependency_symbol_get_symbol(l);
-		uint64_t crc = kmod_module_dependency_symbol_get_crc(l);
-		int bindtype = kmod_module_dependency_symbol_get_bind(l);
+	for (i = 0; i < mod->dep_syms->count; i++) {
+		const char *name = mod->dep_syms->entries[i].name;
+		uint64_t crc = mod->dep_syms->entries[i].crc;
+		int bindtype = mod->dep_syms->entries[i].bind;
 		struct symbol *sym = depmod_symbol_find(depmod, name);
 		uint8_t is_weak = bindtype == KMOD_SYMBOL_WEAK;
 
@@ -1554,7 +2092,7 @@ static int depmod_load_module_dependencies(struct depmod *depmod, struct mod *mo
 				    mod->path, name);
 		}
 
-		mod_add_dependency(mod, sym);
+		mod_add_dependency(mod, sym, mark);
 	}
 
 	return 0;
@@ -1572,7 +2110,7 @@ static int depmod_load_dependencies(struct depmod *depmod)
 	for (; itr < itr_end; itr++) {
 		struct mod *mod = *itr;
 
-		if (mod->dep_sym_list == NULL) {
+		if (mod->dep_syms == NULL) {
 			DBG("ignoring %s: no dependency symbols\n", mod->path);
 			continue;
 		}
@@ -1605,249 +2143,218 @@ static void depmod_sort_dependencies(struct depmod *depmod)
 	}
 }
 
-struct vertex {
-	struct vertex *parent;
-	struct mod *mod;
+/*
+ * Cycle reporting. The modules left over by the topological sort are either
+ * part of a cycle or depend on one. Find the strongly connected components
+ * among them with an iterative Tarjan's algorithm and report each component
+ * once, printing the shortest cycle through the module that rooted it. All
+ * the bookkeeping is done in arrays indexed by mod->idx, so the whole pass is
+ * linear in the number of modules and dependencies.
+ */
+struct cycles {
+	struct depmod *depmod;
+	uint16_t *index; /* DFS discovery order, starting at 1; 0 if unvisited */
+	uint16_t *lowlink;
+	uint16_t *scc; /* component number, starting at 1; 0 if unassigned */
+	uint16_t *stack; /* Tarjan's stack of visited modules */
+	uint16_t *call; /* DFS call stack: module being visited ... */
+	uint16_t *edge; /* ... and position of its next dependency */
+	uint16_t *parent; /* BFS tree used to find the shortest cycle */
+	uint16_t *queue;
+	uint16_t *path;
 };
 
-static struct vertex *vertex_new(struct mod *mod, struct vertex *parent)
+static bool mod_depends_on(const struct mod *mod, const struct mod *dep)
 {
-	struct vertex *v;
+	size_t i;
 
-	v = malloc(sizeof(*v));
-	if (v == NULL)
-		return NULL;
+	for (i = 0; i < mod->deps.count; i++) {
+		if (mod->deps.array[i] == dep)
+			return true;
+	}
 
-	v->parent = parent;
-	v->mod = mod;
-	return v;
+	return false;
 }
 
-static void depmod_list_remove_data(struct kmod_list **list, void *data)
+static void depmod_report_one_cycle(struct cycles *c, uint16_t root,
+				    const uint16_t *members, uint16_t n_members)
 {
-	struct kmod_list *l;
+	const char sep[] = " -> ";
+	struct strbuf buf;
+	uint16_t head = 0, tail = 0, last = UINT16_MAX, n_path = 0;
+	uint16_t i, u;
 
-	l = kmod_list_remove_data(*list, data);
-	*list = l;
-}
+	/* breadth-first search inside the component until we get back */
+	c->parent[root] = root;
+	c->queue[tail++] = root;
+	while (head < tail && last == UINT16_MAX) {
+		const struct mod *m;
 
-static int depmod_report_one_cycle(struct depmod *depmod,
-				   struct vertex *vertex,
-				   struct kmod_list **roots,
-				   struct hash *loop_set)
-{
-	const char sep[] = " -> ";
-	size_t sz;
-	char *buf;
-	struct array reverse;
-	int i;
-	int n;
-	struct vertex *v;
-	int rc;
+		u = c->queue[head++];
+		m = c->depmod->modules.array[u];
 
-	array_init(&reverse, 3);
+		for (i = 0; i < m->deps.count; i++) {
+			const struct mod *dep = m->deps.array[i];
+			uint16_t v = dep->idx;
 
-	sz = 0;
-	for (v = vertex->parent, n = 0;
-	     v != NULL;
-	     v = v->parent, n++) {
+			if (c->scc[v] != c->scc[root])
+				continue;
+			if (v == root) {
+				last = u;
+				break;
+			}
+			if (c->parent[v] != UINT16_MAX)
+				continue;
 
-		sz += v->mod->modnamesz - 1;
-		array_append(&reverse, v);
-		rc = hash_add(loop_set, v->mod->modname, NULL);
-		if (rc != 0)
-			return rc;
-		/* the hash will be freed where created */
+			c->parent[v] = u;
+			c->queue[tail++] = v;
+		}
 	}
-	sz += vertex->mod->modnamesz - 1;
 
-	buf = malloc(sz + n * strlen(sep) + 1);
+	for (u = last; u != root; u = c->parent[u])
+		c->path[n_path++] = u;
+	c->path[n_path++] = root;
 
-	sz = 0;
-	for (i = reverse.count - 1; i >= 0; i--) {
-		size_t len;
+	strbuf_init(&buf);
+	while (n_path > 0) {
+		const struct mod *m = c->depmod->modules.array[c->path[--n_path]];
 
-		v = reverse.array[i];
+		strbuf_pushchars(&buf, m->modname);
+		strbuf_pushchars(&buf, sep);
+	}
+	strbuf_pushchars(&buf, ((struct mod *)
+				c->depmod->modules.array[root])->modname);
+	ERR("Cycle detected: %s\n", strbuf_str(&buf));
+
+	/*
+	 * Members not in the printed cycle still belong to the same loop. The
+	 * path is consumed, so reuse it to mark which members were printed.
+	 */
+	if (n_members > 1) {
+		bool more = false;
+
+		for (i = 0; i < n_members; i++)
+			c->path[members[i]] = UINT16_MAX;
+		for (u = last; u != root; u = c->parent[u])
+			c->path[u] = 0;
+		c->path[root] = 0;
 
-		len = v->mod->modnamesz - 1;
-		memcpy(buf + sz, v->mod->modname, len);
-		sz += len;
-		strcpy(buf + sz, sep);
-		sz += strlen(sep);
+		strbuf_clear(&buf);
+		for (i = 0; i < n_members; i++) {
+			const struct mod *m;
 
-		depmod_list_remove_data(roots, v->mod);
+			if (c->path[members[i]] != UINT16_MAX)
+				continue;
+
+			m = c->depmod->modules.array[members[i]];
+			if (more)
+				strbuf_pushchar(&buf, ' ');
+			strbuf_pushchars(&buf, m->modname);
+			more = true;
+		}
+		if (more)
+			ERR("Other modules in the same cycle: %s\n",
+			    strbuf_str(&buf));
 	}
-	strcpy(buf + sz, vertex->mod->modname);
-	ERR("Cycle detected: %s\n", buf);
 
-	free(buf);
-	array_free_array(&reverse);
+	strbuf_release(&buf);
 
-	return 0;
+	/* leave parent[] clean for the next component */
+	for (i = 0; i < tail; i++)
+		c->parent[c->queue[i]] = UINT16_MAX;
 }
 
-static int depmod_report_cycles_from_root(struct depmod *depmod,
-					  struct mod *root_mod,
-					  struct kmod_list **roots,
-					  void **stack,
-					  size_t stack_size,
-					  struct hash *loop_set)
+static void depmod_report_cycles(struct depmod *depmod, uint16_t n_mods,
+				 const uint16_t *users)
 {
-	struct kmod_list *free_list = NULL; /* struct vertex */
-	struct kmod_list *l;
-	struct vertex *root;
-	struct vertex *vertex;
-	struct vertex *v;
-	struct mod *m;
-	struct mod **itr, **itr_end;
-	size_t is;
-	int ret = -ENOMEM;
+	struct cycles c = { .depmod = depmod };
+	_cleanup_free_ uint16_t *mem = NULL;
+	uint16_t counter = 0, n_scc = 0, sp = 0, depth, i;
+	int num_cyclic = 0;
 
-	root = vertex_new(root_mod, NULL);
-	if (root == NULL) {
+	mem = calloc(n_mods * 9, sizeof(uint16_t));
+	if (mem == NULL) {
 		ERR("No memory to report cycles\n");
-		goto out;
+		return;
 	}
+	c.index = mem;
+	c.lowlink = c.index + n_mods;
+	c.scc = c.lowlink + n_mods;
+	c.stack = c.scc + n_mods;
+	c.call = c.stack + n_mods;
+	c.edge = c.call + n_mods;
+	c.parent = c.edge + n_mods;
+	c.queue = c.parent + n_mods;
+	c.path = c.queue + n_mods;
+	memset(c.parent, 0xff, n_mods * sizeof(uint16_t));
+
+	for (i = 0; i < n_mods; i++) {
+		if (users[i] == 0 || c.index[i] != 0)
+			continue;
 
-	l = kmod_list_append(free_list, root);
-	if (l == NULL) {
-		ERR("No memory to report cycles\n");
-		goto out;
-	}
-	free_list = l;
-
-	is = 0;
-	stack[is++] = (void *)root;
-
-	while (is > 0) {
-		vertex = stack[--is];
-		m = vertex->mod;
-		/*
-		 * because of the topological sort we can start only
-		 * from part of a loop or from a branch after a loop
-		 */
-		if (m->visited && m == root->mod) {
-			int rc;
-			rc = depmod_report_one_cycle(depmod, vertex,
-						     roots, loop_set);
-			if (rc != 0) {
-				ret = rc;
-				goto out;
+		c.index[i] = c.lowlink[i] = ++counter;
+		c.stack[sp++] = i;
+		c.call[0] = i;
+		c.edge[0] = 0;
+		depth = 1;
+
+		while (depth > 0) {
+			uint16_t u = c.call[depth - 1];
+			const struct mod *m = depmod->modules.array[u];
+			uint16_t n_members, v;
+
+			if (c.edge[depth - 1] < m->deps.count) {
+				const struct mod *dep;
+
+				dep = m->deps.array[c.edge[depth - 1]++];
+				v = dep->idx;
+				if (users[v] == 0)
+					continue;
+
+				if (c.index[v] == 0) {
+					c.index[v] = c.lowlink[v] = ++counter;
+					c.stack[sp++] = v;
+					c.call[depth] = v;
+					c.edge[depth] = 0;
+					depth++;
+				} else if (c.scc[v] == 0 &&
+					   c.index[v] < c.lowlink[u]) {
+					/* v is still on Tarjan's stack */
+					c.lowlink[u] = c.index[v];
+				}
+				continue;
 			}
-			continue;
-		}
-
-		m->visited = true;
-		if (m->deps.count == 0) {
-			/*
-			 * boundary condition: if there is more than one
-			 * single node branch (not a loop), it is
-			 * recognized as a loop by the code above:
-			 * m->visited because more then one,
-			 * m == root->mod since it is a single node.
-			 * So, prevent deeping into the branch second
-			 * time.
-			 */
-			depmod_list_remove_data(roots, m);
-
-			continue;
-		}
 
-		itr = (struct mod **) m->deps.array;
-		itr_end = itr + m->deps.count;
-		for (; itr < itr_end; itr++) {
-			struct mod *dep = *itr;
-			v = vertex_new(dep, vertex);
-			if (v == NULL) {
-				ERR("No memory to report cycles\n");
-				goto out;
-			}
-			assert(is < stack_size);
-			stack[is++] = v;
+			/* all dependencies of u are done, return to caller */
+			depth--;
+			if (depth > 0) {
+				uint16_t p = c.call[depth - 1];
 
-			l = kmod_list_append(free_list, v);
-			if (l == NULL) {
-				ERR("No memory to report cycles\n");
-				goto out;
+				if (c.lowlink[u] < c.lowlink[p])
+					c.lowlink[p] = c.lowlink[u];
 			}
-			free_list = l;
-
-		}
-	}
-	ret = 0;
 
-out:
-	while (free_list) {
-		v = free_list->data;
-		l = kmod_list_remove(free_list);
-		free_list = l;
-		free(v);
-	}
+			if (c.lowlink[u] != c.index[u])
+				continue;
 
-	return ret;
-}
+			/* u is the root of a component: pop it */
+			n_scc++;
+			n_members = 0;
+			do {
+				v = c.stack[--sp];
+				c.scc[v] = n_scc;
+				n_members++;
+			} while (v != u);
 
-static void depmod_report_cycles(struct depmod *depmod, uint16_t n_mods,
-				 uint16_t *users)
-{
-	int num_cyclic = 0;
-	struct kmod_list *roots = NULL; /* struct mod */
-	struct kmod_list *l;
-	size_t n_r; /* local n_roots */
-	int i;
-	int err;
-	_cleanup_free_ void **stack = NULL;
-	struct mod *m;
-	struct mod *root;
-	struct hash *loop_set;
+			if (n_members == 1 && !mod_depends_on(m, m))
+				continue;
 
-	for (i = 0, n_r = 0; i < n_mods; i++) {
-		if (users[i] <= 0)
-			continue;
-		m = depmod->modules.array[i];
-		l = kmod_list_append(roots, m);
-		if (l == NULL) {
-			ERR("No memory to report cycles\n");
-			goto out_list;
+			num_cyclic += n_members;
+			depmod_report_one_cycle(&c, u, c.stack + sp, n_members);
 		}
-		roots = l;
-		n_r++;
-	}
-
-	stack = malloc(n_r * sizeof(void *));
-	if (stack == NULL) {
-		ERR("No memory to report cycles\n");
-		goto out_list;
 	}
 
-	loop_set = hash_new(16, NULL);
-	if (loop_set == NULL) {
-		ERR("No memory to report cycles\n");
-		goto out_list;
-	}
-
-	while (roots != NULL) {
-		root = roots->data;
-		l = kmod_list_remove(roots);
-		roots = l;
-		err = depmod_report_cycles_from_root(depmod,
-						     root,
-						     &roots,
-						     stack, n_r, loop_set);
-		if (err < 0)
-			goto out_hash;
-	}
-
-	num_cyclic = hash_get_count(loop_set);
 	ERR("Found %d modules in dependency cycles!\n", num_cyclic);
-
-out_hash:
-	hash_free(loop_set);
-out_list:
-	while (roots != NULL) {
-		/* no need to free data, come from outside */
-		roots = kmod_list_remove(roots);
-	}
 }
 
 static int depmod_calculate_dependencies(struct depmod *depmod)
@@ -1937,52 +2444,51 @@ static int depmod_load(struct depmod *depmod)
 	return 0;
 }
 
-static size_t mod_count_all_dependencies(const struct mod *mod)
+static size_t mod_count_all_dependencies(const struct mod *mod, uint32_t mark)
 {
 	size_t i, count = 0;
 	for (i = 0; i < mod->deps.count; i++) {
-		const struct mod *d = mod->deps.array[i];
-		count += 1 + mod_count_all_dependencies(d);
+		struct mod *d = mod->deps.array[i];
+
+		if (d->mark == mark)
+			continue;
+
+		d->mark = mark;
+		count += 1 + mod_count_all_dependencies(d, mark);
 	}
 	return count;
 }
 
-static int mod_fill_all_unique_dependencies(const struct mod *mod, const struct mod **deps, size_t n_deps, size_t *last)
+static int mod_fill_all_unique_dependencies(const struct mod *mod, const struct mod **deps, size_t n_deps, size_t *last, uint32_t mark)
 {
 	size_t i;
 	int err = 0;
 	for (i = 0; i < mod->deps.count; i++) {
-		const struct mod *d = mod->deps.array[i];
-		size_t j;
-		uint8_t exists = 0;
-
-		for (j = 0; j < *last; j++) {
-			if (deps[j] == d) {
-				exists = 1;
-				break;
-			}
-		}
+		struct mod *d = mod->deps.array[i];
 
-		if (exists)
+		if (d->mark == mark)
 			continue;
 
+		d->mark = mark;
+
 		if (*last >= n_deps)
 			return -ENOSPC;
 		deps[*last] = d;
 		(*last)++;
-		err = mod_fill_all_unique_dependencies(d, deps, n_deps, last);
+		err = mod_fill_all_unique_dependencies(d, deps, n_deps, last,
+									mark);
 		if (err < 0)
 			break;
 	}
 	return err;
 }
 
-static const struct mod **mod_get_all_sorted_dependencies(const struct mod *mod, size_t *n_deps)
+static const struct mod **mod_get_all_sorted_dependencies(struct depmod *depmod, const struct mod *mod, size_t *n_deps)
 {
 	const struct mod **deps;
 	size_t last = 0;
 
-	*n_deps = mod_count_all_dependencies(mod);
+	*n_deps = mod_count_all_dependencies(mod, depmod_next_mark(depmod));
 	if (*n_deps == 0)
 		return NULL;
 
@@ -1990,7 +2496,8 @@ static const struct mod **mod_get_all_sorted_dependencies(const struct mod *mod,
 	if (deps == NULL)
 		return NULL;
 
-	if (mod_fill_all_unique_dependencies(mod, deps, *n_deps, &last) < 0) {
+	if (mod_fill_all_unique_dependencies(mod, deps, *n_deps, &last,
+					     depmod_next_mark(depmod)) < 0) {
 		free(deps);
 		return NULL;
 	}
@@ -2021,7 +2528,7 @@ static int output_deps(struct depmod *depmod, FILE *out)
 		if (mod->deps.count == 0)
 			goto end;
 
-		deps = mod_get_all_sorted_dependencies(mod, &n_deps);
+		deps = mod_get_all_sorted_dependencies(depmod, mod, &n_deps);
 		if (deps == NULL) {
 			ERR("could not get all sorted dependencies of %s\n", p);
 			goto end;
@@ -2043,6 +2550,7 @@ static int output_deps_bin(struct depmod *depmod, FILE *out)
 {
 	struct index_node *idx;
 	size_t i;
+	int ret;
 
 	if (out == stdout)
 		return 0;
@@ -2058,7 +2566,7 @@ static int output_deps_bin(struct depmod *depmod, FILE *out)
 		size_t j, n_deps, linepos, linelen, slen;
 		int duplicate;
 
-		deps = mod_get_all_sorted_dependencies(mod, &n_deps);
+		deps = mod_get_all_sorted_dependencies(depmod, mod, &n_deps);
 		if (deps == NULL && n_deps > 0) {
 			ERR("could not get all sorted dependencies of %s\n", p);
 			continue;
@@ -2105,10 +2613,10 @@ static int output_deps_bin(struct depmod *depmod, FILE *out)
 		free(deps);
 	}
 
-	index_write(idx, out);
+	ret = index_write(idx, out, true);
 	index_destroy(idx);
 
-	return 0;
+	return ret;
 }
 
 static int output_aliases(struct depmod *depmod, FILE *out)
@@ -2139,6 +2647,7 @@ static int output_aliases_bin(struct depmod *depmod, FILE *out)
 {
 	struct index_node *idx;
 	size_t i;
+	int ret;
 
 	if (out == stdout)
 		return 0;
@@ -2175,10 +2684,10 @@ static int output_aliases_bin(struct depmod *depmod, FILE *out)
 		}
 	}
 
-	index_write(idx, out);
+	ret = index_write(idx, out, false);
 	index_destroy(idx);
 
-	return 0;
+	return ret;
 }
 
 static int output_softdeps(struct depmod *depmod, FILE *out)
@@ -2271,7 +2780,12 @@ static int output_symbols_bin(struct depmod *depmod, FILE *out)
 						alias, sym->owner->modname);
 	}
 
-	index_write(idx, out);
+	/*
+	 * Only looked up for "symbol:" requests, about once per open: a hash
+	 * table would make the file, and validating it, much bigger for a
+	 * lookup that is rarely done.
+	 */
+	ret = index_write(idx, out, false);
 
 err_scratchbuf:
 	index_destroy(idx);
@@ -2287,6 +2801,7 @@ static int output_builtin_bin(struct depmod *depmod, FILE *out)
 	FILE *in;
 	struct index_node *idx;
 	char infile[PATH_MAX], line[PATH_MAX], modname[PATH_MAX];
+	int ret;
 
 	if (out == stdout)
 		return 0;
@@ -2315,11 +2830,11 @@ static int output_builtin_bin(struct depmod *depmod, FILE *out)
 		index_insert(idx, modname, "", 0);
 	}
 
-	index_write(idx, out);
+	ret = index_write(idx, out, true);
 	index_destroy(idx);
 	fclose(in);
 
-	return 0;
+	return ret;
 }
 
 static int output_devname(struct depmod *depmod, FILE *out)
@@ -2379,97 +2894,292 @@ static int output_devname(struct depmod *depmod, FILE *out)
 	return 0;
 }
 
+static const struct depfile {
+	const char *name;
+	int (*cb)(struct depmod *depmod, FILE *out);
+} depfiles[] = {
+	{ "modules.dep", output_deps },
+	{ "modules.dep.bin", output_deps_bin },
+	{ "modules.alias", output_aliases },
+	{ "modules.alias.bin", output_aliases_bin },
+	{ "modules.softdep", output_softdeps },
+	{ "modules.symbols", output_symbols },
+	{ "modules.symbols.bin", output_symbols_bin },
+	{ "modules.builtin.bin", output_builtin_bin },
+	{ "modules.devname", output_devname },
+	{ }
+};
+
+/* compare a freshly written index with the one it would replace */
+static bool depfile_is_unchanged(int dfd, const char *tmp, const char *name)
+{
+	char buf_tmp[4096], buf[4096];
+	struct stat st_tmp, st;
+	bool unchanged = false;
+	int fd_tmp, fd;
+
+	fd_tmp = openat(dfd, tmp, O_RDONLY);
+	fd = openat(dfd, name, O_RDONLY);
+	if (fd_tmp < 0 || fd < 0)
+		goto out;
+
+	if (fstat(fd_tmp, &st_tmp) < 0 || fstat(fd, &st) < 0 ||
+					st_tmp.st_size != st.st_size)
+		goto out;
+
+	for (;;) {
+		ssize_t n_tmp = read(fd_tmp, buf_tmp, sizeof(buf_tmp));
+		ssize_t n = read(fd, buf, sizeof(buf));
+
+		if (n_tmp < 0 || n_tmp != n || memcmp(buf_tmp, buf, n) != 0)
+			break;
+		if (n == 0) {
+			unchanged = true;
+			break;
+		}
+	}
+
+out:
+	if (fd_tmp >= 0)
+		close(fd_tmp);
+	if (fd >= 0)
+		close(fd);
+	return unchanged;
+}
+
+/* generation of the indexes currently in dfd, 0 if unknown */
+static unsigned long depmod_read_generation(int dfd)
+{
+	unsigned long generation = 0;
+	FILE *fp;
+	int fd;
+
+	fd = openat(dfd, DEPMOD_MANIFEST, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	fp = fdopen(fd, "r");
+	if (fp == NULL) {
+		close(fd);
+		return 0;
+	}
+
+	if (fscanf(fp, "generation %lu", &generation) != 1)
+		generation = 0;
+
+	fclose(fp);
+	return generation;
+}
+
+static int depmod_write_manifest(int dfd, const char *tmp,
+				 unsigned long generation, const off_t *sizes)
+{
+	const struct depfile *itr;
+	FILE *fp;
+	int fd, ferr;
+
+	fd = openat(dfd, tmp, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0)
+		return -errno;
+
+	fp = fdopen(fd, "w");
+	if (fp == NULL) {
+		close(fd);
+		return -errno;
+	}
+
+	fprintf(fp, "generation %lu\n", generation);
+	for (itr = depfiles; itr->name != NULL; itr++)
+		fprintf(fp, "%s %lld\n", itr->name,
+					(long long) sizes[itr - depfiles]);
+
+	ferr = ferror(fp) | fclose(fp);
+	return ferr ? -ENOSPC : 0;
+}
+
+/* fallback for syncfs(): sync the temporary file of one index */
+static int depfile_sync(int dfd, const char *name)
+{
+	char tmp[NAME_MAX];
+	int fd, err = 0;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	fd = openat(dfd, tmp, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fdatasync(fd) < 0) {
+		err = -errno;
+		ERR("could not sync %s: %s\n", tmp, strerror(-err));
+	}
+	if (fd >= 0)
+		close(fd);
+
+	return err;
+}
+
+/*
+ * Indexes are published as a set: all of them are written to temporary
+ * files and synced with a single syncfs() before any is renamed over the
+ * previous one, so after a crash each index is either the old or the new
+ * one, never a torn file. If syncfs() fails, each file is synced on its
+ * own instead. The manifest goes last, telling readers the generation and
+ * size of the indexes that belong together.
+ */
 static int depmod_output(struct depmod *depmod, FILE *out)
 {
-	static const struct depfile {
-		const char *name;
-		int (*cb)(struct depmod *depmod, FILE *out);
-	} *itr, depfiles[] = {
-		{ "modules.dep", output_deps },
-		{ "modules.dep.bin", output_deps_bin },
-		{ "modules.alias", output_aliases },
-		{ "modules.alias.bin", output_aliases_bin },
-		{ "modules.softdep", output_softdeps },
-		{ "modules.symbols", output_symbols },
-		{ "modules.symbols.bin", output_symbols_bin },
-		{ "modules.builtin.bin", output_builtin_bin },
-		{ "modules.devname", output_devname },
-		{ }
-	};
+	const struct depfile *itr;
 	const char *dname = depmod->cfg->dirname;
+	off_t sizes[sizeof(depfiles) / sizeof(depfiles[0])] = { };
+	bool pending[sizeof(depfiles) / sizeof(depfiles[0])] = { };
+	char tmp[NAME_MAX];
+	size_t n_pending = 0;
+	char *buf = NULL;
 	int dfd, err = 0;
 
-	if (out != NULL)
-		dfd = -1;
-	else {
-		dfd = open(dname, O_RDONLY);
-		if (dfd < 0) {
-			err = -errno;
-			CRIT("could not open directory %s: %m\n", dname);
-			return err;
-		}
+	if (out != NULL) {
+		for (itr = depfiles; itr->name != NULL; itr++)
+			itr->cb(depmod, out);
+		return 0;
 	}
 
-	for (itr = depfiles; itr->name != NULL; itr++) {
-		FILE *fp = out;
-		char tmp[NAME_MAX] = "";
-		int r, ferr;
+	dfd = open(dname, O_RDONLY);
+	if (dfd < 0) {
+		err = -errno;
+		CRIT("could not open directory %s: %m\n", dname);
+		return err;
+	}
 
-		if (fp == NULL) {
-			int flags = O_CREAT | O_TRUNC | O_WRONLY;
-			int mode = 0644;
-			int fd;
+	/* one large buffer, reused by each index in turn */
+	buf = malloc(DEPMOD_OUTPUT_BUFSIZE);
+	if (buf == NULL) {
+		err = -ENOMEM;
+		goto out;
+	}
 
-			snprintf(tmp, sizeof(tmp), "%s.tmp", itr->name);
-			fd = openat(dfd, tmp, flags, mode);
-			if (fd < 0) {
-				ERR("openat(%s, %s, %o, %o): %m\n",
-				    dname, tmp, flags, mode);
-				continue;
-			}
-			fp = fdopen(fd, "wb");
-			if (fp == NULL) {
-				ERR("fdopen(%d=%s/%s): %m\n", fd, dname, tmp);
-				close(fd);
-				continue;
-			}
+	for (itr = depfiles; itr->name != NULL; itr++) {
+		size_t i = itr - depfiles;
+		int flags = O_CREAT | O_TRUNC | O_WRONLY;
+		int mode = 0644;
+		FILE *fp;
+		int fd, r, ferr;
+
+		snprintf(tmp, sizeof(tmp), "%s.tmp", itr->name);
+		fd = openat(dfd, tmp, flags, mode);
+		if (fd < 0) {
+			err = -errno;
+			ERR("openat(%s, %s, %o, %o): %m\n",
+			    dname, tmp, flags, mode);
+			goto fail;
+		}
+		fp = fdopen(fd, "wb");
+		if (fp == NULL) {
+			err = -errno;
+			ERR("fdopen(%d=%s/%s): %m\n", fd, dname, tmp);
+			close(fd);
+			unlinkat(dfd, tmp, 0);
+			goto fail;
 		}
+		setvbuf(fp, buf, _IOFBF, DEPMOD_OUTPUT_BUFSIZE);
 
 		r = itr->cb(depmod, fp);
-		if (fp == out)
+		fflush(fp);
+		sizes[i] = ftello(fp);
+		ferr = ferror(fp) | fclose(fp);
+
+		if (r < 0 || ferr) {
+			unlinkat(dfd, tmp, 0);
+			err = r < 0 ? r : -ENOSPC;
+			ERR("Could not write index '%s': %s\n", itr->name,
+								strerror(-err));
+			goto fail;
+		}
+
+		/*
+		 * When watching, indexes are only replaced if their contents
+		 * changed, so whoever watches them isn't woken up for nothing.
+		 */
+		if (depmod->cache != NULL &&
+		    depfile_is_unchanged(dfd, tmp, itr->name)) {
+			DBG("%s is unchanged\n", itr->name);
+			unlinkat(dfd, tmp, 0);
 			continue;
+		}
 
-		ferr = ferror(fp) | fclose(fp);
+		pending[i] = true;
+		n_pending++;
+	}
 
-		if (r < 0) {
-			if (unlinkat(dfd, tmp, 0) != 0)
-				ERR("unlinkat(%s, %s): %m\n", dname, tmp);
+	if (n_pending == 0)
+		goto out;
 
-			ERR("Could not write index '%s': %s\n", itr->name,
-								strerror(-r));
-			err = -errno;
-			break;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", DEPMOD_MANIFEST);
+	err = depmod_write_manifest(dfd, tmp, depmod_read_generation(dfd) + 1,
+									sizes);
+	if (err < 0) {
+		unlinkat(dfd, tmp, 0);
+		ERR("Could not write '%s': %s\n", DEPMOD_MANIFEST,
+							strerror(-err));
+		goto fail;
+	}
+
+	if (syncfs(dfd) < 0) {
+		WRN("syncfs(%s): %m, syncing each index instead\n", dname);
+
+		for (itr = depfiles; itr->name != NULL; itr++) {
+			if (!pending[itr - depfiles])
+				continue;
+
+			err = depfile_sync(dfd, itr->name);
+			if (err < 0)
+				goto fail;
 		}
 
-		unlinkat(dfd, itr->name, 0);
+		err = depfile_sync(dfd, DEPMOD_MANIFEST);
+		if (err < 0)
+			goto fail;
+	}
+
+	for (itr = depfiles; itr->name != NULL; itr++) {
+		if (!pending[itr - depfiles])
+			continue;
+
+		snprintf(tmp, sizeof(tmp), "%s.tmp", itr->name);
 		if (renameat(dfd, tmp, dfd, itr->name) != 0) {
 			err = -errno;
 			CRIT("renameat(%s, %s, %s, %s): %m\n",
 					dname, tmp, dname, itr->name);
-			break;
+			goto fail;
 		}
+		pending[itr - depfiles] = false;
+	}
 
-		if (ferr) {
-			err = -ENOSPC;
-			ERR("Could not create index '%s'. Output is truncated: %s\n",
-						itr->name, strerror(-err));
-			break;
-		}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", DEPMOD_MANIFEST);
+	if (renameat(dfd, tmp, dfd, DEPMOD_MANIFEST) != 0) {
+		err = -errno;
+		CRIT("renameat(%s, %s, %s, %s): %m\n",
+				dname, tmp, dname, DEPMOD_MANIFEST);
+		unlinkat(dfd, tmp, 0);
+		goto out;
 	}
 
-	if (dfd >= 0)
-		close(dfd);
+	/* make the renames durable as well */
+	if (fsync(dfd) < 0)
+		WRN("fsync(%s): %m\n", dname);
+
+	goto out;
 
+fail:
+	/* nothing from this run is published past the failure */
+	for (itr = depfiles; itr->name != NULL; itr++) {
+		if (!pending[itr - depfiles])
+			continue;
+
+		snprintf(tmp, sizeof(tmp), "%s.tmp", itr->name);
+		unlinkat(dfd, tmp, 0);
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", DEPMOD_MANIFEST);
+	unlinkat(dfd, tmp, 0);
+out:
+	free(buf);
+	close(dfd);
 	return err;
 }
 
@@ -2484,51 +3194,36 @@ static void depmod_add_fake_syms(struct depmod *depmod)
 		depmod_symbol_add(depmod, "TOC.", true, 0, NULL);
 }
 
+static void depmod_symvers_add(const char *symbol,
+			       const struct kmod_symver *sv, void *data)
+{
+	struct depmod *depmod = data;
+
+	if (!streq(kmod_symver_get_owner(sv), "vmlinux"))
+		return;
+
+	depmod_symbol_add(depmod, symbol, false, kmod_symver_get_crc(sv),
+									NULL);
+}
+
 static int depmod_load_symvers(struct depmod *depmod, const char *filename)
 {
-	char line[10240];
-	FILE *fp;
-	unsigned int linenum = 0;
+	struct kmod_symvers *symvers;
+	int err;
 
-	fp = fopen(filename, "r");
-	if (fp == NULL) {
-		int err = -errno;
-		DBG("load symvers: %s: %m\n", filename);
+	err = kmod_symvers_new_from_file(depmod->ctx, filename, &symvers);
+	if (err < 0) {
+		DBG("load symvers: %s: %s\n", filename, strerror(-err));
 		return err;
 	}
 	DBG("load symvers: %s\n", filename);
 
-	/* eg. "0xb352177e\tfind_first_bit\tvmlinux\tEXPORT_SYMBOL" */
-	while (fgets(line, sizeof(line), fp) != NULL) {
-		const char *ver, *sym, *where;
-		char *verend;
-		uint64_t crc;
-
-		linenum++;
-
-		ver = strtok(line, " \t");
-		sym = strtok(NULL, " \t");
-		where = strtok(NULL, " \t");
-		if (!ver || !sym || !where)
-			continue;
-
-		if (!streq(where, "vmlinux"))
-			continue;
-
-		crc = strtoull(ver, &verend, 16);
-		if (verend[0] != '\0') {
-			ERR("%s:%u Invalid symbol version %s: %m\n",
-			    filename, linenum, ver);
-			continue;
-		}
-
-		depmod_symbol_add(depmod, sym, false, crc, NULL);
-	}
+	kmod_symvers_foreach(symvers, depmod_symvers_add, depmod);
+	kmod_symvers_unref(symvers);
 	depmod_add_fake_syms(depmod);
 
 	DBG("loaded symvers: %s\n", filename);
 
-	fclose(fp);
 	return 0;
 }
 
@@ -2710,23 +3405,326 @@ static int is_version_number(const char *version)
 	return (sscanf(version, "%u.%u", &d1, &d2) == 2);
 }
 
+/*
+ * Run once over the modules found in cfg, or the ones in paths if not NULL.
+ * If cache is given, the modules that didn't change since the last run take
+ * their metadata from it, and it's updated with the modules of this run.
+ */
+static int depmod_run(struct cfg *cfg, const char *module_symvers,
+		      const char *system_map, char **paths, FILE *out,
+		      struct hash **cache)
+{
+	const char *null_kmod_config = NULL;
+	struct kmod_ctx *ctx;
+	struct depmod depmod;
+	int err;
+
+	memset(&depmod, 0, sizeof(depmod));
+
+	ctx = kmod_new(cfg->dirname, &null_kmod_config);
+	if (ctx == NULL) {
+		CRIT("kmod_new(\"%s\", {NULL}) failed: %m\n", cfg->dirname);
+		return -ENOMEM;
+	}
+
+	log_setup_kmod_log(ctx, verbose);
+
+	err = depmod_init(&depmod, cfg, ctx);
+	if (err < 0) {
+		CRIT("depmod_init: %s\n", strerror(-err));
+		kmod_unref(ctx);
+		return err;
+	}
+
+	if (cache != NULL)
+		depmod.cache = *cache;
+
+	if (module_symvers != NULL) {
+		err = depmod_load_symvers(&depmod, module_symvers);
+		if (err < 0) {
+			CRIT("could not load %s: %s\n", module_symvers,
+			     strerror(-err));
+			goto out;
+		}
+	} else if (system_map != NULL) {
+		err = depmod_load_system_map(&depmod, system_map);
+		if (err < 0) {
+			CRIT("could not load %s: %s\n", system_map,
+			     strerror(-err));
+			goto out;
+		}
+	}
+
+	if (paths == NULL) {
+		err = depmod_modules_search(&depmod);
+		if (err < 0) {
+			CRIT("could not search modules: %s\n", strerror(-err));
+			goto out;
+		}
+	} else {
+		for (; *paths != NULL; paths++) {
+			const char *path = *paths;
+			struct kmod_module *mod;
+
+			if (path[0] != '/') {
+				CRIT("%s: not absolute path.\n", path);
+				err = -EINVAL;
+				goto out;
+			}
+
+			err = kmod_module_new_from_path(depmod.ctx, path, &mod);
+			if (err < 0) {
+				CRIT("could not create module %s: %s\n",
+				     path, strerror(-err));
+				goto out;
+			}
+
+			err = depmod_module_add(&depmod, mod);
+			if (err < 0) {
+				CRIT("could not add module %s: %s\n",
+				     path, strerror(-err));
+				kmod_module_unref(mod);
+				goto out;
+			}
+		}
+	}
+
+	err = depmod_modules_build_array(&depmod);
+	if (err < 0) {
+		CRIT("could not build module array: %s\n",
+		     strerror(-err));
+		goto out;
+	}
+
+	depmod_modules_sort(&depmod);
+	err = depmod_load(&depmod);
+	if (err < 0)
+		goto out;
+
+	err = depmod_output(&depmod, out);
+
+out:
+	if (cache != NULL) {
+		if (depmod_cache_save(&depmod) < 0)
+			WRN("could not update module cache\n");
+		*cache = depmod.cache;
+	}
+	depmod_shutdown(&depmod);
+	return err;
+}
+
+/* watch path and the directories below it, returning the watch of path */
+static int depmod_watch_tree(int fd, char *path, size_t len)
+{
+	struct dirent *de;
+	DIR *d;
+	int wd;
+
+	wd = inotify_add_watch(fd, path, DEPMOD_WATCH_MASK);
+	if (wd < 0) {
+		int err = -errno;
+		DBG("inotify_add_watch(%s): %m\n", path);
+		return err;
+	}
+
+	d = opendir(path);
+	if (d == NULL)
+		return wd;
+
+	while ((de = readdir(d)) != NULL) {
+		const char *name = de->d_name;
+		size_t namelen;
+
+		if (name[0] == '.' && (name[1] == '\0' ||
+				       (name[1] == '.' && name[2] == '\0')))
+			continue;
+		if (streq(name, "build") || streq(name, "source"))
+			continue;
+
+		namelen = strlen(name);
+		if (len + namelen + 2 > PATH_MAX) {
+			ERR("path is too long %s/%s\n", path, name);
+			continue;
+		}
+
+		path[len] = '/';
+		memcpy(path + len + 1, name, namelen + 1);
+
+		if (de->d_type == DT_DIR)
+			depmod_watch_tree(fd, path, len + 1 + namelen);
+		else if (de->d_type == DT_UNKNOWN) {
+			struct stat st;
+
+			if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+				depmod_watch_tree(fd, path, len + 1 + namelen);
+		}
+
+		path[len] = '\0';
+	}
+
+	closedir(d);
+	return wd;
+}
+
+/* events for the indexes written to the module directory are ours */
+static bool depmod_watch_is_output(const struct inotify_event *ev,
+								int dir_wd)
+{
+	const struct depfile *itr;
+
+	if (ev->wd != dir_wd || ev->len == 0)
+		return false;
+
+	if (strncmp(ev->name, DEPMOD_MANIFEST, strlen(DEPMOD_MANIFEST)) == 0)
+		return true;
+
+	for (itr = depfiles; itr->name != NULL; itr++) {
+		size_t namelen = strlen(itr->name);
+
+		if (strncmp(ev->name, itr->name, namelen) != 0)
+			continue;
+		if (ev->name[namelen] == '\0' ||
+		    streq(ev->name + namelen, ".tmp"))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Wait for something to change, then for the burst of changes to settle
+ * down. Returns 1 when a new run is needed, 0 if nothing changed for
+ * idle_msec (never, if negative) and < 0 on errors.
+ */
+static int depmod_watch_wait(int fd, int dir_wd, int idle_msec)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+
+	for (;;) {
+		struct pollfd pfd = { .fd = fd, .events = POLLIN };
+		const char *p;
+		ssize_t len;
+		int r;
+
+		r = poll(&pfd, 1, changed ? DEPMOD_WATCH_SETTLE_MSEC : idle_msec);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (r == 0)
+			return changed;
+
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -errno;
+		}
+
+		for (p = buf; p < buf + len;) {
+			const struct inotify_event *ev = (const void *) p;
+
+			p += sizeof(struct inotify_event) + ev->len;
+
+			if (ev->mask & IN_IGNORED ||
+			    depmod_watch_is_output(ev, dir_wd))
+				continue;
+
+			DBG("change %#x on %s\n", ev->mask,
+			    ev->len > 0 ? ev->name : "watched path");
+			changed = true;
+		}
+	}
+}
+
+/*
+ * Keep the indexes up to date with the module directories and the
+ * configuration, until nothing changes for idle seconds (0 means forever).
+ * Everything is watched again before each run: new directories are picked
+ * up and changes made while running trigger the next one.
+ */
+static int depmod_watch(struct cfg *cfg, const char * const *config_paths,
+			const char *module_symvers, const char *system_map,
+			unsigned int idle)
+{
+	const char * const *cfg_paths = config_paths;
+	int idle_msec = -1;
+	struct hash *cache;
+	int err, run_err = 0;
+
+	if (cfg_paths == NULL)
+		cfg_paths = default_cfg_paths;
+
+	if (idle > 0)
+		idle_msec = idle < INT_MAX / 1000 ? (int) idle * 1000 : INT_MAX;
+
+	cache = hash_new(512, mod_cache_free);
+	if (cache == NULL)
+		return -errno;
+
+	for (;;) {
+		char path[PATH_MAX];
+		const struct cfg_external *ext;
+		int fd, dir_wd;
+		size_t i;
+
+		fd = inotify_init1(IN_CLOEXEC);
+		if (fd < 0) {
+			err = -errno;
+			CRIT("inotify_init1(): %m\n");
+			break;
+		}
+
+		cfg_load(cfg, config_paths);
+
+		for (i = 0; cfg_paths[i] != NULL; i++)
+			inotify_add_watch(fd, cfg_paths[i], DEPMOD_WATCH_MASK);
+
+		memcpy(path, cfg->dirname, cfg->dirnamelen + 1);
+		dir_wd = depmod_watch_tree(fd, path, cfg->dirnamelen);
+
+		for (ext = cfg->externals; ext != NULL; ext = ext->next) {
+			if (ext->len >= PATH_MAX)
+				continue;
+			memcpy(path, ext->path, ext->len + 1);
+			depmod_watch_tree(fd, path, ext->len);
+		}
+
+		run_err = depmod_run(cfg, module_symvers, system_map, NULL,
+								NULL, &cache);
+		cfg_free(cfg);
+
+		SHOW("depmod: waiting for changes in %s\n", cfg->dirname);
+		err = depmod_watch_wait(fd, dir_wd, idle_msec);
+		close(fd);
+
+		if (err < 0)
+			CRIT("could not watch for changes: %s\n",
+			     strerror(-err));
+		if (err <= 0)
+			break;
+	}
+
+	hash_free(cache);
+	return err < 0 ? err : run_err;
+}
+
 static int do_depmod(int argc, char *argv[])
 {
 	FILE *out = NULL;
-	int err = 0, all = 0, maybe_all = 0, n_config_paths = 0;
+	int err = 0, all = 0, maybe_all = 0, watch = 0, n_config_paths = 0;
+	unsigned int idle = 0;
 	_cleanup_free_ char *root = NULL;
 	_cleanup_free_ const char **config_paths = NULL;
 	const char *system_map = NULL;
 	const char *module_symvers = NULL;
-	const char *null_kmod_config = NULL;
 	struct utsname un;
-	struct kmod_ctx *ctx = NULL;
 	struct cfg cfg;
-	struct depmod depmod;
 
 	memset(&cfg, 0, sizeof(cfg));
-	memset(&depmod, 0, sizeof(depmod));
-
 	for (;;) {
 		int c, idx = 0;
 		c = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
@@ -2783,6 +3781,23 @@ static int do_depmod(int argc, char *argv[])
 		case 'w':
 			cfg.warn_dups = 1;
 			break;
+		case 'W':
+			watch = 1;
+			if (optarg != NULL) {
+				char *end;
+				unsigned long v;
+
+				errno = 0;
+				v = strtoul(optarg, &end, 10);
+				if (errno != 0 || end == optarg || *end != '\0' ||
+								v > UINT_MAX) {
+					CRIT("invalid idle time for --watch: %s\n",
+					     optarg);
+					goto cmdline_failed;
+				}
+				idle = v;
+			}
+			break;
 		case 'u':
 		case 'q':
 		case 'r':
@@ -2831,6 +3846,14 @@ static int do_depmod(int argc, char *argv[])
 	if (optind == argc)
 		all = 1;
 
+	if (watch) {
+		if (out == stdout || !all) {
+			CRIT("--watch needs to write the files for all modules\n");
+			goto cmdline_failed;
+		}
+		maybe_all = 0;
+	}
+
 	if (maybe_all) {
 		if (out == stdout)
 			goto done;
@@ -2840,104 +3863,32 @@ static int do_depmod(int argc, char *argv[])
 		all = 1;
 	}
 
-	ctx = kmod_new(cfg.dirname, &null_kmod_config);
-	if (ctx == NULL) {
-		CRIT("kmod_new(\"%s\", {NULL}) failed: %m\n", cfg.dirname);
-		goto cmdline_failed;
-	}
-
-	log_setup_kmod_log(ctx, verbose);
-
-	err = depmod_init(&depmod, &cfg, ctx);
-	if (err < 0) {
-		CRIT("depmod_init: %s\n", strerror(-err));
-		goto depmod_init_failed;
-	}
-	ctx = NULL; /* owned by depmod */
-
-	if (module_symvers != NULL) {
-		err = depmod_load_symvers(&depmod, module_symvers);
-		if (err < 0) {
-			CRIT("could not load %s: %s\n", module_symvers,
-			     strerror(-err));
-			goto cmdline_failed;
-		}
-	} else if (system_map != NULL) {
-		err = depmod_load_system_map(&depmod, system_map);
-		if (err < 0) {
-			CRIT("could not load %s: %s\n", system_map,
-			     strerror(-err));
-			goto cmdline_failed;
-		}
-	} else if (cfg.print_unknown) {
+	if (cfg.print_unknown && module_symvers == NULL && system_map == NULL) {
 		WRN("-e needs -E or -F\n");
 		cfg.print_unknown = 0;
 	}
 
+	if (watch) {
+		err = depmod_watch(&cfg, config_paths, module_symvers,
+							system_map, idle);
+		goto done;
+	}
+
 	if (all) {
 		err = cfg_load(&cfg, config_paths);
 		if (err < 0) {
 			CRIT("could not load configuration files\n");
-			goto cmdline_modules_failed;
-		}
-		err = depmod_modules_search(&depmod);
-		if (err < 0) {
-			CRIT("could not search modules: %s\n", strerror(-err));
-			goto cmdline_modules_failed;
-		}
-	} else {
-		int i;
-
-		for (i = optind; i < argc; i++) {
-			const char *path = argv[i];
-			struct kmod_module *mod;
-
-			if (path[0] != '/') {
-				CRIT("%s: not absolute path.\n", path);
-				goto cmdline_modules_failed;
-			}
-
-			err = kmod_module_new_from_path(depmod.ctx, path, &mod);
-			if (err < 0) {
-				CRIT("could not create module %s: %s\n",
-				     path, strerror(-err));
-				goto cmdline_modules_failed;
-			}
-
-			err = depmod_module_add(&depmod, mod);
-			if (err < 0) {
-				CRIT("could not add module %s: %s\n",
-				     path, strerror(-err));
-				kmod_module_unref(mod);
-				goto cmdline_modules_failed;
-			}
+			goto cmdline_failed;
 		}
 	}
 
-	err = depmod_modules_build_array(&depmod);
-	if (err < 0) {
-		CRIT("could not build module array: %s\n",
-		     strerror(-err));
-		goto cmdline_modules_failed;
-	}
-
-	depmod_modules_sort(&depmod);
-	err = depmod_load(&depmod);
-	if (err < 0)
-		goto cmdline_modules_failed;
-
-	err = depmod_output(&depmod, out);
+	err = depmod_run(&cfg, module_symvers, system_map,
+			 all ? NULL : argv + optind, out, NULL);
 
 done:
-	depmod_shutdown(&depmod);
 	cfg_free(&cfg);
 	return err >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 
-cmdline_modules_failed:
-	depmod_shutdown(&depmod);
-depmod_init_failed:
-	if (ctx != NULL)
-		kmod_unref(ctx);
 cmdline_failed:
 	cfg_free(&cfg);
 	return EXIT_FAILURE;
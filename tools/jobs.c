@@ -0,0 +1,260 @@
+/*
+ * kmod - one tool to rule them all
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <shared/array.h>
+#include <shared/strbuf.h>
+#include <shared/util.h>
+
+#include <libkmod/libkmod.h>
+
+#include "jobs.h"
+#include "kmod.h"
+
+#define MAX_JOBS 256
+
+static int collect_dir(struct array *paths, struct strbuf *buf);
+
+/* files given by the user are used whatever their name is */
+static int collect_path(struct array *paths, struct strbuf *buf,
+								bool explicit)
+{
+	const char *path = strbuf_str(buf);
+	struct stat st;
+	char *p;
+
+	if (stat(path, &st) < 0) {
+		int err = -errno;
+		ERR("could not stat '%s': %m\n", path);
+		return err;
+	}
+
+	if (S_ISDIR(st.st_mode))
+		return collect_dir(paths, buf);
+
+	if (!explicit && !path_ends_with_kmod_ext(path, buf->used))
+		return 0;
+
+	p = strdup(path);
+	if (p == NULL || array_append(paths, p) < 0) {
+		free(p);
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+static int collect_dir(struct array *paths, struct strbuf *buf)
+{
+	unsigned int len = buf->used;
+	struct dirent *de;
+	DIR *d;
+	int err = 0;
+
+	d = opendir(strbuf_str(buf));
+	if (d == NULL) {
+		err = -errno;
+		ERR("could not open directory '%s': %m\n", strbuf_str(buf));
+		return err;
+	}
+
+	while ((de = readdir(d)) != NULL && err == 0) {
+		const char *name = de->d_name;
+
+		if (name[0] == '.' && (name[1] == '\0' ||
+				       (name[1] == '.' && name[2] == '\0')))
+			continue;
+		/* links to the kernel tree the modules were built from */
+		if (streq(name, "build") || streq(name, "source"))
+			continue;
+
+		if (de->d_type != DT_DIR && de->d_type != DT_UNKNOWN &&
+		    !path_ends_with_kmod_ext(name, strlen(name)))
+			continue;
+
+		strbuf_pushchar(buf, '/');
+		strbuf_pushchars(buf, name);
+		err = collect_path(paths, buf, false);
+		strbuf_popchars(buf, buf->used - len);
+	}
+
+	closedir(d);
+	return err;
+}
+
+static int path_cmp(const void *pa, const void *pb)
+{
+	const char *a = *(const char **)pa;
+	const char *b = *(const char **)pb;
+
+	return strcmp(a, b);
+}
+
+int jobs_collect_modules(struct kmod_ctx *ctx, int argc, char *argv[],
+							struct array *paths)
+{
+	struct strbuf buf;
+	int i, err = 0;
+
+	array_init(paths, 256);
+	strbuf_init(&buf);
+
+	if (argc == 0) {
+		strbuf_pushchars(&buf, kmod_get_dirname(ctx));
+		err = collect_path(paths, &buf, false);
+	} else {
+		for (i = 0; i < argc && err >= 0; i++) {
+			strbuf_clear(&buf);
+			strbuf_pushchars(&buf, argv[i]);
+			err = collect_path(paths, &buf, true);
+		}
+	}
+	strbuf_release(&buf);
+
+	if (err < 0) {
+		jobs_free_modules(paths);
+		return err;
+	}
+
+	array_sort(paths, path_cmp);
+	return 0;
+}
+
+void jobs_free_modules(struct array *paths)
+{
+	size_t i;
+
+	for (i = 0; i < paths->count; i++)
+		free(paths->array[i]);
+	array_free_array(paths);
+}
+
+long jobs_parse(const char *arg)
+{
+	char *end;
+	long n_jobs;
+
+	n_jobs = strtol(arg, &end, 10);
+	if (*end != '\0' || n_jobs < 1) {
+		ERR("invalid number of jobs: %s\n", arg);
+		return -EINVAL;
+	}
+
+	return n_jobs;
+}
+
+/*
+ * Each worker is a forked process handling a contiguous slice of the sorted
+ * paths, sharing whatever the parent already loaded. Workers buffer their
+ * whole report and the parent drains them in order, so the output doesn't
+ * depend on scheduling.
+ */
+static int run_parallel(jobs_range_cb cb, void *data,
+				const struct array *paths, size_t n_jobs)
+{
+	pid_t pids[MAX_JOBS];
+	int fds[MAX_JOBS];
+	size_t i, started = 0;
+	int ret = EXIT_SUCCESS;
+
+	fflush(stdout);
+
+	for (i = 0; i < n_jobs; i++) {
+		int pipefd[2];
+		pid_t pid;
+
+		if (pipe(pipefd) < 0) {
+			ERR("could not create pipe: %m\n");
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		pid = fork();
+		if (pid < 0) {
+			ERR("could not fork: %m\n");
+			close(pipefd[0]);
+			close(pipefd[1]);
+			ret = EXIT_FAILURE;
+			break;
+		}
+
+		if (pid == 0) {
+			char *report = NULL;
+			size_t reportsz = 0;
+			FILE *out;
+			int r;
+
+			close(pipefd[0]);
+			out = open_memstream(&report, &reportsz);
+			if (out == NULL)
+				_exit(EXIT_FAILURE);
+
+			r = cb(data, paths, paths->count * i / n_jobs,
+					paths->count * (i + 1) / n_jobs, out);
+			fclose(out);
+			write_str_safe(pipefd[1], report, reportsz);
+			_exit(r == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+		}
+
+		close(pipefd[1]);
+		pids[started] = pid;
+		fds[started] = pipefd[0];
+		started++;
+	}
+
+	for (i = 0; i < started; i++) {
+		char buf[4096];
+		ssize_t r;
+		int status;
+
+		while ((r = read(fds[i], buf, sizeof(buf))) > 0)
+			fwrite(buf, 1, r, stdout);
+		close(fds[i]);
+
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) ||
+					WEXITSTATUS(status) != EXIT_SUCCESS)
+			ret = EXIT_FAILURE;
+	}
+
+	return ret;
+}
+
+int jobs_run(jobs_range_cb cb, void *data, const struct array *paths,
+								long n_jobs)
+{
+	if (n_jobs > MAX_JOBS)
+		n_jobs = MAX_JOBS;
+	if ((size_t)n_jobs > paths->count)
+		n_jobs = paths->count;
+
+	if (n_jobs <= 1)
+		return cb(data, paths, 0, paths->count, stdout) == 0 ?
+						EXIT_SUCCESS : EXIT_FAILURE;
+
+	return run_parallel(cb, data, paths, n_jobs);
+}
@@ -0,0 +1,46 @@
+/*
+ * kmod - one tool to rule them all
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+
+#include <shared/array.h>
+
+struct kmod_ctx;
+
+/*
+ * Collect the modules in @argv, searching directories recursively, or the
+ * ones of the running kernel if @argc is 0. Paths are sorted.
+ */
+int jobs_collect_modules(struct kmod_ctx *ctx, int argc, char *argv[],
+							struct array *paths);
+void jobs_free_modules(struct array *paths);
+
+/*
+ * Process paths [start, end) and write the report to out. Returns the number
+ * of modules with problems or < 0 if any couldn't be processed.
+ */
+typedef int (*jobs_range_cb)(void *data, const struct array *paths,
+					size_t start, size_t end, FILE *out);
+
+long jobs_parse(const char *arg);
+int jobs_run(jobs_range_cb cb, void *data, const struct array *paths,
+								long n_jobs);
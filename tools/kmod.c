@@ -42,6 +42,14 @@ static const struct kmod_cmd *kmod_cmds[] = {
 	&kmod_cmd_help,
 	&kmod_cmd_list,
 	&kmod_cmd_static_nodes,
+	&kmod_cmd_check_symvers,
+	&kmod_cmd_archive,
+	&kmod_cmd_sig_report,
+	&kmod_cmd_preload,
+	&kmod_cmd_symbol_map,
+#ifdef ENABLE_OPENSSL
+	&kmod_cmd_sign,
+#endif
 
 #ifdef ENABLE_EXPERIMENTAL
 	&kmod_cmd_insert,
@@ -34,6 +34,12 @@ extern const struct kmod_cmd kmod_cmd_compat_modinfo;
 extern const struct kmod_cmd kmod_cmd_compat_modprobe;
 extern const struct kmod_cmd kmod_cmd_compat_depmod;
 
+extern const struct kmod_cmd kmod_cmd_check_symvers;
+extern const struct kmod_cmd kmod_cmd_archive;
+extern const struct kmod_cmd kmod_cmd_sig_report;
+extern const struct kmod_cmd kmod_cmd_sign;
+extern const struct kmod_cmd kmod_cmd_preload;
+extern const struct kmod_cmd kmod_cmd_symbol_map;
 extern const struct kmod_cmd kmod_cmd_insert;
 extern const struct kmod_cmd kmod_cmd_list;
 extern const struct kmod_cmd kmod_cmd_static_nodes;
@@ -32,6 +32,7 @@ static int do_lsmod(int argc, char *argv[])
 {
 	struct kmod_ctx *ctx;
 	const char *null_config = NULL;
+	struct kmod_holder_graph *graph = NULL;
 	struct kmod_list *list, *itr;
 	int err;
 
@@ -54,6 +55,12 @@ static int do_lsmod(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
+	/*
+	 * Read all holders at once instead of walking sysfs per module. If
+	 * that fails, fall back to kmod_module_get_holders().
+	 */
+	kmod_holder_graph_new(ctx, &graph);
+
 	puts("Module                  Size  Used by");
 
 	kmod_list_foreach(itr, list) {
@@ -65,7 +72,9 @@ static int do_lsmod(int argc, char *argv[])
 		int first = 1;
 
 		printf("%-19s %8ld  %d", name, size, use_count);
-		holders = kmod_module_get_holders(mod);
+		if (graph == NULL ||
+		    kmod_holder_graph_get_holders(graph, mod, 0, &holders) < 0)
+			holders = kmod_module_get_holders(mod);
 		kmod_list_foreach(hitr, holders) {
 			struct kmod_module *hm = kmod_module_get_module(hitr);
 
@@ -84,6 +93,7 @@ static int do_lsmod(int argc, char *argv[])
 		kmod_module_unref(mod);
 	}
 	kmod_module_unref_list(list);
+	kmod_holder_graph_unref(graph);
 	kmod_unref(ctx);
 
 	return EXIT_SUCCESS;
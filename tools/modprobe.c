@@ -51,6 +51,7 @@ static int lookup_only = 0;
 static int first_time = 0;
 static int ignore_commands = 0;
 static int use_blacklist = 0;
+static int prefetch_firmware = 1;
 static int force = 0;
 static int strip_modversion = 0;
 static int strip_vermagic = 0;
@@ -70,6 +71,7 @@ static const struct option cmdopts[] = {
 	{"force", no_argument, 0, 'f'},
 	{"force-modversion", no_argument, 0, 2},
 	{"force-vermagic", no_argument, 0, 1},
+	{"no-firmware-prefetch", no_argument, 0, 7},
 
 	{"show-depends", no_argument, 0, 'D'},
 	{"showconfig", no_argument, 0, 'c'},
@@ -83,6 +85,7 @@ static const struct option cmdopts[] = {
 	{"config", required_argument, 0, 'C'},
 	{"dirname", required_argument, 0, 'd'},
 	{"set-version", required_argument, 0, 'S'},
+	{"archive", required_argument, 0, 6},
 
 	{"syslog", no_argument, 0, 's'},
 	{"quiet", no_argument, 0, 'q'},
@@ -117,6 +120,7 @@ static void help(void)
 		"\t                            --force-vermagic\n"
 		"\t    --force-modversion      Ignore module's version\n"
 		"\t    --force-vermagic        Ignore module's version magic\n"
+		"\t    --no-firmware-prefetch  Don't read firmware ahead of insertion\n"
 		"\n"
 		"Query Options:\n"
 		"\t-D, --show-depends          Only print module dependencies and exit\n"
@@ -132,6 +136,8 @@ static void help(void)
 		"\t-C, --config=FILE           Use FILE instead of default search paths\n"
 		"\t-d, --dirname=DIR           Use DIR as filesystem root for /lib/modules\n"
 		"\t-S, --set-version=VERSION   Use VERSION instead of `uname -r`\n"
+		"\t    --archive=FILE          Use modules and indexes from FILE, as\n"
+		"\t                            created by kmod archive\n"
 
 		"\t-s, --syslog                print to syslog, not stderr\n"
 		"\t-q, --quiet                 disable messages\n"
@@ -515,6 +521,8 @@ static int insmod(struct kmod_ctx *ctx, const char *alias,
 		flags |= KMOD_PROBE_APPLY_BLACKLIST;
 	if (first_time)
 		flags |= KMOD_PROBE_FAIL_ON_LOADED;
+	if (prefetch_firmware)
+		flags |= KMOD_PROBE_PREFETCH_FIRMWARE;
 
 	kmod_list_foreach(l, list) {
 		struct kmod_module *mod = kmod_module_get_module(l);
@@ -723,6 +731,7 @@ static int do_modprobe(int argc, char **orig_argv)
 	const char *dirname = NULL;
 	const char *root = NULL;
 	const char *kversion = NULL;
+	const char *archive = NULL;
 	int use_all = 0;
 	int do_remove = 0;
 	int do_show_config = 0;
@@ -809,6 +818,12 @@ static int do_modprobe(int argc, char **orig_argv)
 		case 'S':
 			kversion = optarg;
 			break;
+		case 6:
+			archive = optarg;
+			break;
+		case 7:
+			prefetch_firmware = 0;
+			break;
 		case 's':
 			env_modprobe_options_append("-s");
 			use_syslog = 1;
@@ -880,7 +895,16 @@ static int do_modprobe(int argc, char **orig_argv)
 
 	log_setup_kmod_log(ctx, verbose);
 
-	kmod_load_resources(ctx);
+	if (archive != NULL) {
+		err = kmod_load_archive(ctx, archive);
+		if (err < 0) {
+			ERR("could not load archive %s: %s\n", archive,
+								strerror(-err));
+			kmod_unref(ctx);
+			goto done;
+		}
+	} else
+		kmod_load_resources(ctx);
 
 	if (do_show_config)
 		err = show_config(ctx);
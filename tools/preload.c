@@ -0,0 +1,655 @@
+/*
+ * kmod-preload - load a host's modules as one batch at boot
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include <shared/array.h>
+#include <shared/hash.h>
+#include <shared/strbuf.h>
+#include <shared/util.h>
+
+#include <libkmod/libkmod.h>
+
+#include "jobs.h"
+#include "kmod.h"
+
+#define MAX_JOBS 256
+
+static const char cmdopts_s[] = "r:j:nh";
+static const struct option cmdopts[] = {
+	{ "record", required_argument, 0, 'r' },
+	{ "jobs", required_argument, 0, 'j' },
+	{ "dry-run", no_argument, 0, 'n' },
+	{ "help", no_argument, 0, 'h' },
+	{ },
+};
+
+static void help(void)
+{
+	printf("Usage:\n"
+	       "\t%s preload [options] file|dir...\n"
+	       "\t%s preload --record=FILE\n"
+	       "\n"
+	       "Load the modules listed in the files given, or in the *.conf files of\n"
+	       "the directories given, in the modules-load.d format. They are loaded as\n"
+	       "a single batch: the modules and their dependencies are resolved once,\n"
+	       "each is inserted once, and modules whose dependencies are live are\n"
+	       "inserted in parallel. With --record, write the modules loaded right now\n"
+	       "to FILE instead, as a profile to be loaded on the next boots.\n"
+	       "\n"
+	       "Options:\n"
+	       "\t-r, --record=FILE     record the loaded modules to FILE\n"
+	       "\t-j, --jobs=N          number of modules inserted at the same time\n"
+	       "\t-n, --dry-run         print the modules instead of inserting them\n"
+	       "\t-h, --help            show this help\n",
+	       program_invocation_short_name, program_invocation_short_name);
+}
+
+enum preload_state {
+	PRELOAD_WAITING,
+	PRELOAD_READY,
+	PRELOAD_RUNNING,
+	PRELOAD_DONE,
+	PRELOAD_FAILED,
+	/* has install commands or softdeps: left to the regular probe */
+	PRELOAD_PROBE,
+};
+
+struct preload_mod {
+	struct kmod_module *mod;
+	struct array dependents; /* struct preload_mod waiting for this one */
+	unsigned int n_pending; /* dependencies not live yet */
+	enum preload_state state;
+	pid_t pid;
+};
+
+struct preload {
+	struct kmod_ctx *ctx;
+	struct hash *by_name;
+	struct array mods; /* struct preload_mod, in the order they were added */
+	struct array ready; /* queue of struct preload_mod */
+	size_t ready_next;
+	long n_jobs;
+	bool dry_run;
+	int n_failed;
+};
+
+static void preload_mod_free(void *data)
+{
+	struct preload_mod *m = data;
+
+	array_free_array(&m->dependents);
+	kmod_module_unref(m->mod);
+	free(m);
+}
+
+static bool preload_needs_probe(struct kmod_module *mod)
+{
+	struct kmod_list *pre = NULL, *post = NULL;
+	bool ret;
+
+	if (kmod_module_get_install_commands(mod) != NULL)
+		return true;
+
+	kmod_module_get_softdeps(mod, &pre, &post);
+	ret = pre != NULL || post != NULL;
+	kmod_module_unref_list(pre);
+	kmod_module_unref_list(post);
+
+	return ret;
+}
+
+static struct preload_mod *preload_add(struct preload *p,
+						struct kmod_module *mod)
+{
+	const char *name = kmod_module_get_name(mod);
+	struct kmod_list *deps, *l;
+	struct preload_mod *m;
+	int state;
+
+	m = hash_find(p->by_name, name);
+	if (m != NULL)
+		return m;
+
+	m = calloc(1, sizeof(*m));
+	if (m == NULL)
+		return NULL;
+
+	m->mod = kmod_module_ref(mod);
+	array_init(&m->dependents, 4);
+
+	if (hash_add(p->by_name, name, m) < 0) {
+		preload_mod_free(m);
+		return NULL;
+	}
+	array_append(&p->mods, m);
+
+	state = kmod_module_get_initstate(mod);
+	if (state == KMOD_MODULE_BUILTIN || state == KMOD_MODULE_LIVE) {
+		m->state = PRELOAD_DONE;
+		return m;
+	}
+
+	if (preload_needs_probe(mod)) {
+		m->state = PRELOAD_PROBE;
+		return m;
+	}
+
+	/* modules.dep already lists the whole chain, in load order */
+	deps = kmod_module_get_dependencies(mod);
+	kmod_list_foreach(l, deps) {
+		struct kmod_module *dep = kmod_module_get_module(l);
+		struct preload_mod *d = preload_add(p, dep);
+
+		kmod_module_unref(dep);
+		if (d == NULL) {
+			kmod_module_unref_list(deps);
+			return NULL;
+		}
+
+		if (d->state == PRELOAD_DONE)
+			continue;
+
+		m->n_pending++;
+		array_append(&d->dependents, m);
+	}
+	kmod_module_unref_list(deps);
+
+	if (m->n_pending == 0) {
+		m->state = PRELOAD_READY;
+		array_append(&p->ready, m);
+	}
+
+	return m;
+}
+
+static int preload_add_name(struct preload *p, const char *name)
+{
+	struct kmod_list *list = NULL, *filtered = NULL, *l;
+	int err;
+
+	err = kmod_module_new_from_lookup(p->ctx, name, &list);
+	if (err < 0) {
+		ERR("could not lookup '%s': %s\n", name, strerror(-err));
+		return err;
+	}
+
+	if (list == NULL) {
+		ERR("module '%s' not found\n", name);
+		return -ENOENT;
+	}
+
+	err = kmod_module_apply_filter(p->ctx, KMOD_FILTER_BLACKLIST, list,
+								&filtered);
+	kmod_module_unref_list(list);
+	if (err < 0)
+		return err;
+
+	if (filtered == NULL)
+		DBG("'%s' is blacklisted\n", name);
+
+	kmod_list_foreach(l, filtered) {
+		struct kmod_module *mod = kmod_module_get_module(l);
+
+		if (preload_add(p, mod) == NULL)
+			err = -ENOMEM;
+		kmod_module_unref(mod);
+		if (err < 0)
+			break;
+	}
+	kmod_module_unref_list(filtered);
+
+	return err;
+}
+
+/* one module name per line, '#' and ';' start comments */
+static int preload_add_file(struct preload *p, const char *path)
+{
+	char *line = NULL;
+	size_t linesz = 0;
+	int err = 0;
+	FILE *fp;
+
+	fp = fopen(path, "re");
+	if (fp == NULL) {
+		err = -errno;
+		ERR("could not open '%s': %m\n", path);
+		return err;
+	}
+
+	while (getline(&line, &linesz, fp) >= 0) {
+		char *name = line + strspn(line, " \t");
+
+		name[strcspn(name, " \t\r\n")] = '\0';
+		if (name[0] == '\0' || name[0] == '#' || name[0] == ';')
+			continue;
+
+		/* keep going: a missing module shouldn't hold the others */
+		if (preload_add_name(p, name) < 0)
+			err = -EINVAL;
+	}
+
+	free(line);
+	fclose(fp);
+	return err;
+}
+
+static int name_cmp(const void *pa, const void *pb)
+{
+	const char *a = *(const char **)pa;
+	const char *b = *(const char **)pb;
+
+	return strcmp(a, b);
+}
+
+static int preload_add_dir(struct preload *p, const char *path)
+{
+	struct array files;
+	struct strbuf buf;
+	struct dirent *de;
+	size_t i;
+	int err = 0;
+	DIR *d;
+
+	d = opendir(path);
+	if (d == NULL) {
+		err = -errno;
+		ERR("could not open directory '%s': %m\n", path);
+		return err;
+	}
+
+	array_init(&files, 16);
+	while ((de = readdir(d)) != NULL) {
+		size_t len = strlen(de->d_name);
+		char *name;
+
+		if (de->d_name[0] == '.' || len < 5 ||
+				!streq(de->d_name + len - 5, ".conf"))
+			continue;
+
+		name = strdup(de->d_name);
+		if (name == NULL || array_append(&files, name) < 0) {
+			free(name);
+			err = -ENOMEM;
+			break;
+		}
+	}
+	closedir(d);
+
+	/* same order as modules-load.d */
+	array_sort(&files, name_cmp);
+
+	strbuf_init(&buf);
+	for (i = 0; i < files.count; i++) {
+		strbuf_clear(&buf);
+		strbuf_pushchars(&buf, path);
+		strbuf_pushchar(&buf, '/');
+		strbuf_pushchars(&buf, files.array[i]);
+
+		if (err == 0 && preload_add_file(p, strbuf_str(&buf)) < 0)
+			err = -EINVAL;
+		free(files.array[i]);
+	}
+	strbuf_release(&buf);
+	array_free_array(&files);
+
+	return err;
+}
+
+static int preload_add_path(struct preload *p, const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) < 0) {
+		int err = -errno;
+		ERR("could not stat '%s': %m\n", path);
+		return err;
+	}
+
+	if (S_ISDIR(st.st_mode))
+		return preload_add_dir(p, path);
+
+	return preload_add_file(p, path);
+}
+
+static const char *mod_strerror(int err)
+{
+	switch (err) {
+	case -ENOENT:
+		return "Unknown symbol in module or unknown parameter (see dmesg)";
+	default:
+		return strerror(-err);
+	}
+}
+
+static void preload_fail_dependents(struct preload *p, struct preload_mod *m)
+{
+	size_t i;
+
+	for (i = 0; i < m->dependents.count; i++) {
+		struct preload_mod *d = m->dependents.array[i];
+
+		if (d->state != PRELOAD_WAITING)
+			continue;
+
+		ERR("not inserting '%s': dependency '%s' failed\n",
+			kmod_module_get_name(d->mod), kmod_module_get_name(m->mod));
+		d->state = PRELOAD_FAILED;
+		p->n_failed++;
+		preload_fail_dependents(p, d);
+	}
+}
+
+static void preload_done(struct preload *p, struct preload_mod *m, int err)
+{
+	size_t i;
+
+	if (err < 0 && err != -EEXIST) {
+		ERR("could not insert '%s': %s\n",
+				kmod_module_get_name(m->mod), mod_strerror(err));
+		m->state = PRELOAD_FAILED;
+		p->n_failed++;
+		preload_fail_dependents(p, m);
+		return;
+	}
+
+	m->state = PRELOAD_DONE;
+	for (i = 0; i < m->dependents.count; i++) {
+		struct preload_mod *d = m->dependents.array[i];
+
+		if (d->state != PRELOAD_WAITING || --d->n_pending > 0)
+			continue;
+
+		d->state = PRELOAD_READY;
+		array_append(&p->ready, d);
+	}
+}
+
+static int preload_insert(struct preload_mod *m)
+{
+	const char *options = kmod_module_get_options(m->mod);
+
+	return kmod_module_insert_module(m->mod, 0, options);
+}
+
+/*
+ * Insertions run in forked children sharing everything the parent already
+ * resolved with the context: each one only opens its module and blocks in
+ * init_module() while the parent starts the modules whose dependencies
+ * became live.
+ */
+static int preload_start(struct preload *p, struct preload_mod *m)
+{
+	pid_t pid;
+	int err;
+
+	m->state = PRELOAD_RUNNING;
+
+	if (p->dry_run) {
+		printf("insert %s\n", kmod_module_get_name(m->mod));
+		preload_done(p, m, 0);
+		return 0;
+	}
+
+	fflush(stdout);
+	fflush(stderr);
+
+	pid = fork();
+	if (pid == 0) {
+		err = preload_insert(m);
+		_exit(err < 0 ? -err : EXIT_SUCCESS);
+	}
+
+	if (pid < 0) {
+		ERR("could not fork, inserting '%s' now: %m\n",
+						kmod_module_get_name(m->mod));
+		preload_done(p, m, preload_insert(m));
+		return 0;
+	}
+
+	m->pid = pid;
+	return 1;
+}
+
+static void preload_run(struct preload *p)
+{
+	struct preload_mod *running[MAX_JOBS];
+	size_t n_running = 0;
+
+	for (;;) {
+		struct preload_mod *m;
+		int status, err;
+		size_t i;
+		pid_t pid;
+
+		while (n_running < (size_t) p->n_jobs &&
+					p->ready_next < p->ready.count) {
+			m = p->ready.array[p->ready_next++];
+			if (preload_start(p, m) > 0)
+				running[n_running++] = m;
+		}
+
+		if (n_running == 0)
+			break;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			ERR("waitpid: %m\n");
+			break;
+		}
+
+		for (i = 0; i < n_running; i++) {
+			if (running[i]->pid == pid)
+				break;
+		}
+		if (i == n_running)
+			continue;
+
+		m = running[i];
+		running[i] = running[--n_running];
+
+		if (WIFEXITED(status))
+			err = -WEXITSTATUS(status);
+		else
+			err = -EINTR;
+		preload_done(p, m, err);
+	}
+}
+
+/*
+ * Modules with install commands or softdeps, and the ones depending on
+ * them, go through the regular probe once the batch is done.
+ */
+static void preload_probe_rest(struct preload *p)
+{
+	size_t i;
+
+	for (i = 0; i < p->mods.count; i++) {
+		struct preload_mod *m = p->mods.array[i];
+		int err;
+
+		if (m->state != PRELOAD_PROBE && m->state != PRELOAD_WAITING)
+			continue;
+
+		if (p->dry_run) {
+			printf("probe %s\n", kmod_module_get_name(m->mod));
+			continue;
+		}
+
+		err = kmod_module_probe_insert_module(m->mod, 0, NULL, NULL,
+								NULL, NULL);
+		if (err < 0) {
+			ERR("could not insert '%s': %s\n",
+				kmod_module_get_name(m->mod), mod_strerror(err));
+			p->n_failed++;
+		}
+	}
+}
+
+static int do_record(struct kmod_ctx *ctx, const char *path)
+{
+	struct kmod_list *list = NULL, *l;
+	struct array names;
+	size_t i;
+	FILE *fp;
+	int err;
+
+	err = kmod_module_new_from_loaded(ctx, &list);
+	if (err < 0) {
+		ERR("could not get list of modules: %s\n", strerror(-err));
+		return EXIT_FAILURE;
+	}
+
+	array_init(&names, 128);
+	kmod_list_foreach(l, list) {
+		struct kmod_module *mod = kmod_module_get_module(l);
+
+		array_append(&names, kmod_module_get_name(mod));
+		kmod_module_unref(mod);
+	}
+	array_sort(&names, name_cmp);
+
+	fp = fopen(path, "we");
+	if (fp == NULL) {
+		err = -errno;
+		ERR("could not open '%s': %m\n", path);
+		goto out;
+	}
+
+	fputs("# modules loaded when the profile was recorded\n", fp);
+	for (i = 0; i < names.count; i++)
+		fprintf(fp, "%s\n", (const char *) names.array[i]);
+
+	if (fclose(fp) != 0) {
+		err = -errno;
+		ERR("could not write '%s': %m\n", path);
+	}
+
+out:
+	array_free_array(&names);
+	kmod_module_unref_list(list);
+	return err < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static int do_preload(int argc, char *argv[])
+{
+	struct preload p = { };
+	const char *record = NULL;
+	int i, ret = EXIT_FAILURE;
+
+	p.n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (;;) {
+		int opt, idx = 0;
+
+		opt = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 'r':
+			record = optarg;
+			break;
+		case 'j':
+			p.n_jobs = jobs_parse(optarg);
+			if (p.n_jobs < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'n':
+			p.dry_run = true;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case '?':
+			return EXIT_FAILURE;
+		default:
+			ERR("unexpected getopt_long() value '%c'.\n", opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (record == NULL && optind >= argc) {
+		ERR("missing profile or modules-load.d directory\n");
+		return EXIT_FAILURE;
+	}
+
+	if (p.n_jobs > MAX_JOBS)
+		p.n_jobs = MAX_JOBS;
+	if (p.n_jobs < 1)
+		p.n_jobs = 1;
+
+	p.ctx = kmod_new(NULL, NULL);
+	if (p.ctx == NULL) {
+		ERR("kmod_new() failed!\n");
+		return EXIT_FAILURE;
+	}
+	log_setup_kmod_log(p.ctx, LOG_WARNING);
+
+	if (record != NULL) {
+		ret = do_record(p.ctx, record);
+		goto out_ctx;
+	}
+
+	/* mapped once here, shared by all the children */
+	kmod_load_resources(p.ctx);
+
+	p.by_name = hash_new(256, preload_mod_free);
+	if (p.by_name == NULL) {
+		ERR("could not create hash: %m\n");
+		goto out_ctx;
+	}
+	array_init(&p.mods, 128);
+	array_init(&p.ready, 128);
+
+	ret = EXIT_SUCCESS;
+	for (i = optind; i < argc; i++) {
+		if (preload_add_path(&p, argv[i]) < 0)
+			ret = EXIT_FAILURE;
+	}
+
+	preload_run(&p);
+	preload_probe_rest(&p);
+
+	if (p.n_failed > 0)
+		ret = EXIT_FAILURE;
+
+	array_free_array(&p.ready);
+	array_free_array(&p.mods);
+	hash_free(p.by_name);
+out_ctx:
+	kmod_unref(p.ctx);
+	return ret;
+}
+
+const struct kmod_cmd kmod_cmd_preload = {
+	.name = "preload",
+	.cmd = do_preload,
+	.help = "record or load a boot profile of modules as one batch",
+};
@@ -0,0 +1,210 @@
+/*
+ * kmod-sig-report - report the signatures of modules
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <shared/array.h>
+#include <shared/util.h>
+
+#include <libkmod/libkmod.h>
+
+#include "jobs.h"
+#include "kmod.h"
+
+static const char cmdopts_s[] = "uj:h";
+static const struct option cmdopts[] = {
+	{ "unsigned", no_argument, 0, 'u' },
+	{ "jobs", required_argument, 0, 'j' },
+	{ "help", no_argument, 0, 'h' },
+	{ },
+};
+
+static void help(void)
+{
+	printf("Usage:\n"
+	       "\t%s sig-report [options] [module|dir...]\n"
+	       "\n"
+	       "Report the signature of modules. Directories are searched recursively.\n"
+	       "If none is given, the modules of the running kernel are reported. One\n"
+	       "line is printed per module, with tab-separated fields: module, signature\n"
+	       "type, signer, key and hash algorithm. Fields of unsigned modules are '-'.\n"
+	       "\n"
+	       "Options:\n"
+	       "\t-u, --unsigned        only report unsigned modules\n"
+	       "\t-j, --jobs=N          number of parallel workers\n"
+	       "\t-h, --help            show this help\n",
+	       program_invocation_short_name);
+}
+
+struct report {
+	struct kmod_ctx *ctx;
+	bool only_unsigned;
+};
+
+enum sig_field {
+	SIG_ID,
+	SIG_SIGNER,
+	SIG_KEY,
+	SIG_HASHALGO,
+	_SIG_FIELD_COUNT,
+};
+
+static const char *const sig_fields[_SIG_FIELD_COUNT] = {
+	[SIG_ID] = "sig_id",
+	[SIG_SIGNER] = "signer",
+	[SIG_KEY] = "sig_key",
+	[SIG_HASHALGO] = "sig_hashalgo",
+};
+
+/* Returns 1 if the module is unsigned, 0 if signed and < 0 on error */
+static int report_one(const struct report *r, const char *path, FILE *out)
+{
+	const char *values[_SIG_FIELD_COUNT] = { };
+	struct kmod_module *mod;
+	struct kmod_list *l, *list = NULL;
+	int i, err;
+
+	err = kmod_module_new_from_path(r->ctx, path, &mod);
+	if (err < 0) {
+		ERR("could not open module %s: %s\n", path, strerror(-err));
+		return err;
+	}
+
+	err = kmod_module_get_info(mod, &list);
+	if (err < 0) {
+		ERR("could not get modinfo from %s: %s\n", path, strerror(-err));
+		goto end;
+	}
+
+	kmod_list_foreach(l, list) {
+		const char *key = kmod_module_info_get_key(l);
+
+		for (i = 0; i < _SIG_FIELD_COUNT; i++) {
+			if (streq(key, sig_fields[i]))
+				values[i] = kmod_module_info_get_value(l);
+		}
+	}
+
+	err = values[SIG_ID] == NULL;
+	if (err || !r->only_unsigned) {
+		fputs(path, out);
+		for (i = 0; i < _SIG_FIELD_COUNT; i++) {
+			const char *v = values[i];
+
+			fprintf(out, "\t%s", v != NULL && v[0] != '\0' ? v : "-");
+		}
+		fputc('\n', out);
+	}
+
+	kmod_module_info_free_list(list);
+end:
+	kmod_module_unref(mod);
+	return err;
+}
+
+static int report_range(void *data, const struct array *paths,
+					size_t start, size_t end, FILE *out)
+{
+	const struct report *r = data;
+	size_t i;
+	int n = 0, err = 0;
+
+	for (i = start; i < end; i++) {
+		int ret = report_one(r, paths->array[i], out);
+
+		if (ret < 0)
+			err = ret;
+		else if (ret > 0)
+			n++;
+	}
+
+	if (err < 0)
+		return err;
+
+	/* unsigned modules are only a failure if that's what was asked */
+	return r->only_unsigned ? n : 0;
+}
+
+static int do_sig_report(int argc, char *argv[])
+{
+	struct report r = { };
+	const char *null_config = NULL;
+	struct array paths;
+	long n_jobs;
+	int err, ret;
+
+	n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (;;) {
+		int opt, idx = 0;
+
+		opt = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 'u':
+			r.only_unsigned = true;
+			break;
+		case 'j':
+			n_jobs = jobs_parse(optarg);
+			if (n_jobs < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case '?':
+			return EXIT_FAILURE;
+		default:
+			ERR("unexpected getopt_long() value '%c'.\n", opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	r.ctx = kmod_new(NULL, &null_config);
+	if (r.ctx == NULL) {
+		ERR("kmod_new() failed!\n");
+		return EXIT_FAILURE;
+	}
+	log_setup_kmod_log(r.ctx, LOG_WARNING);
+
+	err = jobs_collect_modules(r.ctx, argc - optind, argv + optind, &paths);
+	if (err < 0) {
+		kmod_unref(r.ctx);
+		return EXIT_FAILURE;
+	}
+
+	ret = jobs_run(report_range, &r, &paths, n_jobs);
+
+	jobs_free_modules(&paths);
+	kmod_unref(r.ctx);
+	return ret;
+}
+
+const struct kmod_cmd kmod_cmd_sig_report = {
+	.name = "sig-report",
+	.cmd = do_sig_report,
+	.help = "report the signatures of modules",
+};
@@ -0,0 +1,430 @@
+/*
+ * kmod-sign - sign modules
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <openssl/bio.h>
+#include <openssl/cms.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include <shared/array.h>
+#include <shared/signature.h>
+#include <shared/util.h>
+
+#include <libkmod/libkmod.h>
+
+#include "jobs.h"
+#include "kmod.h"
+
+static const char cmdopts_s[] = "k:c:a:fj:h";
+static const struct option cmdopts[] = {
+	{ "key", required_argument, 0, 'k' },
+	{ "cert", required_argument, 0, 'c' },
+	{ "hash", required_argument, 0, 'a' },
+	{ "force", no_argument, 0, 'f' },
+	{ "jobs", required_argument, 0, 'j' },
+	{ "help", no_argument, 0, 'h' },
+	{ },
+};
+
+static void help(void)
+{
+	printf("Usage:\n"
+	       "\t%s sign [options] -k KEY module|dir...\n"
+	       "\n"
+	       "Append a PKCS#7 signature to modules, in the format expected by the\n"
+	       "kernel. Directories are searched recursively. Modules already signed\n"
+	       "are left alone unless --force is given.\n"
+	       "\n"
+	       "Options:\n"
+	       "\t-k, --key=FILE        private key, in PEM format\n"
+	       "\t-c, --cert=FILE       X.509 certificate, in PEM or DER format.\n"
+	       "\t                      Defaults to the key file\n"
+	       "\t-a, --hash=ALGO       hash algorithm (default: sha256)\n"
+	       "\t-f, --force           replace existing signatures\n"
+	       "\t-j, --jobs=N          number of parallel workers\n"
+	       "\t-h, --help            show this help\n",
+	       program_invocation_short_name);
+}
+
+struct sign {
+	EVP_PKEY *key;
+	X509 *cert;
+	const EVP_MD *md;
+	bool force;
+};
+
+static void ssl_err(const char *msg, const char *path)
+{
+	const char *reason = ERR_reason_error_string(ERR_get_error());
+
+	ERR("%s %s: %s\n", msg, path, reason != NULL ? reason : "unknown error");
+	ERR_clear_error();
+}
+
+static BIO *open_file(const char *path)
+{
+	FILE *fp;
+	BIO *b;
+
+	fp = fopen(path, "re");
+	if (fp == NULL) {
+		ERR("could not open %s: %m\n", path);
+		return NULL;
+	}
+
+	b = BIO_new_fp(fp, BIO_CLOSE);
+	if (b == NULL)
+		fclose(fp);
+
+	return b;
+}
+
+static EVP_PKEY *load_key(const char *path)
+{
+	EVP_PKEY *key = NULL;
+	BIO *b;
+
+	b = open_file(path);
+	if (b == NULL)
+		return NULL;
+
+	key = PEM_read_bio_PrivateKey(b, NULL, NULL, NULL);
+	BIO_free(b);
+	if (key == NULL)
+		ssl_err("could not load private key from", path);
+
+	return key;
+}
+
+static X509 *load_cert(const char *path)
+{
+	X509 *cert = NULL;
+	BIO *b;
+
+	b = open_file(path);
+	if (b == NULL)
+		return NULL;
+
+	cert = PEM_read_bio_X509(b, NULL, NULL, NULL);
+	if (cert == NULL && BIO_reset(b) == 0) {
+		ERR_clear_error();
+		cert = d2i_X509_bio(b, NULL);
+	}
+	BIO_free(b);
+	if (cert == NULL)
+		ssl_err("could not load certificate from", path);
+
+	return cert;
+}
+
+/* the same detached PKCS#7 message scripts/sign-file creates */
+static int sign_data(const struct sign *s, const void *mem, size_t size,
+					const char *path, unsigned char **der)
+{
+	unsigned int flags = CMS_NOCERTS | CMS_BINARY;
+	CMS_ContentInfo *cms;
+	BIO *b;
+	int len = -EINVAL;
+
+	b = BIO_new_mem_buf(mem, size);
+	if (b == NULL)
+		return -ENOMEM;
+
+	cms = CMS_sign(NULL, NULL, NULL, NULL, flags | CMS_PARTIAL |
+						CMS_DETACHED | CMS_STREAM);
+	if (cms == NULL ||
+	    CMS_add1_signer(cms, s->cert, s->key, s->md, flags |
+				CMS_NOSMIMECAP | CMS_NOATTR) == NULL ||
+	    CMS_final(cms, b, NULL, flags) != 1) {
+		ssl_err("could not sign", path);
+		goto out;
+	}
+
+	*der = NULL;
+	len = i2d_CMS_ContentInfo(cms, der);
+	if (len <= 0) {
+		ssl_err("could not encode signature of", path);
+		len = -EINVAL;
+	}
+
+out:
+	CMS_ContentInfo_free(cms);
+	BIO_free(b);
+	return len;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	ssize_t r = write_str_safe(fd, buf, len);
+
+	if (r < 0)
+		return r;
+	return (size_t)r == len ? 0 : -EIO;
+}
+
+/*
+ * Write the signed module next to the original one and rename it over, so
+ * an interrupted run never leaves truncated modules behind.
+ */
+static int write_signed(const char *path, const struct stat *st,
+				const void *mem, size_t size,
+				const unsigned char *sig, size_t sig_len)
+{
+	const char *dir, *base = strrchr(path, '/');
+	char trailer[MODSIG_TRAILER_SIZE];
+	char tmp[PATH_MAX];
+	int dfd, fd, err;
+
+	if (base == NULL) {
+		dir = ".";
+		base = path;
+	} else {
+		dir = strndupa(path, base - path + 1);
+		base++;
+	}
+
+	dfd = open(dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+	if (dfd < 0) {
+		err = -errno;
+		ERR("could not open directory %s: %m\n", dir);
+		return err;
+	}
+
+	snprintf(tmp, sizeof(tmp), "%s.sign.tmp", base);
+	fd = openat(dfd, tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,
+						st->st_mode & 07777);
+	if (fd < 0) {
+		err = -errno;
+		ERR("could not create %s: %m\n", tmp);
+		goto out;
+	}
+
+	modsig_pkcs7_trailer(sig_len, trailer);
+
+	err = write_all(fd, mem, size);
+	if (err >= 0)
+		err = write_all(fd, sig, sig_len);
+	if (err >= 0)
+		err = write_all(fd, trailer, sizeof(trailer));
+	if (close(fd) < 0 && err >= 0)
+		err = -errno;
+	if (err >= 0 && renameat(dfd, tmp, dfd, base) < 0)
+		err = -errno;
+
+	if (err < 0) {
+		ERR("could not write %s: %s\n", path, strerror(-err));
+		unlinkat(dfd, tmp, 0);
+	}
+
+out:
+	close(dfd);
+	return err;
+}
+
+static int sign_one(const struct sign *s, const char *path)
+{
+	unsigned char *sig = NULL;
+	struct stat st;
+	void *mem;
+	size_t size;
+	int fd, len, err;
+
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) {
+		err = -errno;
+		ERR("could not open %s: %m\n", path);
+		return err;
+	}
+
+	if (fstat(fd, &st) < 0) {
+		err = -errno;
+		ERR("could not stat %s: %m\n", path);
+		close(fd);
+		return err;
+	}
+
+	mem = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mem == MAP_FAILED) {
+		err = -errno;
+		ERR("could not map %s: %m\n", path);
+		return err;
+	}
+
+	/* the kernel checks the signature of the decompressed module */
+	if (st.st_size < 4 || memcmp(mem, "\177ELF", 4) != 0) {
+		ERR("%s is not an ELF module, compressed modules can't be signed\n",
+									path);
+		err = -EINVAL;
+		goto out;
+	}
+
+	size = modsig_strip(mem, st.st_size);
+	if (size != (size_t)st.st_size && !s->force) {
+		err = 0;
+		goto out;
+	}
+
+	len = sign_data(s, mem, size, path, &sig);
+	if (len < 0) {
+		err = len;
+		goto out;
+	}
+
+	err = write_signed(path, &st, mem, size, sig, len);
+	OPENSSL_free(sig);
+
+out:
+	munmap(mem, st.st_size);
+	return err;
+}
+
+static int sign_range(void *data, const struct array *paths,
+					size_t start, size_t end, FILE *out)
+{
+	const struct sign *s = data;
+	size_t i;
+	int err = 0;
+
+	for (i = start; i < end; i++) {
+		int r = sign_one(s, paths->array[i]);
+
+		if (r < 0)
+			err = r;
+	}
+
+	return err;
+}
+
+static int do_sign(int argc, char *argv[])
+{
+	struct sign s = { };
+	const char *key_file = NULL, *cert_file = NULL, *hash = "sha256";
+	const char *null_config = NULL;
+	struct kmod_ctx *ctx;
+	struct array paths;
+	long n_jobs;
+	int err, ret = EXIT_FAILURE;
+
+	n_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (;;) {
+		int opt, idx = 0;
+
+		opt = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 'k':
+			key_file = optarg;
+			break;
+		case 'c':
+			cert_file = optarg;
+			break;
+		case 'a':
+			hash = optarg;
+			break;
+		case 'f':
+			s.force = true;
+			break;
+		case 'j':
+			n_jobs = jobs_parse(optarg);
+			if (n_jobs < 0)
+				return EXIT_FAILURE;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case '?':
+			return EXIT_FAILURE;
+		default:
+			ERR("unexpected getopt_long() value '%c'.\n", opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (key_file == NULL) {
+		ERR("missing private key, use -k/--key\n");
+		return EXIT_FAILURE;
+	}
+
+	if (optind >= argc) {
+		ERR("missing modules to sign\n");
+		return EXIT_FAILURE;
+	}
+
+	s.md = EVP_get_digestbyname(hash);
+	if (s.md == NULL) {
+		ERR("unknown hash algorithm: %s\n", hash);
+		return EXIT_FAILURE;
+	}
+
+	/* loaded once, workers share them with the parent */
+	s.key = load_key(key_file);
+	if (s.key == NULL)
+		return EXIT_FAILURE;
+
+	s.cert = load_cert(cert_file != NULL ? cert_file : key_file);
+	if (s.cert == NULL)
+		goto fail_key;
+
+	if (X509_check_private_key(s.cert, s.key) != 1) {
+		ssl_err("private key doesn't match certificate", key_file);
+		goto fail_cert;
+	}
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL) {
+		ERR("kmod_new() failed!\n");
+		goto fail_cert;
+	}
+
+	err = jobs_collect_modules(ctx, argc - optind, argv + optind, &paths);
+	if (err >= 0) {
+		ret = jobs_run(sign_range, &s, &paths, n_jobs);
+		jobs_free_modules(&paths);
+	}
+
+	kmod_unref(ctx);
+fail_cert:
+	X509_free(s.cert);
+fail_key:
+	EVP_PKEY_free(s.key);
+	return ret;
+}
+
+const struct kmod_cmd kmod_cmd_sign = {
+	.name = "sign",
+	.cmd = do_sign,
+	.help = "sign modules",
+};
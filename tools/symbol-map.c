@@ -0,0 +1,189 @@
+/*
+ * kmod-symbol-map - map addresses of loaded modules to their symbols
+ *
+ * Copyright (C) 2011-2013  ProFUSION embedded systems
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <shared/util.h>
+
+#include <libkmod/libkmod.h>
+
+#include "kmod.h"
+
+static const char cmdopts_s[] = "o:m:h";
+static const struct option cmdopts[] = {
+	{ "output", required_argument, 0, 'o' },
+	{ "map", required_argument, 0, 'm' },
+	{ "help", no_argument, 0, 'h' },
+	{ },
+};
+
+static void help(void)
+{
+	printf("Usage:\n"
+	       "\t%s symbol-map [options] [address...]\n"
+	       "\n"
+	       "Resolve addresses inside loaded modules to the symbol they belong to,\n"
+	       "printed as \"address symbol+offset [module]\". Addresses are read from\n"
+	       "the standard input, one per line, if none is given.\n"
+	       "\n"
+	       "Options:\n"
+	       "\t-o, --output=FILE     write the symbol map of the loaded modules\n"
+	       "\t                      to FILE instead\n"
+	       "\t-m, --map=FILE        use the symbol map in FILE instead of the\n"
+	       "\t                      loaded modules\n"
+	       "\t-h, --help            show this help\n",
+	       program_invocation_short_name);
+}
+
+static int resolve(const struct kmod_symbol_map *map, const char *s)
+{
+	const char *module, *symbol;
+	unsigned long long address;
+	uint64_t offset;
+	char *end;
+
+	errno = 0;
+	address = strtoull(s, &end, 16);
+	if (errno != 0 || end == s || (*end != '\0' && *end != '\n')) {
+		ERR("invalid address: %s\n", s);
+		return -EINVAL;
+	}
+
+	if (kmod_symbol_map_lookup(map, address, &module, &symbol,
+							&offset) < 0) {
+		printf("%#llx ?\n", address);
+		return 0;
+	}
+
+	printf("%#llx %s+%#"PRIx64" [%s]\n", address, symbol, offset, module);
+	return 0;
+}
+
+static int do_write(const struct kmod_symbol_map *map, const char *output)
+{
+	int fd, err;
+
+	fd = open(output, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd < 0) {
+		err = -errno;
+		ERR("could not open %s: %m\n", output);
+		return err;
+	}
+
+	err = kmod_symbol_map_write(map, fd);
+	if (close(fd) < 0 && err >= 0)
+		err = -errno;
+	if (err < 0) {
+		ERR("could not write %s: %s\n", output, strerror(-err));
+		unlink(output);
+	}
+
+	return err;
+}
+
+static int do_symbol_map(int argc, char *argv[])
+{
+	struct kmod_ctx *ctx;
+	struct kmod_symbol_map *map;
+	const char *null_config = NULL;
+	const char *output = NULL, *input = NULL;
+	int i, err = 0;
+
+	for (;;) {
+		int opt, idx = 0;
+
+		opt = getopt_long(argc, argv, cmdopts_s, cmdopts, &idx);
+		if (opt == -1)
+			break;
+		switch (opt) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'm':
+			input = optarg;
+			break;
+		case 'h':
+			help();
+			return EXIT_SUCCESS;
+		case '?':
+			return EXIT_FAILURE;
+		default:
+			ERR("unexpected getopt_long() value '%c'.\n", opt);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (output != NULL && (input != NULL || optind < argc)) {
+		ERR("--output can't be combined with --map or addresses\n");
+		return EXIT_FAILURE;
+	}
+
+	ctx = kmod_new(NULL, &null_config);
+	if (ctx == NULL) {
+		ERR("kmod_new() failed!\n");
+		return EXIT_FAILURE;
+	}
+	log_setup_kmod_log(ctx, LOG_WARNING);
+
+	if (input != NULL)
+		err = kmod_symbol_map_new_from_file(ctx, input, &map);
+	else
+		err = kmod_symbol_map_new(ctx, &map);
+	if (err < 0) {
+		ERR("could not get symbol map: %s\n", strerror(-err));
+		kmod_unref(ctx);
+		return EXIT_FAILURE;
+	}
+
+	if (output != NULL) {
+		err = do_write(map, output);
+	} else if (optind < argc) {
+		for (i = optind; i < argc; i++) {
+			if (resolve(map, argv[i]) < 0)
+				err = -EINVAL;
+		}
+	} else {
+		char line[128];
+
+		while (fgets(line, sizeof(line), stdin) != NULL) {
+			if (resolve(map, line) < 0)
+				err = -EINVAL;
+			/* answer as they come, when used from a pipe */
+			fflush(stdout);
+		}
+	}
+
+	kmod_symbol_map_unref(map);
+	kmod_unref(ctx);
+
+	return err >= 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+const struct kmod_cmd kmod_cmd_symbol_map = {
+	.name = "symbol-map",
+	.cmd = do_symbol_map,
+	.help = "map addresses of loaded modules to their symbols",
+};